@@ -0,0 +1,18 @@
+#include "util/log.h"
+#include <cstdio>
+#include <mutex>
+
+// Console implementation of the log, replacing the log window of the GUI
+// (util/log.cpp) in the batch renderer.
+
+namespace util {
+
+void log(const char *msg) {
+  // shader compilation and task scheduler threads log too
+  static std::mutex           mutex;
+  std::lock_guard<std::mutex> lock{mutex};
+  std::fputs(msg, stderr);
+  std::fputc('\n', stderr);
+}
+
+} // namespace util
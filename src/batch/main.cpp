@@ -0,0 +1,287 @@
+#include "batch/offscreencontext.h"
+#include "fmt/format.h"
+#include "gfxopengl/opengl.h"
+#include "img/imagefile.h"
+#include "img/imgevaluator.h"
+#include "img/imgnetwork.h"
+#include "img/imgoutput.h"
+#include "util/jsonreader.h"
+#include "util/log.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Renders frames of a saved network (.rnet) to image files, without a window.
+//
+// The GL context is created with EGL, so that the renderer runs on machines
+// without a display server (e.g. with Mesa's llvmpipe on render farm nodes).
+
+namespace {
+
+const char USAGE[] = R"(usage: rendergraph_batch [options] <network.rnet> <output>
+
+Renders frames of a network to image files. The format of the files is given
+by the extension of <output> (.exr, .tif, .png...). A run of '#' in <output>
+is replaced by the frame number, padded with zeros to the length of the run
+(e.g. render.####.exr).
+
+options:
+  -f, --frames <first>[:<last>]  frames to render (default: 0)
+  -r, --fps <rate>               frames per second, for the time passed to
+                                 shaders (default: 24)
+  -s, --size <width>x<height>    size of the images (default: 1920x1080)
+  -t, --tile-size <pixels>       size of the tiles evaluated on the GPU
+                                 (default: 1024)
+  -n, --node <name>              node whose first output is written (default:
+                                 the node connected to the output node)
+  -j, --jobs <count>             threads encoding the images (default: one
+                                 per two hardware threads)
+  -h, --help                     prints this message
+)";
+
+struct Options {
+  std::string networkPath;
+  std::string outputPattern;
+  int         firstFrame = 0;
+  int         lastFrame = 0;
+  double      fps = 24.0;
+  int         width = 1920;
+  int         height = 1080;
+  int         tileSize = 1024;
+  std::string nodeName;
+  int         writerThreads = -1;
+};
+
+int parseInt(const char *str) {
+  char *end;
+  long  v = std::strtol(str, &end, 10);
+  if (end == str || *end) {
+    throw std::runtime_error{fmt::format("invalid number: {}", str)};
+  }
+  return (int)v;
+}
+
+void parseFrames(const char *str, Options &opts) {
+  std::string s{str};
+  auto        sep = s.find(':');
+  opts.firstFrame = parseInt(s.substr(0, sep).c_str());
+  opts.lastFrame = sep == std::string::npos
+                       ? opts.firstFrame
+                       : parseInt(s.substr(sep + 1).c_str());
+  if (opts.lastFrame < opts.firstFrame) {
+    throw std::runtime_error{fmt::format("invalid frame range: {}", str)};
+  }
+}
+
+void parseSize(const char *str, Options &opts) {
+  std::string s{str};
+  auto        sep = s.find('x');
+  if (sep == std::string::npos) {
+    throw std::runtime_error{fmt::format("invalid size: {}", str)};
+  }
+  opts.width = parseInt(s.substr(0, sep).c_str());
+  opts.height = parseInt(s.substr(sep + 1).c_str());
+  if (opts.width <= 0 || opts.height <= 0) {
+    throw std::runtime_error{fmt::format("invalid size: {}", str)};
+  }
+}
+
+// Returns false if the program should exit without rendering.
+bool parseOptions(int argc, char **argv, Options &opts) {
+  std::vector<const char *> positional;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    auto        is = [arg](const char *shortName, const char *longName) {
+      return !std::strcmp(arg, shortName) || !std::strcmp(arg, longName);
+    };
+    auto value = [&]() {
+      if (i + 1 >= argc) {
+        throw std::runtime_error{fmt::format("missing value for {}", arg)};
+      }
+      return argv[++i];
+    };
+    if (is("-h", "--help")) {
+      std::fputs(USAGE, stdout);
+      return false;
+    } else if (is("-f", "--frames")) {
+      parseFrames(value(), opts);
+    } else if (is("-r", "--fps")) {
+      opts.fps = std::atof(value());
+      if (opts.fps <= 0.0) {
+        throw std::runtime_error{"the frame rate must be positive"};
+      }
+    } else if (is("-s", "--size")) {
+      parseSize(value(), opts);
+    } else if (is("-t", "--tile-size")) {
+      opts.tileSize = parseInt(value());
+    } else if (is("-n", "--node")) {
+      opts.nodeName = value();
+    } else if (is("-j", "--jobs")) {
+      opts.writerThreads = parseInt(value());
+      if (opts.writerThreads < 1) {
+        throw std::runtime_error{"at least one writer thread is needed"};
+      }
+    } else if (arg[0] == '-' && arg[1]) {
+      throw std::runtime_error{fmt::format("unknown option: {}", arg)};
+    } else {
+      positional.push_back(arg);
+    }
+  }
+  if (positional.size() != 2) {
+    std::fputs(USAGE, stderr);
+    throw std::runtime_error{"expected a network and an output path"};
+  }
+  opts.networkPath = positional[0];
+  opts.outputPattern = positional[1];
+  if (opts.lastFrame > opts.firstFrame &&
+      opts.outputPattern.find('#') == std::string::npos) {
+    throw std::runtime_error{
+        "the output path must contain '#' to render several frames"};
+  }
+  return true;
+}
+
+void loadNetwork(const std::string &path, img::ImgNetwork &network) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    throw std::runtime_error{fmt::format("could not open {}", path)};
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  const auto       src = contents.str();
+  util::JsonReader reader{src};
+  network.load(reader, 0);
+}
+
+// Returns the node whose first output is written to the images.
+node::Node *findRenderedNode(img::ImgNetwork &network,
+                             const std::string &nodeName,
+                             std::string &      outputName) {
+  if (!nodeName.empty()) {
+    auto node = network.findChildByName(nodeName);
+    if (!node) {
+      throw std::runtime_error{fmt::format("no node named {}", nodeName)};
+    }
+    return node;
+  }
+  auto output = network.output();
+  if (!output) {
+    throw std::runtime_error{
+        "the network has no output node: specify the rendered node"};
+  }
+  node::Node *  source;
+  node::Output *sourceOutput;
+  if (!output->inputSource(output->input(0), source, sourceOutput)) {
+    throw std::runtime_error{"the output node is not connected"};
+  }
+  outputName = source->outputName(sourceOutput).to_string();
+  return source;
+}
+
+int render(const Options &opts) {
+  batch::OffscreenContext          context;
+  gfxopengl::OpenGLGraphicsBackend gfx;
+
+  img::ImgNetwork::registerBuiltinNodes();
+  img::ImgNetwork network{"root"};
+  loadNetwork(opts.networkPath, network);
+
+  img::TiledEvaluationDesc desc;
+  desc.width = opts.width;
+  desc.height = opts.height;
+  desc.tileSize = opts.tileSize;
+  desc.outputNode = findRenderedNode(network, opts.nodeName, desc.outputName);
+
+  img::ImgEvaluator evaluator{gfx, network};
+
+  // The tiles of a frame are read back asynchronously, and handed to the
+  // writer after the next frame has been submitted: the GPU renders a frame
+  // while the writer threads encode the previous ones.
+  struct PendingTile {
+    // region of the frame covered by the tile
+    gfx::Rect     region;
+    gfx::Readback readback;
+  };
+  struct PendingFrame {
+    int                      frame = 0;
+    std::vector<PendingTile> tiles;
+  };
+  PendingFrame     pending;
+  img::ImageWriter writer{opts.writerThreads};
+
+  auto queueFrame = [&](PendingFrame &f) {
+    img::ImageFileJob job;
+    job.path = img::expandFramePattern(opts.outputPattern, f.frame);
+    job.width = opts.width;
+    job.height = opts.height;
+    job.channels = 4;
+    for (auto &&tile : f.tiles) {
+      img::ImageFileTile t;
+      t.region = tile.region;
+      t.pixels.resize((size_t)tile.region.width * tile.region.height * 4);
+      tile.readback.getData(t.pixels.data(), true);
+      job.tiles.push_back(std::move(t));
+    }
+    f.tiles.clear();
+    // blocks if the writer lags behind
+    writer.write(std::move(job));
+    const auto stats = writer.stats();
+    util::log("frame {} queued ({} images pending, {:.2f} images/s, {} "
+              "stalls)",
+              f.frame, stats.queueDepth, stats.imagesPerSecond, stats.stalls);
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int frame = opts.firstFrame; frame <= opts.lastFrame; ++frame) {
+    PendingFrame current;
+    current.frame = frame;
+    evaluator.setTime(frame / opts.fps);
+    evaluator.evaluateTiled(desc, [&](const img::ImgTile &tile) {
+      const auto &r = tile.region;
+      // the copy is ordered before the commands reusing the image
+      PendingTile t;
+      t.region = r;
+      t.readback = gfx::Readback{gfx, tile.image,
+                                 gfx::Rect{tile.x, tile.y, r.width, r.height}};
+      current.tiles.push_back(std::move(t));
+    });
+    if (!pending.tiles.empty()) {
+      queueFrame(pending);
+    }
+    pending = std::move(current);
+  }
+  if (!pending.tiles.empty()) {
+    queueFrame(pending);
+  }
+  writer.flush();
+
+  const auto stats = writer.stats();
+  const auto end = std::chrono::steady_clock::now();
+  util::log("{} frames written in {:.1f} s ({:.2f} frames/s); waited {:.0f} "
+            "ms for the writer in {} stalls",
+            stats.imagesWritten,
+            std::chrono::duration<double>(end - start).count(),
+            stats.imagesPerSecond, stats.stallTimeMs, stats.stalls);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+      return 0;
+    }
+    return render(opts);
+  } catch (std::exception &e) {
+    util::log("error: {}", e.what());
+    return 1;
+  }
+}
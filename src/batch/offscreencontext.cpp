@@ -0,0 +1,112 @@
+#include "batch/offscreencontext.h"
+#include "fmt/format.h"
+#include "util/log.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>
+#include <stdexcept>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+namespace batch {
+
+struct OffscreenContext::Private {
+  EGLDisplay display = EGL_NO_DISPLAY;
+  EGLContext context = EGL_NO_CONTEXT;
+};
+
+static bool hasExtension(const char *extensions, const char *name) {
+  if (!extensions) {
+    return false;
+  }
+  const size_t len = std::strlen(name);
+  for (const char *p = extensions; (p = std::strstr(p, name)); p += len) {
+    // must be a whole word of the list
+    if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || !p[len])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static EGLDisplay getDisplay() {
+  // client extensions, queried without a display
+  const char *clientExts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (hasExtension(clientExts, "EGL_MESA_platform_surfaceless")) {
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+        "eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) {
+      auto display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                        EGL_DEFAULT_DISPLAY, nullptr);
+      if (display != EGL_NO_DISPLAY) {
+        return display;
+      }
+    }
+  }
+  util::log("EGL: surfaceless platform unavailable, using the default display");
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+OffscreenContext::OffscreenContext() : d{std::make_unique<Private>()} {
+  d->display = getDisplay();
+  EGLint major, minor;
+  if (d->display == EGL_NO_DISPLAY ||
+      !eglInitialize(d->display, &major, &minor)) {
+    throw std::runtime_error{"could not initialize the EGL display"};
+  }
+  util::log("EGL {}.{} ({})", major, minor,
+            eglQueryString(d->display, EGL_VENDOR));
+
+  if (!hasExtension(eglQueryString(d->display, EGL_EXTENSIONS),
+                    "EGL_KHR_surfaceless_context")) {
+    eglTerminate(d->display);
+    throw std::runtime_error{"EGL_KHR_surfaceless_context is not supported"};
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    eglTerminate(d->display);
+    throw std::runtime_error{"desktop OpenGL is not supported by EGL"};
+  }
+
+  // no surfaces are created: any config rendering with OpenGL will do
+  const EGLint configAttribs[] = {EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE,
+                                  EGL_OPENGL_BIT, EGL_NONE};
+  EGLConfig    config;
+  EGLint       configCount = 0;
+  if (!eglChooseConfig(d->display, configAttribs, &config, 1, &configCount) ||
+      configCount == 0) {
+    eglTerminate(d->display);
+    throw std::runtime_error{"no EGL config supports OpenGL"};
+  }
+
+  const EGLint contextAttribs[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                   4,
+                                   EGL_CONTEXT_MINOR_VERSION,
+                                   5,
+                                   EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                   EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                   EGL_NONE};
+  d->context =
+      eglCreateContext(d->display, config, EGL_NO_CONTEXT, contextAttribs);
+  if (d->context == EGL_NO_CONTEXT) {
+    eglTerminate(d->display);
+    throw std::runtime_error{fmt::format(
+        "could not create an OpenGL 4.5 context (EGL error {:#x})",
+        eglGetError())};
+  }
+  if (!eglMakeCurrent(d->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                      d->context)) {
+    eglDestroyContext(d->display, d->context);
+    eglTerminate(d->display);
+    throw std::runtime_error{"could not make the OpenGL context current"};
+  }
+}
+
+OffscreenContext::~OffscreenContext() {
+  eglMakeCurrent(d->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(d->display, d->context);
+  eglTerminate(d->display);
+}
+
+} // namespace batch
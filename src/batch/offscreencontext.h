@@ -0,0 +1,29 @@
+#pragma once
+#include <memory>
+
+namespace batch {
+
+/// An OpenGL 4.5 core context without a window, created with EGL.
+///
+/// The display comes from the surfaceless platform of Mesa
+/// (`EGL_MESA_platform_surfaceless`) when available, so that no X or
+/// Wayland server is needed (e.g. with llvmpipe on a render farm node), and
+/// from the default display otherwise. The context is made current on the
+/// calling thread, without a surface (`EGL_KHR_surfaceless_context`):
+/// rendering goes to the images of the graphics backend only.
+class OffscreenContext {
+public:
+  /// Creates the context and makes it current. Throws `std::runtime_error`
+  /// on failure.
+  OffscreenContext();
+  ~OffscreenContext();
+
+  OffscreenContext(const OffscreenContext &) = delete;
+  OffscreenContext &operator=(const OffscreenContext &) = delete;
+
+private:
+  struct Private;
+  std::unique_ptr<Private> d;
+};
+
+} // namespace batch
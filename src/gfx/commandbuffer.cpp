@@ -0,0 +1,134 @@
+#include "gfx/commandbuffer.h"
+#include <cstring>
+
+namespace gfx {
+
+template <typename T> T *CommandBuffer::append(CommandType type) {
+  auto cmd = arena_.allocate<T>();
+  cmd->type = type;
+  cmd->next = nullptr;
+  if (last_) {
+    last_->next = cmd;
+  } else {
+    first_ = cmd;
+  }
+  last_ = cmd;
+  commandCount_++;
+  return cmd;
+}
+
+void CommandBuffer::clearRenderTarget(RenderTargetView view,
+                                      const ColorF &clearColor) {
+  auto cmd = append<ClearRenderTargetCommand>(CommandType::ClearRenderTarget);
+  cmd->view = view;
+  cmd->color = clearColor;
+}
+
+void CommandBuffer::clearDepthStencil(DepthStencilRenderTargetView view,
+                                      float clearDepth) {
+  auto cmd = append<ClearDepthStencilCommand>(CommandType::ClearDepthStencil);
+  cmd->view = view;
+  cmd->depth = clearDepth;
+}
+
+void CommandBuffer::presentToScreen(ImageHandle img, unsigned width,
+                                    unsigned height) {
+  auto cmd = append<PresentToScreenCommand>(CommandType::PresentToScreen);
+  cmd->image = img;
+  cmd->width = width;
+  cmd->height = height;
+}
+
+void CommandBuffer::draw(GraphicsPipelineHandle pipeline,
+                         FramebufferHandle framebuffer,
+                         ArgumentBlockHandle arguments, DrawParams drawCommand) {
+  auto cmd = append<DrawCommand>(CommandType::Draw);
+  cmd->pipeline = pipeline;
+  cmd->framebuffer = framebuffer;
+  cmd->arguments = arguments;
+  cmd->params = drawCommand;
+}
+
+void CommandBuffer::dispatch(ComputePipelineHandle pipeline,
+                             ArgumentBlockHandle arguments,
+                             uint32_t groupCountX, uint32_t groupCountY,
+                             uint32_t groupCountZ) {
+  auto cmd = append<DispatchCommand>(CommandType::Dispatch);
+  cmd->pipeline = pipeline;
+  cmd->arguments = arguments;
+  cmd->groupCountX = groupCountX;
+  cmd->groupCountY = groupCountY;
+  cmd->groupCountZ = groupCountZ;
+}
+
+void CommandBuffer::updateBuffer(BufferHandle buffer, size_t offset,
+                                 const void *data, size_t size) {
+  auto cmd = append<UpdateBufferCommand>(CommandType::UpdateBuffer);
+  auto copy = arena_.allocate(size, alignof(std::max_align_t));
+  std::memcpy(copy, data, size);
+  cmd->buffer = buffer;
+  cmd->offset = offset;
+  cmd->size = size;
+  cmd->data = copy;
+}
+
+void CommandBuffer::copyImage(ImageHandle src, ImageHandle dst,
+                              const Rect &region) {
+  auto cmd = append<CopyImageCommand>(CommandType::CopyImage);
+  cmd->src = src;
+  cmd->dst = dst;
+  cmd->region = region;
+}
+
+void CommandBuffer::reset() {
+  arena_.reset();
+  first_ = nullptr;
+  last_ = nullptr;
+  commandCount_ = 0;
+}
+
+//-----------------------------------------------------------------------------
+void GraphicsBackend::submit(const CommandBuffer &commandBuffer) {
+  for (auto c = commandBuffer.commands(); c; c = c->next) {
+    switch (c->type) {
+    case CommandType::ClearRenderTarget: {
+      auto cmd = static_cast<const ClearRenderTargetCommand *>(c);
+      clearRenderTarget(cmd->view, cmd->color);
+      break;
+    }
+    case CommandType::ClearDepthStencil: {
+      auto cmd = static_cast<const ClearDepthStencilCommand *>(c);
+      clearDepthStencil(cmd->view, cmd->depth);
+      break;
+    }
+    case CommandType::Draw: {
+      auto cmd = static_cast<const DrawCommand *>(c);
+      draw(cmd->pipeline, cmd->framebuffer, cmd->arguments, cmd->params);
+      break;
+    }
+    case CommandType::Dispatch: {
+      auto cmd = static_cast<const DispatchCommand *>(c);
+      dispatch(cmd->pipeline, cmd->arguments, cmd->groupCountX,
+               cmd->groupCountY, cmd->groupCountZ);
+      break;
+    }
+    case CommandType::PresentToScreen: {
+      auto cmd = static_cast<const PresentToScreenCommand *>(c);
+      presentToScreen(cmd->image, cmd->width, cmd->height);
+      break;
+    }
+    case CommandType::UpdateBuffer: {
+      auto cmd = static_cast<const UpdateBufferCommand *>(c);
+      updateBufferData(cmd->buffer, cmd->offset, cmd->data, cmd->size);
+      break;
+    }
+    case CommandType::CopyImage: {
+      auto cmd = static_cast<const CopyImageCommand *>(c);
+      copyImage(cmd->src, cmd->dst, cmd->region);
+      break;
+    }
+    }
+  }
+}
+
+} // namespace gfx
@@ -0,0 +1,123 @@
+#pragma once
+#include "gfx/color.h"
+#include "gfx/gfx.h"
+#include "gfx/types.h"
+#include "util/arena.h"
+
+namespace gfx {
+
+enum class CommandType {
+  ClearRenderTarget,
+  ClearDepthStencil,
+  Draw,
+  Dispatch,
+  PresentToScreen,
+  UpdateBuffer,
+  CopyImage,
+};
+
+/// A command recorded in a `CommandBuffer`.
+///
+/// Commands are stored as a singly-linked list of structures derived from
+/// `Command`, allocated in the memory arena of the command buffer.
+struct Command {
+  CommandType    type;
+  const Command *next;
+};
+
+struct ClearRenderTargetCommand : Command {
+  RenderTargetView view;
+  ColorF           color;
+};
+
+struct ClearDepthStencilCommand : Command {
+  DepthStencilRenderTargetView view;
+  float                        depth;
+};
+
+struct DrawCommand : Command {
+  GraphicsPipelineHandle pipeline;
+  FramebufferHandle      framebuffer;
+  ArgumentBlockHandle    arguments;
+  DrawParams             params;
+};
+
+struct DispatchCommand : Command {
+  ComputePipelineHandle pipeline;
+  ArgumentBlockHandle   arguments;
+  uint32_t              groupCountX;
+  uint32_t              groupCountY;
+  uint32_t              groupCountZ;
+};
+
+struct PresentToScreenCommand : Command {
+  ImageHandle image;
+  unsigned    width;
+  unsigned    height;
+};
+
+struct CopyImageCommand : Command {
+  ImageHandle src;
+  ImageHandle dst;
+  Rect        region;
+};
+
+struct UpdateBufferCommand : Command {
+  BufferHandle buffer;
+  size_t       offset;
+  size_t       size;
+  /// Copy of the data, stored in the command buffer.
+  const void *data;
+};
+
+/// A list of commands recorded for later submission with
+/// `GraphicsBackend::submit()`.
+///
+/// Recording does not call the graphics backend, so command buffers can be
+/// recorded on any thread (a single command buffer must not be recorded on
+/// several threads at the same time). Resources referenced by the commands
+/// must stay alive until the command buffer is submitted.
+///
+/// Memory for commands is allocated in a linear arena that is kept across
+/// `reset()` calls, so recording a frame similar to the previous one does not
+/// allocate.
+class CommandBuffer {
+public:
+  CommandBuffer() = default;
+  CommandBuffer(CommandBuffer &&) = default;
+  CommandBuffer &operator=(CommandBuffer &&) = default;
+
+  void clearRenderTarget(RenderTargetView view, const ColorF &clearColor);
+  void clearDepthStencil(DepthStencilRenderTargetView view, float clearDepth);
+  void presentToScreen(ImageHandle img, unsigned width, unsigned height);
+  void draw(GraphicsPipelineHandle pipeline, FramebufferHandle framebuffer,
+            ArgumentBlockHandle arguments, DrawParams drawCommand);
+  void dispatch(ComputePipelineHandle pipeline, ArgumentBlockHandle arguments,
+                uint32_t groupCountX, uint32_t groupCountY,
+                uint32_t groupCountZ);
+  /// Updates the contents of a buffer with the specified data. The data is
+  /// copied into the command buffer.
+  void updateBuffer(BufferHandle buffer, size_t offset, const void *data,
+                    size_t size);
+  /// See `GraphicsBackend::copyImage()`.
+  void copyImage(ImageHandle src, ImageHandle dst, const Rect &region);
+
+  /// Removes all recorded commands.
+  void reset();
+
+  /// Returns the first recorded command, or nullptr if the command buffer is
+  /// empty.
+  const Command *commands() const { return first_; }
+  bool           empty() const { return first_ == nullptr; }
+  int            commandCount() const { return commandCount_; }
+
+private:
+  template <typename T> T *append(CommandType type);
+
+  util::LinearArena arena_;
+  Command *         first_ = nullptr;
+  Command *         last_ = nullptr;
+  int               commandCount_ = 0;
+};
+
+} // namespace gfx
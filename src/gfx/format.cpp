@@ -0,0 +1,94 @@
+#include "gfx/format.h"
+#include <stdexcept>
+
+namespace gfx {
+
+// must be kept in the same order as the `Format` enum
+static const ImageFormatInfo IMAGE_FORMAT_INFOS[] = {
+    {"R32G32B32A32_SFLOAT", 16, 4},
+    {"R16G16B16A16_SFLOAT", 8, 4},
+    {"R32G32_SFLOAT", 8, 2},
+    {"R32_SFLOAT", 4, 1},
+    {"R8_UNORM", 1, 1},
+    {"R8G8B8A8_UNORM", 4, 4},
+    {"R8G8B8A8_SNORM", 4, 4},
+    {"B10G11R11_UFLOAT_PACK32", 4, 3},
+    {"D32_SFLOAT", 4, 1},
+    {"A2R10G10B10_UNORM_PACK32", 4, 4},
+    {"A2R10G10B10_SNORM_PACK32", 4, 4},
+    {"R8_SRGB", 1, 1},
+    {"R8G8_SRGB", 2, 2},
+    {"R8G8B8_SRGB", 3, 3},
+    {"R8G8B8A8_SRGB", 4, 4},
+    {"R32G32B32A32_UINT", 16, 4},
+    {"R16G16_SFLOAT", 4, 2},
+    {"R16G16_SINT", 4, 2},
+    // Compressed block texture formats
+    {"BC1_RGB_UNORM_BLOCK", 8, 3, 4, 4},
+    {"BC1_RGB_SRGB_BLOCK", 8, 3, 4, 4},
+    {"BC1_RGBA_UNORM_BLOCK", 8, 4, 4, 4},
+    {"BC1_RGBA_SRGB_BLOCK", 8, 4, 4, 4},
+    {"BC2_UNORM_BLOCK", 16, 4, 4, 4},
+    {"BC2_SRGB_BLOCK", 16, 4, 4, 4},
+    {"BC3_UNORM_BLOCK", 16, 4, 4, 4},
+    {"BC3_SRGB_BLOCK", 16, 4, 4, 4},
+    {"BC4_UNORM_BLOCK", 8, 1, 4, 4},
+    {"BC4_SNORM_BLOCK", 8, 1, 4, 4},
+    {"BC5_UNORM_BLOCK", 16, 2, 4, 4},
+    {"BC5_SNORM_BLOCK", 16, 2, 4, 4},
+    {"BC6H_UFLOAT_BLOCK", 16, 3, 4, 4},
+    {"BC6H_SFLOAT_BLOCK", 16, 3, 4, 4},
+    {"BC7_UNORM_BLOCK", 16, 4, 4, 4},
+    {"BC7_SRGB_BLOCK", 16, 4, 4, 4},
+    {"ETC2_R8G8B8_UNORM_BLOCK", 8, 3, 4, 4},
+    {"ETC2_R8G8B8_SRGB_BLOCK", 8, 3, 4, 4},
+    {"ETC2_R8G8B8A1_UNORM_BLOCK", 8, 4, 4, 4},
+    {"ETC2_R8G8B8A1_SRGB_BLOCK", 8, 4, 4, 4},
+    {"ETC2_R8G8B8A8_UNORM_BLOCK", 16, 4, 4, 4},
+    {"ETC2_R8G8B8A8_SRGB_BLOCK", 16, 4, 4, 4},
+    {"EAC_R11_UNORM_BLOCK", 8, 1, 4, 4},
+    {"EAC_R11_SNORM_BLOCK", 8, 1, 4, 4},
+    {"EAC_R11G11_UNORM_BLOCK", 16, 2, 4, 4},
+    {"EAC_R11G11_SNORM_BLOCK", 16, 2, 4, 4},
+    {"ASTC_4x4_UNORM_BLOCK", 16, 4, 4, 4},
+    {"ASTC_4x4_SRGB_BLOCK", 16, 4, 4, 4},
+    {"ASTC_5x4_UNORM_BLOCK", 16, 4, 5, 4},
+    {"ASTC_5x4_SRGB_BLOCK", 16, 4, 5, 4},
+    {"ASTC_5x5_UNORM_BLOCK", 16, 4, 5, 5},
+    {"ASTC_5x5_SRGB_BLOCK", 16, 4, 5, 5},
+    {"ASTC_6x5_UNORM_BLOCK", 16, 4, 6, 5},
+    {"ASTC_6x5_SRGB_BLOCK", 16, 4, 6, 5},
+    {"ASTC_6x6_UNORM_BLOCK", 16, 4, 6, 6},
+    {"ASTC_6x6_SRGB_BLOCK", 16, 4, 6, 6},
+    {"ASTC_8x5_UNORM_BLOCK", 16, 4, 8, 5},
+    {"ASTC_8x5_SRGB_BLOCK", 16, 4, 8, 5},
+    {"ASTC_8x6_UNORM_BLOCK", 16, 4, 8, 6},
+    {"ASTC_8x6_SRGB_BLOCK", 16, 4, 8, 6},
+    {"ASTC_8x8_UNORM_BLOCK", 16, 4, 8, 8},
+    {"ASTC_8x8_SRGB_BLOCK", 16, 4, 8, 8},
+    {"ASTC_10x5_UNORM_BLOCK", 16, 4, 10, 5},
+    {"ASTC_10x5_SRGB_BLOCK", 16, 4, 10, 5},
+    {"ASTC_10x6_UNORM_BLOCK", 16, 4, 10, 6},
+    {"ASTC_10x6_SRGB_BLOCK", 16, 4, 10, 6},
+    {"ASTC_10x8_UNORM_BLOCK", 16, 4, 10, 8},
+    {"ASTC_10x8_SRGB_BLOCK", 16, 4, 10, 8},
+    {"ASTC_10x10_UNORM_BLOCK", 16, 4, 10, 10},
+    {"ASTC_10x10_SRGB_BLOCK", 16, 4, 10, 10},
+    {"ASTC_12x10_UNORM_BLOCK", 16, 4, 12, 10},
+    {"ASTC_12x10_SRGB_BLOCK", 16, 4, 12, 10},
+    {"ASTC_12x12_UNORM_BLOCK", 16, 4, 12, 12},
+    {"ASTC_12x12_SRGB_BLOCK", 16, 4, 12, 12},
+};
+
+static_assert(sizeof(IMAGE_FORMAT_INFOS) / sizeof(ImageFormatInfo) ==
+                  (size_t)Format::Max,
+              "IMAGE_FORMAT_INFOS must have an entry for each format");
+
+const ImageFormatInfo &getImageFormatInfo(Format fmt) {
+  if ((size_t)fmt >= (size_t)Format::Max) {
+    throw std::logic_error("Invalid image format");
+  }
+  return IMAGE_FORMAT_INFOS[(size_t)fmt];
+}
+
+} // namespace gfx
@@ -82,10 +82,15 @@ enum class Format {
 
 struct ImageFormatInfo {
   const char *name;
+  /// Size of one texel block in bytes (one pixel for uncompressed formats).
   uint32_t size;
   uint32_t numChannels;
+  /// Dimensions of a texel block, 1x1 for uncompressed formats.
+  uint32_t blockWidth = 1;
+  uint32_t blockHeight = 1;
 };
 
+/// Returns information about the specified format.
 const ImageFormatInfo &getImageFormatInfo(Format fmt);
 
 } // namespace gfx
@@ -2,6 +2,7 @@
 // Main header for the backend-agnostic graphics API
 #include "gfx/format.h"
 #include "gfx/handle.h"
+#include "gfx/rect.h"
 #include "gfx/sampler.h"
 #include "gfx/shader.h"
 #include "gfx/types.h"
@@ -9,14 +10,17 @@
 #include "util/stringref.h"
 #include <cstdint>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <utility>
 
 namespace gfx {
 
+class CommandBuffer;
 struct ImageDesc;
 struct SignatureDesc;
 struct GraphicsPipelineDesc;
+struct ComputePipelineDesc;
 
 struct RenderPassTargetDesc {
   ColorF clearValue;
@@ -50,17 +54,35 @@ struct GraphicsPipelineCompilationMessages {
   std::string messages;
 };
 
-class ShaderCompilationError : public std::exception {
+/// Thrown by the backend when a shader fails to compile. The message contains
+/// the compilation log.
+class ShaderCompilationError : public std::runtime_error {
 public:
-  ShaderCompilationError() = default;
-  ShaderCompilationError(const char *message) : std::exception{message} {}
+  ShaderCompilationError() : std::runtime_error{"shader compilation failed"} {}
+  ShaderCompilationError(const std::string &message)
+      : std::runtime_error{message} {}
 };
 
-class GraphicsPipelineCompilationError : public std::exception {
+/// Thrown by the backend when a graphics pipeline cannot be created (e.g. link
+/// errors). The message contains the log.
+class GraphicsPipelineCompilationError : public std::runtime_error {
 public:
-  GraphicsPipelineCompilationError() = default;
-  GraphicsPipelineCompilationError(const char *message)
-      : std::exception{message} {}
+  GraphicsPipelineCompilationError()
+      : std::runtime_error{"graphics pipeline compilation failed"} {}
+  GraphicsPipelineCompilationError(const std::string &message)
+      : std::runtime_error{message} {}
+};
+
+/// Build status of a pipeline created by
+/// `GraphicsBackend::createGraphicsPipelineAsync()` or
+/// `GraphicsBackend::createComputePipelineAsync()`.
+enum class PipelineStatus {
+  /// Still building: the pipeline cannot be used yet.
+  Pending,
+  /// Can be used in draw commands.
+  Ready,
+  /// The build failed: the pipeline cannot be used.
+  Failed,
 };
 
 class GraphicsBackend {
@@ -71,13 +93,22 @@ public:
   virtual ImageHandle createImage(const ImageDesc &desc) = 0;
   virtual void deleteImage(ImageHandle handle) = 0;
 
-  /// Uploads new image data to the specified image, synchronously.
+  /// Uploads new data to a region of the first mip level of an image.
+  /// `data` contains tightly packed pixels in the format of the image, in
+  /// rows from `y`. The data is copied before the call returns, but the
+  /// upload itself may happen later, without waiting for the GPU.
   virtual void updateImageData(ImageHandle image, int x, int y, int z,
                                int width, int height, int depth,
                                const void *data) = 0;
+  /// Computes the mip levels of an image from its first level.
+  virtual void generateMipMaps(ImageHandle image) = 0;
 
   /// Creates a new shader module from the specified source code. The source
   /// language is backend-specific.
+  ///
+  /// Backends may defer compilation until a pipeline using the module is
+  /// created, in which case `ShaderCompilationError` is thrown by the pipeline
+  /// creation function.
   virtual ShaderModuleHandle createShaderModule(util::StringRef source,
                                                 ShaderStageFlags stage) = 0;
   virtual void deleteShaderModule(ShaderModuleHandle handle) = 0;
@@ -107,21 +138,67 @@ public:
   virtual void argumentBlockSetShaderResource(ArgumentBlockHandle argBlock,
                                               int resourceIndex,
                                               StorageBufferView buf) = 0;
+  virtual void argumentBlockSetShaderResource(ArgumentBlockHandle argBlock,
+                                              int resourceIndex,
+                                              StorageImageView imgView) = 0;
   virtual void argumentBlockSetVertexBuffer(ArgumentBlockHandle argBlock,
                                             int index,
                                             VertexBufferView buf) = 0;
   virtual void argumentBlockSetIndexBuffer(ArgumentBlockHandle argBlock,
                                            IndexBufferView buf) = 0;
+  /// Sets a viewport of the block, in pixels of the framebuffer. Blocks
+  /// without viewports render to the whole framebuffer. `index` must be less
+  /// than `SignatureDesc::viewportsCount`.
+  virtual void argumentBlockSetViewport(ArgumentBlockHandle argBlock,
+                                        int index, const Rect &viewport) = 0;
+  /// Sets a scissor rectangle of the block: pixels outside of it are not
+  /// written by draw commands. Blocks without scissors do not clip.
+  /// `index` must be less than `SignatureDesc::scissorsCount`.
+  virtual void argumentBlockSetScissor(ArgumentBlockHandle argBlock, int index,
+                                       const Rect &scissor) = 0;
 
   /// Creates a new render pass.
   virtual RenderPassHandle createRenderPass(const RenderPassDesc &desc) = 0;
   virtual void deleteRenderPass(RenderPassHandle handle) = 0;
 
   /// Creates a new graphics pipeline.
+  ///
+  /// Backends may return the same handle for identical pipelines (same shader
+  /// sources, signature and states): each handle returned must be deleted
+  /// once.
   virtual GraphicsPipelineHandle
   createGraphicsPipeline(const GraphicsPipelineDesc &desc) = 0;
   virtual void deleteGraphicsPipeline(GraphicsPipelineHandle handle) = 0;
 
+  /// Starts building a graphics pipeline without waiting for the shaders to
+  /// compile. The pipeline must not be used in draw commands until
+  /// `graphicsPipelineStatus()` returns `PipelineStatus::Ready`. Errors are
+  /// reported by the status instead of exceptions.
+  ///
+  /// Backends that cannot build pipelines in the background may build it
+  /// before returning. Handles are shared like those of
+  /// `createGraphicsPipeline()`.
+  virtual GraphicsPipelineHandle
+  createGraphicsPipelineAsync(const GraphicsPipelineDesc &desc) = 0;
+
+  /// Returns the build status of a pipeline, without blocking. If the build
+  /// failed and `log` is not null, the error log is written to it.
+  virtual PipelineStatus graphicsPipelineStatus(GraphicsPipelineHandle handle,
+                                                std::string *log = nullptr) = 0;
+
+  /// Creates a new compute pipeline. Pipelines are shared like those of
+  /// `createGraphicsPipeline()`.
+  virtual ComputePipelineHandle
+  createComputePipeline(const ComputePipelineDesc &desc) = 0;
+  virtual void deleteComputePipeline(ComputePipelineHandle handle) = 0;
+
+  /// Starts building a compute pipeline without waiting for the shader to
+  /// compile. See `createGraphicsPipelineAsync()`.
+  virtual ComputePipelineHandle
+  createComputePipelineAsync(const ComputePipelineDesc &desc) = 0;
+  virtual PipelineStatus computePipelineStatus(ComputePipelineHandle handle,
+                                               std::string *log = nullptr) = 0;
+
   /// Creates a new framebuffer for the given render pass.
   virtual FramebufferHandle createFramebuffer(const FramebufferDesc &desc) = 0;
   virtual void deleteFramebuffer(FramebufferHandle handle) = 0;
@@ -130,6 +207,22 @@ public:
   virtual BufferHandle createConstantBuffer(const void *data, size_t len) = 0;
   virtual void deleteBuffer(BufferHandle handle) = 0;
 
+  /// Creates a constant buffer whose contents are replaced frequently (e.g.
+  /// once per draw).
+  ///
+  /// The backend may allocate new storage for the buffer on each update, so
+  /// the buffer must be updated entirely (`offset == 0` and `len` equal to
+  /// the size of the buffer) and its contents are undefined until the first
+  /// update. Previous contents may be overwritten once they are no longer
+  /// used by the GPU: the buffer must be updated before each submission of
+  /// commands that read it.
+  virtual BufferHandle createDynamicConstantBuffer(size_t len) = 0;
+
+  /// Updates a region of a buffer created by `createConstantBuffer()` or
+  /// `createDynamicConstantBuffer()`.
+  virtual void updateBufferData(BufferHandle buffer, size_t offset,
+                                const void *data, size_t len) = 0;
+
   // Commands
   virtual void clearRenderTarget(RenderTargetView view,
                                  const ColorF &clearColor) = 0;
@@ -140,10 +233,72 @@ public:
   virtual void presentToScreen(ImageHandle img, unsigned width,
                                unsigned height) = 0;
 
+  /// Copies a region of the first mip level of `src` to the same region of
+  /// the first mip level of `dst`. The images must have the same format.
+  virtual void copyImage(ImageHandle src, ImageHandle dst,
+                         const Rect &region) = 0;
+
+  /// Reads back a region of the first mip level of a color image, converted
+  /// to 32-bit float RGBA. `data` receives `region.width * region.height * 4`
+  /// floats, in rows of tightly packed pixels. Waits for all commands
+  /// writing to the image to complete.
+  virtual void readImageData(ImageHandle image, const Rect &region,
+                             float *data) = 0;
+
   virtual void draw(GraphicsPipelineHandle pipeline,
                     FramebufferHandle framebuffer,
                     ArgumentBlockHandle arguments, DrawParams drawCommand) = 0;
 
+  /// Runs a compute shader over a grid of `groupCountX * groupCountY *
+  /// groupCountZ` work groups. Writes made by the shader to storage images and
+  /// buffers are visible to all commands issued after this one.
+  virtual void dispatch(ComputePipelineHandle pipeline,
+                        ArgumentBlockHandle arguments, uint32_t groupCountX,
+                        uint32_t groupCountY, uint32_t groupCountZ) = 0;
+
+  /// Executes all commands recorded in a command buffer, in order.
+  /// The default implementation calls the corresponding immediate commands.
+  virtual void submit(const CommandBuffer &commandBuffer);
+
+  // Frames
+
+  /// Starts a new frame. Waits if the CPU is too many frames ahead of the
+  /// GPU, and reclaims the resources deleted during frames that the GPU has
+  /// finished.
+  virtual void beginFrame() = 0;
+  /// Ends the current frame. Resources deleted since the start of the frame
+  /// are destroyed once the GPU has finished executing the frame.
+  virtual void endFrame() = 0;
+
+  // Queries
+
+  /// Creates a query object that can record a GPU timestamp.
+  virtual QueryHandle createTimestampQuery() = 0;
+  virtual void deleteQuery(QueryHandle handle) = 0;
+
+  /// Records the GPU time (in nanoseconds) at which all previously issued
+  /// commands have completed.
+  virtual void writeTimestamp(QueryHandle query) = 0;
+
+  /// Retrieves the result of a query. Does not block: returns false if the
+  /// result is not available yet.
+  virtual bool getQueryResult(QueryHandle query, uint64_t &result) = 0;
+
+  // Readbacks
+
+  /// Starts reading back a region of the first mip level of a color image,
+  /// in the layout of `readImageData()`, without waiting for the GPU. The data
+  /// is available once the commands issued before the call have completed,
+  /// usually a few frames later: poll it with `getReadbackData()`.
+  virtual ReadbackHandle readImageDataAsync(ImageHandle image,
+                                            const Rect &region) = 0;
+  /// Copies the data of a readback to `data`. If the GPU has not written it
+  /// yet, returns false, or blocks until it has if `wait` is true.
+  virtual bool getReadbackData(ReadbackHandle readback, float *data,
+                               bool wait) = 0;
+  /// Deletes a readback. Pending readbacks can be deleted.
+  virtual void deleteReadback(ReadbackHandle readback) = 0;
+
 private:
 };
 
@@ -165,6 +320,7 @@ public:
   }
 
   operator ImageHandle() { return image.get(); }
+  explicit operator bool() const { return (bool)image; }
 
 private:
   Handle<ImageHandle, ImageDeleter> image;
@@ -203,12 +359,60 @@ public:
   GraphicsPipeline(GraphicsBackend &backend, gfx::GraphicsPipelineDesc &desc)
       : pipeline{backend, backend.createGraphicsPipeline(desc)} {}
 
+  /// Starts building a pipeline in the background. See
+  /// `GraphicsBackend::createGraphicsPipelineAsync()`.
+  static GraphicsPipeline async(GraphicsBackend &backend,
+                                const gfx::GraphicsPipelineDesc &desc) {
+    GraphicsPipeline p;
+    p.pipeline = Handle<GraphicsPipelineHandle, GraphicsPipelineDeleter>{
+        backend, backend.createGraphicsPipelineAsync(desc)};
+    return p;
+  }
+
+  PipelineStatus status(std::string *log = nullptr) {
+    return pipeline.backend().graphicsPipelineStatus(pipeline.get(), log);
+  }
+
   operator GraphicsPipelineHandle() { return pipeline.get(); }
 
 private:
   Handle<GraphicsPipelineHandle, GraphicsPipelineDeleter> pipeline;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+struct ComputePipelineDeleter {
+  void operator()(GraphicsBackend &backend, ComputePipelineHandle handle) {
+    backend.deleteComputePipeline(handle);
+  }
+};
+
+class ComputePipeline {
+public:
+  ComputePipeline() = default;
+  ComputePipeline(GraphicsBackend &backend,
+                  const gfx::ComputePipelineDesc &desc)
+      : pipeline{backend, backend.createComputePipeline(desc)} {}
+
+  /// Starts building a pipeline in the background. See
+  /// `GraphicsBackend::createComputePipelineAsync()`.
+  static ComputePipeline async(GraphicsBackend &backend,
+                               const gfx::ComputePipelineDesc &desc) {
+    ComputePipeline p;
+    p.pipeline = Handle<ComputePipelineHandle, ComputePipelineDeleter>{
+        backend, backend.createComputePipelineAsync(desc)};
+    return p;
+  }
+
+  PipelineStatus status(std::string *log = nullptr) {
+    return pipeline.backend().computePipelineStatus(pipeline.get(), log);
+  }
+
+  operator ComputePipelineHandle() { return pipeline.get(); }
+
+private:
+  Handle<ComputePipelineHandle, ComputePipelineDeleter> pipeline;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 struct FramebufferDeleter {
   void operator()(GraphicsBackend &backend, FramebufferHandle handle) {
@@ -279,6 +483,14 @@ public:
   Buffer(GraphicsBackend &backend, const void *data, size_t size)
       : buffer{backend, backend.createConstantBuffer(data, size)} {}
 
+  /// See `GraphicsBackend::createDynamicConstantBuffer()`.
+  static Buffer dynamic(GraphicsBackend &backend, size_t size) {
+    Buffer b;
+    b.buffer = Handle<BufferHandle, BufferDeleter>{
+        backend, backend.createDynamicConstantBuffer(size)};
+    return b;
+  }
+
   operator BufferHandle() { return buffer.get(); }
 
 private:
@@ -316,15 +528,60 @@ public:
     argblock.backend().argumentBlockSetShaderResource(argblock.get(),
                                                       resourceIndex, buf);
   }
+  void setShaderResource(int resourceIndex, StorageImageView imgView) {
+    argblock.backend().argumentBlockSetShaderResource(argblock.get(),
+                                                      resourceIndex, imgView);
+  }
   void setVertexBuffer(int index, VertexBufferView buf) {
     argblock.backend().argumentBlockSetVertexBuffer(argblock.get(), index, buf);
   }
   void setIndexBuffer(ArgumentBlockHandle argBlock, IndexBufferView buf) {
     argblock.backend().argumentBlockSetIndexBuffer(argblock.get(), buf);
   }
+  void setViewport(int index, const Rect &viewport) {
+    argblock.backend().argumentBlockSetViewport(argblock.get(), index,
+                                                viewport);
+  }
+  void setScissor(int index, const Rect &scissor) {
+    argblock.backend().argumentBlockSetScissor(argblock.get(), index, scissor);
+  }
 
 private:
   Handle<ArgumentBlockHandle, ArgumentBlockDeleter> argblock;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+struct ReadbackDeleter {
+  void operator()(GraphicsBackend &backend, ReadbackHandle handle) {
+    backend.deleteReadback(handle);
+  }
+};
+
+/// The result of an asynchronous readback of an image to CPU memory. See
+/// `GraphicsBackend::readImageDataAsync()`.
+class Readback {
+public:
+  Readback() = default;
+  /// Starts reading back a region of an image.
+  Readback(GraphicsBackend &backend, ImageHandle image, const Rect &region)
+      : readback{backend, backend.readImageDataAsync(image, region)},
+        region_{region} {}
+
+  /// Returns the region of the image read back. The data contains
+  /// `region().width * region().height` RGBA float pixels.
+  const Rect &region() const { return region_; }
+
+  /// Copies the data to `data` if the GPU has written it. Returns false if
+  /// the data is not available yet, unless `wait` is true.
+  bool getData(float *data, bool wait = false) {
+    return readback.backend().getReadbackData(readback.get(), data, wait);
+  }
+
+  explicit operator bool() const { return (bool)readback; }
+
+private:
+  Handle<ReadbackHandle, ReadbackDeleter> readback;
+  Rect                                    region_;
+};
+
 } // namespace gfx
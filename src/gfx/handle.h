@@ -39,7 +39,7 @@ public:
   GraphicsBackend &backend() const { return *backend_; }
   T get() const { return raw_; }
 
-  explicit operator bool() { return obj != 0; }
+  explicit operator bool() const { return raw_ != 0; }
   friend bool operator==(const Handle &l, const Handle &r) {
     return l.backend_ == r.backend_ && l.raw_ == r.raw_;
   }
@@ -0,0 +1,31 @@
+#include "gfx/image.h"
+#include <algorithm>
+
+namespace gfx {
+
+size_t getImageByteSize(const ImageDesc &desc) {
+  const auto &info = getImageFormatInfo(desc.format);
+  size_t      total = 0;
+  size_t      w = desc.width;
+  size_t      h = desc.height;
+  size_t      d = desc.depth;
+  for (int i = 0; i < desc.mipMapCount; ++i) {
+    size_t bw = (w + info.blockWidth - 1) / info.blockWidth;
+    size_t bh = (h + info.blockHeight - 1) / info.blockHeight;
+    total += bw * bh * d * info.size;
+    w = std::max<size_t>(w / 2, 1);
+    h = std::max<size_t>(h / 2, 1);
+    d = std::max<size_t>(d / 2, 1);
+  }
+  return total * desc.arrayLayerCount * desc.sampleCount;
+}
+
+int getTextureMipMapCount(int width, int height) {
+  int count = 1;
+  for (int size = std::max(width, height); size > 1; size /= 2) {
+    ++count;
+  }
+  return count;
+}
+
+} // namespace gfx
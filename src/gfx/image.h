@@ -42,4 +42,12 @@ struct ImageDesc {
   }
 };
 
+/// Returns the size in bytes of the memory needed to store all mip levels,
+/// array layers and samples of an image with the specified description.
+size_t getImageByteSize(const ImageDesc &desc);
+
+/// Returns the number of levels of a complete mip chain of an image of the
+/// specified size, down to 1x1.
+int getTextureMipMapCount(int width, int height);
+
 } // namespace gfx
\ No newline at end of file
@@ -21,6 +21,8 @@ enum class PrimitiveTopology {
 
 enum class PolygonMode { Line, Fill };
 
+enum class FrontFace { CounterClockwise, Clockwise };
+
 enum class CullModeFlags {
   None = 0,
   Front = 1,
@@ -100,19 +102,30 @@ enum class BlendOp {
 };
 
 struct StencilOpState {
-  StencilOp fail;
-  StencilOp pass;
-  StencilOp depthFail;
-  CompareOp compare;
-  uint32_t compareMask;
-  uint32_t writeMask;
-  uint32_t reference;
+  StencilOp fail = StencilOp::Keep;
+  StencilOp pass = StencilOp::Keep;
+  StencilOp depthFail = StencilOp::Keep;
+  CompareOp compare = CompareOp::Always;
+  uint32_t compareMask = 0xFFFFFFFF;
+  uint32_t writeMask = 0xFFFFFFFF;
+  uint32_t reference = 0;
+
+  /// Comparison operator
+  constexpr bool operator==(const StencilOpState &rhs) const {
+    return fail == rhs.fail && pass == rhs.pass &&
+           depthFail == rhs.depthFail && compare == rhs.compare &&
+           compareMask == rhs.compareMask && writeMask == rhs.writeMask &&
+           reference == rhs.reference;
+  }
+  constexpr bool operator!=(const StencilOpState &rhs) const {
+    return !this->operator==(rhs);
+  }
 };
 
 struct DepthStencilState {
   bool depthTestEnable = false;
   bool depthWriteEnable = false;
-  CompareOp depthCompareOp;
+  CompareOp depthCompareOp = CompareOp::Less;
   bool depthBoundsTestEnable = false;
   float minDepthBounds = 0.0;
   float maxDepthBounds = 0.0;
@@ -123,12 +136,12 @@ struct DepthStencilState {
 
 struct ColorBlendAttachmentState {
   bool enabled = false;
-  BlendFactor srcColor;
-  BlendFactor dstColor;
-  BlendOp colorOp;
-  BlendFactor srcAlpha;
-  BlendFactor dstAlpha;
-  BlendOp alphaOp;
+  BlendFactor srcColor = BlendFactor::One;
+  BlendFactor dstColor = BlendFactor::Zero;
+  BlendOp colorOp = BlendOp::Add;
+  BlendFactor srcAlpha = BlendFactor::One;
+  BlendFactor dstAlpha = BlendFactor::Zero;
+  BlendOp alphaOp = BlendOp::Add;
 
   /// Comparison operator
   constexpr bool operator==(const ColorBlendAttachmentState &rhs) const {
@@ -145,10 +158,24 @@ struct ColorBlendAttachmentState {
 
 struct ScissorState {};
 struct ViewportState {};
-struct RasterizationState {};
+
+struct RasterizationState {
+  bool depthClampEnable = false;
+  PolygonMode polygonMode = PolygonMode::Fill;
+  CullModeFlags cullMode = CullModeFlags::None;
+  FrontFace frontFace = FrontFace::CounterClockwise;
+};
+
 struct MultisampleState {};
-struct InputAssemblyState {};
-struct ColorBlendState {};
+
+struct InputAssemblyState {
+  PrimitiveTopology topology = PrimitiveTopology::TriangleList;
+};
+
+struct ColorBlendState {
+  /// Blend state applied to all color attachments.
+  ColorBlendAttachmentState attachment;
+};
 
 struct GraphicsPipelineDesc {
   /// RenderPass that the pipeline conforms to. This pipeline will only be able
@@ -166,4 +193,11 @@ struct GraphicsPipelineDesc {
   ColorBlendState colorBlendState;
 };
 
+struct ComputePipelineDesc {
+  /// Signature of the pipeline. This pipeline will only accept argument blocks
+  /// created with this signature.
+  SignatureHandle signature = 0;
+  ShaderModuleHandle computeShader = 0;
+};
+
 } // namespace gfx
\ No newline at end of file
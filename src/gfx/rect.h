@@ -1,7 +1,68 @@
 #pragma once
+#include <algorithm>
 
+namespace gfx {
 
-namespace gfx
-{
+/// A rectangle of pixels. `x` and `y` are the coordinates of its first pixel.
+struct Rect {
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
 
-}
\ No newline at end of file
+  constexpr Rect() = default;
+  constexpr Rect(int x, int y, int width, int height)
+      : x{x}, y{y}, width{width}, height{height} {}
+
+  constexpr bool empty() const { return width <= 0 || height <= 0; }
+  constexpr int  right() const { return x + width; }
+  constexpr int  bottom() const { return y + height; }
+
+  /// Returns the rectangle grown by `margin` pixels on each side.
+  constexpr Rect inflated(int margin) const {
+    return Rect{x - margin, y - margin, width + 2 * margin,
+                height + 2 * margin};
+  }
+
+  /// Returns the intersection of two rectangles (empty if they do not
+  /// overlap).
+  Rect intersected(const Rect &other) const {
+    const int x0 = std::max(x, other.x);
+    const int y0 = std::max(y, other.y);
+    const int x1 = std::min(right(), other.right());
+    const int y1 = std::min(bottom(), other.bottom());
+    return Rect{x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0)};
+  }
+
+  /// Returns the smallest rectangle containing both rectangles. Empty
+  /// rectangles are ignored.
+  Rect united(const Rect &other) const {
+    if (other.empty()) {
+      return *this;
+    }
+    if (empty()) {
+      return other;
+    }
+    const int x0 = std::min(x, other.x);
+    const int y0 = std::min(y, other.y);
+    const int x1 = std::max(right(), other.right());
+    const int y1 = std::max(bottom(), other.bottom());
+    return Rect{x0, y0, x1 - x0, y1 - y0};
+  }
+
+  /// Returns whether `other` is inside this rectangle. Empty rectangles are
+  /// inside any rectangle.
+  bool contains(const Rect &other) const {
+    return other.empty() || intersected(other) == other;
+  }
+
+  friend constexpr bool operator==(const Rect &lhs, const Rect &rhs) {
+    return lhs.x == rhs.x && lhs.y == rhs.y && lhs.width == rhs.width &&
+           lhs.height == rhs.height;
+  }
+  friend constexpr bool operator!=(const Rect &lhs, const Rect &rhs) {
+    return !(lhs == rhs);
+  }
+};
+
+} // namespace gfx
@@ -130,6 +130,36 @@ struct ResourceBinding {
 		b.count = 1;
 		return b;
 	}
+
+	static ResourceBinding makeTextureSampler(int32_t index, ResourceShape shape = ResourceShape::R2d) {
+		ResourceBinding b;
+		b.index = index;
+		b.ty = ResourceBindingType::TextureSampler;
+		b.shape = shape;
+		b.visibility = ShaderStageFlags::COMPUTE | ShaderStageFlags::VERTEX | ShaderStageFlags::FRAGMENT | ShaderStageFlags::GEOMETRY | ShaderStageFlags::TESS_CONTROL | ShaderStageFlags::TESS_EVAL;
+		b.count = 1;
+		return b;
+	}
+
+	static ResourceBinding makeStorageImage(int32_t index, ResourceShape shape = ResourceShape::R2d) {
+		ResourceBinding b;
+		b.index = index;
+		b.ty = ResourceBindingType::RwImage;
+		b.shape = shape;
+		b.visibility = ShaderStageFlags::COMPUTE | ShaderStageFlags::FRAGMENT;
+		b.count = 1;
+		return b;
+	}
+
+	static ResourceBinding makeStorageBuffer(int32_t index) {
+		ResourceBinding b;
+		b.index = index;
+		b.ty = ResourceBindingType::RwBuffer;
+		b.shape = ResourceShape::RBuffer;
+		b.visibility = ShaderStageFlags::COMPUTE | ShaderStageFlags::VERTEX | ShaderStageFlags::FRAGMENT | ShaderStageFlags::GEOMETRY | ShaderStageFlags::TESS_CONTROL | ShaderStageFlags::TESS_EVAL;
+		b.count = 1;
+		return b;
+	}
 };
 
 /// TODO
@@ -7,10 +7,13 @@ typedef uintptr_t ImageHandle;
 typedef uintptr_t BufferHandle;
 typedef uintptr_t ShaderModuleHandle;
 typedef uintptr_t GraphicsPipelineHandle;
+typedef uintptr_t ComputePipelineHandle;
 typedef uintptr_t SignatureHandle;
 typedef uintptr_t ArgumentBlockHandle;
 typedef uintptr_t RenderPassHandle;
 typedef uintptr_t FramebufferHandle;
+typedef uintptr_t QueryHandle;
+typedef uintptr_t ReadbackHandle;
 
 struct SamplerDesc;
 
@@ -27,6 +30,13 @@ struct SampledImageView {
   const SamplerDesc &sampler;
 };
 
+/// A mip level of an image accessed with image load/store operations. The
+/// image must have been created with `ImageUsageFlags::Storage`.
+struct StorageImageView {
+  ImageHandle image;
+  int         mipLevel;
+};
+
 struct ConstantBufferView {
   BufferHandle buffer;
   size_t offset;
@@ -10,6 +10,8 @@ namespace gfxopengl {
 		gl::GLenum flags;
 		size_t offset;
 		size_t byteSize;
+		// storage is sub-allocated from the upload buffer on each update
+		bool dynamic = false;
 	};
 
 } // namespace gfxopengl
\ No newline at end of file
@@ -0,0 +1,31 @@
+#include "gfxopengl/context.h"
+
+// window system headers are kept out of the other files: X11 defines macros
+// (None, Status, Bool...) that clash with ordinary identifiers
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(RENDERGRAPH_GL_EGL)
+#include <EGL/egl.h>
+#else
+#include <GL/glx.h>
+#endif
+
+namespace gfxopengl {
+
+bool hasCurrentContext() {
+#if defined(_WIN32)
+  return wglGetCurrentContext() != nullptr;
+#elif defined(RENDERGRAPH_GL_EGL)
+  return eglGetCurrentContext() != EGL_NO_CONTEXT;
+#else
+  return glXGetCurrentContext() != nullptr;
+#endif
+}
+
+} // namespace gfxopengl
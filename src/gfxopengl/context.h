@@ -0,0 +1,11 @@
+#pragma once
+
+namespace gfxopengl {
+
+/// Returns whether an OpenGL context is current on the calling thread.
+///
+/// The query depends on the window system binding: WGL on Windows, EGL when
+/// `RENDERGRAPH_GL_EGL` is defined (headless builds), GLX otherwise.
+bool hasCurrentContext();
+
+} // namespace gfxopengl
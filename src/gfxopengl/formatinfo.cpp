@@ -8,7 +8,8 @@ static GLFormatInfo glfmt_rgba8_unorm{gl::RGBA8, gl::RGBA, gl::UNSIGNED_BYTE, 4,
 static GLFormatInfo glfmt_r8_unorm{gl::R8, gl::RED, gl::UNSIGNED_BYTE, 1, 1};
 static GLFormatInfo glfmt_r32_float{gl::R32F, gl::RED, gl::FLOAT, 1, 4};
 static GLFormatInfo glfmt_rg32_float{gl::RG32F, gl::RG, gl::FLOAT, 2, 8};
-static GLFormatInfo glfmt_rgba16_float{gl::RGBA16F, gl::RGBA, gl::FLOAT, 4, 8};
+static GLFormatInfo glfmt_rgba16_float{gl::RGBA16F, gl::RGBA, gl::HALF_FLOAT, 4,
+                                       8};
 static GLFormatInfo glfmt_rgba32_float{gl::RGBA32F, gl::RGBA, gl::FLOAT, 4, 16};
 static GLFormatInfo glfmt_rgba32_uint{gl::RGBA32UI, gl::RGBA, gl::UNSIGNED_INT,
                                       4, 16};
@@ -18,7 +19,7 @@ static GLFormatInfo glfmt_argb_10_10_10_2_unorm{
     gl::RGB10_A2, gl::DEPTH_COMPONENT, gl::FLOAT, 1, 4};
 static GLFormatInfo glfmt_rgba8_unorm_srgb{gl::SRGB8_ALPHA8, gl::RGBA,
                                            gl::UNSIGNED_BYTE, 4, 4};
-static GLFormatInfo glfmt_rg16_float{gl::RG16F, gl::RG, gl::FLOAT, 2, 4};
+static GLFormatInfo glfmt_rg16_float{gl::RG16F, gl::RG, gl::HALF_FLOAT, 2, 4};
 static GLFormatInfo glfmt_rg16_sint{gl::RG16I, gl::RG, gl::INT, 2, 4};
 
 const GLFormatInfo &getGLImageFormatInfo(gfx::Format fmt) {
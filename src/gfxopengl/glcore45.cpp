@@ -77,6 +77,10 @@ static PROC WinGetProcAddress(const char *name) {
 #else
 #if defined(__sgi) || defined(__sun)
 #define IntGetProcAddress(name) SunGetProcAddress(name)
+#elif defined(RENDERGRAPH_GL_EGL) /* EGL (headless) */
+#include <EGL/egl.h>
+
+#define IntGetProcAddress(name) eglGetProcAddress(name)
 #else /* GLX */
 #include <GL/glx.h>
 
@@ -141,6 +145,7 @@ LoadTest var_ARB_texture_barrier;
 LoadTest var_KHR_context_flush_control;
 LoadTest var_KHR_robust_buffer_access_behavior;
 LoadTest var_KHR_robustness;
+LoadTest var_KHR_parallel_shader_compile;
 
 } // namespace exts
 typedef void(CODEGEN_FUNCPTR *PFNTEXPAGECOMMITMENTARB)(GLenum, GLint, GLint,
@@ -1978,6 +1983,19 @@ typedef void(CODEGEN_FUNCPTR *PFNREADNPIXELS)(GLint, GLint, GLsizei, GLsizei,
                                               GLenum, GLenum, GLsizei, void *);
 PFNREADNPIXELS ReadnPixels = 0;
 
+typedef void(CODEGEN_FUNCPTR *PFNMAXSHADERCOMPILERTHREADSKHR)(GLuint);
+PFNMAXSHADERCOMPILERTHREADSKHR MaxShaderCompilerThreadsKHR = 0;
+
+static int Load_KHR_parallel_shader_compile() {
+  int numFailed = 0;
+  MaxShaderCompilerThreadsKHR =
+      reinterpret_cast<PFNMAXSHADERCOMPILERTHREADSKHR>(
+          IntGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+  if (!MaxShaderCompilerThreadsKHR)
+    ++numFailed;
+  return numFailed;
+}
+
 static int Load_KHR_robustness() {
   int numFailed = 0;
   GetGraphicsResetStatus = reinterpret_cast<PFNGETGRAPHICSRESETSTATUS>(
@@ -5699,7 +5717,7 @@ struct MapCompare {
 };
 
 void InitializeMappingTable(std::vector<MapEntry> &table) {
-  table.reserve(54);
+  table.reserve(55);
   table.push_back(MapEntry("GL_ARB_sparse_texture",
                            &exts::var_ARB_sparse_texture,
                            Load_ARB_sparse_texture));
@@ -5826,6 +5844,9 @@ void InitializeMappingTable(std::vector<MapEntry> &table) {
                            &exts::var_KHR_robust_buffer_access_behavior));
   table.push_back(MapEntry("GL_KHR_robustness", &exts::var_KHR_robustness,
                            Load_KHR_robustness));
+  table.push_back(MapEntry("GL_KHR_parallel_shader_compile",
+                           &exts::var_KHR_parallel_shader_compile,
+                           Load_KHR_parallel_shader_compile));
 }
 
 void ClearExtensionVars() {
@@ -5883,6 +5904,7 @@ void ClearExtensionVars() {
   exts::var_KHR_context_flush_control = exts::LoadTest();
   exts::var_KHR_robust_buffer_access_behavior = exts::LoadTest();
   exts::var_KHR_robustness = exts::LoadTest();
+  exts::var_KHR_parallel_shader_compile = exts::LoadTest();
 }
 
 void LoadExtByName(std::vector<MapEntry> &table, const char *extensionName) {
@@ -140,6 +140,7 @@ AG_GFX_API extern LoadTest var_ARB_texture_barrier;
 AG_GFX_API extern LoadTest var_KHR_context_flush_control;
 AG_GFX_API extern LoadTest var_KHR_robust_buffer_access_behavior;
 AG_GFX_API extern LoadTest var_KHR_robustness;
+AG_GFX_API extern LoadTest var_KHR_parallel_shader_compile;
 
 } // namespace exts
 enum {
@@ -155,6 +156,9 @@ enum {
   VIRTUAL_PAGE_SIZE_Y_ARB = 0x9196,
   VIRTUAL_PAGE_SIZE_Z_ARB = 0x9197,
 
+  COMPLETION_STATUS_KHR = 0x91B1,
+  MAX_SHADER_COMPILER_THREADS_KHR = 0x91B0,
+
   COMPRESSED_RGBA_S3TC_DXT1_EXT = 0x83F1,
   COMPRESSED_RGBA_S3TC_DXT3_EXT = 0x83F2,
   COMPRESSED_RGBA_S3TC_DXT5_EXT = 0x83F3,
@@ -1943,6 +1947,9 @@ AG_GFX_API extern void(CODEGEN_FUNCPTR *TexPageCommitmentARB)(
     GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset,
     GLsizei width, GLsizei height, GLsizei depth, GLboolean commit);
 
+AG_GFX_API extern void(CODEGEN_FUNCPTR *MaxShaderCompilerThreadsKHR)(
+    GLuint count);
+
 AG_GFX_API extern void(CODEGEN_FUNCPTR *ClearDepthf)(GLfloat d);
 AG_GFX_API extern void(CODEGEN_FUNCPTR *DepthRangef)(GLfloat n, GLfloat f);
 AG_GFX_API extern void(CODEGEN_FUNCPTR *GetShaderPrecisionFormat)(
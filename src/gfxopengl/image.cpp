@@ -4,7 +4,6 @@
 #include "util/panic.h"
 #include <algorithm>
 #include <cassert>
-#include <cmath>
 #include <stdexcept>
 
 namespace gfxopengl {
@@ -79,10 +78,4 @@ void Texture::upload(void *src, int mipLevel) {
   }
 }*/
 
-int getTextureMipMapCount(int width, int height) {
-  // 1000 is the default value of GL_TEXTURE_MAX_LEVEL
-  return std::min((int)std::floor(std::log2(std::max(width, height))), 1000) -
-         1;
-}
-
 } // namespace gfxopengl
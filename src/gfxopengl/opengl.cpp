@@ -4,21 +4,40 @@
 #include "gfx/signature.h"
 #include "gfxopengl/argumentblock.h"
 #include "gfxopengl/buffer.h"
+#include "gfxopengl/context.h"
 #include "gfxopengl/formatinfo.h"
 #include "gfxopengl/glcore45.h"
 #include "gfxopengl/image.h"
+#include "gfxopengl/programbuild.h"
+#include "gfxopengl/programcache.h"
+#include "gfxopengl/readbackpool.h"
 #include "gfxopengl/shader.h"
+#include "gfxopengl/statecache.h"
 #include "gfxopengl/sync.h"
 #include "gfxopengl/uploadbuffer.h"
+#include "util/hash.h"
 #include "util/log.h"
 #include "util/panic.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
 #include <deque>
 #include <stdexcept>
+#include <type_traits>
 #include <unordered_map>
 
 namespace gfxopengl {
 
 constexpr size_t DEFAULT_UPLOAD_BUFFER_SIZE = 4 * 1024 * 1024;
+// staging memory of image uploads, in 4 segments
+constexpr size_t DEFAULT_STAGING_BUFFER_SIZE = 64 * 1024 * 1024;
+// unused readback buffers kept for reuse (a few frames of a 4K RGBA32F image)
+constexpr size_t READBACK_POOL_FREE_BYTES = 512 * 1024 * 1024;
+// timeout of a single wait for the end of a frame, in nanoseconds
+constexpr uint64_t FRAME_WAIT_TIMEOUT_NS = 1000000;
+// timeout of a single wait for a program built on the worker thread
+constexpr uint64_t PROGRAM_WAIT_TIMEOUT_NS = 1000000;
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 static void APIENTRY debugCallback(gl::GLenum source, gl::GLenum type,
@@ -60,18 +79,14 @@ struct SignatureInner {
   gfx::IndexFormat indexFormat;
   size_t viewportsCount;
   size_t scissorsCount;
+  // hash of the contents of the signature, including inherited signatures
+  uint64_t hash;
 };
 
 struct Signature {
   std::shared_ptr<SignatureInner> ptr;
 };
 
-/*
-struct SyncedBuffer {
-  gl::GLsync sync;
-  std::unique_ptr<MappedBuffer> buffer;
-};*/
-
 struct ResourceGroup {
   std::vector<gl::GLuint> buffers;
   std::vector<gl::GLuint> textures;
@@ -79,8 +94,10 @@ struct ResourceGroup {
   std::vector<gl::GLuint> framebuffers;
 };
 
+// resources deleted during a frame, destroyed once the frame timeline
+// reaches `frame`
 struct SyncResourceGroup {
-  gl::GLsync sync;
+  uint64_t frame;
   ResourceGroup resources;
 };
 
@@ -133,11 +150,11 @@ gl::GLuint createSampler(const gfx::SamplerDesc &desc) {
                         filterToGLenum(desc.minFilter, desc.mipMapMode));
   gl::SamplerParameteri(sampler_obj, gl::TEXTURE_MAG_FILTER,
                         filterToGLenum(desc.magFilter, desc.mipMapMode));
-  gl::SamplerParameteri(sampler_obj, gl::TEXTURE_WRAP_R,
-                        textureAddressModeToGLenum(desc.addrU));
   gl::SamplerParameteri(sampler_obj, gl::TEXTURE_WRAP_S,
-                        textureAddressModeToGLenum(desc.addrV));
+                        textureAddressModeToGLenum(desc.addrU));
   gl::SamplerParameteri(sampler_obj, gl::TEXTURE_WRAP_T,
+                        textureAddressModeToGLenum(desc.addrV));
+  gl::SamplerParameteri(sampler_obj, gl::TEXTURE_WRAP_R,
                         textureAddressModeToGLenum(desc.addrW));
   float borderColor[4] = {(float)desc.borderColor.r, (float)desc.borderColor.g,
 						  (float)desc.borderColor.b, (float)desc.borderColor.a};
@@ -146,17 +163,102 @@ gl::GLuint createSampler(const gfx::SamplerDesc &desc) {
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
+struct PipelineProgram;
+struct GraphicsPipeline;
+struct ComputePipeline;
+struct ArgumentBlock;
+
 struct OpenGLGraphicsBackend::Private {
   ResourceGroup frameResources;
-  std::vector<SyncResourceGroup> pendingResources;
-  // std::deque<SyncedBuffer> uploadBuffers;
+  std::deque<SyncResourceGroup> pendingResources;
+  OpenGLContextInfo contextInfo;
+  // storage of dynamic constant buffers
+  std::unique_ptr<UploadBuffer> uploadBuffer;
+  // staging memory of image uploads
+  std::unique_ptr<UploadBuffer> stagingBuffer;
+  // pixel buffers of asynchronous readbacks
+  ReadbackPool readbackPool{READBACK_POOL_FREE_BYTES};
   std::unordered_map<gfx::SamplerDesc, gl::GLuint, SamplerHash> samplerCache;
   int maxFramesInFlight = 2;
+  // frame timeline value signalled at the end of the current frame
+  uint64_t currentFrame = 0;
+  bool inFrame = false;
   SyncTimeline frameTimeline;
   DriverWorkarounds workarounds;
+  StateCache stateCache;
+  // pipelines by hash of their description
+  std::unordered_map<uint64_t, GraphicsPipeline *> pipelineCache;
+  std::unordered_map<uint64_t, ComputePipeline *> computePipelineCache;
+  uint64_t pipelineCacheHits = 0;
+  uint64_t pipelineCacheMisses = 0;
+  // persistent cache of program binaries, null if disabled
+  std::shared_ptr<ProgramBinaryCache> programCache;
+  // builds programs in the background, null if no worker context was given
+  std::unique_ptr<ProgramBuildWorker> worker;
+  // jobs of pipelines deleted before their program was built
+  std::vector<std::shared_ptr<ProgramBuildJob>> abandonedJobs;
+  uint64_t programCacheHits = 0;
+  uint64_t programCacheMisses = 0;
+  double programBuildTimeMs = 0.0;
+  uint64_t drawCalls = 0;
+  uint64_t dispatches = 0;
+  uint64_t uploadedBytesBase = 0;
+  uint64_t uploadStallsBase = 0;
+  uint64_t readbackBytesBase = 0;
+  uint64_t imageUploadBytesBase = 0;
+  uint64_t imageUploadStallsBase = 0;
+  uint64_t readbackStallsBase = 0;
+  uint64_t frameStalls = 0;
 
   Private() {}
 
+  void destroyResources(ResourceGroup &group) {
+    for (auto obj : group.buffers) {
+      stateCache.forgetBuffer(obj);
+    }
+    for (auto obj : group.framebuffers) {
+      stateCache.forgetFramebuffer(obj);
+    }
+    for (auto obj : group.textures) {
+      stateCache.forgetTexture(obj);
+    }
+    gl::DeleteBuffers((gl::GLsizei)group.buffers.size(), group.buffers.data());
+    gl::DeleteTextures((gl::GLsizei)group.textures.size(),
+                       group.textures.data());
+    gl::DeleteRenderbuffers((gl::GLsizei)group.renderbuffers.size(),
+                            group.renderbuffers.data());
+    gl::DeleteFramebuffers((gl::GLsizei)group.framebuffers.size(),
+                           group.framebuffers.data());
+    group.buffers.clear();
+    group.textures.clear();
+    group.renderbuffers.clear();
+    group.framebuffers.clear();
+  }
+
+  void finishPipeline(PipelineProgram &gp, const ProgramBuildResult &result);
+  // completes the build of a pending pipeline if possible; returns false if
+  // the pipeline is still pending
+  bool pollPipeline(PipelineProgram &gp, bool wait);
+  // starts building the program of a pipeline in the background
+  void startPipelineBuild(PipelineProgram &gp,
+                          std::vector<ShaderSource> sources,
+                          uint64_t programHash);
+  // deletes the program of a pipeline, or abandons its build
+  void releasePipelineProgram(PipelineProgram &gp);
+  void reapAbandonedJobs();
+  // binds the buffers, textures and images of an argument block
+  void bindShaderResources(const ArgumentBlock &args);
+
+  // destroys the resources of all frames completed by the GPU
+  void reclaimResources() {
+    auto completed = frameTimeline.value();
+    while (!pendingResources.empty() &&
+           pendingResources.front().frame <= completed) {
+      destroyResources(pendingResources.front().resources);
+      pendingResources.pop_front();
+    }
+  }
+
   gl::GLuint getSamplerObject(const gfx::SamplerDesc &desc) {
     auto it = samplerCache.find(desc);
     if (it != samplerCache.end()) {
@@ -167,38 +269,11 @@ struct OpenGLGraphicsBackend::Private {
       return result.first->second;
     }
   }
-
-  /*size_t writeToArena(Arena &a, const void *data, size_t len, size_t align,
-                      gl::GLuint &outBufferObj) {
-    auto offset = alignOffset(len, align, a.uploadCurrentOffset_,
-                              a.uploadStartOffset_ + a.uploadSize_);
-
-    if (offset == -1) {
-      // not enough space in current buffer, recycle
-      // put current buffer in the recycling list
-      addSyncedBuffer(std::move(a.buffer_));
-      // request a new one
-      a.buffer_ = requestMappedBuffer();
-      // reset pointers
-      a.uploadCurrentOffset_ = 0;
-      a.uploadStartOffset_ = 0;
-      a.uploadSize_ = 0;
-      // try again
-      offset = alignOffset(len, align, a.uploadCurrentOffset_,
-                           a.uploadStartOffset_ + a.uploadSize_);
-    }
-
-    a.buffer_->writeAt(offset, data, len);
-    outBufferObj = a.buffer_->object();
-    a.uploadCurrentOffset_ = offset + len;
-    return offset;
-  }*/
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 OpenGLGraphicsBackend::OpenGLGraphicsBackend() {
-  auto ctx = wglGetCurrentContext();
-  if (!ctx) {
+  if (!hasCurrentContext()) {
     throw std::runtime_error{"no current context"};
   }
 
@@ -208,9 +283,119 @@ OpenGLGraphicsBackend::OpenGLGraphicsBackend() {
 
   setDebugCallback();
   d = std::make_unique<Private>();
+  getContextInfo(d->contextInfo);
+  if (gl::exts::var_KHR_parallel_shader_compile) {
+    // let the driver choose the number of threads
+    gl::MaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    util::log("using KHR_parallel_shader_compile");
+  }
+  d->uploadBuffer = std::make_unique<UploadBuffer>(
+      DEFAULT_UPLOAD_BUFFER_SIZE,
+      (size_t)std::max(d->contextInfo.uniformBufferOffsetAlignment, 16));
+  d->stagingBuffer =
+      std::make_unique<UploadBuffer>(DEFAULT_STAGING_BUFFER_SIZE, 16);
+}
+
+OpenGLGraphicsBackend::~OpenGLGraphicsBackend() {
+  // builds the programs still queued, if their pipelines are alive
+  setWorkerContext(nullptr);
+  // the GPU may still use deleted resources
+  gl::Finish();
+  for (auto &&group : d->pendingResources) {
+    d->destroyResources(group.resources);
+  }
+  d->destroyResources(d->frameResources);
+  for (auto &&kv : d->samplerCache) {
+    gl::DeleteSamplers(1, &kv.second);
+  }
+}
+
+void OpenGLGraphicsBackend::beginFrame() {
+  if (d->inFrame) {
+    throw std::logic_error{"beginFrame called twice without endFrame"};
+  }
+  d->inFrame = true;
+  d->currentFrame++;
+
+  // bound the number of frames in flight: wait for the GPU to finish the
+  // frame started maxFramesInFlight frames ago
+  if (d->currentFrame > (uint64_t)d->maxFramesInFlight) {
+    auto waitFrame = d->currentFrame - d->maxFramesInFlight;
+    if (!d->frameTimeline.clientSync(waitFrame, 0)) {
+      d->frameStalls++;
+      while (!d->frameTimeline.clientSync(waitFrame, FRAME_WAIT_TIMEOUT_NS)) {
+      }
+    }
+  }
+
+  d->reclaimResources();
+  d->reapAbandonedJobs();
 }
 
-OpenGLGraphicsBackend::~OpenGLGraphicsBackend() {}
+void OpenGLGraphicsBackend::endFrame() {
+  if (!d->inFrame) {
+    throw std::logic_error{"endFrame called without beginFrame"};
+  }
+  d->inFrame = false;
+  d->frameTimeline.signal(d->currentFrame);
+  // resources deleted outside of frames are deferred with the next frame
+  SyncResourceGroup group;
+  group.frame = d->currentFrame;
+  group.resources = std::move(d->frameResources);
+  d->frameResources = ResourceGroup{};
+  d->pendingResources.push_back(std::move(group));
+}
+
+void OpenGLGraphicsBackend::setProgramCacheDirectory(
+    const util::path &directory) {
+  if (directory.empty()) {
+    d->programCache.reset();
+    return;
+  }
+  d->programCache = std::make_shared<ProgramBinaryCache>(directory);
+  if (!d->programCache->supported()) {
+    d->programCache.reset();
+  }
+}
+
+void OpenGLGraphicsBackend::setWorkerContext(
+    std::unique_ptr<OpenGLWorkerContext> context) {
+  // the jobs not started yet are built by the next worker, or here
+  std::deque<std::shared_ptr<ProgramBuildJob>> queued;
+  if (d->worker) {
+    queued = d->worker->takeQueuedJobs();
+  }
+  d->worker.reset();
+  if (context) {
+    d->worker = std::make_unique<ProgramBuildWorker>(std::move(context),
+                                                     d->programCache);
+  }
+  for (auto &&job : queued) {
+    if (d->worker) {
+      d->worker->submit(std::move(job));
+    } else {
+      if (!job->cancelled) {
+        ProgramBuild build;
+        beginProgramBuild(build, job->sources, job->hash,
+                          d->programCache.get());
+        job->result = endProgramBuild(build, d->programCache.get());
+      }
+      job->done = true;
+    }
+  }
+  d->reapAbandonedJobs();
+}
+
+void OpenGLGraphicsBackend::setMaxFramesInFlight(int count) {
+  if (count < 1) {
+    throw std::logic_error{"at least one frame must be allowed in flight"};
+  }
+  d->maxFramesInFlight = count;
+}
+
+int OpenGLGraphicsBackend::maxFramesInFlight() const {
+  return d->maxFramesInFlight;
+}
 
 gfx::ImageHandle
 OpenGLGraphicsBackend::createImage(const gfx::ImageDesc &desc) {
@@ -226,27 +411,134 @@ OpenGLGraphicsBackend::createImage(const gfx::ImageDesc &desc) {
 
 void OpenGLGraphicsBackend::deleteImage(gfx::ImageHandle handle) {
   auto img = (Image *)handle;
-  gl::DeleteTextures(1, &img->obj);
+  if (img->isRenderbuffer) {
+    d->frameResources.renderbuffers.push_back(img->obj);
+  } else {
+    d->frameResources.textures.push_back(img->obj);
+  }
   delete img;
 }
 
 void OpenGLGraphicsBackend::updateImageData(gfx::ImageHandle image, int x,
                                             int y, int z, int width, int height,
                                             int depth, const void *data) {
-  // TODO
+  auto        img = (Image *)image;
+  const auto &fmt = getGLImageFormatInfo(img->desc.format);
+  if (img->isRenderbuffer) {
+    throw std::logic_error{"cannot upload data to renderbuffers"};
+  }
+  if (width <= 0 || height <= 0 || depth <= 0) {
+    return;
+  }
+  gl::PixelStorei(gl::UNPACK_ALIGNMENT, 1);
+  const size_t rowSize = (size_t)width * fmt.size;
+  const size_t rowsPerChunk = d->stagingBuffer->segmentSize() / rowSize;
+  if (img->target != gl::TEXTURE_2D || rowsPerChunk == 0) {
+    // uploaded from client memory: the driver makes its own copy
+    switch (img->target) {
+    case gl::TEXTURE_1D:
+      gl::TextureSubImage1D(img->obj, 0, x, width, fmt.externalFormat,
+                            fmt.type, data);
+      break;
+    case gl::TEXTURE_2D:
+      gl::TextureSubImage2D(img->obj, 0, x, y, width, height,
+                            fmt.externalFormat, fmt.type, data);
+      break;
+    case gl::TEXTURE_3D:
+      gl::TextureSubImage3D(img->obj, 0, x, y, z, width, height, depth,
+                            fmt.externalFormat, fmt.type, data);
+      break;
+    default:
+      throw std::logic_error{"unsupported image type for uploads"};
+    }
+    return;
+  }
+
+  // Copy to the staging buffer in bands of rows that fit in a segment, and
+  // upload from there: the copy does not wait for the GPU to finish using
+  // the image, and the GPU transfers the data asynchronously.
+  gl::BindBuffer(gl::PIXEL_UNPACK_BUFFER, d->stagingBuffer->object());
+  auto src = (const char *)data;
+  for (int row = 0; row < height;) {
+    const int rows = std::min(height - row, (int)rowsPerChunk);
+    const auto offset = d->stagingBuffer->write(src, rows * rowSize);
+    gl::TextureSubImage2D(img->obj, 0, x, y + row, width, rows,
+                          fmt.externalFormat, fmt.type,
+                          (const void *)(uintptr_t)offset);
+    src += rows * rowSize;
+    row += rows;
+  }
+  gl::BindBuffer(gl::PIXEL_UNPACK_BUFFER, 0);
 }
 
+void OpenGLGraphicsBackend::generateMipMaps(gfx::ImageHandle image) {
+  auto img = (Image *)image;
+  if (img->isRenderbuffer) {
+    throw std::logic_error{"renderbuffers have no mip levels"};
+  }
+  gl::GenerateTextureMipmap(img->obj);
+}
+
+// Shader modules are compiled when a pipeline is created from them, so that
+// pipelines found in the cache do not compile anything.
+struct ShaderModule {
+  gl::GLenum stage;
+  std::string source;
+  // hash of the stage and source
+  uint64_t hash;
+};
+
 gfx::ShaderModuleHandle
 OpenGLGraphicsBackend::createShaderModule(util::StringRef source,
                                           gfx::ShaderStageFlags stage) {
-  std::string log;
-  gl::GLenum stageGl = shaderStageToGLenum(stage);
-  gl::GLuint obj = createShader(stageGl, source, log);
-  return (gfx::ShaderModuleHandle)obj;
+  auto sm = new ShaderModule;
+  sm->stage = shaderStageToGLenum(stage);
+  sm->source = source.to_string();
+  sm->hash = util::fnv1a64(sm->source.data(), sm->source.size());
+  util::fnv1a64Combine(sm->hash, sm->stage);
+  return (gfx::ShaderModuleHandle)sm;
 }
 
 void OpenGLGraphicsBackend::deleteShaderModule(gfx::ShaderModuleHandle handle) {
-  gl::DeleteShader((gl::GLuint)handle);
+  delete (ShaderModule *)handle;
+}
+
+static uint64_t hashSignature(const SignatureInner &sig,
+                              const gfx::SignatureDesc &desc) {
+  uint64_t h = util::FNV1A64_OFFSET_BASIS;
+  for (auto &&inherited : sig.inherited) {
+    util::fnv1a64Combine(h, inherited->hash);
+  }
+  for (auto &&r : sig.shaderResources) {
+    util::fnv1a64Combine(h, r.index);
+    util::fnv1a64Combine(h, r.ty);
+    util::fnv1a64Combine(h, r.shape);
+    util::fnv1a64Combine(h, r.visibility);
+    util::fnv1a64Combine(h, r.count);
+  }
+  for (auto &&vi : sig.vertexInputs) {
+    util::fnv1a64Combine(h, vi.rate);
+    util::fnv1a64Combine(h, vi.baseLocation);
+    util::fnv1a64Combine(h, vi.layout.stride);
+    for (int i = 0; i < vi.layout.elements.len; ++i) {
+      auto &&e = vi.layout.elements[i];
+      if (e.semantic.name) {
+        h = util::fnv1a64(e.semantic.name, std::strlen(e.semantic.name), h);
+      }
+      util::fnv1a64Combine(h, e.semantic.index);
+      util::fnv1a64Combine(h, e.format);
+      util::fnv1a64Combine(h, e.offset);
+    }
+  }
+  util::fnv1a64Combine(h, desc.fragmentOutputs.len);
+  util::fnv1a64Combine(h, desc.hasdepthStencilFragmentOutput);
+  util::fnv1a64Combine(h, desc.hasIndexFormat);
+  if (desc.hasIndexFormat) {
+    util::fnv1a64Combine(h, desc.indexFormat);
+  }
+  util::fnv1a64Combine(h, sig.viewportsCount);
+  util::fnv1a64Combine(h, sig.scissorsCount);
+  return h;
 }
 
 gfx::SignatureHandle OpenGLGraphicsBackend::createSignature(
@@ -264,6 +556,7 @@ gfx::SignatureHandle OpenGLGraphicsBackend::createSignature(
   sig->indexFormat = desc.indexFormat;
   sig->viewportsCount = desc.viewportsCount;
   sig->scissorsCount = desc.scissorsCount;
+  sig->hash = hashSignature(*sig, desc);
   auto s = new Signature;
   s->ptr = std::move(sig);
   return (gfx::SignatureHandle)s;
@@ -279,10 +572,14 @@ struct ArgumentBlock {
   std::vector<gl::GLuint> textures;
   std::vector<gl::GLuint> samplers;
   std::vector<gl::GLuint> images;
-  std::vector<gl::GLuint> uniformBuffers;
+  std::vector<gl::GLint> imageLevels;
+  std::vector<gl::GLenum> imageFormats;
+  // resolved when drawing, since the storage of dynamic buffers changes
+  // on every update
+  std::vector<const Buffer *> uniformBuffers;
   std::vector<gl::GLsizeiptr> uniformBufferSizes;
   std::vector<gl::GLintptr> uniformBufferOffsets;
-  std::vector<gl::GLuint> shaderStorageBuffers;
+  std::vector<const Buffer *> shaderStorageBuffers;
   std::vector<gl::GLsizeiptr> shaderStorageBufferSizes;
   std::vector<gl::GLintptr> shaderStorageBufferOffsets;
   std::vector<gl::GLuint> vertexBuffers;
@@ -291,6 +588,8 @@ struct ArgumentBlock {
   gl::GLuint indexBuffer = 0;
   gl::GLsizeiptr indexBufferOffset = 0;
   gl::GLenum indexBufferType = 0;
+  std::vector<gfx::Rect> viewports;
+  std::vector<gfx::Rect> scissors;
 };
 
 gfx::ArgumentBlockHandle
@@ -319,7 +618,7 @@ void OpenGLGraphicsBackend::argumentBlockSetShaderResource(
     gfx::SampledImageView imgView) {
   // set texture
   ArgumentBlock *argblock = (ArgumentBlock *)handle;
-  Image *img = (Image *)handle;
+  Image *img = (Image *)imgView.image;
   if (argblock->textures.size() <= resourceIndex)
     argblock->textures.resize(resourceIndex + 1, 0);
   if (argblock->samplers.size() <= resourceIndex)
@@ -327,7 +626,7 @@ void OpenGLGraphicsBackend::argumentBlockSetShaderResource(
   if (img->isRenderbuffer)
     throw std::logic_error{"image cannot be bound as a texture"};
   argblock->textures[resourceIndex] = img->obj;
-  argblock->samplers[resourceIndex] = img->obj;
+  argblock->samplers[resourceIndex] = d->getSamplerObject(imgView.sampler);
 }
 
 void OpenGLGraphicsBackend::argumentBlockSetShaderResource(
@@ -335,7 +634,7 @@ void OpenGLGraphicsBackend::argumentBlockSetShaderResource(
 
   ArgumentBlock *a = (ArgumentBlock *)argBlock;
   if (a->uniformBuffers.size() <= index)
-    a->uniformBuffers.resize(index + 1, 0);
+    a->uniformBuffers.resize(index + 1, nullptr);
   if (a->uniformBufferOffsets.size() <= index)
     a->uniformBufferOffsets.resize(index + 1, 0);
   if (a->uniformBufferSizes.size() <= index)
@@ -343,15 +642,51 @@ void OpenGLGraphicsBackend::argumentBlockSetShaderResource(
 
   Buffer *buf = (Buffer *)cbv.buffer;
 
-  a->uniformBuffers[index] = buf->obj;
-  a->uniformBufferOffsets[index] = buf->offset + cbv.offset;
-  a->uniformBufferSizes[index] = buf->byteSize;
+  a->uniformBuffers[index] = buf;
+  a->uniformBufferOffsets[index] = cbv.offset;
+  a->uniformBufferSizes[index] = cbv.size;
 }
 
 void OpenGLGraphicsBackend::argumentBlockSetShaderResource(
     gfx::ArgumentBlockHandle argBlock, int resourceIndex,
-    gfx::StorageBufferView buf) {
-  // TODO
+    gfx::StorageBufferView sbv) {
+  ArgumentBlock *a = (ArgumentBlock *)argBlock;
+  if ((int)a->shaderStorageBuffers.size() <= resourceIndex)
+    a->shaderStorageBuffers.resize(resourceIndex + 1, nullptr);
+  if ((int)a->shaderStorageBufferOffsets.size() <= resourceIndex)
+    a->shaderStorageBufferOffsets.resize(resourceIndex + 1, 0);
+  if ((int)a->shaderStorageBufferSizes.size() <= resourceIndex)
+    a->shaderStorageBufferSizes.resize(resourceIndex + 1, 0);
+
+  Buffer *buf = (Buffer *)sbv.buffer;
+  if (buf->dynamic) {
+    // shader writes would be lost on the next update
+    throw std::logic_error{
+        "dynamic buffers cannot be bound as storage buffers"};
+  }
+  a->shaderStorageBuffers[resourceIndex] = buf;
+  a->shaderStorageBufferOffsets[resourceIndex] = sbv.offset;
+  a->shaderStorageBufferSizes[resourceIndex] = sbv.size;
+}
+
+void OpenGLGraphicsBackend::argumentBlockSetShaderResource(
+    gfx::ArgumentBlockHandle argBlock, int resourceIndex,
+    gfx::StorageImageView imgView) {
+  ArgumentBlock *a = (ArgumentBlock *)argBlock;
+  Image *img = (Image *)imgView.image;
+  if ((int)a->images.size() <= resourceIndex)
+    a->images.resize(resourceIndex + 1, 0);
+  if ((int)a->imageLevels.size() <= resourceIndex)
+    a->imageLevels.resize(resourceIndex + 1, 0);
+  if ((int)a->imageFormats.size() <= resourceIndex)
+    a->imageFormats.resize(resourceIndex + 1, 0);
+  if (img->isRenderbuffer ||
+      !(img->desc.usage & gfx::ImageUsageFlags::Storage))
+    throw std::logic_error{"image cannot be bound as a storage image"};
+  a->images[resourceIndex] = img->obj;
+  a->imageLevels[resourceIndex] = imgView.mipLevel;
+  a->imageFormats[resourceIndex] =
+      getGLImageFormatInfo(img->desc.format).internalFormat;
 }
 
 void OpenGLGraphicsBackend::argumentBlockSetVertexBuffer(
@@ -376,6 +711,30 @@ void OpenGLGraphicsBackend::argumentBlockSetIndexBuffer(
   // TODO
 }
 
+void OpenGLGraphicsBackend::argumentBlockSetViewport(
+    gfx::ArgumentBlockHandle argBlock, int index, const gfx::Rect &viewport) {
+  ArgumentBlock *a = (ArgumentBlock *)argBlock;
+  if (index < 0 || index >= (int)a->sig->viewportsCount ||
+      index >= MAX_VIEWPORTS) {
+    throw std::logic_error{"viewport index out of range of the signature"};
+  }
+  if ((int)a->viewports.size() <= index)
+    a->viewports.resize(index + 1);
+  a->viewports[index] = viewport;
+}
+
+void OpenGLGraphicsBackend::argumentBlockSetScissor(
+    gfx::ArgumentBlockHandle argBlock, int index, const gfx::Rect &scissor) {
+  ArgumentBlock *a = (ArgumentBlock *)argBlock;
+  if (index < 0 || index >= (int)a->sig->scissorsCount ||
+      index >= MAX_VIEWPORTS) {
+    throw std::logic_error{"scissor index out of range of the signature"};
+  }
+  if ((int)a->scissors.size() <= index)
+    a->scissors.resize(index + 1);
+  a->scissors[index] = scissor;
+}
+
 struct RenderPass {};
 
 gfx::RenderPassHandle
@@ -412,59 +771,472 @@ createVertexArrayObject(util::ArrayRef<gfx::VertexInputBinding> bindings) {
   return vao;
 }
 
-struct GraphicsPipeline {
+// The program of a graphics or compute pipeline.
+struct PipelineProgram {
   gl::GLuint program;
+  // key in the pipeline cache
+  uint64_t hash;
+  // number of handles returned by the pipeline creation functions
+  int refCount;
+  gfx::PipelineStatus status;
+  // errors if the build failed
+  bool shaderCompilationFailed;
+  std::string log;
+  // program build in progress, either on the worker thread or in the
+  // background in the driver (KHR_parallel_shader_compile)
+  std::shared_ptr<ProgramBuildJob> job;
+  std::unique_ptr<ProgramBuild> build;
+  // "graphics" or "compute", for log messages
+  const char *kind;
+};
+
+static void initPipelineProgram(PipelineProgram &p, uint64_t hash,
+                                const char *kind) {
+  p.program = 0;
+  p.hash = hash;
+  p.refCount = 1;
+  p.status = gfx::PipelineStatus::Pending;
+  p.shaderCompilationFailed = false;
+  p.kind = kind;
+}
+
+struct GraphicsPipeline : PipelineProgram {
   gl::GLuint vao;
-  gfx::ViewportState viewportState;
+  // the viewport and multisample states are not stored: they are empty, and
+  // the viewports come from the argument blocks
   gfx::RasterizationState rasterizationState;
-  gfx::MultisampleState multisampleState;
   gfx::DepthStencilState depthStencilState;
   gfx::InputAssemblyState inputAssemblyState;
   gfx::ColorBlendState colorBlendState;
 };
 
-gfx::GraphicsPipelineHandle OpenGLGraphicsBackend::createGraphicsPipeline(
-    const gfx::GraphicsPipelineDesc &desc) {
-  if (!desc.shaderStages.vertex || !desc.shaderStages.fragment) {
-    throw std::logic_error{"must define at least a vertex shader and a "
-                           "fragment shader to create a pipeline"};
+struct ComputePipeline : PipelineProgram {};
+
+static void hashStencilOpState(uint64_t &h, const gfx::StencilOpState &s) {
+  util::fnv1a64Combine(h, s.fail);
+  util::fnv1a64Combine(h, s.pass);
+  util::fnv1a64Combine(h, s.depthFail);
+  util::fnv1a64Combine(h, s.compare);
+  util::fnv1a64Combine(h, s.compareMask);
+  util::fnv1a64Combine(h, s.writeMask);
+  util::fnv1a64Combine(h, s.reference);
+}
+
+static uint64_t hashGraphicsPipelineDesc(const gfx::GraphicsPipelineDesc &desc) {
+  uint64_t h = util::FNV1A64_OFFSET_BASIS;
+  const gfx::ShaderModuleHandle stages[5] = {
+      desc.shaderStages.vertex, desc.shaderStages.fragment,
+      desc.shaderStages.tessControl, desc.shaderStages.tessEval,
+      desc.shaderStages.geometry};
+  for (auto stage : stages) {
+    uint64_t stageHash = stage ? ((const ShaderModule *)stage)->hash : 0;
+    util::fnv1a64Combine(h, stageHash);
   }
+  util::fnv1a64Combine(h, ((const Signature *)desc.signature)->ptr->hash);
+
+  // every state stored in GraphicsPipeline must be hashed: pipelines with the
+  // same hash are shared
+  static_assert(std::is_empty<gfx::ViewportState>::value &&
+                    std::is_empty<gfx::MultisampleState>::value,
+                "hash the new viewport and multisample states, and store them "
+                "in GraphicsPipeline");
+  auto &&rs = desc.rasterizationState;
+  util::fnv1a64Combine(h, rs.depthClampEnable);
+  util::fnv1a64Combine(h, rs.polygonMode);
+  util::fnv1a64Combine(h, rs.cullMode);
+  util::fnv1a64Combine(h, rs.frontFace);
+  auto &&ds = desc.depthStencilState;
+  util::fnv1a64Combine(h, ds.depthTestEnable);
+  util::fnv1a64Combine(h, ds.depthWriteEnable);
+  util::fnv1a64Combine(h, ds.depthCompareOp);
+  util::fnv1a64Combine(h, ds.depthBoundsTestEnable);
+  util::fnv1a64Combine(h, ds.minDepthBounds);
+  util::fnv1a64Combine(h, ds.maxDepthBounds);
+  util::fnv1a64Combine(h, ds.stencilTestEnable);
+  hashStencilOpState(h, ds.stencilFrontOps);
+  hashStencilOpState(h, ds.stencilBackOps);
+  util::fnv1a64Combine(h, desc.inputAssemblyState.topology);
+  auto &&cb = desc.colorBlendState.attachment;
+  util::fnv1a64Combine(h, cb.enabled);
+  util::fnv1a64Combine(h, cb.srcColor);
+  util::fnv1a64Combine(h, cb.dstColor);
+  util::fnv1a64Combine(h, cb.colorOp);
+  util::fnv1a64Combine(h, cb.srcAlpha);
+  util::fnv1a64Combine(h, cb.dstAlpha);
+  util::fnv1a64Combine(h, cb.alphaOp);
+  return h;
+}
 
-  gl::GLuint program = gl::CreateProgram();
-  gl::AttachShader(program, (gl::GLuint)desc.shaderStages.vertex);
-  gl::AttachShader(program, (gl::GLuint)desc.shaderStages.fragment);
-  if (desc.shaderStages.tessControl)
-    gl::AttachShader(program, (gl::GLuint)desc.shaderStages.tessControl);
-  if (desc.shaderStages.tessEval)
-    gl::AttachShader(program, (gl::GLuint)desc.shaderStages.tessEval);
-  if (desc.shaderStages.geometry)
-    gl::AttachShader(program, (gl::GLuint)desc.shaderStages.geometry);
+static std::vector<ShaderSource>
+getShaderSources(const gfx::GraphicsPipelineDesc &desc, uint64_t &hash) {
+  const gfx::ShaderModuleHandle stages[5] = {
+      desc.shaderStages.vertex, desc.shaderStages.fragment,
+      desc.shaderStages.tessControl, desc.shaderStages.tessEval,
+      desc.shaderStages.geometry};
+  std::vector<ShaderSource> sources;
+  // the program binary only depends on the shader sources
+  hash = util::FNV1A64_OFFSET_BASIS;
+  for (auto stage : stages) {
+    uint64_t stageHash = 0;
+    if (stage) {
+      auto sm = (const ShaderModule *)stage;
+      sources.push_back(ShaderSource{sm->stage, sm->source});
+      stageHash = sm->hash;
+    }
+    util::fnv1a64Combine(hash, stageHash);
+  }
+  return sources;
+}
 
-  std::string log;
-  if (!linkProgram(program, log)) {
-    util::log("failed to link program: {}", log);
-    return 0;
+void OpenGLGraphicsBackend::Private::finishPipeline(
+    PipelineProgram &gp, const ProgramBuildResult &result) {
+  programBuildTimeMs += result.buildTimeMs;
+  if (programCache) {
+    if (result.loadedFromCache) {
+      programCacheHits++;
+    } else {
+      programCacheMisses++;
+    }
+  }
+  if (!result.program) {
+    util::log("{} pipeline {:016x}: build failed in {:.2f} ms", gp.kind,
+              gp.hash, result.buildTimeMs);
+    gp.status = gfx::PipelineStatus::Failed;
+    gp.shaderCompilationFailed = result.shaderCompilationFailed;
+    gp.log = result.log;
+    return;
+  }
+  util::log("{} pipeline {:016x}: program {} in {:.2f} ms", gp.kind, gp.hash,
+            result.loadedFromCache ? "loaded from binary cache"
+                                   : "compiled and linked",
+            result.buildTimeMs);
+  gp.program = result.program;
+  gp.status = gfx::PipelineStatus::Ready;
+}
+
+bool OpenGLGraphicsBackend::Private::pollPipeline(PipelineProgram &gp,
+                                                  bool wait) {
+  if (gp.status != gfx::PipelineStatus::Pending) {
+    return true;
+  }
+
+  if (gp.job) {
+    auto &job = *gp.job;
+    if (!job.done) {
+      if (!wait) {
+        return false;
+      }
+      worker->wait(job);
+    }
+    if (job.sync) {
+      // the program is only usable in this context once the worker commands
+      // have completed
+      auto timeout = wait ? PROGRAM_WAIT_TIMEOUT_NS : 0;
+      for (;;) {
+        auto r = gl::ClientWaitSync(job.sync, 0, timeout);
+        if (r == gl::ALREADY_SIGNALED || r == gl::CONDITION_SATISFIED ||
+            r == gl::WAIT_FAILED_) {
+          break;
+        }
+        if (!wait) {
+          return false;
+        }
+      }
+      gl::DeleteSync(job.sync);
+      job.sync = nullptr;
+    }
+    finishPipeline(gp, job.result);
+    gp.job.reset();
+  } else if (gp.build) {
+    if (!wait && !programBuildCompleted(*gp.build)) {
+      return false;
+    }
+    finishPipeline(gp, endProgramBuild(*gp.build, programCache.get()));
+    gp.build.reset();
+  }
+  return true;
+}
+
+void OpenGLGraphicsBackend::Private::startPipelineBuild(
+    PipelineProgram &gp, std::vector<ShaderSource> sources,
+    uint64_t programHash) {
+  if (worker) {
+    gp.job = std::make_shared<ProgramBuildJob>();
+    gp.job->sources = std::move(sources);
+    gp.job->hash = programHash;
+    worker->submit(gp.job);
+  } else {
+    // without KHR_parallel_shader_compile, this blocks in pollPipeline
+    gp.build = std::make_unique<ProgramBuild>();
+    beginProgramBuild(*gp.build, sources, programHash, programCache.get());
+  }
+}
+
+void OpenGLGraphicsBackend::Private::releasePipelineProgram(
+    PipelineProgram &gp) {
+  if (gp.job) {
+    // the worker may still be building the program
+    gp.job->cancelled = true;
+    abandonedJobs.push_back(std::move(gp.job));
+  }
+  if (gp.build) {
+    for (auto shader : gp.build->shaders) {
+      gl::DeleteShader(shader);
+    }
+    gl::DeleteProgram(gp.build->program);
+  }
+  // names may be reused by new objects
+  if (stateCache.knowProgram && stateCache.program == gp.program) {
+    stateCache.knowProgram = false;
+  }
+  gl::DeleteProgram(gp.program);
+}
+
+void OpenGLGraphicsBackend::Private::reapAbandonedJobs() {
+  for (auto it = abandonedJobs.begin(); it != abandonedJobs.end();) {
+    auto &job = **it;
+    if (!job.done) {
+      ++it;
+      continue;
+    }
+    if (job.sync) {
+      gl::DeleteSync(job.sync);
+    }
+    if (job.result.program) {
+      gl::DeleteProgram(job.result.program);
+    }
+    it = abandonedJobs.erase(it);
   }
+}
 
+// creates a pipeline object without a program
+static GraphicsPipeline *newGraphicsPipeline(const gfx::GraphicsPipelineDesc &desc,
+                                             uint64_t hash) {
   // make VAO from signature
   Signature *signature = (Signature *)desc.signature;
   gl::GLuint vao =
       createVertexArrayObject({signature->ptr->vertexInputs.data(), signature->ptr->vertexInputs.size()});
 
   GraphicsPipeline *gp = new GraphicsPipeline;
-  gp->program = program;
+  initPipelineProgram(*gp, hash, "graphics");
   gp->vao = vao;
-  gp->viewportState = desc.viewportState;
   gp->rasterizationState = desc.rasterizationState;
-  gp->multisampleState = desc.multisampleState;
   gp->depthStencilState = desc.depthStencilState;
   gp->inputAssemblyState = desc.inputAssemblyState;
   gp->colorBlendState = desc.colorBlendState;
+  return gp;
+}
+
+static void checkGraphicsPipelineDesc(const gfx::GraphicsPipelineDesc &desc) {
+  if (!desc.shaderStages.vertex || !desc.shaderStages.fragment) {
+    throw std::logic_error{"must define at least a vertex shader and a "
+                           "fragment shader to create a pipeline"};
+  }
+}
+
+// throws the error of a failed pipeline
+static void throwPipelineError(const PipelineProgram &gp) {
+  if (gp.shaderCompilationFailed) {
+    throw gfx::ShaderCompilationError{gp.log};
+  }
+  throw gfx::GraphicsPipelineCompilationError{gp.log};
+}
+
+gfx::GraphicsPipelineHandle OpenGLGraphicsBackend::createGraphicsPipeline(
+    const gfx::GraphicsPipelineDesc &desc) {
+  checkGraphicsPipelineDesc(desc);
+
+  // identical pipelines are shared
+  const uint64_t hash = hashGraphicsPipelineDesc(desc);
+  auto it = d->pipelineCache.find(hash);
+  if (it != d->pipelineCache.end()) {
+    d->pipelineCacheHits++;
+    util::log("graphics pipeline {:016x}: cache hit ({} hits, {} misses)",
+              hash, d->pipelineCacheHits, d->pipelineCacheMisses);
+    auto gp = it->second;
+    d->pollPipeline(*gp, true);
+    if (gp->status == gfx::PipelineStatus::Failed) {
+      throwPipelineError(*gp);
+    }
+    gp->refCount++;
+    return (gfx::GraphicsPipelineHandle)gp;
+  }
+  d->pipelineCacheMisses++;
+  util::log("graphics pipeline {:016x}: cache miss ({} hits, {} misses)",
+            hash, d->pipelineCacheHits, d->pipelineCacheMisses);
+
+  uint64_t programHash;
+  auto sources = getShaderSources(desc, programHash);
+  ProgramBuild build;
+  beginProgramBuild(build, sources, programHash, d->programCache.get());
+  auto result = endProgramBuild(build, d->programCache.get());
+
+  std::unique_ptr<GraphicsPipeline> gp{newGraphicsPipeline(desc, hash)};
+  d->finishPipeline(*gp, result);
+  if (gp->status == gfx::PipelineStatus::Failed) {
+    gl::DeleteVertexArrays(1, &gp->vao);
+    throwPipelineError(*gp);
+  }
+  d->pipelineCache.emplace(hash, gp.get());
+  return (gfx::GraphicsPipelineHandle)gp.release();
+}
+
+gfx::GraphicsPipelineHandle OpenGLGraphicsBackend::createGraphicsPipelineAsync(
+    const gfx::GraphicsPipelineDesc &desc) {
+  checkGraphicsPipelineDesc(desc);
+
+  const uint64_t hash = hashGraphicsPipelineDesc(desc);
+  auto it = d->pipelineCache.find(hash);
+  if (it != d->pipelineCache.end()) {
+    d->pipelineCacheHits++;
+    util::log("graphics pipeline {:016x}: cache hit ({} hits, {} misses)",
+              hash, d->pipelineCacheHits, d->pipelineCacheMisses);
+    it->second->refCount++;
+    return (gfx::GraphicsPipelineHandle)it->second;
+  }
+  d->pipelineCacheMisses++;
+  util::log("graphics pipeline {:016x}: cache miss, building in the "
+            "background ({} hits, {} misses)",
+            hash, d->pipelineCacheHits, d->pipelineCacheMisses);
+
+  uint64_t programHash;
+  auto sources = getShaderSources(desc, programHash);
+  auto gp = newGraphicsPipeline(desc, hash);
+  d->startPipelineBuild(*gp, std::move(sources), programHash);
+  d->pipelineCache.emplace(hash, gp);
   return (gfx::GraphicsPipelineHandle)gp;
 }
 
+gfx::PipelineStatus
+OpenGLGraphicsBackend::graphicsPipelineStatus(gfx::GraphicsPipelineHandle handle,
+                                              std::string *log) {
+  auto gp = (GraphicsPipeline *)handle;
+  d->pollPipeline(*gp, false);
+  if (log) {
+    *log = gp->log;
+  }
+  return gp->status;
+}
+
 void OpenGLGraphicsBackend::deleteGraphicsPipeline(
-    gfx::GraphicsPipelineHandle handle) {}
+    gfx::GraphicsPipelineHandle handle) {
+  auto gp = (GraphicsPipeline *)handle;
+  if (!gp || --gp->refCount > 0) {
+    return;
+  }
+  d->pipelineCache.erase(gp->hash);
+  d->releasePipelineProgram(*gp);
+  // names may be reused by new objects
+  auto &sc = d->stateCache;
+  if (sc.knowVertexArray && sc.vertexArray == gp->vao) {
+    sc.knowVertexArray = false;
+  }
+  gl::DeleteVertexArrays(1, &gp->vao);
+  delete gp;
+}
+
+static void checkComputePipelineDesc(const gfx::ComputePipelineDesc &desc) {
+  if (!desc.computeShader) {
+    throw std::logic_error{
+        "must define a compute shader to create a compute pipeline"};
+  }
+}
+
+static uint64_t hashComputePipelineDesc(const gfx::ComputePipelineDesc &desc,
+                                        uint64_t &programHash) {
+  programHash = util::FNV1A64_OFFSET_BASIS;
+  util::fnv1a64Combine(programHash,
+                       ((const ShaderModule *)desc.computeShader)->hash);
+  uint64_t h = programHash;
+  util::fnv1a64Combine(h, ((const Signature *)desc.signature)->ptr->hash);
+  return h;
+}
+
+static ShaderSource getComputeShaderSource(const gfx::ComputePipelineDesc &desc) {
+  auto sm = (const ShaderModule *)desc.computeShader;
+  if (sm->stage != gl::COMPUTE_SHADER) {
+    throw std::logic_error{"shader module is not a compute shader"};
+  }
+  return ShaderSource{sm->stage, sm->source};
+}
+
+gfx::ComputePipelineHandle OpenGLGraphicsBackend::createComputePipeline(
+    const gfx::ComputePipelineDesc &desc) {
+  checkComputePipelineDesc(desc);
+  uint64_t programHash;
+  const uint64_t hash = hashComputePipelineDesc(desc, programHash);
+  auto it = d->computePipelineCache.find(hash);
+  if (it != d->computePipelineCache.end()) {
+    auto cp = it->second;
+    d->pollPipeline(*cp, true);
+    if (cp->status == gfx::PipelineStatus::Failed) {
+      throwPipelineError(*cp);
+    }
+    cp->refCount++;
+    return (gfx::ComputePipelineHandle)cp;
+  }
+
+  ProgramBuild build;
+  beginProgramBuild(build, {getComputeShaderSource(desc)}, programHash,
+                    d->programCache.get());
+  auto result = endProgramBuild(build, d->programCache.get());
+
+  auto cp = std::make_unique<ComputePipeline>();
+  initPipelineProgram(*cp, hash, "compute");
+  d->finishPipeline(*cp, result);
+  if (cp->status == gfx::PipelineStatus::Failed) {
+    throwPipelineError(*cp);
+  }
+  d->computePipelineCache.emplace(hash, cp.get());
+  return (gfx::ComputePipelineHandle)cp.release();
+}
+
+gfx::ComputePipelineHandle OpenGLGraphicsBackend::createComputePipelineAsync(
+    const gfx::ComputePipelineDesc &desc) {
+  checkComputePipelineDesc(desc);
+  uint64_t programHash;
+  const uint64_t hash = hashComputePipelineDesc(desc, programHash);
+  auto it = d->computePipelineCache.find(hash);
+  if (it != d->computePipelineCache.end()) {
+    it->second->refCount++;
+    return (gfx::ComputePipelineHandle)it->second;
+  }
+
+  auto cp = new ComputePipeline;
+  initPipelineProgram(*cp, hash, "compute");
+  d->startPipelineBuild(*cp, {getComputeShaderSource(desc)}, programHash);
+  d->computePipelineCache.emplace(hash, cp);
+  return (gfx::ComputePipelineHandle)cp;
+}
+
+gfx::PipelineStatus
+OpenGLGraphicsBackend::computePipelineStatus(gfx::ComputePipelineHandle handle,
+                                             std::string *log) {
+  auto cp = (ComputePipeline *)handle;
+  d->pollPipeline(*cp, false);
+  if (log) {
+    *log = cp->log;
+  }
+  return cp->status;
+}
+
+void OpenGLGraphicsBackend::deleteComputePipeline(
+    gfx::ComputePipelineHandle handle) {
+  auto cp = (ComputePipeline *)handle;
+  if (!cp || --cp->refCount > 0) {
+    return;
+  }
+  d->computePipelineCache.erase(cp->hash);
+  d->releasePipelineProgram(*cp);
+  delete cp;
+}
+
+struct Framebuffer {
+  gl::GLuint obj;
+  // size of the smallest attachment
+  int width;
+  int height;
+};
 
 gfx::FramebufferHandle
 OpenGLGraphicsBackend::createFramebuffer(const gfx::FramebufferDesc &desc) {
@@ -478,8 +1250,12 @@ OpenGLGraphicsBackend::createFramebuffer(const gfx::FramebufferDesc &desc) {
   gl::NamedFramebufferDrawBuffers(fbo, (gl::GLsizei)desc.colorTargets.len,
                                   drawBuffers);
 
+  int width = INT_MAX;
+  int height = INT_MAX;
   for (int i = 0; i < desc.colorTargets.len; ++i) {
     Image *img = (Image *)desc.colorTargets.data[i].image;
+    width = std::min(width, img->desc.width);
+    height = std::min(height, img->desc.height);
 
     if (img->isRenderbuffer) {
       gl::NamedFramebufferRenderbuffer(fbo, gl::COLOR_ATTACHMENT0 + i,
@@ -496,34 +1272,71 @@ OpenGLGraphicsBackend::createFramebuffer(const gfx::FramebufferDesc &desc) {
     return 0;
   }
 
-  return fbo;
+  auto fb = new Framebuffer;
+  fb->obj = fbo;
+  fb->width = width;
+  fb->height = height;
+  return (gfx::FramebufferHandle)fb;
 }
 
 void OpenGLGraphicsBackend::deleteFramebuffer(gfx::FramebufferHandle handle) {
-  gl::GLuint fbo = (gl::GLuint)handle;
-  gl::DeleteFramebuffers(1, &fbo);
+  auto fb = (Framebuffer *)handle;
+  d->frameResources.framebuffers.push_back(fb->obj);
+  delete fb;
 }
 
 gfx::BufferHandle OpenGLGraphicsBackend::createConstantBuffer(const void *data,
                                                               size_t len) {
-  gl::GLuint obj = createBuffer(len, 0, data);
+  // dynamic, so that it can be updated with updateBufferData
+  gl::GLuint obj = createBuffer(len, gl::DYNAMIC_STORAGE_BIT, data);
   Buffer *b = new Buffer;
   b->byteSize = len;
   b->offset = 0;
   b->own = true;
-  b->flags = 0;
+  b->flags = gl::DYNAMIC_STORAGE_BIT;
   b->obj = obj;
   return (gfx::BufferHandle)b;
 }
 
+gfx::BufferHandle
+OpenGLGraphicsBackend::createDynamicConstantBuffer(size_t len) {
+  Buffer *b = new Buffer;
+  b->byteSize = len;
+  b->offset = 0;
+  b->own = false;
+  b->flags = 0;
+  b->obj = d->uploadBuffer->object();
+  b->dynamic = true;
+  return (gfx::BufferHandle)b;
+}
+
 void OpenGLGraphicsBackend::deleteBuffer(gfx::BufferHandle handle) {
   Buffer *b = (Buffer *)handle;
   if (b->own) {
-    gl::DeleteFramebuffers(1, &b->obj);
+    d->frameResources.buffers.push_back(b->obj);
   }
   delete b;
 }
 
+void OpenGLGraphicsBackend::updateBufferData(gfx::BufferHandle buffer,
+                                             size_t offset, const void *data,
+                                             size_t len) {
+  Buffer *b = (Buffer *)buffer;
+  if (offset + len > b->byteSize) {
+    throw std::logic_error{"buffer update out of bounds"};
+  }
+  if (b->dynamic) {
+    // rename the buffer: previous contents may still be in use by the GPU
+    if (offset != 0 || len != b->byteSize) {
+      throw std::logic_error{"dynamic buffers must be updated entirely"};
+    }
+    b->obj = d->uploadBuffer->object();
+    b->offset = d->uploadBuffer->write(data, len);
+    return;
+  }
+  gl::NamedBufferSubData(b->obj, b->offset + offset, len, data);
+}
+
 void OpenGLGraphicsBackend::clearRenderTarget(gfx::RenderTargetView view,
                                               const gfx::ColorF &clearColor) {
   Image *image = (Image *)view.image;
@@ -551,6 +1364,88 @@ void OpenGLGraphicsBackend::clearDepthStencil(
   }
 }
 
+void OpenGLGraphicsBackend::copyImage(gfx::ImageHandle src,
+                                      gfx::ImageHandle dst,
+                                      const gfx::Rect &region) {
+  auto srcImage = (Image *)src;
+  auto dstImage = (Image *)dst;
+  if (srcImage->desc.format != dstImage->desc.format) {
+    throw std::logic_error{"cannot copy between images of different formats"};
+  }
+  if (region.empty()) {
+    return;
+  }
+  gl::CopyImageSubData(srcImage->obj, srcImage->target, 0, region.x,
+                       region.y, 0, dstImage->obj, dstImage->target, 0,
+                       region.x, region.y, 0, region.width, region.height, 1);
+}
+
+// Throws if the image cannot be read back by `readImageData()`.
+static void checkReadable(const Image &image) {
+  if (image.isRenderbuffer) {
+    throw std::logic_error{"cannot read back renderbuffers"};
+  }
+  const auto &fmtInfo = getGLImageFormatInfo(image.desc.format);
+  if (fmtInfo.externalFormat == gl::DEPTH_COMPONENT ||
+      fmtInfo.externalFormat == gl::DEPTH_STENCIL) {
+    throw std::logic_error{"cannot read back depth images"};
+  }
+}
+
+// Size of the data read back from a region, in bytes (RGBA floats).
+static size_t readbackSize(const gfx::Rect &region) {
+  return sizeof(float) * 4 * (size_t)region.width * (size_t)region.height;
+}
+
+void OpenGLGraphicsBackend::readImageData(gfx::ImageHandle img,
+                                          const gfx::Rect & region,
+                                          float *           data) {
+  auto image = (Image *)img;
+  checkReadable(*image);
+  if (region.empty()) {
+    return;
+  }
+  gl::PixelStorei(gl::PACK_ALIGNMENT, 1);
+  gl::GetTextureSubImage(image->obj, 0, region.x, region.y, 0, region.width,
+                         region.height, 1, gl::RGBA, gl::FLOAT,
+                         (gl::GLsizei)readbackSize(region), data);
+}
+
+gfx::ReadbackHandle
+OpenGLGraphicsBackend::readImageDataAsync(gfx::ImageHandle img,
+                                          const gfx::Rect &region) {
+  auto image = (Image *)img;
+  checkReadable(*image);
+  const auto size = readbackSize(region);
+  auto       readback = d->readbackPool.acquire(std::max(size, (size_t)1));
+  if (size) {
+    // the copy goes to the pixel buffer: it does not wait for the GPU
+    gl::BindBuffer(gl::PIXEL_PACK_BUFFER, readback->buffer);
+    gl::PixelStorei(gl::PACK_ALIGNMENT, 1);
+    gl::GetTextureSubImage(image->obj, 0, region.x, region.y, 0, region.width,
+                           region.height, 1, gl::RGBA, gl::FLOAT,
+                           (gl::GLsizei)size, nullptr);
+    gl::BindBuffer(gl::PIXEL_PACK_BUFFER, 0);
+  }
+  readback->size = size;
+  d->readbackPool.submit(*readback);
+  return (gfx::ReadbackHandle)readback;
+}
+
+bool OpenGLGraphicsBackend::getReadbackData(gfx::ReadbackHandle handle,
+                                            float *data, bool wait) {
+  auto readback = (Readback *)handle;
+  if (!d->readbackPool.ready(*readback, wait)) {
+    return false;
+  }
+  std::memcpy(data, readback->ptr, readback->size);
+  return true;
+}
+
+void OpenGLGraphicsBackend::deleteReadback(gfx::ReadbackHandle handle) {
+  d->readbackPool.release((Readback *)handle);
+}
+
 void OpenGLGraphicsBackend::presentToScreen(gfx::ImageHandle img,
                                             unsigned width, unsigned height) {
   Image *image = (Image *)img;
@@ -566,16 +1461,14 @@ void OpenGLGraphicsBackend::presentToScreen(gfx::ImageHandle img,
     gl::NamedFramebufferTexture(tmpfb, gl::COLOR_ATTACHMENT0, texObj, 0);
   }
 
-  // TODO disable scissor test
-
   // XXX figure out why binding the framebuffer here is necessary
 
-  gl::Disable(gl::DEPTH_TEST);
-  gl::Disable(gl::SCISSOR_TEST);
+  d->stateCache.setDepthTestEnabled(false);
+  d->stateCache.setScissorTestEnabled(false);
 
   if (d->workarounds.intelWindowsBrokenDSABlitNamedFramebuffer) {
     gl::BindFramebuffer(gl::READ_FRAMEBUFFER, tmpfb);
-    gl::BindFramebuffer(gl::DRAW_FRAMEBUFFER, 0);
+    d->stateCache.setDrawFramebuffer(0);
     gl::BlitFramebuffer(0,      // srcX0
                         0,      // srcY0
                         width,  // srcX1,
@@ -613,24 +1506,185 @@ void OpenGLGraphicsBackend::draw(gfx::GraphicsPipelineHandle pipeline,
                                  gfx::DrawParams drawCommand) {
   GraphicsPipeline *pipeline_ = (GraphicsPipeline *)pipeline;
   ArgumentBlock *args_ = (ArgumentBlock *)arguments;
-  gl::GLuint fbo = (gl::GLuint)framebuffer;
-
-  gl::BindVertexArray(pipeline_->vao);
-  gl::UseProgram(pipeline_->program);
+  Framebuffer *fb = (Framebuffer *)framebuffer;
+  auto &sc = d->stateCache;
 
-  gl::BindVertexBuffers(0, 1, args_->vertexBuffers.data(),
-                        args_->vertexBufferOffsets.data(),
-                        args_->vertexBufferStrides.data());
-  gl::BindFramebuffer(gl::DRAW_FRAMEBUFFER, fbo);
+  if (pipeline_->status != gfx::PipelineStatus::Ready) {
+    throw std::logic_error{"drawing with a pipeline that is not ready"};
+  }
 
-  gl::BindBuffersRange(gl::UNIFORM_BUFFER, 0, args_->uniformBuffers.size(),
-                       args_->uniformBuffers.data(),
-                       args_->uniformBufferOffsets.data(),
-                       args_->uniformBufferSizes.data());
+  sc.setVertexArray(pipeline_->vao);
+  sc.setProgram(pipeline_->program);
+  sc.setRasterizationState(pipeline_->rasterizationState);
+  sc.setDepthStencilState(pipeline_->depthStencilState);
+  sc.setAllBlendStates(pipeline_->colorBlendState.attachment);
+
+  sc.setVertexBuffers((int)args_->vertexBuffers.size(),
+                      args_->vertexBuffers.data(),
+                      args_->vertexBufferOffsets.data(),
+                      args_->vertexBufferStrides.data());
+  d->bindShaderResources(*args_);
+
+  sc.setDrawFramebuffer(fb->obj);
+  if (args_->viewports.empty()) {
+    sc.setViewport(0, 0, 0, fb->width, fb->height);
+  }
+  for (int i = 0; i < (int)args_->viewports.size(); ++i) {
+    auto &&v = args_->viewports[i];
+    sc.setViewport(i, v.x, v.y, v.width, v.height);
+  }
+  sc.setScissorTestEnabled(!args_->scissors.empty());
+  for (int i = 0; i < (int)args_->scissors.size(); ++i) {
+    auto &&r = args_->scissors[i];
+    sc.setScissor(i, r.x, r.y, r.width, r.height);
+  }
 
   gl::DrawArraysInstancedBaseInstance(
-      gl::TRIANGLES, drawCommand.firstVertex, drawCommand.vertexCount,
+      primitiveTopologyToGLenum(pipeline_->inputAssemblyState.topology),
+      drawCommand.firstVertex, drawCommand.vertexCount,
       drawCommand.instanceCount, drawCommand.firstInstance);
+  d->drawCalls++;
+}
+
+void OpenGLGraphicsBackend::dispatch(gfx::ComputePipelineHandle pipeline,
+                                     gfx::ArgumentBlockHandle arguments,
+                                     uint32_t groupCountX, uint32_t groupCountY,
+                                     uint32_t groupCountZ) {
+  ComputePipeline *pipeline_ = (ComputePipeline *)pipeline;
+  ArgumentBlock *args_ = (ArgumentBlock *)arguments;
+
+  if (pipeline_->status != gfx::PipelineStatus::Ready) {
+    throw std::logic_error{"dispatching a pipeline that is not ready"};
+  }
+
+  d->stateCache.setProgram(pipeline_->program);
+  d->bindShaderResources(*args_);
+  gl::DispatchCompute(groupCountX, groupCountY, groupCountZ);
+  // incoherent writes must be made visible to all the ways later commands
+  // can read images and buffers (sampling, rendering, transfers...)
+  gl::MemoryBarrier(gl::ALL_BARRIER_BITS);
+  d->dispatches++;
+}
+
+void OpenGLGraphicsBackend::Private::bindShaderResources(
+    const ArgumentBlock &args) {
+  auto &sc = stateCache;
+
+  // uniform and storage buffers are resolved now, since the storage of
+  // dynamic buffers changes on every update
+  const int uniformBufferCount = (int)args.uniformBuffers.size();
+  if (uniformBufferCount > MAX_UNIFORM_BUFFERS) {
+    throw std::logic_error{"too many uniform buffers"};
+  }
+  gl::GLuint uniformBuffers[MAX_UNIFORM_BUFFERS];
+  gl::GLintptr uniformBufferOffsets[MAX_UNIFORM_BUFFERS];
+  for (int i = 0; i < uniformBufferCount; ++i) {
+    auto buf = args.uniformBuffers[i];
+    uniformBuffers[i] = buf ? buf->obj : 0;
+    uniformBufferOffsets[i] =
+        buf ? buf->offset + args.uniformBufferOffsets[i] : 0;
+  }
+  sc.setUniformBuffers(uniformBufferCount, uniformBuffers,
+                       uniformBufferOffsets, args.uniformBufferSizes.data());
+
+  const int storageBufferCount = (int)args.shaderStorageBuffers.size();
+  if (storageBufferCount > MAX_STORAGE_BUFFERS) {
+    throw std::logic_error{"too many storage buffers"};
+  }
+  gl::GLuint storageBuffers[MAX_STORAGE_BUFFERS];
+  gl::GLintptr storageBufferOffsets[MAX_STORAGE_BUFFERS];
+  for (int i = 0; i < storageBufferCount; ++i) {
+    auto buf = args.shaderStorageBuffers[i];
+    storageBuffers[i] = buf ? buf->obj : 0;
+    storageBufferOffsets[i] =
+        buf ? buf->offset + args.shaderStorageBufferOffsets[i] : 0;
+  }
+  sc.setStorageBuffers(storageBufferCount, storageBuffers,
+                       storageBufferOffsets,
+                       args.shaderStorageBufferSizes.data());
+
+  sc.setTextures((int)args.textures.size(), args.textures.data(),
+                 args.samplers.data());
+
+  if ((int)args.images.size() > MAX_IMAGE_UNITS) {
+    throw std::logic_error{"too many storage images"};
+  }
+  sc.setImages((int)args.images.size(), args.images.data(),
+               args.imageLevels.data(), args.imageFormats.data());
+}
+
+void OpenGLGraphicsBackend::invalidateStateCache() {
+  d->stateCache.invalidate();
+}
+
+OpenGLBackendStats OpenGLGraphicsBackend::stats() const {
+  OpenGLBackendStats s;
+  s.drawCalls = d->drawCalls;
+  s.dispatches = d->dispatches;
+  s.stateChangesIssued = d->stateCache.stats.issued;
+  s.stateChangesSkipped = d->stateCache.stats.skipped;
+  s.uploadedBytes = d->uploadBuffer->writtenBytes() - d->uploadedBytesBase;
+  s.uploadStalls = d->uploadBuffer->stallCount() - d->uploadStallsBase;
+  s.frameStalls = d->frameStalls;
+  s.imageUploadBytes =
+      d->stagingBuffer->writtenBytes() - d->imageUploadBytesBase;
+  s.imageUploadStalls =
+      d->stagingBuffer->stallCount() - d->imageUploadStallsBase;
+  s.readbackBytes = d->readbackPool.readBytes() - d->readbackBytesBase;
+  s.readbackStalls = d->readbackPool.stallCount() - d->readbackStallsBase;
+  s.pipelineCacheHits = d->pipelineCacheHits;
+  s.pipelineCacheMisses = d->pipelineCacheMisses;
+  s.programCacheHits = d->programCacheHits;
+  s.programCacheMisses = d->programCacheMisses;
+  s.programBuildTimeMs = d->programBuildTimeMs;
+  return s;
+}
+
+void OpenGLGraphicsBackend::resetStats() {
+  d->drawCalls = 0;
+  d->dispatches = 0;
+  d->frameStalls = 0;
+  d->pipelineCacheHits = 0;
+  d->pipelineCacheMisses = 0;
+  d->programCacheHits = 0;
+  d->programCacheMisses = 0;
+  d->programBuildTimeMs = 0.0;
+  d->stateCache.stats = StateCacheStats{};
+  d->uploadedBytesBase = d->uploadBuffer->writtenBytes();
+  d->uploadStallsBase = d->uploadBuffer->stallCount();
+  d->imageUploadBytesBase = d->stagingBuffer->writtenBytes();
+  d->imageUploadStallsBase = d->stagingBuffer->stallCount();
+  d->readbackBytesBase = d->readbackPool.readBytes();
+  d->readbackStallsBase = d->readbackPool.stallCount();
+}
+
+gfx::QueryHandle OpenGLGraphicsBackend::createTimestampQuery() {
+  gl::GLuint query;
+  gl::CreateQueries(gl::TIMESTAMP, 1, &query);
+  return (gfx::QueryHandle)query;
+}
+
+void OpenGLGraphicsBackend::deleteQuery(gfx::QueryHandle handle) {
+  gl::GLuint query = (gl::GLuint)handle;
+  gl::DeleteQueries(1, &query);
+}
+
+void OpenGLGraphicsBackend::writeTimestamp(gfx::QueryHandle query) {
+  gl::QueryCounter((gl::GLuint)query, gl::TIMESTAMP);
+}
+
+bool OpenGLGraphicsBackend::getQueryResult(gfx::QueryHandle query,
+                                           uint64_t &result) {
+  gl::GLuint obj = (gl::GLuint)query;
+  gl::GLint available = gl::FALSE_;
+  gl::GetQueryObjectiv(obj, gl::QUERY_RESULT_AVAILABLE, &available);
+  if (!available) {
+    return false;
+  }
+  gl::GLuint64 value = 0;
+  gl::GetQueryObjectui64v(obj, gl::QUERY_RESULT, &value);
+  result = value;
+  return true;
 }
 
 } // namespace gfxopengl
@@ -1,7 +1,9 @@
 #pragma once
 #include "gfx/gfx.h"
+#include "util/filesystem.h"
 #include "util/hash.h"
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 namespace gfxopengl {
@@ -10,6 +12,54 @@ struct OpenGLContextInfo {
   int uniformBufferOffsetAlignment;
 };
 
+/// Counters of the work done by the backend, since creation or the last call
+/// to `resetStats()`.
+struct OpenGLBackendStats {
+  uint64_t drawCalls = 0;
+  /// Compute dispatches.
+  uint64_t dispatches = 0;
+  /// State-changing GL calls made by draw and dispatch commands.
+  uint64_t stateChangesIssued = 0;
+  /// State-changing GL calls avoided because the state was already set.
+  uint64_t stateChangesSkipped = 0;
+  /// Bytes written to the upload buffer by updates of dynamic buffers.
+  uint64_t uploadedBytes = 0;
+  /// Updates of dynamic buffers that had to wait for the GPU.
+  uint64_t uploadStalls = 0;
+  /// Bytes of image data copied to the staging buffer by `updateImageData()`.
+  uint64_t imageUploadBytes = 0;
+  /// Image uploads that had to wait for the GPU to release staging memory.
+  uint64_t imageUploadStalls = 0;
+  /// Calls to `beginFrame()` that had to wait for the GPU to catch up.
+  uint64_t frameStalls = 0;
+  /// Bytes copied to pixel buffers by asynchronous readbacks.
+  uint64_t readbackBytes = 0;
+  /// Readbacks whose data was requested before the GPU had written it.
+  uint64_t readbackStalls = 0;
+  /// Calls to `createGraphicsPipeline()` that returned an existing pipeline.
+  uint64_t pipelineCacheHits = 0;
+  /// Calls to `createGraphicsPipeline()` that compiled a new pipeline.
+  uint64_t pipelineCacheMisses = 0;
+  /// Programs loaded from the program binary cache.
+  uint64_t programCacheHits = 0;
+  /// Programs compiled because they were not in the program binary cache.
+  uint64_t programCacheMisses = 0;
+  /// Total time spent building programs (loading binaries or compiling and
+  /// linking shaders), in milliseconds.
+  double programBuildTimeMs = 0.0;
+};
+
+/// A GL context sharing objects with the context of the backend, used to build
+/// programs on a worker thread. `makeCurrent()` is called once on the worker
+/// thread when it starts, `doneCurrent()` when it stops if `makeCurrent()`
+/// succeeded.
+class OpenGLWorkerContext {
+public:
+  virtual ~OpenGLWorkerContext() {}
+  virtual bool makeCurrent() = 0;
+  virtual void doneCurrent() = 0;
+};
+
 struct SamplerHash {
 	constexpr std::size_t operator()(gfx::SamplerDesc const &s) const {
 		std::size_t res = 0;
@@ -38,6 +88,7 @@ public:
   virtual gfx::ImageHandle createImage(const gfx::ImageDesc & desc) override;
   virtual void deleteImage(gfx::ImageHandle handle) override;
   virtual void updateImageData(gfx::ImageHandle image, int x, int y, int z, int width, int height, int depth, const void * data) override;
+  virtual void generateMipMaps(gfx::ImageHandle image) override;
   virtual gfx::ShaderModuleHandle createShaderModule(util::StringRef source, gfx::ShaderStageFlags stage) override;
   virtual void deleteShaderModule(gfx::ShaderModuleHandle handle) override;
   virtual gfx::SignatureHandle createSignature(util::ArrayRef<gfx::SignatureHandle> inheritedSignatures, const gfx::SignatureDesc & description) override;
@@ -48,20 +99,69 @@ public:
   virtual void argumentBlockSetShaderResource(gfx::ArgumentBlockHandle argBlock, int resourceIndex, gfx::SampledImageView imgView) override;
   virtual void argumentBlockSetShaderResource(gfx::ArgumentBlockHandle argBlock, int resourceIndex, gfx::ConstantBufferView buf) override;
   virtual void argumentBlockSetShaderResource(gfx::ArgumentBlockHandle argBlock, int resourceIndex, gfx::StorageBufferView buf) override;
+  virtual void argumentBlockSetShaderResource(gfx::ArgumentBlockHandle argBlock, int resourceIndex, gfx::StorageImageView imgView) override;
   virtual void argumentBlockSetVertexBuffer(gfx::ArgumentBlockHandle argBlock, int index, gfx::VertexBufferView buf) override;
   virtual void argumentBlockSetIndexBuffer(gfx::ArgumentBlockHandle argBlock, gfx::IndexBufferView buf) override;
+  virtual void argumentBlockSetViewport(gfx::ArgumentBlockHandle argBlock, int index, const gfx::Rect &viewport) override;
+  virtual void argumentBlockSetScissor(gfx::ArgumentBlockHandle argBlock, int index, const gfx::Rect &scissor) override;
   virtual gfx::RenderPassHandle createRenderPass(const gfx::RenderPassDesc& desc) override;
   virtual void deleteRenderPass(gfx::RenderPassHandle handle) override;
   virtual gfx::GraphicsPipelineHandle createGraphicsPipeline(const gfx::GraphicsPipelineDesc & desc) override;
+  virtual gfx::GraphicsPipelineHandle createGraphicsPipelineAsync(const gfx::GraphicsPipelineDesc & desc) override;
+  virtual gfx::PipelineStatus graphicsPipelineStatus(gfx::GraphicsPipelineHandle handle, std::string *log) override;
   virtual void deleteGraphicsPipeline(gfx::GraphicsPipelineHandle handle) override;
+  virtual gfx::ComputePipelineHandle createComputePipeline(const gfx::ComputePipelineDesc & desc) override;
+  virtual gfx::ComputePipelineHandle createComputePipelineAsync(const gfx::ComputePipelineDesc & desc) override;
+  virtual gfx::PipelineStatus computePipelineStatus(gfx::ComputePipelineHandle handle, std::string *log) override;
+  virtual void deleteComputePipeline(gfx::ComputePipelineHandle handle) override;
   virtual gfx::FramebufferHandle createFramebuffer(const gfx::FramebufferDesc& desc) override;
   virtual void deleteFramebuffer(gfx::FramebufferHandle handle) override;
   virtual gfx::BufferHandle createConstantBuffer(const void * data, size_t len) override;
+  virtual gfx::BufferHandle createDynamicConstantBuffer(size_t len) override;
   virtual void deleteBuffer(gfx::BufferHandle handle) override;
+  virtual void updateBufferData(gfx::BufferHandle buffer, size_t offset, const void *data, size_t len) override;
   virtual void clearRenderTarget(gfx::RenderTargetView view, const gfx::ColorF & clearColor) override;
   virtual void clearDepthStencil(gfx::DepthStencilRenderTargetView view, float clearDepth) override;
   virtual void presentToScreen(gfx::ImageHandle img, unsigned width, unsigned height) override;
+  virtual void copyImage(gfx::ImageHandle src, gfx::ImageHandle dst, const gfx::Rect &region) override;
+  virtual void readImageData(gfx::ImageHandle image, const gfx::Rect &region, float *data) override;
+  virtual gfx::ReadbackHandle readImageDataAsync(gfx::ImageHandle image, const gfx::Rect &region) override;
+  virtual bool getReadbackData(gfx::ReadbackHandle readback, float *data, bool wait) override;
+  virtual void deleteReadback(gfx::ReadbackHandle readback) override;
   virtual void draw(gfx::GraphicsPipelineHandle pipeline, gfx::FramebufferHandle framebuffer, gfx::ArgumentBlockHandle arguments, gfx::DrawParams drawCommand) override;
+  virtual void dispatch(gfx::ComputePipelineHandle pipeline, gfx::ArgumentBlockHandle arguments, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ) override;
+  virtual gfx::QueryHandle createTimestampQuery() override;
+  virtual void deleteQuery(gfx::QueryHandle handle) override;
+  virtual void writeTimestamp(gfx::QueryHandle query) override;
+  virtual bool getQueryResult(gfx::QueryHandle query, uint64_t &result) override;
+  virtual void beginFrame() override;
+  virtual void endFrame() override;
+
+  /// Sets the maximum number of frames that the CPU can submit before the GPU
+  /// finishes executing them (2 by default). `beginFrame()` blocks when the
+  /// limit is reached.
+  void setMaxFramesInFlight(int count);
+
+  /// Enables the persistent cache of program binaries, stored in the
+  /// specified directory. An empty path disables the cache (the default).
+  void setProgramCacheDirectory(const util::path &directory);
+
+  /// Builds the programs of `createGraphicsPipelineAsync()` on a thread
+  /// using the specified context. Without a worker context, programs are
+  /// built in the background by the driver if it supports
+  /// `KHR_parallel_shader_compile`, and synchronously otherwise. Call after
+  /// `setProgramCacheDirectory()`: the worker uses the cache set at this time.
+  /// Programs queued on the previous worker are built by the new one, or
+  /// synchronously if there is none.
+  void setWorkerContext(std::unique_ptr<OpenGLWorkerContext> context);
+  int maxFramesInFlight() const;
+
+  /// Forgets all GL states cached by the backend. Must be called if GL calls
+  /// are made on the context outside of the backend.
+  void invalidateStateCache();
+
+  OpenGLBackendStats stats() const;
+  void resetStats();
 
 private:
 	struct Private;
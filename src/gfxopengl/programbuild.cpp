@@ -0,0 +1,157 @@
+#include "gfxopengl/programbuild.h"
+#include "gfxopengl/glcore45.h"
+#include "gfxopengl/opengl.h"
+#include "gfxopengl/programcache.h"
+#include "gfxopengl/shader.h"
+
+namespace gfxopengl {
+
+void beginProgramBuild(ProgramBuild &build,
+                       const std::vector<ShaderSource> &sources,
+                       uint64_t hash, ProgramBinaryCache *cache) {
+  build.start = std::chrono::steady_clock::now();
+  build.hash = hash;
+  build.program = gl::CreateProgram();
+  if (cache && cache->load(build.program, hash)) {
+    build.loadedFromCache = true;
+    return;
+  }
+  if (cache) {
+    // start again from a fresh program if the binary was rejected
+    gl::DeleteProgram(build.program);
+    build.program = gl::CreateProgram();
+  }
+
+  for (auto &&s : sources) {
+    auto shader = beginCompileShader(s.stage, s.source);
+    gl::AttachShader(build.program, shader);
+    build.shaders.push_back(shader);
+  }
+  gl::ProgramParameteri(build.program, gl::PROGRAM_BINARY_RETRIEVABLE_HINT,
+                        gl::TRUE_);
+  gl::LinkProgram(build.program);
+}
+
+bool programBuildCompleted(const ProgramBuild &build) {
+  if (build.loadedFromCache || !gl::exts::var_KHR_parallel_shader_compile) {
+    // nothing happens in the background
+    return true;
+  }
+  gl::GLint completed = gl::FALSE_;
+  gl::GetProgramiv(build.program, gl::COMPLETION_STATUS_KHR, &completed);
+  return completed == gl::TRUE_;
+}
+
+ProgramBuildResult endProgramBuild(ProgramBuild &build,
+                                   ProgramBinaryCache *cache) {
+  ProgramBuildResult result;
+  result.loadedFromCache = build.loadedFromCache;
+
+  bool success = true;
+  if (!build.loadedFromCache) {
+    // report shader errors first, the link log is less useful
+    for (auto shader : build.shaders) {
+      if (!getShaderCompileStatus(shader, result.log)) {
+        result.shaderCompilationFailed = true;
+        success = false;
+        break;
+      }
+    }
+    if (success) {
+      success = getProgramLinkStatus(build.program, result.log);
+    }
+    // the program keeps the compiled code
+    for (auto shader : build.shaders) {
+      gl::DeleteShader(shader);
+    }
+    build.shaders.clear();
+  }
+
+  if (success) {
+    if (!build.loadedFromCache && cache) {
+      cache->store(build.program, build.hash);
+    }
+    result.program = build.program;
+  } else {
+    gl::DeleteProgram(build.program);
+  }
+  build.program = 0;
+  result.buildTimeMs = std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - build.start)
+                           .count();
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+ProgramBuildWorker::ProgramBuildWorker(
+    std::unique_ptr<OpenGLWorkerContext> context,
+    std::shared_ptr<ProgramBinaryCache>  cache)
+    : context_{std::move(context)}, cache_{std::move(cache)} {
+  thread_ = std::thread{[this]() { run(); }};
+}
+
+ProgramBuildWorker::~ProgramBuildWorker() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stop_ = true;
+  }
+  cond_.notify_all();
+  thread_.join();
+}
+
+void ProgramBuildWorker::submit(std::shared_ptr<ProgramBuildJob> job) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    queue_.push_back(std::move(job));
+  }
+  cond_.notify_all();
+}
+
+std::deque<std::shared_ptr<ProgramBuildJob>>
+ProgramBuildWorker::takeQueuedJobs() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return std::move(queue_);
+}
+
+void ProgramBuildWorker::wait(ProgramBuildJob &job) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  cond_.wait(lock, [&]() { return job.done.load(); });
+}
+
+void ProgramBuildWorker::run() {
+  const bool current = context_->makeCurrent();
+  for (;;) {
+    std::shared_ptr<ProgramBuildJob> job;
+    {
+      std::unique_lock<std::mutex> lock{mutex_};
+      cond_.wait(lock, [&]() { return stop_ || !queue_.empty(); });
+      if (stop_) {
+        break;
+      }
+      job = std::move(queue_.front());
+      queue_.pop_front();
+    }
+
+    if (!current) {
+      job->result.log = "no GL context on the program build thread";
+    } else if (!job->cancelled) {
+      ProgramBuild build;
+      beginProgramBuild(build, job->sources, job->hash, cache_.get());
+      job->result = endProgramBuild(build, cache_.get());
+      job->sync = gl::FenceSync(gl::SYNC_GPU_COMMANDS_COMPLETE, 0);
+      // make the fence visible to the other context
+      gl::Flush();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      job->done = true;
+    }
+    cond_.notify_all();
+  }
+  if (current) {
+    context_->doneCurrent();
+  }
+}
+
+} // namespace gfxopengl
@@ -0,0 +1,110 @@
+#pragma once
+#include <cstddef>
+#include "gfxopengl/glcore45types.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gfxopengl {
+
+class OpenGLWorkerContext;
+class ProgramBinaryCache;
+
+struct ShaderSource {
+  gl::GLenum  stage;
+  std::string source;
+};
+
+/// A program being built, either loaded from the program binary cache or
+/// compiled from sources.
+///
+/// The build is split in two halves so that it can overlap with other work
+/// when the driver compiles in the background (`KHR_parallel_shader_compile`):
+/// `beginProgramBuild` issues the GL calls, `endProgramBuild` waits for the
+/// result.
+struct ProgramBuild {
+  gl::GLuint              program = 0;
+  std::vector<gl::GLuint> shaders;
+  uint64_t                hash = 0;
+  bool                    loadedFromCache = false;
+  std::chrono::steady_clock::time_point start;
+};
+
+struct ProgramBuildResult {
+  /// The linked program, 0 on failure.
+  gl::GLuint program = 0;
+  bool       loadedFromCache = false;
+  /// On failure, whether a shader failed to compile (otherwise the link
+  /// failed).
+  bool        shaderCompilationFailed = false;
+  std::string log;
+  double      buildTimeMs = 0.0;
+};
+
+/// Starts building a program from the specified sources, whose hash is
+/// `hash`. `cache` may be null.
+void beginProgramBuild(ProgramBuild &build,
+                       const std::vector<ShaderSource> &sources,
+                       uint64_t hash, ProgramBinaryCache *cache);
+/// Returns whether the result of the build is available without waiting.
+bool programBuildCompleted(const ProgramBuild &build);
+/// Waits for the build to complete and returns its result. Stores the
+/// binary in `cache` on success if it was compiled from sources.
+ProgramBuildResult endProgramBuild(ProgramBuild &build,
+                                   ProgramBinaryCache *cache);
+
+/// A program built by a `ProgramBuildWorker`.
+struct ProgramBuildJob {
+  std::vector<ShaderSource> sources;
+  uint64_t                  hash = 0;
+
+  /// Valid once `done` is set, unless the job was cancelled.
+  ProgramBuildResult result;
+  /// Signalled in the worker context once the program is ready: wait for it
+  /// before using the program in another context.
+  gl::GLsync       sync = nullptr;
+  std::atomic_bool done{false};
+  /// Set when the result is not needed anymore: the worker skips the job if
+  /// it has not started it yet.
+  std::atomic_bool cancelled{false};
+};
+
+/// A thread building programs in a GL context that shares objects with the
+/// context of the backend.
+class ProgramBuildWorker {
+public:
+  /// Starts the thread. `cache` may be null.
+  ProgramBuildWorker(std::unique_ptr<OpenGLWorkerContext> context,
+                     std::shared_ptr<ProgramBinaryCache>  cache);
+  /// Waits for the job in progress, if any, and stops the thread. Queued jobs
+  /// are left as they are: take them with `takeQueuedJobs()` first to build
+  /// them elsewhere.
+  ~ProgramBuildWorker();
+
+  void submit(std::shared_ptr<ProgramBuildJob> job);
+  /// Removes the jobs that are not started yet from the queue and returns
+  /// them, in submission order.
+  std::deque<std::shared_ptr<ProgramBuildJob>> takeQueuedJobs();
+  /// Blocks until the specified job is done.
+  void wait(ProgramBuildJob &job);
+
+private:
+  void run();
+
+  std::unique_ptr<OpenGLWorkerContext>         context_;
+  std::shared_ptr<ProgramBinaryCache>          cache_;
+  std::mutex                                   mutex_;
+  std::condition_variable                      cond_;
+  std::deque<std::shared_ptr<ProgramBuildJob>> queue_;
+  bool                                         stop_ = false;
+  std::thread                                  thread_;
+};
+
+} // namespace gfxopengl
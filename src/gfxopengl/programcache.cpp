@@ -0,0 +1,165 @@
+#include "gfxopengl/programcache.h"
+#include "fmt/format.h"
+#include "gfxopengl/glcore45.h"
+#include "util/hash.h"
+#include "util/log.h"
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <vector>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace gfxopengl {
+
+namespace {
+constexpr char     PROGRAM_BINARY_MAGIC[4] = {'R', 'G', 'P', 'B'};
+constexpr uint32_t PROGRAM_BINARY_VERSION = 1;
+
+struct ProgramBinaryHeader {
+  char     magic[4];
+  uint32_t version;
+  uint64_t sourceHash;
+  uint64_t driverHash;
+  uint32_t binaryFormat;
+  uint32_t length;
+};
+} // namespace
+
+static long currentProcessId() {
+#ifdef _WIN32
+  return (long)_getpid();
+#else
+  return (long)getpid();
+#endif
+}
+
+static uint64_t hashDriverString(uint64_t h, gl::GLenum name) {
+  auto str = (const char *)gl::GetString(name);
+  if (str) {
+    h = util::fnv1a64(str, std::strlen(str), h);
+  }
+  // separator, so that ("ab", "c") and ("a", "bc") differ
+  const char zero = 0;
+  return util::fnv1a64(&zero, 1, h);
+}
+
+ProgramBinaryCache::ProgramBinaryCache(util::path directory)
+    : directory_{std::move(directory)} {
+  gl::GLint formatCount = 0;
+  gl::GetIntegerv(gl::NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+  if (formatCount == 0) {
+    util::log("program binary cache: no binary format supported by the "
+              "driver, cache disabled");
+    return;
+  }
+
+  uint64_t h = util::FNV1A64_OFFSET_BASIS;
+  h = hashDriverString(h, gl::VENDOR);
+  h = hashDriverString(h, gl::RENDERER);
+  h = hashDriverString(h, gl::VERSION);
+  driverHash_ = h;
+
+  std::error_code ec;
+  ghc::filesystem::create_directories(directory_, ec);
+  if (ec) {
+    util::log("program binary cache: could not create {}: {}",
+              directory_.string(), ec.message());
+    return;
+  }
+  supported_ = true;
+}
+
+util::path ProgramBinaryCache::entryPath(uint64_t sourceHash) const {
+  return directory_ / fmt::format("{:016x}.bin", sourceHash);
+}
+
+bool ProgramBinaryCache::load(gl::GLuint program, uint64_t sourceHash) {
+  if (!supported_) {
+    return false;
+  }
+
+  auto          path = entryPath(sourceHash);
+  std::ifstream file{path.string(), std::ios::binary};
+  if (!file) {
+    return false;
+  }
+
+  ProgramBinaryHeader header;
+  if (!file.read((char *)&header, sizeof(header)) ||
+      std::memcmp(header.magic, PROGRAM_BINARY_MAGIC, 4) != 0 ||
+      header.version != PROGRAM_BINARY_VERSION ||
+      header.sourceHash != sourceHash || header.driverHash != driverHash_) {
+    // stale or corrupted entry: it will be overwritten
+    return false;
+  }
+  std::vector<char> binary(header.length);
+  if (!file.read(binary.data(), binary.size())) {
+    return false;
+  }
+
+  gl::ProgramBinary(program, header.binaryFormat, binary.data(),
+                    (gl::GLsizei)binary.size());
+  gl::GLint status = gl::FALSE_;
+  gl::GetProgramiv(program, gl::LINK_STATUS, &status);
+  if (status != gl::TRUE_) {
+    // the driver may reject binaries even if the version strings match
+    util::log("program binary cache: binary {:016x} rejected by the driver",
+              sourceHash);
+    return false;
+  }
+  return true;
+}
+
+void ProgramBinaryCache::store(gl::GLuint program, uint64_t sourceHash) {
+  if (!supported_) {
+    return;
+  }
+
+  gl::GLint length = 0;
+  gl::GetProgramiv(program, gl::PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  std::vector<char> binary(length);
+  gl::GLenum        binaryFormat = 0;
+  gl::GetProgramBinary(program, length, &length, &binaryFormat,
+                       binary.data());
+
+  ProgramBinaryHeader header;
+  std::memcpy(header.magic, PROGRAM_BINARY_MAGIC, 4);
+  header.version = PROGRAM_BINARY_VERSION;
+  header.sourceHash = sourceHash;
+  header.driverHash = driverHash_;
+  header.binaryFormat = binaryFormat;
+  header.length = (uint32_t)length;
+
+  // write to a temporary file first, so that other instances (or threads)
+  // never see a partially written entry. Render farm nodes may share the
+  // cache directory, so the name combines the process id with a random
+  // number instead of relying on ids unique to a single machine.
+  thread_local std::mt19937_64 random{std::random_device{}()};
+  auto path = entryPath(sourceHash);
+  auto tmpPath = path;
+  tmpPath += fmt::format(".{}.{:016x}.tmp", currentProcessId(), random());
+  {
+    std::ofstream file{tmpPath.string(), std::ios::binary | std::ios::trunc};
+    file.write((const char *)&header, sizeof(header));
+    file.write(binary.data(), length);
+    if (!file) {
+      util::log("program binary cache: could not write {}", tmpPath.string());
+      return;
+    }
+  }
+  std::error_code ec;
+  ghc::filesystem::rename(tmpPath, path, ec);
+  if (ec) {
+    util::log("program binary cache: could not write {}: {}", path.string(),
+              ec.message());
+  }
+}
+
+} // namespace gfxopengl
@@ -0,0 +1,42 @@
+#pragma once
+#include "gfxopengl/glcore45types.h"
+#include "util/filesystem.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace gfxopengl {
+
+/// A persistent cache of linked program binaries (`glGetProgramBinary`).
+///
+/// Each entry is a file named after a hash of the program sources. Entries
+/// also record a hash of the vendor, renderer and version strings of the
+/// driver that produced them: binaries from another driver are ignored and
+/// overwritten.
+class ProgramBinaryCache {
+public:
+  /// Creates a cache storing binaries in the specified directory, which is
+  /// created if needed. Must be called with a current context.
+  explicit ProgramBinaryCache(util::path directory);
+
+  /// Returns false if the driver does not support any program binary format,
+  /// in which case nothing is loaded or stored.
+  bool supported() const { return supported_; }
+
+  /// Loads the binary of the program with the specified source hash into
+  /// `program`. Returns false if there is no valid entry for this driver, or
+  /// if the driver rejected the binary; the program must then be compiled.
+  bool load(gl::GLuint program, uint64_t sourceHash);
+
+  /// Stores the binary of a linked program. The program should be linked with
+  /// `PROGRAM_BINARY_RETRIEVABLE_HINT` set.
+  void store(gl::GLuint program, uint64_t sourceHash);
+
+private:
+  util::path entryPath(uint64_t sourceHash) const;
+
+  util::path directory_;
+  uint64_t   driverHash_ = 0;
+  bool       supported_ = false;
+};
+
+} // namespace gfxopengl
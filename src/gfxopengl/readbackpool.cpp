@@ -0,0 +1,85 @@
+#include "gfxopengl/readbackpool.h"
+#include "gfxopengl/buffer.h"
+#include "gfxopengl/glcore45.h"
+#include <stdexcept>
+
+namespace gfxopengl {
+
+// wait timeout for a single ClientWaitSync, in nanoseconds
+constexpr uint64_t READBACK_WAIT_TIMEOUT_NS = 1000000;
+
+static void deleteReadbackBuffer(Readback &r) {
+  gl::UnmapNamedBuffer(r.buffer);
+  gl::DeleteBuffers(1, &r.buffer);
+}
+
+ReadbackPool::ReadbackPool(size_t maxFreeBytes) : maxFreeBytes_{maxFreeBytes} {}
+
+ReadbackPool::~ReadbackPool() {
+  for (auto &&r : free_) {
+    deleteReadbackBuffer(*r);
+  }
+}
+
+Readback *ReadbackPool::acquire(size_t size) {
+  // smallest free buffer that fits
+  auto best = free_.end();
+  for (auto it = free_.begin(); it != free_.end(); ++it) {
+    if ((*it)->capacity >= size &&
+        (best == free_.end() || (*it)->capacity < (*best)->capacity)) {
+      best = it;
+    }
+  }
+  std::unique_ptr<Readback> r;
+  if (best != free_.end()) {
+    r = std::move(*best);
+    free_.erase(best);
+    freeBytes_ -= r->capacity;
+  } else {
+    r = std::make_unique<Readback>();
+    const gl::GLenum flags =
+        gl::MAP_READ_BIT | gl::MAP_PERSISTENT_BIT | gl::MAP_COHERENT_BIT;
+    r->buffer = createBuffer(size, flags, nullptr);
+    r->ptr = (const char *)gl::MapNamedBufferRange(r->buffer, 0, size, flags);
+    if (!r->ptr) {
+      gl::DeleteBuffers(1, &r->buffer);
+      throw std::runtime_error{"could not map readback buffer"};
+    }
+    r->capacity = size;
+  }
+  r->size = size;
+  r->fence = 0;
+  return r.release();
+}
+
+void ReadbackPool::submit(Readback &readback) {
+  readback.fence = nextFenceValue_;
+  timeline_.signal(nextFenceValue_++);
+  readBytes_ += readback.size;
+}
+
+bool ReadbackPool::ready(Readback &readback, bool wait) {
+  if (timeline_.clientSync(readback.fence, 0)) {
+    return true;
+  }
+  if (!wait) {
+    return false;
+  }
+  stallCount_++;
+  while (!timeline_.clientSync(readback.fence, READBACK_WAIT_TIMEOUT_NS)) {
+  }
+  return true;
+}
+
+void ReadbackPool::release(Readback *readback) {
+  free_.push_back(std::unique_ptr<Readback>{readback});
+  freeBytes_ += readback->capacity;
+  // the least recently used buffers go first
+  while (freeBytes_ > maxFreeBytes_ && !free_.empty()) {
+    freeBytes_ -= free_.front()->capacity;
+    deleteReadbackBuffer(*free_.front());
+    free_.pop_front();
+  }
+}
+
+} // namespace gfxopengl
@@ -0,0 +1,71 @@
+#pragma once
+#include "gfxopengl/glcore45types.h"
+#include "gfxopengl/sync.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+namespace gfxopengl {
+
+/// A pending copy of GPU data to a pixel pack buffer. See `ReadbackPool`.
+struct Readback {
+  /// The pixel pack buffer receiving the data, and its persistent mapping.
+  gl::GLuint  buffer = 0;
+  const char *ptr = nullptr;
+  size_t      capacity = 0;
+  /// Size of the data, in bytes.
+  size_t size = 0;
+  /// Timeline value reached once the copy has completed.
+  uint64_t fence = 0;
+};
+
+/// A pool of persistently mapped, coherent pixel pack buffers receiving
+/// asynchronous readbacks of images.
+///
+/// The copy to a buffer is followed by a fence in the command stream: the
+/// data can be read directly from the mapping once the fence is signalled,
+/// usually a few frames later, so the CPU does not wait for the GPU unless
+/// it asks for data that is not ready. Buffers of released readbacks go back
+/// to the pool, so that a steady stream of readbacks of the same size (e.g.
+/// one per frame) cycles through the same buffers.
+class ReadbackPool {
+public:
+  /// Keeps at most `maxFreeBytes` of unused buffers for reuse.
+  explicit ReadbackPool(size_t maxFreeBytes);
+  ~ReadbackPool();
+
+  ReadbackPool(const ReadbackPool &) = delete;
+  ReadbackPool &operator=(const ReadbackPool &) = delete;
+
+  /// Returns a readback of `size` bytes whose buffer can receive the data.
+  /// Call `submit()` once the copy commands have been issued.
+  Readback *acquire(size_t size);
+  /// Inserts the fence signalled once the commands writing to the buffer of
+  /// the readback have completed.
+  void submit(Readback &readback);
+  /// Returns whether the data of the readback is available. If `wait` is
+  /// true, blocks until it is.
+  bool ready(Readback &readback, bool wait);
+  /// Returns the buffer of the readback to the pool. The readback may still
+  /// be pending: a buffer is only written by commands issued after the
+  /// previous ones.
+  void release(Readback *readback);
+
+  /// Number of bytes read back since creation.
+  uint64_t readBytes() const { return readBytes_; }
+  /// Number of times data was requested before the GPU had written it.
+  uint64_t stallCount() const { return stallCount_; }
+
+private:
+  // unused readbacks, least recently released first
+  std::deque<std::unique_ptr<Readback>> free_;
+  size_t                                freeBytes_ = 0;
+  size_t                                maxFreeBytes_;
+  SyncTimeline                          timeline_;
+  uint64_t                              nextFenceValue_ = 1;
+  uint64_t                              readBytes_ = 0;
+  uint64_t                              stallCount_ = 0;
+};
+
+} // namespace gfxopengl
@@ -80,15 +80,16 @@ util::log("{}", log);
 }
 */
 
-gl::GLuint createShader(gl::GLenum stage, util::StringRef source,
-                        std::string &log) {
-
+gl::GLuint beginCompileShader(gl::GLenum stage, util::StringRef source) {
   gl::GLuint obj = gl::CreateShader(stage);
   std::string src = source.to_string();
   const char *shaderSources[1] = {src.c_str()};
   gl::ShaderSource(obj, 1, shaderSources, NULL);
   gl::CompileShader(obj);
+  return obj;
+}
 
+bool getShaderCompileStatus(gl::GLuint obj, std::string &log) {
   // get log
   gl::GLint logsize = 0;
   gl::GetShaderiv(obj, gl::INFO_LOG_LENGTH, &logsize);
@@ -99,20 +100,23 @@ gl::GLuint createShader(gl::GLenum stage, util::StringRef source,
     delete[] logbuf;
   }
 
-  // if failure, delete and return 0
   gl::GLint status = gl::TRUE_;
   gl::GetShaderiv(obj, gl::COMPILE_STATUS, &status);
-  if (status != gl::TRUE_) {
+  return status == gl::TRUE_;
+}
+
+gl::GLuint createShader(gl::GLenum stage, util::StringRef source,
+                        std::string &log) {
+  gl::GLuint obj = beginCompileShader(stage, source);
+  // if failure, delete and return 0
+  if (!getShaderCompileStatus(obj, log)) {
     gl::DeleteShader(obj);
     return 0;
   }
-
   return obj;
 }
 
-bool linkProgram(gl::GLuint program, std::string &log) {
-  gl::LinkProgram(program);
-
+bool getProgramLinkStatus(gl::GLuint program, std::string &log) {
   gl::GLint logsize = 0;
   gl::GetProgramiv(program, gl::INFO_LOG_LENGTH, &logsize);
   if (logsize != 0) {
@@ -127,4 +131,9 @@ bool linkProgram(gl::GLuint program, std::string &log) {
   return status == gl::TRUE_;
 }
 
+bool linkProgram(gl::GLuint program, std::string &log) {
+  gl::LinkProgram(program);
+  return getProgramLinkStatus(program, log);
+}
+
 } // namespace gfxopengl
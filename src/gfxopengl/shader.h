@@ -13,4 +13,15 @@ gl::GLuint createShader(gl::GLenum stage, util::StringRef source,
 
 bool linkProgram(gl::GLuint program, std::string &log);
 
+/// Creates a shader object and starts compiling it. Unlike `createShader`, does
+/// not wait for the result: with `KHR_parallel_shader_compile`, compilation
+/// then happens in the background.
+gl::GLuint beginCompileShader(gl::GLenum stage, util::StringRef source);
+
+/// Waits for the compilation of a shader and returns whether it succeeded.
+bool getShaderCompileStatus(gl::GLuint shader, std::string &log);
+
+/// Waits for the link of a program and returns whether it succeeded.
+bool getProgramLinkStatus(gl::GLuint program, std::string &log);
+
 } // namespace gfxopengl
\ No newline at end of file
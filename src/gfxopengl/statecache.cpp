@@ -3,7 +3,6 @@
 #include "util/panic.h"
 
 namespace gfxopengl {
-namespace {
 
 gl::GLenum primitiveTopologyToGLenum(gfx::PrimitiveTopology topo) {
   switch (topo) {
@@ -17,6 +16,8 @@ gl::GLenum primitiveTopologyToGLenum(gfx::PrimitiveTopology topo) {
   UT_UNREACHABLE;
 }
 
+namespace {
+
 gl::GLenum stencilOpToGLenum(gfx::StencilOp op) {
   switch (op) {
   case gfx::StencilOp::Keep:
@@ -123,20 +124,260 @@ gl::GLenum blendOpToGLenum(gfx::BlendOp op) {
 
 } // namespace
 
-void StateCache::setAllBlendStates(gfx::ColorBlendAttachmentState blend) {
-  for (int i = 0; i < MAX_VIEWPORTS; ++i) {
-    updateCached(colorBlend[i].known, colorBlend[i].state, blend, [&]() {
+static void enableCap(gl::GLenum cap, bool enabled) {
+  if (enabled) {
+    gl::Enable(cap);
+  } else {
+    gl::Disable(cap);
+  }
+}
+
+void StateCache::invalidate() {
+  auto savedStats = stats;
+  *this = StateCache{};
+  stats = savedStats;
+}
+
+void StateCache::forgetBuffer(gl::GLuint buffer) {
+  for (auto &&b : vertexBuffers) {
+    if (b.known && b.buffer == buffer) {
+      b.known = false;
+    }
+  }
+  for (auto &&b : uniformBuffers) {
+    if (b.known && b.buffer == buffer) {
+      b.known = false;
+    }
+  }
+  for (auto &&b : storageBuffers) {
+    if (b.known && b.buffer == buffer) {
+      b.known = false;
+    }
+  }
+}
+
+void StateCache::forgetFramebuffer(gl::GLuint fbo) {
+  if (knowFramebuffer && framebuffer == fbo) {
+    knowFramebuffer = false;
+  }
+}
+
+void StateCache::forgetTexture(gl::GLuint texture) {
+  for (auto &&t : textureUnits) {
+    if (t.known && t.texture == texture) {
+      t.known = false;
+    }
+  }
+  for (auto &&t : imageUnits) {
+    if (t.known && t.texture == texture) {
+      t.known = false;
+    }
+  }
+}
+
+void StateCache::setProgram(gl::GLuint newProgram) {
+  update(knowProgram, program, newProgram,
+         [&]() { gl::UseProgram(newProgram); });
+}
+
+void StateCache::setVertexArray(gl::GLuint vao) {
+  update(knowVertexArray, vertexArray, vao,
+         [&]() { gl::BindVertexArray(vao); });
+}
+
+void StateCache::setDrawFramebuffer(gl::GLuint drawFramebuffer) {
+  update(knowFramebuffer, framebuffer, drawFramebuffer, [&]() {
+    gl::BindFramebuffer(gl::DRAW_FRAMEBUFFER, drawFramebuffer);
+  });
+}
+
+void StateCache::setVertexBuffers(int count, const gl::GLuint *buffers,
+                                  const gl::GLintptr *offsets,
+                                  const gl::GLsizei *strides) {
+  for (int i = 0; i < count && i < MAX_VERTEX_BUFFERS; ++i) {
+    BufferBindingCache b;
+    b.buffer = buffers[i];
+    b.offset = offsets[i];
+    b.sizeOrStride = strides[i];
+    update(vertexBuffers[i].known, vertexBuffers[i], b, [&]() {
+      gl::BindVertexBuffer(i, buffers[i], offsets[i], strides[i]);
+    });
+  }
+}
+
+void StateCache::setUniformBuffers(int count, const gl::GLuint *buffers,
+                                   const gl::GLintptr *offsets,
+                                   const gl::GLsizeiptr *sizes) {
+  for (int i = 0; i < count && i < MAX_UNIFORM_BUFFERS; ++i) {
+    if (!buffers[i]) {
+      // unused binding
+      continue;
+    }
+    BufferBindingCache b;
+    b.buffer = buffers[i];
+    b.offset = offsets[i];
+    b.sizeOrStride = sizes[i];
+    update(uniformBuffers[i].known, uniformBuffers[i], b, [&]() {
+      gl::BindBufferRange(gl::UNIFORM_BUFFER, i, buffers[i], offsets[i],
+                          sizes[i]);
+    });
+  }
+}
+
+void StateCache::setTextures(int count, const gl::GLuint *textures,
+                             const gl::GLuint *samplers) {
+  for (int i = 0; i < count && i < MAX_TEXTURE_UNITS; ++i) {
+    if (!textures[i]) {
+      // unused binding
+      continue;
+    }
+    TextureBindingCache t;
+    t.texture = textures[i];
+    t.sampler = samplers[i];
+    update(textureUnits[i].known, textureUnits[i], t, [&]() {
+      gl::BindTextureUnit(i, textures[i]);
+      gl::BindSampler(i, samplers[i]);
+    });
+  }
+}
+
+void StateCache::setStorageBuffers(int count, const gl::GLuint *buffers,
+                                   const gl::GLintptr *offsets,
+                                   const gl::GLsizeiptr *sizes) {
+  for (int i = 0; i < count && i < MAX_STORAGE_BUFFERS; ++i) {
+    if (!buffers[i]) {
+      // unused binding
+      continue;
+    }
+    BufferBindingCache b;
+    b.buffer = buffers[i];
+    b.offset = offsets[i];
+    b.sizeOrStride = sizes[i];
+    update(storageBuffers[i].known, storageBuffers[i], b, [&]() {
+      gl::BindBufferRange(gl::SHADER_STORAGE_BUFFER, i, buffers[i], offsets[i],
+                          sizes[i]);
+    });
+  }
+}
+
+void StateCache::setImages(int count, const gl::GLuint *textures,
+                           const gl::GLint *levels, const gl::GLenum *formats) {
+  for (int i = 0; i < count && i < MAX_IMAGE_UNITS; ++i) {
+    if (!textures[i]) {
+      // unused binding
+      continue;
+    }
+    ImageBindingCache t;
+    t.texture = textures[i];
+    t.level = levels[i];
+    t.format = formats[i];
+    update(imageUnits[i].known, imageUnits[i], t, [&]() {
+      // layered, so that all layers of arrays and 3D textures are accessible
+      gl::BindImageTexture(i, textures[i], levels[i], gl::TRUE_, 0,
+                           gl::READ_WRITE, formats[i]);
+    });
+  }
+}
+
+void StateCache::setViewport(int index, int x, int y, int width,
+                             int height) {
+  std::array<int, 4> rect = {x, y, width, height};
+  update(viewports[index].known, viewports[index].rect, rect, [&]() {
+    gl::ViewportIndexedf(index, (float)x, (float)y, (float)width,
+                         (float)height);
+  });
+}
+
+void StateCache::setScissorTestEnabled(bool enabled) {
+  update(knowScissorTestEnabled, scissorTestEnabled, enabled,
+         [&]() { enableCap(gl::SCISSOR_TEST, enabled); });
+}
+
+void StateCache::setScissor(int index, int x, int y, int width, int height) {
+  std::array<int, 4> rect = {x, y, width, height};
+  update(scissors[index].known, scissors[index].rect, rect,
+         [&]() { gl::ScissorIndexed(index, x, y, width, height); });
+}
+
+void StateCache::setRasterizationState(const gfx::RasterizationState &rs) {
+  update(knowPolygonMode, polygonMode, rs.polygonMode, [&]() {
+    gl::PolygonMode(gl::FRONT_AND_BACK,
+                    rs.polygonMode == gfx::PolygonMode::Fill ? gl::FILL
+                                                             : gl::LINE);
+  });
+  update(knowCullMode, cullMode, rs.cullMode, [&]() {
+    switch (rs.cullMode) {
+    case gfx::CullModeFlags::None:
+      gl::Disable(gl::CULL_FACE);
+      return;
+    case gfx::CullModeFlags::Front:
+      gl::CullFace(gl::FRONT);
+      break;
+    case gfx::CullModeFlags::Back:
+      gl::CullFace(gl::BACK);
+      break;
+    case gfx::CullModeFlags::FrontAndBack:
+      gl::CullFace(gl::FRONT_AND_BACK);
+      break;
+    }
+    gl::Enable(gl::CULL_FACE);
+  });
+  update(knowFrontFace, frontFace, rs.frontFace, [&]() {
+    gl::FrontFace(rs.frontFace == gfx::FrontFace::CounterClockwise ? gl::CCW
+                                                                   : gl::CW);
+  });
+  update(knowDepthClampEnabled, depthClampEnabled, rs.depthClampEnable,
+         [&]() { enableCap(gl::DEPTH_CLAMP, rs.depthClampEnable); });
+}
+
+void StateCache::setDepthTestEnabled(bool enabled) {
+  update(knowDepthTestEnabled, depthTestEnabled, enabled,
+         [&]() { enableCap(gl::DEPTH_TEST, enabled); });
+}
+
+void StateCache::setDepthStencilState(const gfx::DepthStencilState &ds) {
+  setDepthTestEnabled(ds.depthTestEnable);
+  if (ds.depthTestEnable) {
+    update(knowDepthCompareOp, depthCompareOp, ds.depthCompareOp,
+           [&]() { gl::DepthFunc(compareOpToGLenum(ds.depthCompareOp)); });
+  }
+  update(knowDepthWriteEnabled, depthWriteEnabled, ds.depthWriteEnable,
+         [&]() { gl::DepthMask(ds.depthWriteEnable); });
+  update(knowStencilTestEnabled, stencilTestEnabled, ds.stencilTestEnable,
+         [&]() { enableCap(gl::STENCIL_TEST, ds.stencilTestEnable); });
+  if (ds.stencilTestEnable) {
+    auto applyStencilOps = [](gl::GLenum face, const gfx::StencilOpState &s) {
+      gl::StencilOpSeparate(face, stencilOpToGLenum(s.fail),
+                            stencilOpToGLenum(s.depthFail),
+                            stencilOpToGLenum(s.pass));
+      gl::StencilFuncSeparate(face, compareOpToGLenum(s.compare), s.reference,
+                              s.compareMask);
+      gl::StencilMaskSeparate(face, s.writeMask);
+    };
+    update(knowStencilFront, stencilFront, ds.stencilFrontOps,
+           [&]() { applyStencilOps(gl::FRONT, ds.stencilFrontOps); });
+    update(knowStencilBack, stencilBack, ds.stencilBackOps,
+           [&]() { applyStencilOps(gl::BACK, ds.stencilBackOps); });
+  }
+}
+
+void StateCache::setAllBlendStates(
+    const gfx::ColorBlendAttachmentState &blend) {
+  for (int i = 0; i < MAX_COLOR_ATTACHMENTS; ++i) {
+    update(colorBlend[i].known, colorBlend[i].state, blend, [&]() {
+      if (!blend.enabled) {
+        gl::Disablei(gl::BLEND, i);
+        return;
+      }
       gl::Enablei(gl::BLEND, i);
-      gl::BlendEquationSeparatei(i,
-                                 blendOpToGLenum(colorBlend[i].state.colorOp),
-                                 blendOpToGLenum(colorBlend[i].state.alphaOp));
-      gl::BlendFuncSeparatei(i,
-                             blendFactorToGLenum(colorBlend[i].state.srcColor),
-                             blendFactorToGLenum(colorBlend[i].state.dstColor),
-                             blendFactorToGLenum(colorBlend[i].state.srcAlpha),
-                             blendFactorToGLenum(colorBlend[i].state.dstAlpha));
+      gl::BlendEquationSeparatei(i, blendOpToGLenum(blend.colorOp),
+                                 blendOpToGLenum(blend.alphaOp));
+      gl::BlendFuncSeparatei(i, blendFactorToGLenum(blend.srcColor),
+                             blendFactorToGLenum(blend.dstColor),
+                             blendFactorToGLenum(blend.srcAlpha),
+                             blendFactorToGLenum(blend.dstAlpha));
     });
   }
 }
 
-} // namespace gfxopengl
\ No newline at end of file
+} // namespace gfxopengl
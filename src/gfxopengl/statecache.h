@@ -2,10 +2,18 @@
 #include "gfx/pipeline.h"
 #include "glcore45types.h"
 #include <array>
+#include <cstddef>
+#include <cstdint>
 
 namespace gfxopengl {
 
 constexpr int MAX_VIEWPORTS = 32;
+constexpr int MAX_COLOR_ATTACHMENTS = 8;
+constexpr int MAX_VERTEX_BUFFERS = 16;
+constexpr int MAX_UNIFORM_BUFFERS = 16;
+constexpr int MAX_TEXTURE_UNITS = 16;
+constexpr int MAX_STORAGE_BUFFERS = 8;
+constexpr int MAX_IMAGE_UNITS = 8;
 
 struct ColorBlendCache {
   bool known = false;
@@ -14,46 +22,91 @@ struct ColorBlendCache {
 
 struct ViewportCache {
   bool known = false;
-  gfx::ViewportState state;
+  std::array<int, 4> rect;
 };
 
-struct ScissorCache {
+struct BufferBindingCache {
   bool known = false;
-  gfx::ScissorState state;
+  gl::GLuint buffer;
+  gl::GLintptr offset;
+  gl::GLsizeiptr sizeOrStride;
+
+  bool operator!=(const BufferBindingCache &rhs) const {
+    return buffer != rhs.buffer || offset != rhs.offset ||
+           sizeOrStride != rhs.sizeOrStride;
+  }
+};
+
+struct TextureBindingCache {
+  bool known = false;
+  gl::GLuint texture;
+  gl::GLuint sampler;
+
+  bool operator!=(const TextureBindingCache &rhs) const {
+    return texture != rhs.texture || sampler != rhs.sampler;
+  }
+};
+
+struct ImageBindingCache {
+  bool known = false;
+  gl::GLuint texture;
+  gl::GLint level;
+  gl::GLenum format;
+
+  bool operator!=(const ImageBindingCache &rhs) const {
+    return texture != rhs.texture || level != rhs.level ||
+           format != rhs.format;
+  }
+};
+
+/// Returns the GL primitive type corresponding to a topology.
+gl::GLenum primitiveTopologyToGLenum(gfx::PrimitiveTopology topo);
+
+/// Number of state-changing GL calls made or avoided by the state cache.
+struct StateCacheStats {
+  uint64_t issued = 0;
+  uint64_t skipped = 0;
 };
 
 namespace {
 template <typename T, typename Callback>
-void updateCached(bool &known, T &oldVal, T newVal, Callback callback) {
+bool updateCached(bool &known, T &oldVal, const T &newVal, Callback callback) {
   if (!known || oldVal != newVal) {
-    callback();
     oldVal = newVal;
     known = true;
+    callback();
+    return true;
   }
+  return false;
 }
 } // namespace
 
 // We keep a cache of OpenGL states set in the pipeline so that we don't make
 // unnecessary calls.
+//
+// The cache assumes that it sees all state changes: call invalidate() after
+// any GL call that bypasses it (including calls made by other libraries
+// sharing the context).
 struct StateCache {
-  size_t maxDrawBuffers;
-  size_t maxColorAttachments;
-  size_t maxViewports;
-  bool cullEnable;
-  bool cullMode;
+  bool knowPolygonMode = false;
   gfx::PolygonMode polygonMode;
-  // front_face: Option<GLenum>,
-  bool knowProgram;
+  bool knowCullMode = false;
+  gfx::CullModeFlags cullMode;
+  bool knowFrontFace = false;
+  gfx::FrontFace frontFace;
+  bool knowDepthClampEnabled = false;
+  bool depthClampEnabled;
+  bool knowProgram = false;
   gl::GLuint program;
-  bool knowVertexArray;
+  bool knowVertexArray = false;
   gl::GLuint vertexArray;
-  bool knowFramebuffer;
+  bool knowFramebuffer = false;
   gl::GLuint framebuffer;
   bool knowStencilTestEnabled = false;
   bool stencilTestEnabled;
-  bool knowStencilFront;
+  bool knowStencilFront = false;
   gfx::StencilOpState stencilFront;
-  bool knowStencilBack;
+  bool knowStencilBack = false;
   gfx::StencilOpState stencilBack;
   bool knowDepthTestEnabled = false;
   bool depthTestEnabled;
@@ -61,20 +114,63 @@ struct StateCache {
   bool depthWriteEnabled;
   bool knowDepthCompareOp = false;
   gfx::CompareOp depthCompareOp;
-  std::array<ColorBlendCache, MAX_VIEWPORTS> colorBlend;
+  std::array<ColorBlendCache, MAX_COLOR_ATTACHMENTS> colorBlend;
   std::array<ViewportCache, MAX_VIEWPORTS> viewports;
-  std::array<ScissorCache, MAX_VIEWPORTS> scissors;
-  bool knowIndexBuffer = false;
-  gl::GLuint indexBufferObj;
-  size_t indexBufferSize;
-  size_t indexBufferOffset;
-  gl::GLenum indexBufferType;
+  bool knowScissorTestEnabled = false;
+  bool scissorTestEnabled;
+  std::array<ViewportCache, MAX_VIEWPORTS> scissors;
+  std::array<BufferBindingCache, MAX_VERTEX_BUFFERS> vertexBuffers;
+  std::array<BufferBindingCache, MAX_UNIFORM_BUFFERS> uniformBuffers;
+  std::array<TextureBindingCache, MAX_TEXTURE_UNITS> textureUnits;
+  std::array<BufferBindingCache, MAX_STORAGE_BUFFERS> storageBuffers;
+  std::array<ImageBindingCache, MAX_IMAGE_UNITS> imageUnits;
+  StateCacheStats stats;
+
+  /// Forgets all cached states.
+  void invalidate();
+  /// Forgets the bindings of an object that is about to be deleted (GL
+  /// unbinds deleted objects from the current context).
+  void forgetBuffer(gl::GLuint buffer);
+  void forgetFramebuffer(gl::GLuint framebuffer);
+  void forgetTexture(gl::GLuint texture);
 
   void setProgram(gl::GLuint program);
   void setVertexArray(gl::GLuint vao);
   void setDrawFramebuffer(gl::GLuint drawFramebuffer);
-  void setAllBlendStates(gfx::ColorBlendAttachmentState blend);
+  void setVertexBuffers(int count, const gl::GLuint *buffers,
+                        const gl::GLintptr *offsets,
+                        const gl::GLsizei *strides);
+  void setUniformBuffers(int count, const gl::GLuint *buffers,
+                         const gl::GLintptr *offsets,
+                         const gl::GLsizeiptr *sizes);
+  /// Binds textures and samplers to texture units `0..count-1`. Units whose
+  /// texture is 0 are left untouched.
+  void setTextures(int count, const gl::GLuint *textures,
+                   const gl::GLuint *samplers);
+  void setStorageBuffers(int count, const gl::GLuint *buffers,
+                         const gl::GLintptr *offsets,
+                         const gl::GLsizeiptr *sizes);
+  /// Binds levels of textures to image units `0..count-1` for read/write
+  /// access. Units whose texture is 0 are left untouched.
+  void setImages(int count, const gl::GLuint *textures, const gl::GLint *levels,
+                 const gl::GLenum *formats);
+  void setViewport(int index, int x, int y, int width, int height);
+  void setScissorTestEnabled(bool enabled);
+  void setScissor(int index, int x, int y, int width, int height);
+  void setRasterizationState(const gfx::RasterizationState &rs);
+  void setDepthTestEnabled(bool enabled);
+  void setDepthStencilState(const gfx::DepthStencilState &ds);
+  void setAllBlendStates(const gfx::ColorBlendAttachmentState &blend);
 
+private:
+  template <typename T, typename Callback>
+  void update(bool &known, T &oldVal, const T &newVal, Callback callback) {
+    if (updateCached(known, oldVal, newVal, callback)) {
+      stats.issued++;
+    } else {
+      stats.skipped++;
+    }
+  }
 };
 
-} // namespace gfxopengl
\ No newline at end of file
+} // namespace gfxopengl
@@ -61,7 +61,11 @@ bool SyncTimeline::clientSync(uint64_t value, uint64_t timeoutNs) {
 }
 
 uint64_t SyncTimeline::value() {
-  clientSync(UINT64_MAX, 0);
+  // poll the pending sync points (waiting for UINT64_MAX would report a
+  // deadlock once they have all been reached)
+  if (!d_->syncPoints.empty()) {
+    clientSync(d_->syncPoints.back().value, 0);
+  }
   return d_->currentValue;
 }
 
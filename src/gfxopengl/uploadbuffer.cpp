@@ -0,0 +1,72 @@
+#include "gfxopengl/uploadbuffer.h"
+#include "gfxopengl/buffer.h"
+#include "gfxopengl/glcore45.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace gfxopengl {
+
+// wait timeout for a single ClientWaitSync, in nanoseconds
+constexpr uint64_t SEGMENT_WAIT_TIMEOUT_NS = 1000000;
+
+static size_t alignUp(size_t offset, size_t align) {
+  return (offset + align - 1) & ~(align - 1);
+}
+
+UploadBuffer::UploadBuffer(size_t size, size_t alignment, int segmentCount)
+    : alignment_{alignment}, segmentFences_(segmentCount, 0) {
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    throw std::logic_error{"upload buffer alignment must be a power of two"};
+  }
+  // segments start on an aligned offset
+  segmentSize_ = (size / segmentCount) & ~(alignment - 1);
+  size_ = segmentSize_ * segmentCount;
+
+  const gl::GLenum flags =
+      gl::MAP_WRITE_BIT | gl::MAP_PERSISTENT_BIT | gl::MAP_COHERENT_BIT;
+  obj_ = createBuffer(size_, flags, nullptr);
+  ptr_ = (char *)gl::MapNamedBufferRange(obj_, 0, size_, flags);
+  if (!ptr_) {
+    gl::DeleteBuffers(1, &obj_);
+    throw std::runtime_error{"could not map upload buffer"};
+  }
+}
+
+UploadBuffer::~UploadBuffer() {
+  gl::UnmapNamedBuffer(obj_);
+  gl::DeleteBuffers(1, &obj_);
+}
+
+size_t UploadBuffer::write(const void *data, size_t len) {
+  if (len > segmentSize_) {
+    throw std::logic_error{"data too large for the upload buffer"};
+  }
+  size_t offset = alignUp(current_, alignment_);
+  if (offset + len > (segment_ + 1) * segmentSize_) {
+    nextSegment();
+    offset = segment_ * segmentSize_;
+  }
+  std::memcpy(ptr_ + offset, data, len);
+  current_ = offset + len;
+  writtenBytes_ += len;
+  return offset;
+}
+
+void UploadBuffer::nextSegment() {
+  // the current segment is in use by all commands issued until now
+  segmentFences_[segment_] = nextFenceValue_;
+  timeline_.signal(nextFenceValue_++);
+
+  segment_ = (segment_ + 1) % (int)segmentFences_.size();
+  current_ = segment_ * segmentSize_;
+
+  // wait for the GPU to finish reading the previous contents of the segment
+  auto fence = segmentFences_[segment_];
+  if (!timeline_.clientSync(fence, 0)) {
+    stallCount_++;
+    while (!timeline_.clientSync(fence, SEGMENT_WAIT_TIMEOUT_NS)) {
+    }
+  }
+}
+
+} // namespace gfxopengl
@@ -1,74 +1,59 @@
 #pragma once
-#include "gfxopengl/buffer.h"
-#include "gfxopengl/glcore45.h"
-#include <cassert>
-#include <cstring>
+#include "gfxopengl/glcore45types.h"
+#include "gfxopengl/sync.h"
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 namespace gfxopengl {
-	/*
-class MappedBuffer {
+
+/// A persistently mapped, coherent buffer used as a ring of transient
+/// allocations (e.g. uniform data that changes on every draw).
+///
+/// The buffer is split in segments. Each time the allocator leaves a segment,
+/// a fence is inserted in the command stream; before writing again to a
+/// segment, the allocator waits for the fence, so that data still read by the
+/// GPU is never overwritten. Writing data is a plain memcpy.
+class UploadBuffer {
 public:
-  MappedBuffer(size_t size)
-      : buffer_{size, gl::MAP_WRITE_BIT | gl::MAP_PERSISTENT_BIT |
-                          gl::MAP_COHERENT_BIT} {
+  /// Creates a buffer of `size` bytes. Allocations are aligned to
+  /// `alignment`, which must be a power of two.
+  UploadBuffer(size_t size, size_t alignment, int segmentCount = 4);
+  ~UploadBuffer();
 
-    ptr_ = gl::MapNamedBufferRange(
-        buffer_.object(), 0, size,
-        gl::MAP_UNSYNCHRONIZED_BIT | gl::MAP_WRITE_BIT |
-            gl::MAP_PERSISTENT_BIT | gl::MAP_COHERENT_BIT);
-  }
+  UploadBuffer(const UploadBuffer &) = delete;
+  UploadBuffer &operator=(const UploadBuffer &) = delete;
 
-  gl::GLuint object() const { return buffer_.object(); }
+  /// Copies data into the buffer and returns the offset of the copy. Throws
+  /// `std::logic_error` if `len` is larger than a segment.
+  size_t write(const void *data, size_t len);
 
-  size_t size() const { return buffer_.size(); }
+  gl::GLuint object() const { return obj_; }
+  size_t     size() const { return size_; }
+  /// Largest amount of data that can be written at once.
+  size_t segmentSize() const { return segmentSize_; }
 
-  void writeAt(size_t offset, const void *data, size_t len) {
-    assert(offset + len < size_);
-    std::memcpy((char *)ptr_ + offset, data, len);
-  }
+  /// Number of bytes written since creation.
+  uint64_t writtenBytes() const { return writtenBytes_; }
+  /// Number of times a write had to wait for the GPU to release a segment.
+  uint64_t stallCount() const { return stallCount_; }
 
 private:
-  Buffer buffer_;
-  void *ptr_;
+  void nextSegment();
+
+  gl::GLuint            obj_ = 0;
+  char *                ptr_ = nullptr;
+  size_t                size_;
+  size_t                alignment_;
+  size_t                segmentSize_;
+  int                   segment_ = 0;
+  size_t                current_ = 0;
+  // timeline value to wait for before writing to each segment
+  std::vector<uint64_t> segmentFences_;
+  uint64_t              nextFenceValue_ = 1;
+  SyncTimeline          timeline_;
+  uint64_t              writtenBytes_ = 0;
+  uint64_t              stallCount_ = 0;
 };
 
-size_t alignOffset(size_t size, size_t align, size_t start, size_t end) {
-  // assert(align.is_power_of_two(), "alignment must be a power of two");
-  auto off = start & (align - 1);
-  if (off > 0) {
-    off = align - off;
-  }
-  if (start + off + size > end) {
-	  return -1;
-  }
-  return start + off;
-}
-
-class UploadBufferAdapter {
-public:
-  /// Borrows the mapped buffer, so it must not move or be deleted.
-  UploadBufferAdapter(MappedBuffer &buffer, size_t regionOffset,
-                      size_t regionSize)
-      : buffer_{buffer}, regionStartOffset_{regionOffset},
-        regionSize_{regionSize}, regionCurrentOffset_{0} {}
-
-  gl::GLuint object() const { buffer_.object(); }
-
-  size_t write(const void *data, size_t len, size_t align) {
-    auto offset = alignOffset(len, align, regionCurrentOffset_,
-                              regionStartOffset_ + regionSize_);
-    buffer_.writeAt(offset, data, len);
-    regionCurrentOffset_ = offset + len;
-
-    return offset;
-  }
-
-private:
-  MappedBuffer &buffer_;
-  size_t regionStartOffset_;
-  size_t regionSize_;
-  size_t regionCurrentOffset_;
-};*/
-
-} // namespace gfxopengl
\ No newline at end of file
+} // namespace gfxopengl
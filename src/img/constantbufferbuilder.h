@@ -16,6 +16,8 @@ public:
   size_t size() const {
 	  return buf_.size();
   }
+  const void *data() const { return buf_.data(); }
+  void clear() { buf_.clear(); }
   // TODO vectors and matrices
 
   gfx::Buffer create(gfx::GraphicsBackend &gfx);
@@ -0,0 +1,162 @@
+#include "img/fusedpass.h"
+#include "gfx/pipeline.h"
+#include "gfx/signature.h"
+#include "img/imgevaluator.h"
+#include "img/imgnode.h"
+#include "img/shadergen.h"
+#include "util/log.h"
+
+namespace img {
+
+FusedPass::FusedPass(std::vector<ImgNode *> chain)
+    : chain_{std::move(chain)}, codeVersions_(chain_.size(), 0) {
+  // point-wise nodes read the pixel they write
+  sampler_.minFilter = gfx::SamplerDesc::Filter::Nearest;
+  sampler_.magFilter = gfx::SamplerDesc::Filter::Nearest;
+  sampler_.mipMapMode = gfx::SamplerDesc::MipMapMode::None;
+  sampler_.addrU = gfx::SamplerDesc::AddressMode::Clamp;
+  sampler_.addrV = gfx::SamplerDesc::AddressMode::Clamp;
+  sampler_.addrW = gfx::SamplerDesc::AddressMode::Clamp;
+}
+
+std::string FusedPass::generateFragmentSource() {
+  ShaderGenerator gen{gfx::ShaderStageFlags::FRAGMENT,
+                      ShaderGenerator::Target::OpenGL_GLSL};
+  auto floatTy = gen.primitiveType(PrimitiveType::Float);
+  auto float2Ty = gen.primitiveType(PrimitiveType::Float2);
+  auto float4Ty = gen.primitiveType(PrimitiveType::Float4);
+
+  // see QUAD_VERTEX_SHADER and CommonParameters
+  auto texcoord = gen.createInput("f_texcoord", float2Ty, 1);
+  auto color = gen.createOutput("color", float4Ty, 0);
+  gen.addGlobalParameter("u_time", floatTy, 0);
+  gen.addGlobalParameter("u_frame", gen.primitiveType(PrimitiveType::Int), 0);
+  gen.addGlobalParameter("u_resolution", float2Ty, 0);
+  gen.addGlobalParameter("u_tileOrigin", float2Ty, 0);
+  auto input = gen.addTextureResource(gfx::ImageDimensions::Image2D, floatTy);
+
+  auto main = gen.beginMain();
+  auto block = gen.beginBlock(main);
+  auto value =
+      gen.emitSample2D(block, input, sampler_, gen.emitSwizzle(block, texcoord, "x"),
+                       gen.emitSwizzle(block, texcoord, "y"));
+  for (int i = 0; i < (int)chain_.size(); ++i) {
+    value = chain_[i]->emitPointwise(gen, block, value, i);
+  }
+  gen.emitStore(block, color, value);
+  gen.endMain(main);
+  return gen.generate();
+}
+
+void FusedPass::compile(gfx::GraphicsBackend &gfx) {
+  if (!signature_) {
+    gfx::SignatureDesc         sigDesc;
+    const gfx::ResourceBinding resources[2] = {
+        gfx::ResourceBinding::makeConstantBuffer(0),
+        gfx::ResourceBinding::makeTextureSampler(0),
+    };
+    const gfx::FragmentOutputDescription fragOut[1] = {};
+    const gfx::VertexInputBinding        vtxIn[1] = {
+        QUAD_VERTEX_LAYOUT, gfx::VertexInputRate::Vertex, 0};
+    sigDesc.fragmentOutputs = util::makeArrayRef(fragOut);
+    sigDesc.shaderResources = util::makeArrayRef(resources);
+    sigDesc.vertexInputs = util::makeArrayRef(vtxIn);
+    sigDesc.hasdepthStencilFragmentOutput = false;
+    sigDesc.hasIndexFormat = false;
+    sigDesc.viewportsCount = 1;
+    sigDesc.scissorsCount = 1;
+    signature_ = gfx::Signature{gfx, sigDesc};
+    args_ = gfx::ArgumentBlock{gfx, signature_};
+  }
+
+  const gfx::RenderPassTargetDesc targets[1] = {};
+  gfx::RenderPassDesc             rpDesc{util::makeArrayRef(targets), nullptr};
+  gfx::RenderPass                 rp{gfx, rpDesc};
+  gfx::ShaderModule               vertexShader{gfx, QUAD_VERTEX_SHADER,
+                                 gfx::ShaderStageFlags::VERTEX};
+  gfx::ShaderModule               fragmentShader{gfx, fragSource_,
+                                   gfx::ShaderStageFlags::FRAGMENT};
+  util::log("FusedPass[{}]: fragment shader: \n{}",
+            chain_.back()->name().to_string(), fragSource_);
+
+  gfx::GraphicsPipelineDesc desc;
+  desc.shaderStages.vertex = vertexShader;
+  desc.shaderStages.fragment = fragmentShader;
+  desc.signature = signature_;
+  desc.renderPass = rp;
+  pendingPipeline_ = gfx::GraphicsPipeline::async(gfx, desc);
+}
+
+void FusedPass::execute(ImgContext &ctx, gfx::ImageHandle inputImage) {
+  auto &&gfx = ctx.gfx();
+
+  // the code of the nodes may have changed since the last execution
+  bool outdated = fragSource_.empty();
+  for (size_t i = 0; i < chain_.size(); ++i) {
+    const auto version = chain_[i]->codeVersion();
+    if (version != codeVersions_[i]) {
+      codeVersions_[i] = version;
+      outdated = true;
+    }
+  }
+  if (outdated) {
+    fragSource_ = generateFragmentSource();
+    compile(gfx);
+  }
+  if (pendingPipeline_) {
+    std::string log;
+    switch (pendingPipeline_.status(&log)) {
+    case gfx::PipelineStatus::Pending:
+      ctx.scheduleReexecution();
+      break;
+    case gfx::PipelineStatus::Ready:
+      pipeline_ = std::move(pendingPipeline_);
+      compileFailed_ = false;
+      break;
+    case gfx::PipelineStatus::Failed:
+      // keep the last pipeline that worked
+      util::log("FusedPass[{}]: shader compilation failed: \n{}",
+                chain_.back()->name().to_string(), log);
+      pendingPipeline_ = gfx::GraphicsPipeline{};
+      compileFailed_ = true;
+      break;
+    }
+  }
+  if (compileFailed_) {
+    ctx.markOutputsStale();
+  }
+  if (!pipeline_) {
+    // nothing to draw
+    ctx.markOutputsStale();
+    return;
+  }
+
+  args_.setShaderResource(0, ctx.commonParameters());
+  if (inputImage) {
+    args_.setShaderResource(0, gfx::SampledImageView{inputImage, sampler_});
+  }
+  args_.setVertexBuffer(0, ctx.quadVertices());
+  // the intermediate results are not stored: the region of the chain is the
+  // region of its last node
+  args_.setScissor(0, ctx.regionOfInterest());
+
+  auto last = chain_.back();
+  auto rtv = ctx.getRenderTargetView(last->outputName(last->output(0)));
+  if (!framebuffer_ || framebufferTarget_ != rtv.image) {
+    gfx::FramebufferDesc  fbDesc;
+    gfx::RenderTargetView rtvs[1] = {rtv};
+    fbDesc.colorTargets = util::makeConstArrayRef(rtvs);
+    fbDesc.depthTarget = nullptr;
+    framebuffer_ = gfx::Framebuffer{gfx, fbDesc};
+    framebufferTarget_ = rtv.image;
+  }
+
+  gfx::DrawParams params;
+  params.firstVertex = 0;
+  params.vertexCount = 6;
+  params.firstInstance = 0;
+  params.instanceCount = 1;
+  ctx.commandBuffer().draw(pipeline_, framebuffer_, args_, params);
+}
+
+} // namespace img
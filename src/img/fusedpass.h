@@ -0,0 +1,58 @@
+#pragma once
+#include "gfx/gfx.h"
+#include "util/stringref.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace img {
+
+class ImgContext;
+class ImgNode;
+
+/// A chain of point-wise nodes (see `ImgNode::isPointwise()`) executed as a
+/// single full-screen pass.
+///
+/// The fragment shader is generated from the nodes of the chain with a
+/// `ShaderGenerator`: the input image of the first node is sampled once, and
+/// the result of each node is passed directly to the next one, so that only
+/// the output of the last node is written to memory. It is generated again
+/// when the code of a node changes (see `ImgNode::codeVersion()`).
+class FusedPass {
+public:
+  /// `chain` is ordered from the node reading the input of the chain to the
+  /// node writing its output.
+  explicit FusedPass(std::vector<ImgNode *> chain);
+
+  const std::vector<ImgNode *> &nodes() const { return chain_; }
+
+  /// Records the commands of the pass, in the context of the last node of
+  /// the chain. `inputImage` is the image read by the first node, 0 if its
+  /// input is not connected.
+  void execute(ImgContext &ctx, gfx::ImageHandle inputImage);
+
+  /// Returns the generated fragment shader, empty before the first execution.
+  util::StringRef fragmentSource() const { return fragSource_; }
+
+private:
+  std::string generateFragmentSource();
+  void        compile(gfx::GraphicsBackend &gfx);
+
+  std::vector<ImgNode *> chain_;
+  // ImgNode::codeVersion() of the nodes when the shader was generated
+  std::vector<uint64_t>  codeVersions_;
+  std::string            fragSource_;
+  gfx::SamplerDesc       sampler_;
+  // resources referenced by the recorded commands, kept alive until the
+  // next execution
+  gfx::Signature        signature_;
+  gfx::ArgumentBlock    args_;
+  gfx::GraphicsPipeline pipeline_;
+  gfx::GraphicsPipeline pendingPipeline_;
+  gfx::Framebuffer      framebuffer_;
+  gfx::ImageHandle      framebufferTarget_ = 0;
+  // the last compilation failed: the pass draws with an older pipeline
+  bool compileFailed_ = false;
+};
+
+} // namespace img
@@ -0,0 +1,415 @@
+#include "img/imagefile.h"
+#include "fmt/format.h"
+#include <OpenImageIO/imageio.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace img {
+
+void writeImageFile(const util::path &path, int width, int height,
+                    int channels, const float *pixels) {
+  const auto fileName = path.string();
+  auto       out = OIIO::ImageOutput::create(fileName);
+  if (!out) {
+    throw std::runtime_error{fmt::format("unsupported image format: {} ({})",
+                                         fileName, OIIO::geterror())};
+  }
+  OIIO::ImageSpec spec{width, height, channels, OIIO::TypeDesc::FLOAT};
+  if (!out->open(fileName, spec) ||
+      !out->write_image(OIIO::TypeDesc::FLOAT, pixels) || !out->close()) {
+    throw std::runtime_error{fmt::format("could not write image {}: {}",
+                                         fileName, out->geterror())};
+  }
+}
+
+std::string expandFramePattern(const std::string &pattern, int frame) {
+  auto first = pattern.find('#');
+  if (first == std::string::npos) {
+    return pattern;
+  }
+  auto last = pattern.find_first_not_of('#', first);
+  if (last == std::string::npos) {
+    last = pattern.size();
+  }
+  const int width = (int)(last - first);
+  return pattern.substr(0, first) + fmt::format("{:0{}}", frame, width) +
+         pattern.substr(last);
+}
+
+DecodedImage decodeImageFile(const util::path &path) {
+  const auto fileName = path.string();
+  auto       in = OIIO::ImageInput::open(fileName);
+  if (!in) {
+    throw std::runtime_error{fmt::format("could not open image {}: {}",
+                                         fileName, OIIO::geterror())};
+  }
+  const auto &spec = in->spec();
+  const int   channels = std::min(spec.nchannels, 4);
+  if (spec.width <= 0 || spec.height <= 0 || channels <= 0) {
+    throw std::runtime_error{fmt::format("empty image: {}", fileName)};
+  }
+
+  // 32-bit files keep their precision, anything else fits in halfs
+  DecodedImage img;
+  img.width = spec.width;
+  img.height = spec.height;
+  const bool full = spec.format.size() >= 4;
+  img.format = full ? gfx::Format::R32G32B32A32_SFLOAT
+                    : gfx::Format::R16G16B16A16_SFLOAT;
+  const int elemSize = full ? 4 : 2;
+  img.pixelSize = 4 * elemSize;
+  const size_t pixelCount = (size_t)img.width * img.height;
+  img.pixels.assign(pixelCount * img.pixelSize, 0);
+
+  // missing channels are zero, except alpha which is opaque
+  if (channels < 4) {
+    const float    one = 1.0f;
+    const uint16_t halfOne = 0x3C00;
+    for (size_t i = 0; i < pixelCount; ++i) {
+      auto alpha = &img.pixels[i * img.pixelSize + 3 * elemSize];
+      if (full) {
+        std::memcpy(alpha, &one, sizeof(one));
+      } else {
+        std::memcpy(alpha, &halfOne, sizeof(halfOne));
+      }
+    }
+  }
+
+  const auto type = full ? OIIO::TypeDesc::FLOAT : OIIO::TypeDesc::HALF;
+  if (!in->read_image(0, 0, 0, channels, type, img.pixels.data(),
+                      img.pixelSize)) {
+    throw std::runtime_error{fmt::format("could not read image {}: {}",
+                                         fileName, in->geterror())};
+  }
+  in->close();
+
+  // grayscale images are displayed as gray, not red
+  if (channels == 1) {
+    for (size_t i = 0; i < pixelCount; ++i) {
+      auto px = &img.pixels[i * img.pixelSize];
+      std::memcpy(px + elemSize, px, elemSize);
+      std::memcpy(px + 2 * elemSize, px, elemSize);
+    }
+  }
+  return img;
+}
+
+// Assembles the tiles of a job into rows from the top of the image, keeping
+// the first `channels` components of the pixels.
+static void assembleImage(const ImageFileJob &job, std::vector<float> &out) {
+  const int c = job.channels;
+  out.assign((size_t)job.width * job.height * c, 0.0f);
+  for (auto &&tile : job.tiles) {
+    const auto r =
+        tile.region.intersected(gfx::Rect{0, 0, job.width, job.height});
+    for (int y = r.y; y < r.bottom(); ++y) {
+      const float *src =
+          &tile.pixels[((size_t)(y - tile.region.y) * tile.region.width +
+                        (r.x - tile.region.x)) *
+                       4];
+      float *dst = &out[((size_t)(job.height - 1 - y) * job.width + r.x) * c];
+      for (int x = 0; x < r.width; ++x) {
+        std::copy(src, src + c, dst);
+        src += 4;
+        dst += c;
+      }
+    }
+  }
+}
+
+ImageWriter::ImageWriter(int threadCount, int maxQueuedImages)
+    : maxQueuedImages_{std::max(maxQueuedImages, 1)} {
+  if (threadCount < 0) {
+    // encoding is partly I/O bound: leave room for the render thread and the
+    // driver
+    threadCount = std::max((int)std::thread::hardware_concurrency() / 2, 1);
+  }
+  for (int i = 0; i < std::max(threadCount, 1); ++i) {
+    workers_.emplace_back([this] { workerMain(); });
+  }
+}
+
+ImageWriter::~ImageWriter() {
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    jobDone_.wait(lock, [this] { return pendingImages_ == 0; });
+    stop_ = true;
+  }
+  jobAvailable_.notify_all();
+  for (auto &&w : workers_) {
+    w.join();
+  }
+}
+
+void ImageWriter::rethrowError() {
+  if (error_) {
+    auto e = error_;
+    error_ = nullptr;
+    std::rethrow_exception(e);
+  }
+}
+
+void ImageWriter::write(ImageFileJob job) {
+  if (job.channels < 1 || job.channels > 4) {
+    throw std::logic_error{"images must have 1 to 4 channels"};
+  }
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    rethrowError();
+    if (!started_) {
+      started_ = true;
+      startTime_ = Clock::now();
+    }
+    if (pendingImages_ >= maxQueuedImages_) {
+      // backpressure: wait for an encoder to finish an image
+      const auto start = Clock::now();
+      jobDone_.wait(lock,
+                    [this] { return pendingImages_ < maxQueuedImages_; });
+      stalls_++;
+      stallTimeMs_ += std::chrono::duration<double, std::milli>(
+                          Clock::now() - start)
+                          .count();
+      rethrowError();
+    }
+    jobs_.push_back(std::move(job));
+    pendingImages_++;
+  }
+  jobAvailable_.notify_one();
+}
+
+void ImageWriter::flush() {
+  std::unique_lock<std::mutex> lock{mutex_};
+  jobDone_.wait(lock, [this] { return pendingImages_ == 0; });
+  rethrowError();
+}
+
+ImageWriterStats ImageWriter::stats() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  ImageWriterStats            s;
+  s.imagesWritten = imagesWritten_;
+  s.queueDepth = pendingImages_;
+  s.stalls = stalls_;
+  s.stallTimeMs = stallTimeMs_;
+  if (started_) {
+    const double seconds =
+        std::chrono::duration<double>(Clock::now() - startTime_).count();
+    s.imagesPerSecond = seconds > 0.0 ? imagesWritten_ / seconds : 0.0;
+  }
+  return s;
+}
+
+void ImageWriter::workerMain() {
+  std::vector<float> pixels;
+  for (;;) {
+    ImageFileJob job;
+    {
+      std::unique_lock<std::mutex> lock{mutex_};
+      jobAvailable_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+      if (jobs_.empty()) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+
+    std::exception_ptr error;
+    try {
+      assembleImage(job, pixels);
+      writeImageFile(job.path, job.width, job.height, job.channels,
+                     pixels.data());
+    } catch (...) {
+      error = std::current_exception();
+    }
+    // free the tiles before accepting more work
+    job.tiles.clear();
+
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      pendingImages_--;
+      if (error) {
+        if (!error_) {
+          error_ = error;
+        }
+      } else {
+        imagesWritten_++;
+      }
+    }
+    jobDone_.notify_all();
+  }
+}
+
+ImageFileLoader::ImageFileLoader(int threadCount, size_t cacheBudget)
+    : cacheBudget_{cacheBudget} {
+  if (threadCount < 0) {
+    // decoding is partly I/O bound: leave room for the render thread and the
+    // driver
+    threadCount = std::max((int)std::thread::hardware_concurrency() / 2, 1);
+  }
+  for (int i = 0; i < std::max(threadCount, 1); ++i) {
+    workers_.emplace_back([this] { workerMain(); });
+  }
+}
+
+ImageFileLoader::~ImageFileLoader() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    queue_.clear();
+    stop_ = true;
+  }
+  jobAvailable_.notify_all();
+  for (auto &&w : workers_) {
+    w.join();
+  }
+}
+
+ImageFileLoader &ImageFileLoader::instance() {
+  static ImageFileLoader loader;
+  return loader;
+}
+
+std::string ImageFileLoader::fileKey(const util::path &path,
+                                     std::string *     error) {
+  std::error_code ec;
+  const auto      mtime = ghc::filesystem::last_write_time(path, ec);
+  if (ec) {
+    if (error) {
+      *error = fmt::format("could not access {}: {}", path.string(),
+                           ec.message());
+    }
+    return {};
+  }
+  return fmt::format("{}|{}", path.string(),
+                     (long long)mtime.time_since_epoch().count());
+}
+
+ImageFileLoader::Entry *ImageFileLoader::findOrQueue(const util::path &path,
+                                                     bool        urgent,
+                                                     std::string *error) {
+  auto key = fileKey(path, error);
+  if (key.empty()) {
+    return nullptr;
+  }
+
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    if (urgent && it->second.state == EntryState::Pending) {
+      // a prefetched image is needed now: decode it next
+      auto q = std::find(queue_.begin(), queue_.end(), key);
+      if (q != queue_.end() && q != queue_.begin()) {
+        queue_.erase(q);
+        queue_.push_front(key);
+      }
+    }
+    return &it->second;
+  }
+
+  Entry entry;
+  entry.path = path;
+  it = entries_.emplace(key, std::move(entry)).first;
+  if (urgent) {
+    queue_.push_front(std::move(key));
+  } else {
+    queue_.push_back(std::move(key));
+  }
+  misses_++;
+  jobAvailable_.notify_one();
+  return &it->second;
+}
+
+ImageFileLoader::ImagePtr ImageFileLoader::request(const util::path &path,
+                                                   std::string *     error) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto                        entry = findOrQueue(path, true, error);
+  if (!entry) {
+    return nullptr;
+  }
+  switch (entry->state) {
+  case EntryState::Ready:
+    hits_++;
+    lru_.splice(lru_.end(), lru_, entry->lruPos);
+    return entry->image;
+  case EntryState::Failed:
+    if (error) {
+      *error = entry->error;
+    }
+    return nullptr;
+  case EntryState::Pending:
+  default:
+    return nullptr;
+  }
+}
+
+void ImageFileLoader::prefetch(const util::path &path) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  findOrQueue(path, false, nullptr);
+}
+
+void ImageFileLoader::setCacheBudget(size_t bytes) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  cacheBudget_ = bytes;
+  evict();
+}
+
+ImageFileLoaderStats ImageFileLoader::stats() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  ImageFileLoaderStats        s;
+  s.hits = hits_;
+  s.misses = misses_;
+  s.imageCount = (int)lru_.size();
+  s.cachedBytes = cachedBytes_;
+  s.pendingDecodes = (int)queue_.size() + decoding_;
+  return s;
+}
+
+void ImageFileLoader::evict() {
+  // the most recent image stays, even if it exceeds the budget on its own
+  while (cachedBytes_ > cacheBudget_ && lru_.size() > 1) {
+    auto it = entries_.find(lru_.front());
+    cachedBytes_ -= it->second.image->pixels.size();
+    lru_.pop_front();
+    entries_.erase(it);
+  }
+}
+
+void ImageFileLoader::workerMain() {
+  for (;;) {
+    std::string key;
+    util::path  path;
+    {
+      std::unique_lock<std::mutex> lock{mutex_};
+      jobAvailable_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (stop_) {
+        return;
+      }
+      key = std::move(queue_.front());
+      queue_.pop_front();
+      path = entries_.at(key).path;
+      decoding_++;
+    }
+
+    std::shared_ptr<DecodedImage> image;
+    std::string                   error;
+    try {
+      image = std::make_shared<DecodedImage>(decodeImageFile(path));
+    } catch (std::exception &e) {
+      error = e.what();
+    }
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    decoding_--;
+    auto &entry = entries_.at(key);
+    if (image) {
+      entry.state = EntryState::Ready;
+      cachedBytes_ += image->pixels.size();
+      entry.image = std::move(image);
+      entry.lruPos = lru_.insert(lru_.end(), key);
+      evict();
+    } else {
+      entry.state = EntryState::Failed;
+      entry.error = std::move(error);
+    }
+  }
+}
+
+} // namespace img
@@ -1 +1,237 @@
-#pragma once 
+#pragma once
+#include "gfx/format.h"
+#include "gfx/rect.h"
+#include "util/filesystem.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace img {
+
+/// Replaces the first run of '#' in a file name pattern by the frame
+/// number, padded with zeros to the length of the run (e.g. `render.####.exr`
+/// becomes `render.0042.exr`). Returns the pattern unchanged if it contains
+/// no '#'.
+std::string expandFramePattern(const std::string &pattern, int frame);
+
+/// An image decoded from a file, in a format that can be uploaded with
+/// `GraphicsBackend::updateImageData()`.
+struct DecodedImage {
+  int width = 0;
+  int height = 0;
+  /// `R32G32B32A32_SFLOAT` for files storing 32-bit values,
+  /// `R16G16B16A16_SFLOAT` otherwise. Missing channels are filled with 0,
+  /// and alpha with 1; single-channel images are replicated to RGB.
+  gfx::Format format = gfx::Format::R16G16B16A16_SFLOAT;
+  /// Size of a pixel, in bytes.
+  int pixelSize = 8;
+  /// Pixels, in rows from the top of the image.
+  std::vector<uint8_t> pixels;
+};
+
+/// Decodes an image file with OpenImageIO. Throws `std::runtime_error` on
+/// failure.
+DecodedImage decodeImageFile(const util::path &path);
+
+/// Writes an image to a file, in the format given by the extension of the
+/// path (e.g. `.exr`, `.png`, `.tif`). `pixels` contains `height` rows of
+/// `width * channels` floats, from the top of the image. Formats that do not
+/// store floats receive values quantized to their pixel type.
+///
+/// Throws `std::runtime_error` if the file cannot be written.
+void writeImageFile(const util::path &path, int width, int height,
+                    int channels, const float *pixels);
+
+/// A part of an image read back from the GPU.
+struct ImageFileTile {
+  /// Region of the image covered by the tile.
+  gfx::Rect region;
+  /// RGBA float pixels, in rows from the bottom of the region (the layout
+  /// of `GraphicsBackend::readImageData()`).
+  std::vector<float> pixels;
+};
+
+/// An image to be written by `ImageWriter`.
+struct ImageFileJob {
+  util::path path;
+  int        width = 0;
+  int        height = 0;
+  /// Number of channels written, taken from the start of the RGBA pixels
+  /// (e.g. 3 for RGB).
+  int                        channels = 4;
+  std::vector<ImageFileTile> tiles;
+};
+
+/// Counters of an `ImageWriter`.
+struct ImageWriterStats {
+  /// Images written to disk.
+  uint64_t imagesWritten = 0;
+  /// Images written per second, since the first image was queued.
+  double imagesPerSecond = 0.0;
+  /// Images queued or being encoded.
+  int queueDepth = 0;
+  /// Calls to `write()` that waited for the queue to have room, and the
+  /// total time spent waiting, in milliseconds. Non-zero values mean that
+  /// encoding or the disk are slower than rendering.
+  uint64_t stalls = 0;
+  double   stallTimeMs = 0.0;
+};
+
+/// Assembles, converts and encodes images on worker threads, so that
+/// rendering the next frame overlaps writing the previous ones.
+///
+/// The number of images queued or being encoded is bounded: `write()` blocks
+/// when the queue is full, which throttles rendering to the speed of the
+/// encoders and of the disk instead of accumulating frames in memory.
+class ImageWriter {
+public:
+  /// Creates a writer with the specified number of worker threads (one per
+  /// two hardware threads if negative), holding at most `maxQueuedImages`
+  /// images.
+  explicit ImageWriter(int threadCount = -1, int maxQueuedImages = 4);
+  /// Waits for the queued images to be written.
+  ~ImageWriter();
+
+  ImageWriter(const ImageWriter &) = delete;
+  ImageWriter &operator=(const ImageWriter &) = delete;
+
+  /// Queues an image. Blocks while the queue is full.
+  ///
+  /// Errors of previous images (e.g. an unwritable path) are rethrown here,
+  /// or by `flush()`.
+  void write(ImageFileJob job);
+
+  /// Waits until all queued images have been written. Rethrows the first
+  /// error that occurred in a worker.
+  void flush();
+
+  ImageWriterStats stats() const;
+
+private:
+  void workerMain();
+  void rethrowError();
+
+  using Clock = std::chrono::steady_clock;
+
+  std::vector<std::thread> workers_;
+  mutable std::mutex       mutex_;
+  std::condition_variable  jobAvailable_;
+  std::condition_variable  jobDone_;
+  std::deque<ImageFileJob> jobs_;
+  int                      maxQueuedImages_;
+  // queued or being encoded
+  int                      pendingImages_ = 0;
+  bool                     stop_ = false;
+  std::exception_ptr       error_;
+  bool                     started_ = false;
+  Clock::time_point        startTime_;
+  uint64_t                 imagesWritten_ = 0;
+  uint64_t                 stalls_ = 0;
+  double                   stallTimeMs_ = 0.0;
+};
+
+/// Counters of an `ImageFileLoader`.
+struct ImageFileLoaderStats {
+  /// Requests of images that were already decoded.
+  uint64_t hits = 0;
+  /// Requests and prefetches that started decoding an image.
+  uint64_t misses = 0;
+  /// Decoded images in the cache, and their size.
+  int    imageCount = 0;
+  size_t cachedBytes = 0;
+  /// Images queued or being decoded.
+  int pendingDecodes = 0;
+};
+
+/// Decodes image files on worker threads, and keeps the decoded images in a
+/// cache with a memory budget.
+///
+/// Files are identified by their path and modification time: modified files
+/// are decoded again. When the budget is exceeded, the least recently
+/// requested images are evicted (images still referenced elsewhere stay
+/// alive until released).
+class ImageFileLoader {
+public:
+  using ImagePtr = std::shared_ptr<const DecodedImage>;
+
+  static constexpr size_t DEFAULT_CACHE_BUDGET = size_t{1024} * 1024 * 1024;
+
+  /// Creates a loader with the specified number of worker threads (one per
+  /// two hardware threads if negative).
+  explicit ImageFileLoader(int    threadCount = -1,
+                           size_t cacheBudget = DEFAULT_CACHE_BUDGET);
+  /// Waits for the images being decoded and discards the queued ones.
+  ~ImageFileLoader();
+
+  ImageFileLoader(const ImageFileLoader &) = delete;
+  ImageFileLoader &operator=(const ImageFileLoader &) = delete;
+
+  /// Returns the decoded image of a file, or nullptr if it is not decoded
+  /// yet, in which case decoding starts in the background: call again later
+  /// (e.g. in the next evaluation). Never blocks on decoding.
+  ///
+  /// If the file cannot be read or decoded, returns nullptr and stores the
+  /// reason in `error`.
+  ImagePtr request(const util::path &path, std::string *error = nullptr);
+
+  /// Starts decoding an image in the background if it is not decoded yet,
+  /// after the images requested with `request()` (e.g. the next frames of a
+  /// sequence).
+  void prefetch(const util::path &path);
+
+  void                 setCacheBudget(size_t bytes);
+  ImageFileLoaderStats stats() const;
+
+  /// Returns the loader shared by the whole application.
+  static ImageFileLoader &instance();
+
+  /// Returns the key identifying a version of a file in the loader: its path
+  /// and modification time. Returns an empty string and stores the reason in
+  /// `error` if the file cannot be accessed.
+  static std::string fileKey(const util::path &path,
+                             std::string *     error = nullptr);
+
+private:
+  enum class EntryState { Pending, Ready, Failed };
+
+  struct Entry {
+    util::path path;
+    EntryState state = EntryState::Pending;
+    ImagePtr   image;
+    std::string error;
+    // position in lru_ if the entry is ready
+    std::list<std::string>::iterator lruPos;
+  };
+
+  // Returns the entry of a file, creating it and queuing the decode if
+  // needed. Returns nullptr if the file cannot be accessed.
+  Entry *findOrQueue(const util::path &path, bool urgent, std::string *error);
+  void   evict();
+  void   workerMain();
+
+  std::vector<std::thread>               workers_;
+  mutable std::mutex                     mutex_;
+  std::condition_variable                jobAvailable_;
+  std::unordered_map<std::string, Entry> entries_;
+  // keys of entries to decode
+  std::deque<std::string> queue_;
+  // keys of ready entries, least recently requested first
+  std::list<std::string> lru_;
+  size_t                 cacheBudget_;
+  size_t                 cachedBytes_ = 0;
+  int                    decoding_ = 0;
+  uint64_t               hits_ = 0;
+  uint64_t               misses_ = 0;
+  bool                   stop_ = false;
+};
+
+} // namespace img
@@ -49,9 +49,8 @@ void ImgClear::execute(ImgContext &ctx) {
   // get the concrete image associated to the render target
   auto targetView = ctx.getRenderTargetView(OUTPUT_NAME);
 
-  auto& gfx = ctx.gfx();
-  gfx.clearRenderTarget(targetView,
-                        gfx::ColorF{color[0], color[1], color[2], color[3]});
+  ctx.commandBuffer().clearRenderTarget(
+      targetView, gfx::ColorF{color[0], color[1], color[2], color[3]});
 }
 
 } // namespace img
\ No newline at end of file
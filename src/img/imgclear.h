@@ -11,6 +11,7 @@ public:
 
   void execute(ImgContext& ctx) override;
   void prepare(ImgContext& ctx) override;
+  bool hashState(ImgContext &ctx, uint64_t &hash) override { return true; }
 
   static void registerNode();
 
@@ -0,0 +1,305 @@
+#include "img/imgcomputenode.h"
+#include "fmt/format.h"
+#include "gfx/image.h"
+#include "gfx/pipeline.h"
+#include "gfx/signature.h"
+#include "img/imgevaluator.h"
+#include "img/shadertemplate.h"
+#include "util/hash.h"
+#include "node/description.h"
+#include "util/log.h"
+#include <string>
+
+using node::Network;
+using node::Node;
+using node::NodeDescription;
+
+namespace img {
+
+static const char COMP_SRC_TEMPLATE[] = R"(
+#version 450
+layout(local_size_x=<<<GROUP_SIZE>>>, local_size_y=<<<GROUP_SIZE>>>) in;
+layout(std140, binding=0) uniform CommonParameters {
+	float u_time;
+	int u_frame;
+	vec2 u_resolution;
+	vec2 u_tileOrigin;
+};
+layout(std140, binding=1) uniform NodeParameters {
+	ivec2 u_regionOrigin;
+};
+layout(binding=0) uniform sampler2D u_input;
+layout(binding=0, <<<OUTPUT_FORMAT>>>) uniform writeonly image2D u_output;
+<<<DECLARATIONS>>>
+void main() {
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy) + u_regionOrigin;
+	<<<BODY>>>
+}
+)";
+
+static const char DEFAULT_COMPUTE_CODE[] =
+    "imageStore(u_output, pixel, texelFetch(u_input, pixel, 0));";
+
+static const char INPUT_NAME[] = "input";
+static const char OUTPUT_NAME[] = "output";
+
+// parsed once, rendered on each recompilation
+static const ShaderTemplate COMP_TEMPLATE{COMP_SRC_TEMPLATE};
+static const int COMP_GROUP_SIZE = COMP_TEMPLATE.placeholderIndex("GROUP_SIZE");
+static const int COMP_OUTPUT_FORMAT =
+    COMP_TEMPLATE.placeholderIndex("OUTPUT_FORMAT");
+static const int COMP_DECLARATIONS =
+    COMP_TEMPLATE.placeholderIndex("DECLARATIONS");
+static const int COMP_BODY = COMP_TEMPLATE.placeholderIndex("BODY");
+
+// Returns the GLSL format qualifier of a storage image of the specified
+// format, or nullptr if the format cannot be used for storage images.
+static const char *imageFormatQualifier(gfx::Format format) {
+  switch (format) {
+  case gfx::Format::R32G32B32A32_SFLOAT:
+    return "rgba32f";
+  case gfx::Format::R16G16B16A16_SFLOAT:
+    return "rgba16f";
+  case gfx::Format::R32G32_SFLOAT:
+    return "rg32f";
+  case gfx::Format::R16G16_SFLOAT:
+    return "rg16f";
+  case gfx::Format::R32_SFLOAT:
+    return "r32f";
+  case gfx::Format::B10G11R11_UFLOAT_PACK32:
+    return "r11f_g11f_b10f";
+  case gfx::Format::R8G8B8A8_UNORM:
+    return "rgba8";
+  case gfx::Format::R8G8B8A8_SNORM:
+    return "rgba8_snorm";
+  case gfx::Format::R8_UNORM:
+    return "r8";
+  default:
+    return nullptr;
+  }
+}
+
+static void generateComputeShaderSource(std::string &    out,
+                                        gfx::Format      outputFormat,
+                                        util::StringRef declarations,
+                                        util::StringRef body) {
+  const auto      groupSize = std::to_string(ImgComputeNode::WORK_GROUP_SIZE);
+  util::StringRef values[4];
+  values[COMP_GROUP_SIZE] = groupSize;
+  values[COMP_OUTPUT_FORMAT] = imageFormatQualifier(outputFormat);
+  values[COMP_DECLARATIONS] = declarations;
+  values[COMP_BODY] = body;
+  COMP_TEMPLATE.render(out, util::makeConstArrayRef(values));
+}
+
+void ImgComputeNode::setComputeCode(std::string code) {
+  computeCode_ = std::move(code);
+  computeSource_.clear();
+  shaderDirty_ = true;
+  markDirty();
+}
+
+void ImgComputeNode::setDeclarations(std::string code) {
+  declarations_ = std::move(code);
+  computeSource_.clear();
+  shaderDirty_ = true;
+  markDirty();
+}
+
+void ImgComputeNode::loadInternal(util::StringRef key, util::JsonReader &r,
+                                  int baseId) {
+  if (key == "computeCode") {
+    setComputeCode(r.nextString());
+  } else if (key == "declarations") {
+    setDeclarations(r.nextString());
+  } else if (key == "halo") {
+    setHalo((int)r.nextInt());
+  } else {
+    ImgNode::loadInternal(key, r, baseId);
+  }
+}
+
+void ImgComputeNode::saveInternal(util::JsonWriter &w) {
+  ImgNode::saveInternal(w);
+  w.name("computeCode");
+  w.value(computeCode_);
+  w.name("declarations");
+  w.value(declarations_);
+  w.name("halo");
+  w.value((int64_t)halo_);
+}
+
+bool ImgComputeNode::hashState(ImgContext &ctx, uint64_t &hash) {
+  util::fnv1a64Combine(hash, (uint64_t)declarations_.size());
+  hash = util::fnv1a64(declarations_.data(), declarations_.size(), hash);
+  hash = util::fnv1a64(computeCode_.data(), computeCode_.size(), hash);
+  return true;
+}
+
+void ImgComputeNode::compile(gfx::GraphicsBackend &gfx) {
+  if (!signature_) {
+    gfx::SignatureDesc         sigDesc;
+    const gfx::ResourceBinding resources[4] = {
+        gfx::ResourceBinding::makeConstantBuffer(0),
+        gfx::ResourceBinding::makeConstantBuffer(1),
+        gfx::ResourceBinding::makeTextureSampler(0),
+        gfx::ResourceBinding::makeStorageImage(0),
+    };
+    sigDesc.shaderResources = util::makeArrayRef(resources);
+    sigDesc.hasdepthStencilFragmentOutput = false;
+    sigDesc.hasIndexFormat = false;
+    sigDesc.viewportsCount = 0;
+    sigDesc.scissorsCount = 0;
+    signature_ = gfx::Signature{gfx, sigDesc};
+    args_ = gfx::ArgumentBlock{gfx, signature_};
+  }
+
+  if (computeSource_.empty()) {
+    generateComputeShaderSource(computeSource_, outputFormat_, declarations_,
+                                computeCode_);
+  }
+  gfx::ShaderModule computeShader{gfx, computeSource_,
+                                  gfx::ShaderStageFlags::COMPUTE};
+  util::log("ImgNode[{}]: compute shader: \n{}", name().to_string(),
+            computeSource_);
+
+  // same as ImgShaderNode: the previous pipeline is used until the new one
+  // is ready
+  gfx::ComputePipelineDesc desc;
+  desc.computeShader = computeShader;
+  desc.signature = signature_;
+  pendingPipeline_ = gfx::ComputePipeline::async(gfx, desc);
+  compileStatus_ = ShaderCompileStatus::Compiling;
+  shaderDirty_ = false;
+}
+
+void ImgComputeNode::pollCompilation() {
+  std::string log;
+  switch (pendingPipeline_.status(&log)) {
+  case gfx::PipelineStatus::Pending:
+    return;
+  case gfx::PipelineStatus::Ready:
+    pipeline_ = std::move(pendingPipeline_);
+    compilationMessages_.clear();
+    compileStatus_ = ShaderCompileStatus::Succeeded;
+    break;
+  case gfx::PipelineStatus::Failed:
+    compilationMessages_ =
+        fmt::format("Shader compilation messages: \n {}", log);
+    pendingPipeline_ = gfx::ComputePipeline{};
+    compileStatus_ = ShaderCompileStatus::Failed;
+    util::log("ImgNode[{}]: {}", name().to_string(), compilationMessages_);
+    break;
+  }
+}
+
+void ImgComputeNode::execute(ImgContext &ctx) {
+  auto &&gfx = ctx.gfx();
+  if (shaderDirty_) {
+    compile(gfx);
+  }
+  if (compileStatus_ == ShaderCompileStatus::Compiling) {
+    pollCompilation();
+    if (compileStatus_ == ShaderCompileStatus::Compiling) {
+      ctx.scheduleReexecution();
+    }
+  }
+  if (compileStatus_ == ShaderCompileStatus::Failed) {
+    ctx.markOutputsStale();
+  }
+  if (!pipeline_) {
+    ctx.markOutputsStale();
+    return;
+  }
+
+  auto &cmd = ctx.commandBuffer();
+  if (constantBufferSize_ != constants_.size()) {
+    constantBuffer_ = gfx::Buffer::dynamic(gfx, constants_.size());
+    constantBufferSize_ = constants_.size();
+  }
+  cmd.updateBuffer(constantBuffer_, 0, constants_.data(), constants_.size());
+
+  args_.setShaderResource(0, ctx.commonParameters());
+  args_.setShaderResource(
+      1, gfx::ConstantBufferView{constantBuffer_, 0, constantBufferSize_});
+  if (auto input = ctx.getInputImage(this->input(0))) {
+    args_.setShaderResource(0, gfx::SampledImageView{input, inputSampler_});
+  }
+  args_.setShaderResource(0, ctx.getStorageImageView(OUTPUT_NAME));
+
+  // one invocation per pixel of the region, rounded up to whole work groups
+  // (the origin of the region is passed in the constant buffer)
+  const auto region = dispatchRegion_;
+  if (region.empty()) {
+    return;
+  }
+  const uint32_t groupsX =
+      (region.width + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE;
+  const uint32_t groupsY =
+      (region.height + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE;
+  cmd.dispatch(pipeline_, args_, groupsX, groupsY, 1);
+}
+
+static Node *constructor(Network &parent, util::StringRef name) {
+  return new ImgComputeNode(parent, name);
+}
+
+void ImgComputeNode::update(ImgContext &ctx) {
+  if (shaderDirty_ && computeSource_.empty()) {
+    generateComputeShaderSource(computeSource_, outputFormat_, declarations_,
+                                computeCode_);
+  }
+
+  // the region can extend past the image by the halos of the consumers
+  auto desc = ctx.getRenderTargetDesc(OUTPUT_NAME);
+  dispatchRegion_ = ctx.regionOfInterest().intersected(
+      gfx::Rect{0, 0, desc->width, desc->height});
+
+  constants_.clear();
+  constants_.push(dispatchRegion_.x);
+  constants_.push(dispatchRegion_.y);
+}
+
+void ImgComputeNode::prepare(ImgContext &ctx) {
+  int w, h;
+  ctx.defaultImageSize(w, h);
+  // not all formats can be written by image stores (e.g. sRGB)
+  auto format = ctx.defaultImageFormat();
+  if (!imageFormatQualifier(format)) {
+    format = gfx::Format::R16G16B16A16_SFLOAT;
+  }
+  if (format != outputFormat_) {
+    // the format qualifier is part of the shader
+    outputFormat_ = format;
+    computeSource_.clear();
+    shaderDirty_ = true;
+  }
+  gfx::ImageDesc targetDesc;
+  targetDesc.width = w;
+  targetDesc.height = h;
+  targetDesc.format = format;
+  targetDesc.usage = gfx::ImageUsageFlags::All;
+  ctx.setRenderTargetDesc(OUTPUT_NAME, targetDesc);
+  // the halo is in pixels of the full resolution image
+  ctx.setHalo((halo_ + ctx.proxyScale() - 1) / ctx.proxyScale());
+}
+
+void ImgComputeNode::registerNode() {
+  ImgNetwork::registerChild("ImgComputeNode", "Compute",
+                            "Runs a compute shader over the output image.",
+                            constructor);
+}
+
+ImgComputeNode::ImgComputeNode(Network &parent, util::StringRef name)
+    : ImgNode{parent, name}, computeCode_{DEFAULT_COMPUTE_CODE} {
+  createInput(INPUT_NAME);
+  createOutput(OUTPUT_NAME);
+  inputSampler_.minFilter = gfx::SamplerDesc::Filter::Linear;
+  inputSampler_.magFilter = gfx::SamplerDesc::Filter::Linear;
+  inputSampler_.mipMapMode = gfx::SamplerDesc::MipMapMode::None;
+  inputSampler_.addrU = gfx::SamplerDesc::AddressMode::Clamp;
+  inputSampler_.addrV = gfx::SamplerDesc::AddressMode::Clamp;
+  inputSampler_.addrW = gfx::SamplerDesc::AddressMode::Clamp;
+}
+
+} // namespace img
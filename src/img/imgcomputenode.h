@@ -0,0 +1,95 @@
+#pragma once
+#include "img/constantbufferbuilder.h"
+#include "img/imgnode.h"
+#include "img/imgshadernode.h"
+
+namespace img {
+
+class ImgContext;
+
+///
+/// A node running a compute shader over its output image.
+///
+/// Each invocation of the shader corresponds to a pixel of the output, in
+/// work groups of `WORK_GROUP_SIZE` x `WORK_GROUP_SIZE` pixels. Only the
+/// region of interest of the node (see `ImgContext::regionOfInterest()`) is
+/// dispatched. Unlike
+/// `ImgShaderNode`, invocations of a work group can share data through
+/// `shared` variables, which suits reductions, histograms and separable
+/// filters.
+class ImgComputeNode : public img::ImgNode {
+public:
+  static constexpr int WORK_GROUP_SIZE = 16;
+
+  ImgComputeNode(node::Network &parent, util::StringRef name);
+
+  void prepare(ImgContext &ctx) override;
+  void update(ImgContext &ctx) override;
+  void execute(ImgContext &ctx) override;
+
+  //------ Compute shader ------
+
+  /// Returns the body of the compute shader. The code reads the input through
+  /// `sampler2D u_input` and writes the output with
+  /// `imageStore(u_output, pixel, color)`, where `ivec2 pixel` is the pixel of
+  /// the invocation. Work groups at the edges extend past the region: stores
+  /// outside of the image are ignored.
+  util::StringRef computeCode() const { return computeCode_; }
+  /// Sets the body of the compute shader.
+  void setComputeCode(std::string code);
+
+  /// Returns the declarations placed before the entry point of the shader
+  /// (`shared` variables, functions).
+  util::StringRef declarations() const { return declarations_; }
+  void            setDeclarations(std::string code);
+
+  ShaderCompileStatus compileStatus() const { return compileStatus_; }
+  /// Returns the errors of the last compilation that failed.
+  util::StringRef compilationMessages() const { return compilationMessages_; }
+
+  /// Returns how far from `pixel` the code reads `u_input`, in pixels. See
+  /// `ImgContext::setHalo()`.
+  int  halo() const { return halo_; }
+  void setHalo(int pixels) { halo_ = pixels; }
+
+  bool hashState(ImgContext &ctx, uint64_t &hash) override;
+
+  static void registerNode();
+
+protected:
+  /// Loads and saves the code and the halo, which are not parameters.
+  void loadInternal(util::StringRef key, util::JsonReader &reader,
+                    int baseId) override;
+  void saveInternal(util::JsonWriter &writer) override;
+
+private:
+  void compile(gfx::GraphicsBackend &gfx);
+  void pollCompilation();
+
+  gfx::SamplerDesc inputSampler_;
+  std::string      computeCode_;
+  std::string      declarations_;
+  // format of the output image, and its GLSL image format qualifier
+  gfx::Format outputFormat_ = gfx::Format::R16G16B16A16_SFLOAT;
+  // generated compute shader source, empty if it must be regenerated
+  std::string           computeSource_;
+  ConstantBufferBuilder constants_;
+  // part of the output dispatched by the next execution
+  gfx::Rect dispatchRegion_;
+  std::string           compilationMessages_;
+  // resources referenced by the recorded commands, kept alive until the
+  // next execution
+  gfx::Buffer constantBuffer_;
+  size_t      constantBufferSize_ = 0;
+  // last pipeline that compiled successfully
+  gfx::ComputePipeline pipeline_;
+  // pipeline being compiled in the background
+  gfx::ComputePipeline pendingPipeline_;
+  gfx::Signature       signature_;
+  gfx::ArgumentBlock   args_;
+  ShaderCompileStatus  compileStatus_ = ShaderCompileStatus::NotCompiled;
+  bool                 shaderDirty_ = true;
+  int                  halo_ = 0;
+};
+
+} // namespace img
@@ -1,5 +1,14 @@
 #include "img/imgevaluator.h"
+#include "img/fusedpass.h"
+#include "util/hash.h"
 #include "util/log.h"
+#include "util/taskscheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <typeinfo>
 
 namespace img {
 
@@ -7,27 +16,249 @@ using node::Input;
 using node::Node;
 using node::Output;
 
+// two triangles covering the screen: position (x,y), texcoord (u,v)
+static const float QUAD_VERTICES[] = {
+    -1.0f, -1.0f, 0.0f, 0.0f, //
+    1.0f,  -1.0f, 1.0f, 0.0f, //
+    -1.0f, 1.0f,  0.0f, 1.0f, //
+    -1.0f, 1.0f,  0.0f, 1.0f, //
+    1.0f,  -1.0f, 1.0f, 0.0f, //
+    1.0f,  1.0f,  1.0f, 1.0f,
+};
+
+const char QUAD_VERTEX_SHADER[] = R"(
+#version 450
+layout(location=0) in vec2 a_position;
+layout(location=1) in vec2 a_texcoord;
+layout(location=0) out vec2 f_position;
+layout(location=1) out vec2 f_texcoord;
+void main() {
+    f_position = a_position;
+    f_texcoord = a_texcoord;
+    gl_Position = vec4(a_position, 0.0, 1.0);
+}
+)";
+
+static const gfx::VertexLayoutElement QUAD_VERTEX_LAYOUT_ELEMENTS[] = {
+    {{"POSITION", 0}, gfx::Format::R32G32_SFLOAT, 0},
+    {{"TEXCOORD", 1}, gfx::Format::R32G32_SFLOAT, 8}};
+
+const gfx::VertexLayout QUAD_VERTEX_LAYOUT = {
+    util::makeArrayRef(QUAD_VERTEX_LAYOUT_ELEMENTS), 16};
+
 ImgEvaluator::ImgEvaluator(gfx::GraphicsBackend &gfx, ImgNetwork &network)
     : network_{network}, gfx_{gfx} {
   network_.lock();
+  renderTargetCache_ = RenderTargetCache::make(gfx_);
   // toposort nodes in the network
   sortedNodes_ = network_.sortedChildren();
-  // debug
-  util::log("=== Execution plan: ===");
-  for (auto s : sortedNodes_) {
-    util::log(" - {}", s->name().to_string());
-  }
   // init node data
   nodeData_.resize(sortedNodes_.size());
+  timings_.resize(sortedNodes_.size());
+  const int n = (int)sortedNodes_.size();
+  for (int i = 0; i < n; ++i) {
+    nodeIndices_[sortedNodes_[i]] = i;
+    timings_[i].node = sortedNodes_[i];
+  }
+  findDependents();
+  // group nodes by level, for parallel processing
+  std::vector<int> nodeLevels(n, 0);
+  for (int i = 0; i < n; ++i) {
+    if (nodeLevels[i] >= (int)levels_.size()) {
+      levels_.resize(nodeLevels[i] + 1);
+    }
+    levels_[nodeLevels[i]].push_back(i);
+    for (auto d : nodeData_[i].dependents) {
+      nodeLevels[d] = std::max(nodeLevels[d], nodeLevels[i] + 1);
+    }
+  }
+  fuseNodes();
   // update render target descriptions
-  for (int i = 0; i < sortedNodes_.size(); ++i) {
+  prepareNodes();
+  // create resources shared by all nodes
+  commonParameterBuffer_ =
+      gfx::Buffer::dynamic(gfx_, sizeof(CommonParameters));
+  commonParameters_ = gfx::ConstantBufferView{commonParameterBuffer_, 0,
+                                              sizeof(CommonParameters)};
+  quadVertexBuffer_ = gfx::Buffer{gfx_, QUAD_VERTICES, sizeof(QUAD_VERTICES)};
+  quadVertices_ =
+      gfx::VertexBufferView{quadVertexBuffer_, 0, sizeof(QUAD_VERTICES)};
+}
+
+ImgEvaluator::~ImgEvaluator() {
+  for (auto &&data : nodeData_) {
+    releaseCachedImages(data);
+    for (auto &&q : data.timerQueries) {
+      if (q.begin) {
+        gfx_.deleteQuery(q.begin);
+        gfx_.deleteQuery(q.end);
+      }
+    }
+  }
+  network_.unlock();
+}
+
+void ImgEvaluator::runPerLevel(const std::function<void(int)> &fn) {
+  auto &scheduler = util::TaskScheduler::instance();
+  for (auto &&level : levels_) {
+    scheduler.parallelFor((int)level.size(),
+                          [&](int k) { fn(level[k]); });
+  }
+}
+
+void ImgEvaluator::findDependents() {
+  // the network is locked: dependencies between nodes cannot change
+  const int n = (int)sortedNodes_.size();
+  for (int i = 0; i < n; ++i) {
+    auto &data = nodeData_[i];
+    auto  dependents = sortedNodes_[i]->dependentNodes();
+    data.isResult = dependents.empty();
+    data.dependents.clear();
+    for (auto d : dependents) {
+      auto it = nodeIndices_.find(d);
+      if (it == nodeIndices_.end()) {
+        // read by something that is not evaluated by us
+        data.isResult = true;
+      } else {
+        data.dependents.push_back(it->second);
+      }
+    }
+  }
+}
+
+void ImgEvaluator::fuseNodes() {
+  const int n = (int)sortedNodes_.size();
+  auto      pointwise = [&](int i) {
+    auto node = static_cast<ImgNode *>(sortedNodes_[i]);
+    return node->isPointwise() && node->inputCount() == 1 &&
+           node->outputCount() == 1;
+  };
+
+  // a node is fused with its consumer if both are point-wise, and the
+  // consumer is the only reader of its output
+  std::vector<int> next(n, -1);
+  std::vector<int> prev(n, -1);
+  for (int i = 0; i < n; ++i) {
+    auto &data = nodeData_[i];
+    auto  node = static_cast<ImgNode *>(sortedNodes_[i]);
+    data.codeVersion = node->codeVersion();
+    data.pointwise = node->isPointwise();
+    data.fusedInto = -1;
+    data.fusedPass = nullptr;
+  }
+  for (int i = 0; i < n; ++i) {
+    auto &data = nodeData_[i];
+    if (!pointwise(i) || data.isResult || data.dependents.size() != 1) {
+      continue;
+    }
+    const int j = data.dependents[0];
+    if (pointwise(j) &&
+        sortedNodes_[j]->referenceCount(sortedNodes_[i],
+                                        sortedNodes_[i]->output(0)) == 1) {
+      next[i] = j;
+      prev[j] = i;
+    }
+  }
+
+  for (int i = 0; i < n; ++i) {
+    if (next[i] < 0 || prev[i] >= 0) {
+      continue;
+    }
+    // i starts a chain
+    std::vector<ImgNode *> chain;
+    std::vector<int>       members;
+    for (int k = i; k >= 0; k = next[k]) {
+      chain.push_back(static_cast<ImgNode *>(sortedNodes_[k]));
+      members.push_back(k);
+    }
+    const int last = members.back();
+    for (size_t k = 0; k + 1 < members.size(); ++k) {
+      nodeData_[members[k]].fusedInto = last;
+      nodeData_[members[k]].dependents.clear();
+    }
+    nodeData_[last].fusedPass = std::make_shared<FusedPass>(std::move(chain));
+  }
+
+  // the outputs read by the first node of a chain are read when the last
+  // node executes
+  for (auto &&data : nodeData_) {
+    for (auto &&d : data.dependents) {
+      if (nodeData_[d].fusedInto >= 0) {
+        d = nodeData_[d].fusedInto;
+      }
+    }
+    std::sort(data.dependents.begin(), data.dependents.end());
+    data.dependents.erase(
+        std::unique(data.dependents.begin(), data.dependents.end()),
+        data.dependents.end());
+  }
+
+  // debug
+  util::log("=== Execution plan: ===");
+  for (int i = 0; i < n; ++i) {
+    auto &data = nodeData_[i];
+    if (data.fusedInto >= 0) {
+      continue;
+    }
+    if (data.fusedPass) {
+      std::string names;
+      for (auto node : data.fusedPass->nodes()) {
+        names += names.empty() ? "" : " + ";
+        names += node->name().to_string();
+      }
+      util::log(" - [fused] {}", names);
+    } else {
+      util::log(" - {}", sortedNodes_[i]->name().to_string());
+    }
+  }
+}
+
+void ImgEvaluator::updateFusionPlan() {
+  // the code of a node can change while the network is locked, and with it
+  // whether the node can be fused
+  const int n = (int)sortedNodes_.size();
+  bool      changed = false;
+  for (int i = 0; i < n; ++i) {
+    auto &data = nodeData_[i];
+    auto  node = static_cast<ImgNode *>(sortedNodes_[i]);
+    if (node->codeVersion() != data.codeVersion) {
+      data.codeVersion = node->codeVersion();
+      changed = changed || node->isPointwise() != data.pointwise;
+    }
+  }
+  if (!changed) {
+    return;
+  }
+  findDependents();
+  fuseNodes();
+  // the nodes that left a chain need their render targets back
+  prepareNodes();
+  executeAll_ = true;
+}
+
+void ImgEvaluator::prepareNodes() {
+  runPerLevel([this](int i) {
     auto       imgNode = static_cast<ImgNode *>(sortedNodes_[i]);
     ImgContext ctx(*this, *imgNode, nodeData_[i]);
+    nodeData_[i].halo = 0;
     imgNode->prepare(ctx);
+  });
+  // the outputs of fused nodes, except the last one, stay in registers
+  const int n = (int)sortedNodes_.size();
+  for (int i = 0; i < n; ++i) {
+    auto &data = nodeData_[i];
+    if (data.fusedInto < 0) {
+      continue;
+    }
+    auto       imgNode = static_cast<ImgNode *>(sortedNodes_[i]);
+    ImgContext ctx(*this, *imgNode, data);
+    while (!data.renderTargets.empty()) {
+      ctx.deleteRenderTarget(data.renderTargets.back().name);
+    }
   }
   // debug
   util::log("=== Render targets: ===");
-  for (int i = 0; i < sortedNodes_.size(); ++i) {
+  for (int i = 0; i < n; ++i) {
     auto imgNode = static_cast<ImgNode *>(sortedNodes_[i]);
     for (auto &&rt : nodeData_[i].renderTargets) {
       util::log(" - [{}]{} {}x{}", imgNode->name().to_string(), rt.name,
@@ -36,21 +267,732 @@ ImgEvaluator::ImgEvaluator(gfx::GraphicsBackend &gfx, ImgNetwork &network)
   }
 }
 
-ImgEvaluator::~ImgEvaluator() { network_.unlock(); }
+void ImgEvaluator::defaultImageSize(int &width, int &height) const {
+  // rounded up, so that proxies cover the whole image
+  width = (defaultWidth_ + proxyScale_ - 1) / proxyScale_;
+  height = (defaultHeight_ + proxyScale_ - 1) / proxyScale_;
+}
 
-void ImgEvaluator::defaultImageSize(int &width, int &height) const {}
+void ImgEvaluator::imageSize(int &width, int &height) const {
+  if (tiled_) {
+    width = imageWidth_;
+    height = imageHeight_;
+  } else {
+    defaultImageSize(width, height);
+  }
+}
 
-void ImgEvaluator::setDefaultImageSize(int width, int height) {}
+void ImgEvaluator::tileOrigin(int &x, int &y) const {
+  x = tileOriginX_;
+  y = tileOriginY_;
+}
 
-gfx::Format ImgEvaluator::defaultImageFormat() const {
-	return defaultFormat_;
+void ImgEvaluator::setDefaultImageSize(int width, int height) {
+  if (defaultWidth_ == width && defaultHeight_ == height) {
+    return;
+  }
+  defaultWidth_ = width;
+  defaultHeight_ = height;
+  // render target descriptions may depend on the default size
+  prepareNodes();
+  nextProxyLevel_ = 0;
+  refined_ = false;
 }
 
-void ImgEvaluator::setDefaultImageFormat(gfx::Format format) {}
+void ImgEvaluator::setProxyScale(int scale) {
+  if (scale < 1) {
+    throw std::logic_error{"invalid proxy scale"};
+  }
+  if (proxyScale_ == scale) {
+    return;
+  }
+  proxyScale_ = scale;
+  prepareNodes();
+}
 
-void ImgEvaluator::evaluate() {}
+void ImgEvaluator::setTime(double seconds) {
+  if (currentTime_ == seconds) {
+    return;
+  }
+  currentTime_ = seconds;
+  // nodes do not tell whether they depend on the time
+  executeAll_ = true;
+}
 
-void ImgEvaluator::allocateRenderTargets() {}
+void ImgEvaluator::setProxyLevels(std::vector<int> scales) {
+  for (size_t i = 0; i < scales.size(); ++i) {
+    if (scales[i] <= 1 || (i > 0 && scales[i] >= scales[i - 1])) {
+      throw std::logic_error{
+          "proxy levels must be decreasing scales greater than 1"};
+    }
+  }
+  proxyLevels_ = std::move(scales);
+  nextProxyLevel_ = 0;
+  refined_ = false;
+}
+
+bool ImgEvaluator::refinementPending() const { return !refined_; }
+
+bool ImgEvaluator::evaluateProgressive() {
+  const int  levelCount = (int)proxyLevels_.size();
+  const auto modifications = network_.modificationCount();
+  if (modifications != progressiveModificationCount_) {
+    // an edit: the pending refinement would compute stale results
+    progressiveModificationCount_ = modifications;
+    nextProxyLevel_ = 0;
+    refined_ = false;
+  }
+  // once refined, stay at full resolution: only the modified nodes execute
+  const int level = refined_ ? levelCount : nextProxyLevel_;
+  setProxyScale(level < levelCount ? proxyLevels_[level] : 1);
+  evaluate();
+
+  if (needsReexecution()) {
+    // nodes waiting for work in the background (shaders compiling, uploads,
+    // pages loading): the next step evaluates the same level again
+    return true;
+  }
+  if (level < levelCount) {
+    nextProxyLevel_ = level + 1;
+    return true;
+  }
+  refined_ = true;
+  return false;
+}
+
+gfx::Format ImgEvaluator::defaultImageFormat() const { return defaultFormat_; }
+
+void ImgEvaluator::setDefaultImageFormat(gfx::Format format) {
+  if (defaultFormat_ == format) {
+    return;
+  }
+  defaultFormat_ = format;
+  prepareNodes();
+}
+
+ImgNodeData *ImgEvaluator::nodeData(node::Node *node) {
+  auto it = nodeIndices_.find(node);
+  if (it == nodeIndices_.end()) {
+    return nullptr;
+  }
+  return &nodeData_[it->second];
+}
+
+void ImgEvaluator::evaluate() {
+  using clock = std::chrono::steady_clock;
+
+  updateFusionPlan();
+  gfx_.beginFrame();
+  allocateRenderTargets();
+  updateCommonParameters();
+  propagateRegions();
+  scheduleNodes();
+  computeContentHashes();
+  lookupCachedOutputs();
+  // CPU-side work, in parallel
+  updateNodes();
+
+  // record commands
+  const int n = (int)sortedNodes_.size();
+  for (int i = 0; i < n; ++i) {
+    if (!executeMask_[i]) {
+      timings_[i].executed = false;
+      timings_[i].restoredFromCache = false;
+      timings_[i].cpuTimeMs = 0.0;
+      continue;
+    }
+
+    auto  imgNode = static_cast<ImgNode *>(sortedNodes_[i]);
+    auto &data = nodeData_[i];
+    data.recordedGeneration = renderTargetCache_->allocationGeneration();
+    data.recordedRegion = data.region;
+    timings_[i].restoredFromCache = data.restoredFromCache;
+    if (data.restoredFromCache) {
+      restoreCachedOutputs(i);
+      timings_[i].executed = false;
+      timings_[i].cpuTimeMs = 0.0;
+      continue;
+    }
+
+    data.commands.reset();
+    data.staleOutputs = false;
+    ImgContext ctx{*this, *imgNode, data};
+    auto       start = clock::now();
+    if (data.fusedPass) {
+      executeFusedPass(ctx, *data.fusedPass);
+    } else {
+      imgNode->execute(ctx);
+    }
+    auto end = clock::now();
+    imgNode->resetDirty();
+    storeCachedOutputs(i);
+
+    timings_[i].executed = true;
+    timings_[i].cpuTimeMs =
+        std::chrono::duration<double, std::milli>(end - start).count();
+  }
+
+  // nodes that asked to be executed again: this must happen after the loop
+  // above, which cleans the dependents of the node
+  for (int i = 0; i < n; ++i) {
+    if (nodeData_[i].reexecute) {
+      nodeData_[i].reexecute = false;
+      sortedNodes_[i]->markDirtyForReexecution();
+    }
+  }
+
+  // submit
+  const int slot = currentFrame_ % TIMER_QUERY_LATENCY;
+  gfx_.submit(frameCommands_);
+  for (int i = 0; i < n; ++i) {
+    auto &data = nodeData_[i];
+    auto &q = data.timerQueries[slot];
+
+    // the queries of this slot were issued TIMER_QUERY_LATENCY evaluations
+    // ago, their results should be available by now
+    readTimerQueries(i, q);
+
+    if (!executeMask_[i]) {
+      continue;
+    }
+
+    if (!q.begin) {
+      q.begin = gfx_.createTimestampQuery();
+      q.end = gfx_.createTimestampQuery();
+    }
+    gfx_.writeTimestamp(q.begin);
+    gfx_.submit(data.commands);
+    gfx_.writeTimestamp(q.end);
+    q.pending = true;
+
+    for (auto &&rt : data.renderTargets) {
+      renderTargetCache_->markContentsValid(rt.target);
+    }
+  }
+
+  gfx_.endFrame();
+  currentFrame_++;
+}
+
+bool ImgEvaluator::replay() {
+  if (executeAll_) {
+    // e.g. a new time: the recorded commands (including the copies into the
+    // output cache, keyed by the previous state) are out of date
+    return false;
+  }
+  allocateRenderTargets();
+  propagateRegions();
+  const int generation = renderTargetCache_->allocationGeneration();
+  const int n = (int)sortedNodes_.size();
+  for (int i = 0; i < n; ++i) {
+    if (nodeData_[i].fusedInto >= 0) {
+      // recorded by the last node of the chain
+      continue;
+    }
+    if (sortedNodes_[i]->isDirty() ||
+        nodeData_[i].recordedGeneration != generation ||
+        nodeData_[i].recordedRegion != nodeData_[i].region) {
+      return false;
+    }
+  }
+
+  gfx_.beginFrame();
+  updateCommonParameters();
+  gfx_.submit(frameCommands_);
+  for (auto &&data : nodeData_) {
+    gfx_.submit(data.commands);
+    for (auto &&rt : data.renderTargets) {
+      renderTargetCache_->markContentsValid(rt.target);
+    }
+  }
+  gfx_.endFrame();
+
+  currentFrame_++;
+  return true;
+}
+
+void ImgEvaluator::evaluateTiled(const TiledEvaluationDesc &desc,
+                                 const ImgTileSink &        sink) {
+  auto it = nodeIndices_.find(desc.outputNode);
+  if (it == nodeIndices_.end()) {
+    throw std::logic_error{"output node is not evaluated by this evaluator"};
+  }
+  const int outputIndex = it->second;
+  if (nodeData_[outputIndex].fusedInto >= 0) {
+    throw std::logic_error{"the output of a fused node cannot be streamed"};
+  }
+  if (desc.width <= 0 || desc.height <= 0 || desc.tileSize <= 0) {
+    throw std::logic_error{"invalid image or tile size"};
+  }
+  auto outputNode = static_cast<ImgNode *>(desc.outputNode);
+  std::string outputName = desc.outputName;
+  if (outputName.empty()) {
+    if (!outputNode->outputCount()) {
+      throw std::logic_error{"output node has no outputs"};
+    }
+    outputName = outputNode->outputName(outputNode->output(0)).to_string();
+  }
+
+  // tiles are always evaluated at full resolution
+  setProxyScale(1);
+  refined_ = false;
+  const int savedWidth = defaultWidth_;
+  const int savedHeight = defaultHeight_;
+  tiled_ = true;
+  imageWidth_ = desc.width;
+  imageHeight_ = desc.height;
+  streamedNode_ = outputIndex;
+
+  try {
+    // the halos are declared in prepare(): prepare once to get them, then
+    // again with the size of the padded tiles
+    prepareNodes();
+    const int padding = tilePadding(outputIndex);
+    const int targetSize = desc.tileSize + 2 * padding;
+    util::log("tiled evaluation: {}x{} image, {}px tiles, {}px padding",
+              desc.width, desc.height, desc.tileSize, padding);
+    defaultWidth_ = targetSize;
+    defaultHeight_ = targetSize;
+    prepareNodes();
+    // the commands recorded before do not match the new render targets
+    executeAll_ = true;
+    const bool tileDependent =
+        std::any_of(sortedNodes_.begin(), sortedNodes_.end(),
+                    [](node::Node *node) {
+                      return static_cast<ImgNode *>(node)->dependsOnTile();
+                    });
+
+    for (int ty = 0; ty * desc.tileSize < desc.height; ++ty) {
+      for (int tx = 0; tx * desc.tileSize < desc.width; ++tx) {
+        ImgTile tile;
+        tile.region = gfx::Rect{tx * desc.tileSize, ty * desc.tileSize,
+                                desc.tileSize, desc.tileSize}
+                          .intersected(gfx::Rect{0, 0, desc.width, desc.height});
+        tileOriginX_ = tile.region.x - padding;
+        tileOriginY_ = tile.region.y - padding;
+        // only the common parameters differ between tiles, unless nodes
+        // must execute again (e.g. because their shaders were compiling) or
+        // record different commands for each tile. Clean nodes would keep
+        // the outputs of the previous tile: execute them all.
+        executeAll_ = executeAll_ || tileDependent;
+        if (!replay()) {
+          do {
+            evaluate();
+          } while (needsReexecution());
+        }
+        ImgContext ctx{*this, *outputNode, nodeData_[outputIndex]};
+        tile.image = outputNode->getOutputImage(ctx, outputName);
+        tile.x = padding;
+        tile.y = padding;
+        sink(tile);
+      }
+    }
+  } catch (...) {
+    endTiledEvaluation(savedWidth, savedHeight);
+    throw;
+  }
+  endTiledEvaluation(savedWidth, savedHeight);
+}
+
+void ImgEvaluator::endTiledEvaluation(int savedWidth, int savedHeight) {
+  tiled_ = false;
+  tileOriginX_ = 0;
+  tileOriginY_ = 0;
+  streamedNode_ = -1;
+  defaultWidth_ = savedWidth;
+  defaultHeight_ = savedHeight;
+  prepareNodes();
+  // the recorded commands render tiles
+  executeAll_ = true;
+}
+
+int ImgEvaluator::tilePadding(int outputIndex) const {
+  // Render targets all cover the tile extended by the padding. Near the
+  // edges of the render targets, nodes read pixels that their inputs did not
+  // compute: the invalid border grows by the halo of each node. The padding
+  // must absorb the largest growth along a path to the output.
+  const int        n = (int)sortedNodes_.size();
+  std::vector<int> border(n, 0);
+  for (int i = 0; i < n; ++i) {
+    border[i] += nodeData_[i].halo;
+    for (auto d : nodeData_[i].dependents) {
+      border[d] = std::max(border[d], border[i]);
+    }
+  }
+  return border[outputIndex];
+}
+
+bool ImgEvaluator::needsReexecution() const {
+  for (auto node : sortedNodes_) {
+    if (node->isDirty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ImgEvaluator::executeFusedPass(ImgContext &ctx, FusedPass &pass) {
+  auto  first = pass.nodes().front();
+  auto &firstData = nodeData_[nodeIndices_[first]];
+  // the input of the chain is resolved in the context of its first node
+  ImgContext firstCtx{*this, *first, firstData};
+  auto       input = firstCtx.getInputImage(first->input(0));
+  pass.execute(ctx, input);
+  // the other nodes of the chain are executed by the pass
+  for (auto node : pass.nodes()) {
+    node->resetDirty();
+  }
+}
+
+void ImgEvaluator::updateNodes() {
+  using clock = std::chrono::steady_clock;
+  runPerLevel([this](int i) {
+    if (!executeMask_[i] || nodeData_[i].restoredFromCache) {
+      timings_[i].updateTimeMs = 0.0;
+      return;
+    }
+    auto       imgNode = static_cast<ImgNode *>(sortedNodes_[i]);
+    ImgContext ctx(*this, *imgNode, nodeData_[i]);
+    auto       start = clock::now();
+    imgNode->update(ctx);
+    auto end = clock::now();
+    timings_[i].updateTimeMs =
+        std::chrono::duration<double, std::milli>(end - start).count();
+  });
+}
+
+void ImgEvaluator::scheduleNodes() {
+  const int n = (int)sortedNodes_.size();
+  executeMask_.assign(n, false);
+  for (int i = 0; i < n; ++i) {
+    // fused nodes are executed by the last node of their chain, which is
+    // dirty if any of them is
+    executeMask_[i] = (executeAll_ || sortedNodes_[i]->isDirty()) &&
+                      nodeData_[i].fusedInto < 0;
+  }
+  executeAll_ = false;
+
+  // A clean node must also be executed if its outputs are needed (by a node
+  // that executes, or because they are results of the evaluation) but have
+  // not been preserved since the last time it executed. Executing a clean
+  // node can in turn invalidate the outputs of other nodes sharing the same
+  // images, so iterate until nothing changes.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    // visit consumers before producers so that most of the work is done in
+    // one pass
+    for (int i = n - 1; i >= 0; --i) {
+      if (executeMask_[i]) {
+        continue;
+      }
+      auto &data = nodeData_[i];
+      bool  needed = data.isResult;
+      for (auto d : data.dependents) {
+        needed = needed || executeMask_[d];
+      }
+      if (needed && !outputsPreserved(i)) {
+        executeMask_[i] = true;
+        changed = true;
+      }
+    }
+  }
+}
+
+bool ImgEvaluator::outputsPreserved(int nodeIndex) {
+  // the node may have computed a smaller region than needed now
+  auto &data = nodeData_[nodeIndex];
+  if (!data.recordedRegion.contains(data.region)) {
+    return false;
+  }
+  auto &cache = *renderTargetCache_;
+  for (auto &&rt : nodeData_[nodeIndex].renderTargets) {
+    if (!cache.hasValidContents(rt.target)) {
+      return false;
+    }
+    // The image must not be overwritten by another node before the
+    // consumers read it. Nodes executing after this one cannot share the
+    // image until the last consumer has executed, so only nodes before this
+    // one need to be checked.
+    auto image = cache.getImage(rt.target);
+    for (int k = 0; k < nodeIndex; ++k) {
+      if (!executeMask_[k]) {
+        continue;
+      }
+      for (auto &&other : nodeData_[k].renderTargets) {
+        if (cache.getImage(other.target) == image) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void ImgEvaluator::readTimerQueries(int nodeIndex, ImgNodeData::TimerQuery &q) {
+  if (!q.pending) {
+    // the node was not executed in that evaluation
+    timings_[nodeIndex].gpuTimeMs = 0.0;
+    return;
+  }
+  uint64_t begin, end;
+  if (gfx_.getQueryResult(q.begin, begin) &&
+      gfx_.getQueryResult(q.end, end)) {
+    timings_[nodeIndex].gpuTimeMs = (double)(end - begin) * 1e-6;
+  }
+  // if the results are still not available, they are discarded: the queries
+  // will be issued again
+  q.pending = false;
+}
+
+double ImgEvaluator::totalCpuTimeMs() const {
+  double total = 0.0;
+  for (auto &&t : timings_) {
+    total += t.cpuTimeMs;
+  }
+  return total;
+}
+
+double ImgEvaluator::totalGpuTimeMs() const {
+  double total = 0.0;
+  for (auto &&t : timings_) {
+    total += t.gpuTimeMs;
+  }
+  return total;
+}
+
+void ImgEvaluator::setRenderTargetAliasing(bool enabled) {
+  renderTargetAliasing_ = enabled;
+}
+
+void ImgEvaluator::setRegionOfInterest(const gfx::Rect &region) {
+  regionOfInterest_ = region;
+}
+
+void ImgEvaluator::setOutputCacheBudget(size_t bytes) {
+  renderTargetCache_->setImageCacheBudget(bytes);
+}
+
+void ImgEvaluator::computeContentHashes() {
+  const int n = (int)sortedNodes_.size();
+  for (int i = 0; i < n; ++i) {
+    auto  node = static_cast<ImgNode *>(sortedNodes_[i]);
+    auto &data = nodeData_[i];
+    auto  type = typeid(*node).name();
+    auto  hash = util::fnv1a64(type, std::strlen(type));
+    // tiles differ only by common parameters, which are not hashed
+    ImgContext ctx{*this, *node, data};
+    bool       cacheable = !tiled_ && node->hashState(ctx, hash);
+    for (int p = 0; p < node->paramCount(); ++p) {
+      hash = node->evalParam(*node->param(p)).hash(hash);
+    }
+    for (int k = 0; k < node->inputCount(); ++k) {
+      node::Node *  source = nullptr;
+      node::Output *output = nullptr;
+      if (!node->inputSource(node->input(k), source, output)) {
+        util::fnv1a64Combine(hash, -1);
+        continue;
+      }
+      auto it = nodeIndices_.find(source);
+      if (it == nodeIndices_.end()) {
+        // not evaluated by us: its state is unknown
+        cacheable = false;
+        continue;
+      }
+      auto &&sourceData = nodeData_[it->second];
+      cacheable = cacheable && sourceData.cacheable;
+      util::fnv1a64Combine(hash, sourceData.contentHash);
+      util::fnv1a64Combine(hash, source->outputUniqueId(output));
+    }
+    // parameters in pixels are scaled in proxies
+    util::fnv1a64Combine(hash, proxyScale_);
+    util::fnv1a64Combine(hash, currentTime_);
+    data.contentHash = hash;
+    data.cacheable = cacheable;
+  }
+}
+
+// Key of a render target of a node in the output cache.
+static uint64_t outputCacheKey(const ImgNodeData &              data,
+                               const ImgNodeData::RenderTarget &rt) {
+  return util::fnv1a64(rt.name.data(), rt.name.size(), data.contentHash);
+}
+
+// Part of a render target computed by the node: regions can extend past the
+// image.
+static gfx::Rect outputCacheRegion(const ImgNodeData &              data,
+                                   const ImgNodeData::RenderTarget &rt) {
+  return data.region.intersected(
+      gfx::Rect{0, 0, rt.desc.width, rt.desc.height});
+}
+
+void ImgEvaluator::lookupCachedOutputs() {
+  auto &    cache = *renderTargetCache_;
+  const int n = (int)sortedNodes_.size();
+  for (int i = 0; i < n; ++i) {
+    auto &data = nodeData_[i];
+    data.restoredFromCache = false;
+    if (!executeMask_[i]) {
+      continue;
+    }
+    // the commands referencing the cached images are recorded again
+    releaseCachedImages(data);
+    if (!data.cacheable || !cache.imageCacheBudget() ||
+        data.renderTargets.empty()) {
+      continue;
+    }
+    bool hit = true;
+    for (auto &&rt : data.renderTargets) {
+      auto img = cache.findCachedImage(outputCacheKey(data, rt), rt.desc,
+                                       outputCacheRegion(data, rt));
+      if (!img) {
+        hit = false;
+        break;
+      }
+      // pinned so that storing the outputs of other nodes does not evict it
+      cache.pinCachedImage(img);
+      data.cachedImages.push_back(img);
+    }
+    if (hit) {
+      data.restoredFromCache = true;
+    } else {
+      releaseCachedImages(data);
+    }
+  }
+}
+
+void ImgEvaluator::restoreCachedOutputs(int nodeIndex) {
+  auto &data = nodeData_[nodeIndex];
+  auto &cache = *renderTargetCache_;
+  data.commands.reset();
+  for (size_t k = 0; k < data.renderTargets.size(); ++k) {
+    auto &&rt = data.renderTargets[k];
+    data.commands.copyImage(cache.getCachedImage(data.cachedImages[k]),
+                            cache.getImage(rt.target),
+                            outputCacheRegion(data, rt));
+  }
+  sortedNodes_[nodeIndex]->resetDirty();
+  if (data.fusedPass) {
+    for (auto node : data.fusedPass->nodes()) {
+      node->resetDirty();
+    }
+  }
+}
+
+void ImgEvaluator::storeCachedOutputs(int nodeIndex) {
+  auto &data = nodeData_[nodeIndex];
+  auto &cache = *renderTargetCache_;
+  // outputs waiting for a shader do not match the hash
+  if (!data.cacheable || data.staleOutputs || data.reexecute ||
+      !cache.imageCacheBudget()) {
+    return;
+  }
+  for (auto &&rt : data.renderTargets) {
+    const auto region = outputCacheRegion(data, rt);
+    if (region.empty()) {
+      continue;
+    }
+    auto img = cache.insertCachedImage(outputCacheKey(data, rt), rt.desc,
+                                       region);
+    if (!img) {
+      // larger than the budget
+      continue;
+    }
+    // copied after the commands of the node, and again on replay
+    data.commands.copyImage(cache.getImage(rt.target),
+                            cache.getCachedImage(img), region);
+    cache.pinCachedImage(img);
+    data.cachedImages.push_back(img);
+  }
+}
+
+void ImgEvaluator::releaseCachedImages(ImgNodeData &data) {
+  for (auto img : data.cachedImages) {
+    renderTargetCache_->unpinCachedImage(img);
+  }
+  data.cachedImages.clear();
+}
+
+void ImgEvaluator::propagateRegions() {
+  int width, height;
+  defaultImageSize(width, height);
+  const gfx::Rect image{0, 0, width, height};
+  gfx::Rect       requested = image;
+  if (!tiled_ && !regionOfInterest_.empty()) {
+    // the region is in pixels of the full resolution image
+    const int s = proxyScale_;
+    const int x0 = regionOfInterest_.x / s;
+    const int y0 = regionOfInterest_.y / s;
+    const int x1 = (regionOfInterest_.right() + s - 1) / s;
+    const int y1 = (regionOfInterest_.bottom() + s - 1) / s;
+    requested = gfx::Rect{x0, y0, x1 - x0, y1 - y0}.intersected(image);
+  }
+  // consumers are visited before producers
+  for (int i = (int)sortedNodes_.size() - 1; i >= 0; --i) {
+    auto &data = nodeData_[i];
+    data.region = data.isResult ? requested : gfx::Rect{};
+    for (auto d : data.dependents) {
+      auto &&consumer = nodeData_[d];
+      data.region =
+          data.region.united(consumer.region.inflated(consumer.halo));
+    }
+  }
+}
+
+void ImgEvaluator::allocateRenderTargets() {
+  for (auto &&data : nodeData_) {
+    for (auto &&rt : data.renderTargets) {
+      if (!rt.target) {
+        rt.target = renderTargetCache_->createRenderTarget(rt.desc);
+      } else {
+        // does nothing if the description has not changed
+        renderTargetCache_->setRenderTargetDesc(rt.target, rt.desc);
+      }
+    }
+  }
+  updateRenderTargetLifetimes();
+  // does nothing if neither the descriptions nor the lifetimes have changed
+  renderTargetCache_->allocateImages();
+}
+
+void ImgEvaluator::updateRenderTargetLifetimes() {
+  // The render targets of a node are written when the node executes, and
+  // must be preserved until the last node that depends on it has executed.
+  // Nodes without dependents are the results of the network: their render
+  // targets are kept until the end of the frame.
+  const int n = (int)sortedNodes_.size();
+  for (int i = 0; i < n; ++i) {
+    auto &data = nodeData_[i];
+    int   lastUse = i;
+    if (!renderTargetAliasing_ || data.isResult || i == streamedNode_) {
+      lastUse = INT_MAX;
+    } else {
+      for (auto d : data.dependents) {
+        lastUse = std::max(lastUse, d);
+      }
+    }
+    for (auto &&rt : data.renderTargets) {
+      renderTargetCache_->setRenderTargetLifetime(rt.target, i, lastUse);
+    }
+  }
+}
+
+void ImgEvaluator::updateCommonParameters() {
+  CommonParameters params;
+  params.time = (float)currentTime_;
+  params.frame = currentFrame_;
+  int width, height;
+  imageSize(width, height);
+  params.resolution[0] = (float)width;
+  params.resolution[1] = (float)height;
+  params.tileOrigin[0] = (float)tileOriginX_;
+  params.tileOrigin[1] = (float)tileOriginY_;
+  // the buffer is dynamic: it must be updated before each submission of the
+  // node commands that reference it
+  frameCommands_.reset();
+  frameCommands_.updateBuffer(commonParameterBuffer_, 0, &params,
+                              sizeof(params));
+}
 
 //-----------------------------------------------------------------------------
 ImgContext::ImgContext(ImgEvaluator &evaluator, ImgNode &node,
@@ -61,8 +1003,14 @@ gfx::ImageHandle ImgContext::getInputImage(node::Input *input) {
   Node *  srcNode;
   Output *srcOutput;
   if (node_.inputSource(input, srcNode, srcOutput)) {
-    ImgNode *imgNode = static_cast<ImgNode *>(srcNode);
-    return imgNode->getOutputImage(*this, imgNode->outputName(srcOutput));
+    ImgNode *    imgNode = static_cast<ImgNode *>(srcNode);
+    ImgNodeData *srcData = evaluator_.nodeData(srcNode);
+    if (!srcData) {
+      return 0;
+    }
+    // resolve the output image in the context of the source node
+    ImgContext srcCtx{evaluator_, *imgNode, *srcData};
+    return imgNode->getOutputImage(srcCtx, imgNode->outputName(srcOutput));
   }
   return 0;
 }
@@ -93,8 +1041,8 @@ ImgContext::findOrCreateRenderTarget(util::StringRef name) {
 void ImgContext::setRenderTargetDesc(util::StringRef       name,
                                      const gfx::ImageDesc &desc) {
   auto rt = findOrCreateRenderTarget(name);
+  // the concrete image is (re)assigned by the evaluator before execution
   rt->desc = desc;
-  rt->shared = nullptr;
 }
 
 const gfx::ImageDesc *
@@ -105,17 +1053,38 @@ ImgContext::getRenderTargetDesc(util::StringRef renderTarget) const {
   return &rt->desc;
 }
 
-void ImgContext::deleteRenderTarget(util::StringRef renderTarget) 
-{
-
+void ImgContext::deleteRenderTarget(util::StringRef renderTarget) {
+  auto &rts = nodeData_.renderTargets;
+  for (auto it = rts.begin(); it != rts.end(); ++it) {
+    if (it->name == renderTarget) {
+      if (it->target) {
+        evaluator_.renderTargetCache().deleteRenderTarget(it->target);
+      }
+      rts.erase(it);
+      return;
+    }
+  }
 }
 
 gfx::RenderTargetView
 ImgContext::getRenderTargetView(util::StringRef renderTarget) {
-	auto rt = findRenderTarget(renderTarget);
-	if (!rt)
-		return gfx::RenderTargetView{0};
-	return gfx::RenderTargetView{ rt->shared->image };
+  auto rt = findRenderTarget(renderTarget);
+  if (!rt || !rt->target)
+    return gfx::RenderTargetView{0};
+  return gfx::RenderTargetView{
+      evaluator_.renderTargetCache().getImage(rt->target)};
+}
+
+gfx::StorageImageView
+ImgContext::getStorageImageView(util::StringRef renderTarget) {
+  auto rt = findRenderTarget(renderTarget);
+  if (!rt || !rt->target)
+    return gfx::StorageImageView{0, 0};
+  if (!(rt->desc.usage & gfx::ImageUsageFlags::Storage)) {
+    throw std::logic_error{"render target cannot be used as a storage image"};
+  }
+  return gfx::StorageImageView{
+      evaluator_.renderTargetCache().getImage(rt->target), 0};
 }
 
-} // namespace img
\ No newline at end of file
+} // namespace img
@@ -1,63 +1,417 @@
 #pragma once
+#include "gfx/commandbuffer.h"
 #include "gfx/gfx.h"
 #include "gfx/image.h"
+#include "gfx/rect.h"
+#include "gfx/signature.h"
 #include "img/imgnetwork.h"
 #include "img/imgnode.h"
+#include "img/rendertarget.h"
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace img {
 
-struct SharedRenderTarget {
+class FusedPass;
+
+/// Number of evaluations to wait before reading back GPU timer queries.
+constexpr int TIMER_QUERY_LATENCY = 3;
+
+/// Parameters shared by all nodes, uploaded once per evaluation (and once
+/// per tile in tiled evaluations).
+///
+/// Matches the std140 layout of the uniform block bound at index 0.
+struct CommonParameters {
+  float   time;
+  int32_t frame;
+  /// Size of the full image.
+  float resolution[2];
+  /// Position in the full image of the first pixel of the render targets:
+  /// non-zero in tiled evaluations. Shaders must add it to `gl_FragCoord` to
+  /// get positions in the image.
+  float tileOrigin[2];
+};
+
+/// Parameters of `ImgEvaluator::evaluateTiled()`.
+struct TiledEvaluationDesc {
+  /// Size of the full image, in pixels.
+  int width = 0;
+  int height = 0;
+  /// Size of the tiles, in pixels. Render targets are larger, by the
+  /// padding required by the halos of the nodes.
+  int tileSize = 1024;
+  /// The node whose output is streamed.
+  node::Node *outputNode = nullptr;
+  /// Name of the streamed output, empty for the first output of the node.
+  std::string outputName;
+};
+
+/// A tile produced by `ImgEvaluator::evaluateTiled()`.
+struct ImgTile {
+  /// Region of the full image covered by the tile. Tiles on the right and
+  /// top edges may be smaller than the tile size.
+  gfx::Rect region;
+  /// Image containing the tile, valid until the sink returns.
   gfx::ImageHandle image;
+  /// Position of the tile in `image`.
+  int x;
+  int y;
+};
+
+/// Receives the tiles of a tiled evaluation, once their commands have been
+/// submitted.
+using ImgTileSink = std::function<void(const ImgTile &tile)>;
+
+/// Vertex shader drawing `ImgEvaluator::quadVertices()`. Outputs the
+/// position at location 0 and the texture coordinates at location 1 (both
+/// `vec2`).
+extern const char QUAD_VERTEX_SHADER[];
+/// Layout of `ImgEvaluator::quadVertices()`.
+extern const gfx::VertexLayout QUAD_VERTEX_LAYOUT;
+
+/// Execution statistics of a node.
+struct ImgNodeTimings {
+  node::Node *node = nullptr;
+  /// Whether the node was executed during the last evaluation. Clean nodes
+  /// whose outputs are still valid are skipped.
+  bool executed = false;
+  /// Whether the outputs of the node were copied from the output cache
+  /// instead of executing it during the last evaluation.
+  bool restoredFromCache = false;
+  /// CPU time spent in `ImgNode::execute` during the last evaluation, in
+  /// milliseconds.
+  double cpuTimeMs = 0.0;
+  /// CPU time spent in `ImgNode::update` (on a worker thread) during the
+  /// last evaluation, in milliseconds.
+  double updateTimeMs = 0.0;
+  /// GPU time spent on the commands issued by the node, in milliseconds.
+  /// GPU timings are read back asynchronously: they lag a few evaluations
+  /// behind the CPU timings.
+  double gpuTimeMs = 0.0;
 };
 
 struct ImgNodeData {
   struct RenderTarget {
-    std::string                         name;
-    gfx::ImageDesc                      desc;
-    std::shared_ptr<SharedRenderTarget> shared;
+    std::string        name;
+    gfx::ImageDesc     desc;
+    img::RenderTarget *target = nullptr;
+  };
+
+  /// A pair of timestamp queries surrounding the execution of the node.
+  struct TimerQuery {
+    gfx::QueryHandle begin = 0;
+    gfx::QueryHandle end = 0;
+    bool             pending = false;
   };
 
-  std::vector<RenderTarget> renderTargets;
+  std::vector<RenderTarget>                   renderTargets;
+  std::array<TimerQuery, TIMER_QUERY_LATENCY> timerQueries;
+  /// Commands recorded during the last execution of the node.
+  gfx::CommandBuffer commands;
+  /// `RenderTargetCache::allocationGeneration()` at the time the commands
+  /// were recorded, -1 if the node has never been executed.
+  int recordedGeneration = -1;
+  /// Indices in the execution order of the nodes that read the outputs of
+  /// this node.
+  std::vector<int> dependents;
+  /// Whether the outputs of the node are results of the evaluation (i.e.
+  /// they are not consumed by another node of the network).
+  bool isResult = false;
+  /// Set by `ImgContext::scheduleReexecution()`.
+  bool reexecute = false;
+  /// Index of the node that executes this node in a fused pass, -1 if the
+  /// node is not fused or is the last node of the pass.
+  int fusedInto = -1;
+  /// On the last node of a fused chain, the pass executing the chain.
+  std::shared_ptr<FusedPass> fusedPass;
+  /// `ImgNode::codeVersion()` and `ImgNode::isPointwise()` when the fused
+  /// chains were last planned.
+  uint64_t codeVersion = 0;
+  bool     pointwise = false;
+  /// Set by `ImgContext::setHalo()`.
+  int halo = 0;
+  /// Region of the render targets that must be computed in the current
+  /// evaluation. See `ImgEvaluator::setRegionOfInterest()`.
+  gfx::Rect region;
+  /// Region computed by the recorded commands: the contents of the render
+  /// targets are only valid there.
+  gfx::Rect recordedRegion;
+  /// Hash of everything that determines the outputs of the node: its type,
+  /// parameters and internal state (see `ImgNode::hashState()`), and the
+  /// hashes of its inputs.
+  uint64_t contentHash = 0;
+  /// Whether the outputs of the node can be stored in the output cache.
+  bool cacheable = false;
+  /// Set by `ImgContext::markOutputsStale()`.
+  bool staleOutputs = false;
+  /// Whether the outputs are copied from the output cache in the current
+  /// evaluation.
+  bool restoredFromCache = false;
+  /// Images of the output cache referenced by `commands`, pinned until the
+  /// node is recorded again.
+  std::vector<CachedImage *> cachedImages;
 };
 
 class ImgEvaluator {
 public:
+  /// Locks the network and builds the execution plan. Chains of point-wise
+  /// nodes (see `ImgNode::isPointwise()`) are fused into a single pass
+  /// without intermediate render targets; the chains are planned again when
+  /// the code of a node changes whether it is point-wise.
   ImgEvaluator(gfx::GraphicsBackend &gfx, ImgNetwork &network);
   ~ImgEvaluator();
 
+  /// Returns the size of render targets that cover the image: the size set
+  /// with `setDefaultImageSize()`, divided by the proxy scale (rounded up).
   void defaultImageSize(int &width, int &height) const;
+  /// Sets the size of the image at full resolution (the project size).
   void setDefaultImageSize(int width, int height);
+  /// Returns the size of the whole image in pixels of the render targets:
+  /// `defaultImageSize()`, or the size of the image in tiled evaluations
+  /// (`CommonParameters::resolution`).
+  void imageSize(int &width, int &height) const;
+  /// Returns the position in the image of the origin of the render targets:
+  /// zero, or the origin of the padded tile in tiled evaluations
+  /// (`CommonParameters::tileOrigin`).
+  void tileOrigin(int &x, int &y) const;
 
   gfx::Format           defaultImageFormat() const;
   void                  setDefaultImageFormat(gfx::Format format);
   gfx::GraphicsBackend &gfx() const { return gfx_; }
+  RenderTargetCache &   renderTargetCache() const { return *renderTargetCache_; }
 
+  /// Executes the nodes of the network, in topological order.
+  ///
+  /// Only dirty nodes are executed: clean nodes keep the outputs computed
+  /// during a previous evaluation, unless they have been lost (e.g. because
+  /// of render target aliasing) and are needed by a node that executes.
+  ///
+  /// Each evaluation is a frame of the graphics backend (see
+  /// `GraphicsBackend::beginFrame()`): it must not be called inside a frame.
   void evaluate();
 
+  /// Submits again the commands recorded by all nodes during previous
+  /// evaluations, without executing the nodes. The common parameters are
+  /// updated. No timings are recorded.
+  ///
+  /// Returns false, without submitting anything, if the recorded commands
+  /// are not up-to-date (dirty nodes, reallocated render targets, or all
+  /// nodes must execute again, e.g. after `setTime()`): call `evaluate()` in
+  /// this case.
+  bool replay();
+
+  /// Evaluates an image that may be too large for the GPU, tile by tile, and
+  /// passes each tile of the specified output to `sink`, in rows from the
+  /// origin of the image.
+  ///
+  /// The render targets of all nodes are the size of a tile, extended on
+  /// each side by the sum of the halos (see `ImgContext::setHalo()`) of the
+  /// nodes on the longest path to the output, so that peak memory depends on
+  /// the tile size only. The nodes are executed for the first tile; the
+  /// commands they recorded are replayed for the other tiles with different
+  /// `CommonParameters::tileOrigin`, except nodes whose commands depend on
+  /// the tile (see `ImgNode::dependsOnTile()`): if there are any, all the
+  /// nodes are executed for each tile.
+  ///
+  /// Blocks until shaders compiling in the background are ready. The
+  /// default image size is restored afterwards.
+  void evaluateTiled(const TiledEvaluationDesc &desc,
+                     const ImgTileSink &        sink);
+
+  /// Enables or disables sharing of backing images between render targets
+  /// whose lifetimes do not overlap (enabled by default).
+  ///
+  /// When enabled, the contents of a render target are only valid until the
+  /// last node that reads it has executed: disable it to inspect
+  /// intermediate results of the network after evaluation.
+  void setRenderTargetAliasing(bool enabled);
+  bool renderTargetAliasing() const { return renderTargetAliasing_; }
+
+  /// Restricts the evaluation to a region of the results, in pixels of the
+  /// default image size (e.g. the part of the image visible in a zoomed-in
+  /// viewer). The region is propagated backwards through the network: each
+  /// node computes the region read by the nodes that consume its outputs,
+  /// extended by their halos (see `ImgContext::setHalo()`). An empty
+  /// rectangle (the default) evaluates the whole image.
+  ///
+  /// Outputs are only valid inside the region. Ignored by tiled evaluations.
+  void      setRegionOfInterest(const gfx::Rect &region);
+  gfx::Rect regionOfInterest() const { return regionOfInterest_; }
+
+  //------ Output cache ------
+
+  /// Sets the memory budget of the output cache, in bytes (256 MiB by
+  /// default, 0 disables it).
+  ///
+  /// The outputs of executed nodes are copied to the cache, keyed by a hash
+  /// of the state of the node and of all the nodes it depends on. A node that
+  /// must execute but whose state matches a cached entry (e.g. after a
+  /// parameter is set back to a previous value) gets its outputs copied back
+  /// from the cache instead. See `ImgNode::hashState()`.
+  void setOutputCacheBudget(size_t bytes);
+  /// Returns the statistics of the output cache (hit rate, evicted bytes).
+  const ImageCacheStats &outputCacheStats() const {
+    return renderTargetCache_->imageCacheStats();
+  }
+
+  //------ Proxy resolution ------
+
+  /// Evaluates the network at a fraction of the default image size: render
+  /// targets are `scale` times smaller in each dimension (1 is full
+  /// resolution). Nodes get the reduced size from
+  /// `ImgContext::defaultImageSize()`, and should divide distances expressed
+  /// in pixels of the full image by `ImgContext::proxyScale()`.
+  ///
+  /// Changing the scale reallocates the render targets: all nodes execute in
+  /// the next evaluation.
+  void setProxyScale(int scale);
+  int  proxyScale() const { return proxyScale_; }
+
+  /// Sets the time passed to shaders in `CommonParameters::time`, in
+  /// seconds. All nodes execute in the next evaluation when the time
+  /// changes.
+  void   setTime(double seconds);
+  double time() const { return currentTime_; }
+
+  /// Sets the proxy scales used by `evaluateProgressive()` before full
+  /// resolution, coarsest first (by default, {4, 2}).
+  void setProxyLevels(std::vector<int> scales);
+  const std::vector<int> &proxyLevels() const { return proxyLevels_; }
+
+  /// Evaluates the network for interactive editing, one step of progressive
+  /// refinement per call.
+  ///
+  /// If nodes have been modified since the previous call, the pending
+  /// refinement is abandoned and the network is evaluated at the coarsest
+  /// proxy level, so that feedback does not depend on the cost of full
+  /// resolution. Otherwise, the network is evaluated at the next finer level.
+  /// Returns true if finer levels remain: call again when idle (e.g. from an
+  /// idle timer of the UI) until it returns false. See `proxyScale()` for the
+  /// scale of the results.
+  bool evaluateProgressive();
+  /// Returns whether finer levels remain to be evaluated by
+  /// `evaluateProgressive()`.
+  bool refinementPending() const;
+
+  //------ Profiling ------
+
+  /// Returns the execution statistics of each node, in execution order.
+  /// Updated by each call to `evaluate()`.
+  const std::vector<ImgNodeTimings> &nodeTimings() const { return timings_; }
+  /// Returns the total CPU time spent executing nodes in the last evaluation,
+  /// in milliseconds.
+  double totalCpuTimeMs() const;
+  /// Returns the total GPU time of the most recent evaluation for which
+  /// results are available, in milliseconds.
+  double totalGpuTimeMs() const;
+
+  //------ Resources shared by all nodes ------
+
+  /// Returns a view of the buffer containing the `CommonParameters` of the
+  /// current evaluation.
+  gfx::ConstantBufferView commonParameters() const { return commonParameters_; }
+  /// Returns a vertex buffer containing a full-screen quad (two triangles,
+  /// 2D position + texcoord).
+  gfx::VertexBufferView quadVertices() const { return quadVertices_; }
+
+  /// Returns the data associated to a node, or nullptr if the node is not
+  /// evaluated by this evaluator.
+  ImgNodeData *nodeData(node::Node *node);
+
 private:
+  void findDependents();
+  void fuseNodes();
+  // Plans the fused chains again if a node stopped or started being
+  // point-wise.
+  void updateFusionPlan();
+  void prepareNodes();
+  void updateNodes();
+  void runPerLevel(const std::function<void(int)> &fn);
+  void scheduleNodes();
+  bool outputsPreserved(int nodeIndex);
   void allocateRenderTargets();
+  void updateRenderTargetLifetimes();
+  void updateCommonParameters();
+  void readTimerQueries(int nodeIndex, ImgNodeData::TimerQuery &q);
+  void propagateRegions();
+  void computeContentHashes();
+  void lookupCachedOutputs();
+  void restoreCachedOutputs(int nodeIndex);
+  void storeCachedOutputs(int nodeIndex);
+  void releaseCachedImages(ImgNodeData &data);
+  void executeFusedPass(ImgContext &ctx, FusedPass &pass);
+  int  tilePadding(int outputIndex) const;
+  bool needsReexecution() const;
+  void endTiledEvaluation(int savedWidth, int savedHeight);
 
-  std::vector<node::Node *> sortedNodes_;
-  ImgNetwork &              network_;
-  gfx::GraphicsBackend &    gfx_;
-  int                       defaultWidth_;
-  int                       defaultHeight_;
-  gfx::Format               defaultFormat_;
-  std::vector<ImgNodeData>  nodeData_;
-  double                    currentTime_;
-  int                       currentFrame_;
-  gfx::ConstantBufferView   commonParameters_;
-  gfx::VertexBufferView     quadVertices_;
+  std::vector<node::Node *>             sortedNodes_;
+  std::unordered_map<node::Node *, int> nodeIndices_;
+  // nodes grouped by depth in the graph: nodes of the same level do not
+  // depend on each other
+  std::vector<std::vector<int>> levels_;
+  ImgNetwork &                          network_;
+  gfx::GraphicsBackend &                gfx_;
+  int                                   defaultWidth_ = 1280;
+  int                                   defaultHeight_ = 720;
+  gfx::Format                 defaultFormat_ = gfx::Format::R16G16B16A16_SFLOAT;
+  std::vector<ImgNodeData>    nodeData_;
+  std::vector<bool>           executeMask_;
+  std::vector<ImgNodeTimings> timings_;
+  RenderTargetCache::Ptr      renderTargetCache_;
+  bool                        renderTargetAliasing_ = true;
+  gfx::Rect                   regionOfInterest_;
+  int                         proxyScale_ = 1;
+  std::vector<int>            proxyLevels_ = {4, 2};
+  // index in proxyLevels_ of the next step of evaluateProgressive(), equal
+  // to proxyLevels_.size() for full resolution
+  int nextProxyLevel_ = 0;
+  // whether the last step of the refinement has been evaluated
+  bool refined_ = false;
+  // network modification count seen by the last evaluateProgressive()
+  uint64_t progressiveModificationCount_ = 0;
+  double                      currentTime_ = 0.0;
+  int                         currentFrame_ = 0;
+  gfx::CommandBuffer          frameCommands_;
+  gfx::Buffer                 commonParameterBuffer_;
+  gfx::ConstantBufferView     commonParameters_ = {};
+  gfx::Buffer                 quadVertexBuffer_;
+  gfx::VertexBufferView       quadVertices_ = {};
+  // tiled evaluation state
+  bool tiled_ = false;
+  // size of the full image
+  int imageWidth_ = 0;
+  int imageHeight_ = 0;
+  int tileOriginX_ = 0;
+  int tileOriginY_ = 0;
+  // node whose render targets must be preserved until the end of the frame
+  int streamedNode_ = -1;
+  // execute all nodes in the next evaluation, even clean ones
+  bool executeAll_ = false;
 };
 
 class ImgContext {
 public:
   ImgContext(ImgEvaluator &evaluator, ImgNode &node, ImgNodeData &nodeData);
 
+  /// Returns the size of render targets that cover the image. In tiled
+  /// evaluations, this is the size of a tile including its padding.
   void defaultImageSize(int &width, int &height) const {
     evaluator_.defaultImageSize(width, height);
   }
+  /// See `ImgEvaluator::setProxyScale()`.
+  int proxyScale() const { return evaluator_.proxyScale(); }
+  /// See `ImgEvaluator::setTime()`.
+  double time() const { return evaluator_.time(); }
+  /// See `ImgEvaluator::imageSize()`.
+  void imageSize(int &width, int &height) const {
+    evaluator_.imageSize(width, height);
+  }
+  /// See `ImgEvaluator::tileOrigin()`.
+  void tileOrigin(int &x, int &y) const { evaluator_.tileOrigin(x, y); }
   gfx::Format defaultImageFormat() const {
     return evaluator_.defaultImageFormat();
   }
@@ -76,11 +430,51 @@ public:
   /// Returns a "RenderTargetView" object suitable for rendering to the
   /// specified render target.
   gfx::RenderTargetView getRenderTargetView(util::StringRef renderTarget);
+  /// Returns a view of the first mip level of the specified render target
+  /// for image load/store operations. The render target must have been
+  /// described with `ImageUsageFlags::Storage`.
+  gfx::StorageImageView getStorageImageView(util::StringRef renderTarget);
+
+  /// Declares that computing a pixel of the outputs of the node reads the
+  /// inputs up to `pixels` pixels away from it. Call in `prepare()`: tiled
+  /// evaluations compute a margin around each tile so that the output is
+  /// correct up to the tile edges.
+  void setHalo(int pixels) { nodeData_.halo = pixels; }
+
+  /// Returns the region of the render targets that the node must compute.
+  /// Nodes should restrict their work to it (e.g. with a scissor rectangle):
+  /// the contents of the render targets outside of it are not used.
+  gfx::Rect regionOfInterest() const { return nodeData_.region; }
 
   //------ graphics ------
 
   /// Returns an interface to the graphics backend.
   gfx::GraphicsBackend &gfx() const { return evaluator_.gfx(); }
+  /// See `ImgEvaluator::commonParameters()`.
+  gfx::ConstantBufferView commonParameters() const {
+    return evaluator_.commonParameters();
+  }
+  /// See `ImgEvaluator::quadVertices()`.
+  gfx::VertexBufferView quadVertices() const {
+    return evaluator_.quadVertices();
+  }
+  /// Returns the command buffer in which the node should record its
+  /// commands. It is submitted after all nodes have been executed: the
+  /// resources referenced by the commands must stay alive until the next
+  /// execution of the node.
+  gfx::CommandBuffer &commandBuffer() const { return nodeData_.commands; }
+
+  /// Requests another execution of the node in the next evaluation, e.g.
+  /// because it waits for shaders compiling in the background. The node (and
+  /// its dependents) are marked dirty once the current evaluation has
+  /// finished recording commands.
+  void scheduleReexecution() { nodeData_.reexecute = true; }
+
+  /// Declares that the outputs recorded by this execution do not match the
+  /// current state of the node (e.g. they are drawn with the last version of
+  /// a shader that compiled), so that they are not stored in the output
+  /// cache. Implied by `scheduleReexecution()`.
+  void markOutputsStale() { nodeData_.staleOutputs = true; }
 
 private:
   ImgNodeData::RenderTarget *findRenderTarget(util::StringRef name) const;
@@ -90,4 +484,4 @@ private:
   ImgNode &     node_;
   ImgNodeData & nodeData_;
 };
-} // namespace img
\ No newline at end of file
+} // namespace img
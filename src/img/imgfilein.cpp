@@ -0,0 +1,288 @@
+#include "img/imgfilein.h"
+#include "gfx/pipeline.h"
+#include "gfx/signature.h"
+#include "img/imgevaluator.h"
+#include "node/description.h"
+#include "node/param.h"
+#include "util/hash.h"
+#include "util/log.h"
+#include <algorithm>
+#include <cmath>
+
+using node::Network;
+using node::Node;
+
+namespace img {
+
+// Samples the image at the position of the pixel in the whole output, so
+// that tiles line up. Files are stored from the top, the output from the
+// bottom.
+static const char FRAG_SRC[] = R"(
+#version 450
+layout(location=0) in vec2 f_position;
+layout(location=1) in vec2 f_texcoord;
+layout(location=0) out vec4 color;
+layout(std140, binding=0) uniform CommonParameters {
+	float u_time;
+	int u_frame;
+	vec2 u_resolution;
+	vec2 u_tileOrigin;
+};
+layout(binding=0) uniform sampler2D u_image;
+void main() {
+	vec2 uv = (gl_FragCoord.xy + u_tileOrigin) / u_resolution;
+	color = texture(u_image, vec2(uv.x, 1.0 - uv.y));
+}
+)";
+
+static const char OUTPUT_NAME[] = "output";
+
+static Node *constructor(Network &parent, util::StringRef name) {
+  return new ImgFileIn(parent, name);
+}
+
+void ImgFileIn::registerNode() {
+  ImgNetwork::registerChild("ImgFileIn", "File In",
+                            "Reads an image file, or a sequence of files.",
+                            constructor);
+}
+
+ImgFileIn::ImgFileIn(Network &parent, util::StringRef name)
+    : ImgNode{parent, name} {
+  createOutput(OUTPUT_NAME);
+  createParameter(node::paramFileName(
+      "file", "File", "Image file. A run of '#' is replaced by the frame."));
+  createParameter(node::paramFloat(
+      "fps", "Frame Rate", "Frames of the sequence per second.", 24.0));
+  createParameter(node::paramInt("firstFrame", "First Frame",
+                                 "Frame of the sequence shown at time 0."));
+  createParameter(node::paramInt(
+      "mipmaps", "Mip Maps",
+      "Generates the mip levels of the image (0 to disable).", 1));
+
+  sampler_.minFilter = gfx::SamplerDesc::Filter::Linear;
+  sampler_.magFilter = gfx::SamplerDesc::Filter::Linear;
+  sampler_.addrU = gfx::SamplerDesc::AddressMode::Clamp;
+  sampler_.addrV = gfx::SamplerDesc::AddressMode::Clamp;
+  sampler_.addrW = gfx::SamplerDesc::AddressMode::Clamp;
+}
+
+int ImgFileIn::currentFrame(ImgContext &ctx) {
+  const auto fps = evalParam("fps").asReal();
+  const int  firstFrame = (int)evalParam("firstFrame").asInt();
+  return firstFrame + (int)std::floor(ctx.time() * fps);
+}
+
+bool ImgFileIn::hashState(ImgContext &ctx, uint64_t &hash) {
+  // the parameters are already part of the hash, but not the file read in
+  // this evaluation: hash it as the loader identifies it, so that a modified
+  // file is not served from the cache
+  const auto pattern = evalParam("file").asString().to_string();
+  if (pattern.empty()) {
+    return true;
+  }
+  const auto key =
+      ImageFileLoader::fileKey(expandFramePattern(pattern, currentFrame(ctx)));
+  if (key.empty()) {
+    return false;
+  }
+  hash = util::fnv1a64(key.data(), key.size(), hash);
+  return true;
+}
+
+void ImgFileIn::prepare(ImgContext &ctx) {
+  int w, h;
+  ctx.defaultImageSize(w, h);
+  gfx::ImageDesc targetDesc;
+  targetDesc.width = w;
+  targetDesc.height = h;
+  targetDesc.format = ctx.defaultImageFormat();
+  ctx.setRenderTargetDesc(OUTPUT_NAME, targetDesc);
+}
+
+void ImgFileIn::createPipeline(gfx::GraphicsBackend &gfx) {
+  gfx::SignatureDesc         sigDesc;
+  const gfx::ResourceBinding resources[2] = {
+      gfx::ResourceBinding::makeConstantBuffer(0),
+      gfx::ResourceBinding::makeTextureSampler(0),
+  };
+  const gfx::FragmentOutputDescription fragOut[1] = {};
+  const gfx::VertexInputBinding        vtxIn[1] = {
+      QUAD_VERTEX_LAYOUT, gfx::VertexInputRate::Vertex, 0};
+  sigDesc.fragmentOutputs = util::makeArrayRef(fragOut);
+  sigDesc.shaderResources = util::makeArrayRef(resources);
+  sigDesc.vertexInputs = util::makeArrayRef(vtxIn);
+  sigDesc.hasdepthStencilFragmentOutput = false;
+  sigDesc.hasIndexFormat = false;
+  sigDesc.viewportsCount = 1;
+  sigDesc.scissorsCount = 1;
+  signature_ = gfx::Signature{gfx, sigDesc};
+  args_ = gfx::ArgumentBlock{gfx, signature_};
+
+  const gfx::RenderPassTargetDesc targets[1] = {};
+  gfx::RenderPassDesc             rpDesc{util::makeArrayRef(targets), nullptr};
+  gfx::RenderPass                 rp{gfx, rpDesc};
+  gfx::ShaderModule               vertexShader{gfx, QUAD_VERTEX_SHADER,
+                                 gfx::ShaderStageFlags::VERTEX};
+  gfx::ShaderModule               fragmentShader{gfx, FRAG_SRC,
+                                   gfx::ShaderStageFlags::FRAGMENT};
+
+  gfx::GraphicsPipelineDesc desc;
+  desc.shaderStages.vertex = vertexShader;
+  desc.shaderStages.fragment = fragmentShader;
+  desc.signature = signature_;
+  desc.renderPass = rp;
+  pipeline_ = gfx::GraphicsPipeline::async(gfx, desc);
+}
+
+bool ImgFileIn::uploadPending(gfx::GraphicsBackend &gfx, bool mipmaps) {
+  const auto &img = *pendingImage_;
+  if (uploadedRows_ == 0) {
+    gfx::ImageDesc desc;
+    desc.format = img.format;
+    desc.width = img.width;
+    desc.height = img.height;
+    desc.mipMapCount =
+        mipmaps ? gfx::getTextureMipMapCount(img.width, img.height) : 1;
+    desc.usage = gfx::ImageUsageFlags::Sampled;
+    if (!pending_ || pendingDesc_ != desc) {
+      pending_ = gfx::Image{gfx, desc};
+      pendingDesc_ = desc;
+    }
+  }
+
+  // a band of rows per execution: the backend stages them without waiting
+  // for the GPU, but a whole 4K image at once would still take several
+  // milliseconds of copies
+  const size_t rowSize = (size_t)img.width * img.pixelSize;
+  const int    rows = std::min(
+      img.height - uploadedRows_,
+      std::max((int)(UPLOAD_BYTES_PER_EXECUTION / rowSize), 1));
+  gfx.updateImageData(pending_, 0, uploadedRows_, 0, img.width, rows, 1,
+                      img.pixels.data() + uploadedRows_ * rowSize);
+  uploadedRows_ += rows;
+  if (uploadedRows_ < img.height) {
+    return false;
+  }
+  if (pendingDesc_.mipMapCount > 1) {
+    gfx.generateMipMaps(pending_);
+  }
+  return true;
+}
+
+void ImgFileIn::execute(ImgContext &ctx) {
+  auto &&gfx = ctx.gfx();
+  if (!pipeline_) {
+    createPipeline(gfx);
+  }
+  if (!pipelineReady_) {
+    std::string log;
+    switch (pipeline_.status(&log)) {
+    case gfx::PipelineStatus::Pending:
+      ctx.scheduleReexecution();
+      break;
+    case gfx::PipelineStatus::Ready:
+      pipelineReady_ = true;
+      break;
+    case gfx::PipelineStatus::Failed:
+      if (log != lastError_) {
+        util::log("ImgNode[{}]: {}", name().to_string(), log);
+        lastError_ = log;
+      }
+      ctx.markOutputsStale();
+      return;
+    }
+  }
+
+  const auto pattern = evalParam("file").asString().to_string();
+  const bool mipmaps = evalParam("mipmaps").asInt() != 0;
+
+  if (pattern.empty()) {
+    if (shown_) {
+      shown_ = gfx::Image{};
+      shownImage_ = nullptr;
+    }
+    pendingImage_ = nullptr;
+  } else {
+    const int  frame = currentFrame(ctx);
+    const auto path = expandFramePattern(pattern, frame);
+    auto &     loader = ImageFileLoader::instance();
+
+    // never blocks: if the file is not decoded yet, the previous image is
+    // drawn until it is
+    std::string error;
+    auto        image = loader.request(path, &error);
+    if (pattern.find('#') != std::string::npos) {
+      for (int i = 1; i <= PREFETCH_FRAMES; ++i) {
+        loader.prefetch(expandFramePattern(pattern, frame + i));
+      }
+    }
+
+    if (!image) {
+      if (error.empty()) {
+        // the previous image is drawn
+        ctx.markOutputsStale();
+        ctx.scheduleReexecution();
+      } else {
+        if (error != lastError_) {
+          util::log("ImgNode[{}]: {}", name().to_string(), error);
+          lastError_ = error;
+        }
+        ctx.markOutputsStale();
+      }
+    } else if (image != shownImage_ ||
+               shownDesc_.mipMapCount !=
+                   (mipmaps ? gfx::getTextureMipMapCount(image->width,
+                                                          image->height)
+                            : 1)) {
+      lastError_.clear();
+      if (image != pendingImage_) {
+        pendingImage_ = std::move(image);
+        uploadedRows_ = 0;
+      }
+      if (uploadPending(gfx, mipmaps)) {
+        // the previous image is reused for the next upload
+        std::swap(shown_, pending_);
+        std::swap(shownDesc_, pendingDesc_);
+        shownImage_ = std::move(pendingImage_);
+        uploadedRows_ = 0;
+      } else {
+        ctx.markOutputsStale();
+        ctx.scheduleReexecution();
+      }
+    }
+  }
+
+  auto &cmd = ctx.commandBuffer();
+  auto  rtv = ctx.getRenderTargetView(OUTPUT_NAME);
+  if (!shown_ || !pipelineReady_) {
+    cmd.clearRenderTarget(rtv, gfx::ColorF{0.0f, 0.0f, 0.0f, 0.0f});
+    return;
+  }
+
+  sampler_.mipMapMode = shownDesc_.mipMapCount > 1
+                            ? gfx::SamplerDesc::MipMapMode::Linear
+                            : gfx::SamplerDesc::MipMapMode::None;
+  args_.setShaderResource(0, ctx.commonParameters());
+  args_.setShaderResource(0, gfx::SampledImageView{shown_, sampler_});
+  args_.setVertexBuffer(0, ctx.quadVertices());
+  args_.setScissor(0, ctx.regionOfInterest());
+
+  if (!framebuffer_ || framebufferTarget_ != rtv.image) {
+    gfx::FramebufferDesc  fbDesc;
+    gfx::RenderTargetView rtvs[1] = {rtv};
+    fbDesc.colorTargets = util::makeConstArrayRef(rtvs);
+    fbDesc.depthTarget = nullptr;
+    framebuffer_ = gfx::Framebuffer{gfx, fbDesc};
+    framebufferTarget_ = rtv.image;
+  }
+
+  gfx::DrawParams params;
+  params.firstVertex = 0;
+  params.vertexCount = 6;
+  params.firstInstance = 0;
+  params.instanceCount = 1;
+  cmd.draw(pipeline_, framebuffer_, args_, params);
+}
+
+} // namespace img
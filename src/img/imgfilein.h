@@ -0,0 +1,70 @@
+#pragma once
+#include "gfx/gfx.h"
+#include "gfx/image.h"
+#include "gfx/sampler.h"
+#include "img/imagefile.h"
+#include "img/imgnode.h"
+#include <string>
+
+namespace img {
+
+class ImgContext;
+
+///
+/// A node reading an image file (or a sequence of files) with OpenImageIO.
+///
+/// Files are decoded on the worker threads of `ImageFileLoader`, and uploaded
+/// to the GPU over several executions (at most
+/// `UPLOAD_BYTES_PER_EXECUTION` bytes each), so that loading a large image
+/// does not stall the evaluation: until the new image is ready, the previous
+/// one is drawn and the outputs are marked as stale.
+///
+/// The "file" parameter can contain a run of '#', replaced by the frame
+/// number (see `expandFramePattern()`). The frame is computed from the
+/// evaluation time, the "fps" and "firstFrame" parameters; the next frames
+/// are decoded in advance.
+class ImgFileIn : public img::ImgNode {
+public:
+  static constexpr size_t UPLOAD_BYTES_PER_EXECUTION = 32 * 1024 * 1024;
+  /// Number of frames of a sequence decoded ahead of the current one.
+  static constexpr int PREFETCH_FRAMES = 2;
+
+  ImgFileIn(node::Network &parent, util::StringRef name);
+
+  void prepare(ImgContext &ctx) override;
+  void execute(ImgContext &ctx) override;
+  bool hashState(ImgContext &ctx, uint64_t &hash) override;
+
+  static void registerNode();
+
+private:
+  void createPipeline(gfx::GraphicsBackend &gfx);
+  // Returns the frame of the sequence at the time of the evaluation.
+  int currentFrame(ImgContext &ctx);
+  // Uploads the next rows of the pending image. Returns true once the whole
+  // image is uploaded.
+  bool uploadPending(gfx::GraphicsBackend &gfx, bool mipmaps);
+
+  // image drawn
+  gfx::Image                shown_;
+  gfx::ImageDesc            shownDesc_;
+  ImageFileLoader::ImagePtr shownImage_;
+  // image being uploaded, reusing the previous image if it has the same
+  // description
+  gfx::Image                pending_;
+  gfx::ImageDesc            pendingDesc_;
+  ImageFileLoader::ImagePtr pendingImage_;
+  int                       uploadedRows_ = 0;
+  // last error reported, to avoid repeating it on every execution
+  std::string lastError_;
+
+  gfx::SamplerDesc      sampler_;
+  gfx::Signature        signature_;
+  gfx::ArgumentBlock    args_;
+  gfx::GraphicsPipeline pipeline_;
+  bool                  pipelineReady_ = false;
+  gfx::ImageHandle      framebufferTarget_ = 0;
+  gfx::Framebuffer      framebuffer_;
+};
+
+} // namespace img
@@ -1,7 +1,12 @@
 #include "img/imgnetwork.h"
 #include "gfx/gfx.h"
+#include "img/imgclear.h"
+#include "img/imgcomputenode.h"
+#include "img/imgfilein.h"
 #include "img/imgnode.h"
 #include "img/imgoutput.h"
+#include "img/imgshadernode.h"
+#include "img/imgtiledfilein.h"
 #include "img/rendertarget.h"
 #include "node/description.h"
 #include "util/log.h"
@@ -55,6 +60,15 @@ void ImgNetwork::onChildRemoved(Node *node) {
   }
 }
 
+void ImgNetwork::registerBuiltinNodes() {
+  ImgShaderNode::registerNode();
+  ImgComputeNode::registerNode();
+  ImgOutput::registerNode();
+  ImgClear::registerNode();
+  ImgFileIn::registerNode();
+  ImgTiledFileIn::registerNode();
+}
+
 ImgNetwork::ImgNetwork(util::StringRef name) : Network{nullptr, name} {}
 
 Node *ImgNetwork::createNode(util::StringRef typeName, util::StringRef name) {
@@ -62,6 +76,7 @@ Node *ImgNetwork::createNode(util::StringRef typeName, util::StringRef name) {
   if (!desc) {
     util::log("WARNING ImgNetwork::createNode: unknown node type `{}`",
               typeName.to_string());
+    return nullptr;
   }
   return addChild(desc->instantiate(*this, name));
 }
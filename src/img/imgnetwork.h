@@ -9,6 +9,8 @@
 
 namespace img {
 
+class ImgOutput;
+
 enum class ImageOutputScale {
 	/// output size is size defined in the current project
 	ProjectSize,
@@ -46,6 +48,13 @@ public:
   static void registerChild(util::StringRef name, util::StringRef friendlyName,
                             util::StringRef   description,
                             node::Constructor constructor);
+  /// Registers the IMG nodes provided by the application. Must be called
+  /// before networks are loaded.
+  static void registerBuiltinNodes();
+
+  /// Returns the output node of the network (the first one added), or
+  /// nullptr if there is none.
+  ImgOutput *output() const { return output_; }
 
   node::NodeDescriptions &registeredNodes() const override {
     return descriptions_;
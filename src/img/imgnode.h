@@ -3,6 +3,7 @@
 #include "node/network.h"
 #include "node/node.h"
 #include "util/stringref.h"
+#include <cstdint>
 #include <memory>
 #include <string>
 
@@ -10,6 +11,9 @@ namespace img {
 
 class ImgContext;
 class ImgNetwork;
+class ShaderGenerator;
+struct SBlockCtx;
+struct SVal;
 
 /// A node representing a screen space operation.
 ///
@@ -30,10 +34,56 @@ public:
 
   /// Called before rendering so that the system knows what render targets are going to be used.
   /// Implementors should call setRenderTargetDesc() within this function for each target that the node needs.
+  /// Nodes that read their inputs around the pixel they compute should also declare it with setHalo().
   virtual void prepare(ImgContext& ctx) = 0;
+  /// Called before `execute()` on nodes that are about to be executed.
+  /// Implementors should do CPU-side work here (evaluating parameters,
+  /// building constant data, generating shader source).
+  ///
+  /// This function may be called on a worker thread, concurrently with other
+  /// nodes that do not depend on each other: it must not access the graphics
+  /// backend. The same goes for `prepare()`.
+  virtual void update(ImgContext& ctx) {}
   /// Executes the node. Nodes should call operations on the graphics context here.
   virtual void execute(ImgContext& ctx) = 0;
 
+  //------ fusion ------
+
+  /// Returns whether the node is point-wise: it has one input and one output,
+  /// and each pixel of the output only depends on the same pixel of the
+  /// input. Chains of point-wise nodes are fused by the evaluator into a
+  /// single pass, in which case `execute()` is not called.
+  virtual bool isPointwise() const { return false; }
+  /// Returns a counter incremented when the code of the node changes (e.g.
+  /// its shader): `isPointwise()` and `emitPointwise()` only change with it.
+  virtual uint64_t codeVersion() const { return 0; }
+  /// Emits the per-pixel operation of a point-wise node in the fragment
+  /// shader of a fused pass. `input` is the color (`Float4`) of the input at
+  /// the current pixel; returns the color of the output. `index` is the
+  /// position of the node in the fused chain, which can be used to generate
+  /// unique names.
+  virtual SVal *emitPointwise(ShaderGenerator &gen, SBlockCtx *block,
+                              SVal *input, int index) {
+    return input;
+  }
+
+  /// Returns whether the commands recorded by the node depend on the tile of
+  /// a tiled evaluation beyond `CommonParameters::tileOrigin` (e.g. the node
+  /// loads the data under the tile). The commands of such nodes are not
+  /// replayed for other tiles (see `ImgEvaluator::evaluateTiled()`).
+  virtual bool dependsOnTile() const { return false; }
+
+  //------ caching ------
+
+  /// Combines into `hash` the state of the node that determines its outputs
+  /// but is not stored in parameters (e.g. shader code). The evaluator
+  /// already hashes the type, the parameters and the inputs of the node.
+  ///
+  /// `ctx` gives the state of the evaluation (e.g. the time). Returns false if
+  /// the outputs cannot be cached (the default): nodes must opt in once all
+  /// their state is accounted for.
+  virtual bool hashState(ImgContext &ctx, uint64_t &hash) { return false; }
+
 protected:
   ImgNetwork &parent_;
 };
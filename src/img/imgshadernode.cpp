@@ -4,9 +4,11 @@
 #include "gfx/signature.h"
 #include "img/constantbufferbuilder.h"
 #include "img/imgevaluator.h"
+#include "util/hash.h"
+#include "img/shadergen.h"
+#include "img/shadertemplate.h"
 #include "node/description.h"
 #include "util/log.h"
-#include <regex>
 
 using node::Network;
 using node::Node;
@@ -14,113 +16,160 @@ using node::NodeDescription;
 
 namespace img {
 
-static const char VERT_SRC_TEMPLATE[] = R"(
-#version 450
-layout(location=0) in vec2 a_position;
-layout(location=1) in vec2 texcoord;
-layout(location=0) out vec2 uv;
-void main() {
-    uv = texcoord;
-    gl_Position = vec4(a_position, 0.0, 1.0);
-}
-)";
-
 static const char FRAG_SRC_TEMPLATE[] = R"(
 #version 450
 layout(location=0) in vec2 f_position;
 layout(location=1) in vec2 f_texcoord;
 layout(location=0) out vec4 color;
-
+<<<UNIFORMS>>>
+<<<INPUTS>>>
 void main() {
-	<<<FRAG_SRC>>>
+	vec4 input_color = texture(u_input, f_texcoord);
+	<<<BODY>>>
 }
 )";
 
+static const char INPUT_DECLARATIONS[] = R"(
+layout(binding=0) uniform sampler2D u_input;
+)";
+
+// matches img::CommonParameters
+static const char COMMON_UNIFORMS[] = R"(
+layout(std140, binding=0) uniform CommonParameters {
+	float u_time;
+	int u_frame;
+	vec2 u_resolution;
+	vec2 u_tileOrigin;
+};
+)";
+
 static const char DEFAULT_FRAG_CODE[] = "color = vec4(0.0, 0.0, 0.0, 1.0);";
 
-static std::string generateFragmentShaderSource(util::StringRef snippet) {
-  static std::regex template_re{"<<<FRAG_SRC>>>"};
-  return std::regex_replace(FRAG_SRC_TEMPLATE, template_re,
-                            snippet.to_string());
-}
+static const char INPUT_NAME[] = "input";
+static const char OUTPUT_NAME[] = "output";
+// name of the sampler of the input, in the generated shader
+static const char INPUT_SAMPLER_NAME[] = "u_input";
 
-static const gfx::VertexLayoutElement POSITION_LAYOUT_ELEMENTS[] = {
-    {{"POSITION", 0}, gfx::Format::R32G32_SFLOAT, 0},
-    {{"TEXCOORD", 1}, gfx::Format::R32G32_SFLOAT, 8}};
+// parsed once, rendered on each recompilation
+static const ShaderTemplate FRAG_TEMPLATE{FRAG_SRC_TEMPLATE};
+static const int FRAG_UNIFORMS = FRAG_TEMPLATE.placeholderIndex("UNIFORMS");
+static const int FRAG_INPUTS = FRAG_TEMPLATE.placeholderIndex("INPUTS");
+static const int FRAG_BODY = FRAG_TEMPLATE.placeholderIndex("BODY");
 
-static const gfx::VertexLayout POSITION_LAYOUT = {
-    util::makeArrayRef(POSITION_LAYOUT_ELEMENTS), 16};
+static void generateFragmentShaderSource(std::string &    out,
+                                         util::StringRef snippet) {
+  util::StringRef values[3];
+  values[FRAG_UNIFORMS] = COMMON_UNIFORMS;
+  values[FRAG_INPUTS] = INPUT_DECLARATIONS;
+  values[FRAG_BODY] = snippet;
+  FRAG_TEMPLATE.render(out, util::makeConstArrayRef(values));
+}
 
 void ImgShaderNode::setFragCode(std::string code) {
   fragCode_ = std::move(code);
+  fragSource_.clear();
+  codeVersion_++;
   shaderDirty_ = true;
-  compilationSuccess_ = false;
+  markDirty();
 }
 
-bool ImgShaderNode::compile(gfx::GraphicsBackend &gfx) {
-
-  if (shaderDirty_ == false) {
-    // no need to recompile the pipeline.
-    return compilationSuccess_;
+void ImgShaderNode::loadInternal(util::StringRef key, util::JsonReader &r,
+                                 int baseId) {
+  if (key == "fragCode") {
+    setFragCode(r.nextString());
+  } else if (key == "halo") {
+    setHalo((int)r.nextInt());
+  } else {
+    ImgNode::loadInternal(key, r, baseId);
   }
+}
+
+void ImgShaderNode::saveInternal(util::JsonWriter &w) {
+  ImgNode::saveInternal(w);
+  w.name("fragCode");
+  w.value(fragCode_);
+  w.name("halo");
+  w.value((int64_t)halo_);
+}
 
-  // create the signature
-  gfx::SignatureDesc         sigDesc;
-  const gfx::ResourceBinding resources[2] = {
-      gfx::ResourceBinding::makeConstantBuffer(0),
-      gfx::ResourceBinding::makeConstantBuffer(1),
-  };
-  const gfx::FragmentOutputDescription fragOut[1] = {};
-  const gfx::VertexInputBinding        vtxIn[1] = {POSITION_LAYOUT,
-                                            gfx::VertexInputRate::Vertex, 0};
-  sigDesc.fragmentOutputs = util::makeArrayRef(fragOut);
-  sigDesc.shaderResources = util::makeArrayRef(resources);
-  sigDesc.vertexInputs = util::makeArrayRef(vtxIn);
-  sigDesc.hasdepthStencilFragmentOutput = false;
-  sigDesc.hasIndexFormat = false;
-  sigDesc.viewportsCount = 1;
-  sigDesc.scissorsCount = 1;
-  signature_ = gfx::Signature{gfx, sigDesc};
+bool ImgShaderNode::hashState(ImgContext &ctx, uint64_t &hash) {
+  hash = util::fnv1a64(fragCode_.data(), fragCode_.size(), hash);
+  return true;
+}
+
+void ImgShaderNode::compile(gfx::GraphicsBackend &gfx) {
+  // the signature only depends on the resources used by the node, which do
+  // not change with the code
+  if (!signature_) {
+    gfx::SignatureDesc         sigDesc;
+    const gfx::ResourceBinding resources[3] = {
+        gfx::ResourceBinding::makeConstantBuffer(0),
+        gfx::ResourceBinding::makeConstantBuffer(1),
+        gfx::ResourceBinding::makeTextureSampler(0),
+    };
+    const gfx::FragmentOutputDescription fragOut[1] = {};
+    const gfx::VertexInputBinding        vtxIn[1] = {
+        QUAD_VERTEX_LAYOUT, gfx::VertexInputRate::Vertex, 0};
+    sigDesc.fragmentOutputs = util::makeArrayRef(fragOut);
+    sigDesc.shaderResources = util::makeArrayRef(resources);
+    sigDesc.vertexInputs = util::makeArrayRef(vtxIn);
+    sigDesc.hasdepthStencilFragmentOutput = false;
+    sigDesc.hasIndexFormat = false;
+    sigDesc.viewportsCount = 1;
+    sigDesc.scissorsCount = 1;
+    signature_ = gfx::Signature{gfx, sigDesc};
+    args_ = gfx::ArgumentBlock{gfx, signature_};
+  }
 
   // render pass
   const gfx::RenderPassTargetDesc targets[1] = {};
   gfx::RenderPassDesc             rpDesc{util::makeArrayRef(targets), nullptr};
   gfx::RenderPass                 rp{gfx, rpDesc};
 
-  try {
-    // shaders
-    gfx::ShaderModule vertexShader{gfx, VERT_SRC_TEMPLATE,
-                                   gfx::ShaderStageFlags::VERTEX};
-    auto              fragShaderSrc = generateFragmentShaderSource(fragCode_);
-    gfx::ShaderModule fragmentShader{gfx, fragShaderSrc,
-                                     gfx::ShaderStageFlags::FRAGMENT};
-    util::log("ImgNode[{}]: fragment shader: \n{}", name().to_string(),
-              fragShaderSrc);
-
-    // pipeline
-    gfx::GraphicsPipelineDesc desc;
-    desc.shaderStages.vertex = vertexShader;
-    desc.shaderStages.fragment = fragmentShader;
-    desc.signature = signature_;
-    desc.renderPass = rp;
-    pipeline_ = gfx::GraphicsPipeline{gfx, desc};
-  } catch (gfx::ShaderCompilationError e) {
-    // failed to compile one of the shaders, store log and bail out.
-    fmt::format("Shader compilation messages: \n {}", e.what());
-    compilationSuccess_ = false;
-    // reset the dirty flag: we don't want to keep recompiling
-    // the shader over and over if the source has errors.
-    shaderDirty_ = false;
-    return false;
-  } catch (gfx::GraphicsPipelineCompilationError e) {
-    // failed to create the pipeline, store log and bail out.
-    fmt::format("Pipeline compilation messages: \n {}", e.what());
-    compilationSuccess_ = false;
-    shaderDirty_ = false;
-    return false;
+  // shaders
+  gfx::ShaderModule vertexShader{gfx, QUAD_VERTEX_SHADER,
+                                 gfx::ShaderStageFlags::VERTEX};
+  if (fragSource_.empty()) {
+    generateFragmentShaderSource(fragSource_, fragCode_);
   }
+  gfx::ShaderModule fragmentShader{gfx, fragSource_,
+                                   gfx::ShaderStageFlags::FRAGMENT};
+  util::log("ImgNode[{}]: fragment shader: \n{}", name().to_string(),
+            fragSource_);
 
-  return true;
+  // pipeline: shaders are compiled in the background, unless an identical
+  // pipeline already exists in the backend. The previous pipeline is used
+  // until the new one is ready.
+  gfx::GraphicsPipelineDesc desc;
+  desc.shaderStages.vertex = vertexShader;
+  desc.shaderStages.fragment = fragmentShader;
+  desc.signature = signature_;
+  desc.renderPass = rp;
+  pendingPipeline_ = gfx::GraphicsPipeline::async(gfx, desc);
+  compileStatus_ = ShaderCompileStatus::Compiling;
+  // reset the dirty flag: we don't want to keep recompiling
+  // the shader over and over if the source has errors.
+  shaderDirty_ = false;
+}
+
+void ImgShaderNode::pollCompilation() {
+  std::string log;
+  switch (pendingPipeline_.status(&log)) {
+  case gfx::PipelineStatus::Pending:
+    return;
+  case gfx::PipelineStatus::Ready:
+    pipeline_ = std::move(pendingPipeline_);
+    compilationMessages_.clear();
+    compileStatus_ = ShaderCompileStatus::Succeeded;
+    break;
+  case gfx::PipelineStatus::Failed:
+    // store the log and keep the last pipeline that worked
+    compilationMessages_ = fmt::format("Shader compilation messages: \n {}", log);
+    pendingPipeline_ = gfx::GraphicsPipeline{};
+    compileStatus_ = ShaderCompileStatus::Failed;
+    util::log("ImgNode[{}]: {}", name().to_string(), compilationMessages_);
+    break;
+  }
 }
 
 void ImgShaderNode::execute(ImgContext &ctx) {
@@ -128,32 +177,55 @@ void ImgShaderNode::execute(ImgContext &ctx) {
   if (shaderDirty_) {
     compile(gfx);
   }
+  if (compileStatus_ == ShaderCompileStatus::Compiling) {
+    pollCompilation();
+    if (compileStatus_ == ShaderCompileStatus::Compiling) {
+      // come back once the shaders have compiled
+      ctx.scheduleReexecution();
+    }
+  }
+  if (compileStatus_ == ShaderCompileStatus::Failed) {
+    // drawn with the last code that compiled, if any
+    ctx.markOutputsStale();
+  }
+  if (!pipeline_) {
+    // nothing to draw
+    ctx.markOutputsStale();
+    return;
+  }
 
-  // build the constant (uniform) buffer
-  ConstantBufferBuilder b;
-  // TODO push all parameters in the buffer
-  b.push(0.0f);
-  b.push(0.2f);
-  b.push(0.4f);
-  auto constantBuffer = b.create(gfx);
+  auto &cmd = ctx.commandBuffer();
+
+  // upload the constants built in update(): this is a copy into the upload
+  // buffer of the backend, recorded so that it is repeated on replay
+  if (constantBufferSize_ != constants_.size()) {
+    constantBuffer_ = gfx::Buffer::dynamic(gfx, constants_.size());
+    constantBufferSize_ = constants_.size();
+  }
+  cmd.updateBuffer(constantBuffer_, 0, constants_.data(), constants_.size());
   auto constantBufferView =
-      gfx::ConstantBufferView{constantBuffer, 0, b.size()};
+      gfx::ConstantBufferView{constantBuffer_, 0, constantBufferSize_};
 
-  // create the argblock
-  gfx::ArgumentBlock args{gfx, signature_};
-  // args.setShaderResource(0, ctx.commonParameters);
-  // args.setShaderResource(1, constantBufferView);
-  // args.setVertexBuffer(0, ctx.quadVertices);
-  // TODO textures
+  // update the argblock
+  args_.setShaderResource(0, ctx.commonParameters());
+  args_.setShaderResource(1, constantBufferView);
+  args_.setVertexBuffer(0, ctx.quadVertices());
+  if (auto input = ctx.getInputImage(this->input(0))) {
+    args_.setShaderResource(0, gfx::SampledImageView{input, inputSampler_});
+  }
+  // only shade the pixels read downstream
+  args_.setScissor(0, ctx.regionOfInterest());
 
-  // check if the framebuffer needs updating
-  if (!framebuffer_) {
+  // check if the framebuffer needs updating: the image behind the render
+  // target may change between evaluations
+  auto rtv = ctx.getRenderTargetView(OUTPUT_NAME);
+  if (!framebuffer_ || framebufferTarget_ != rtv.image) {
     gfx::FramebufferDesc  fbDesc;
-    gfx::RenderTargetView rtv;
-    // rtv.image = outputs_[0]->getImage(ctx); // TODO
     gfx::RenderTargetView rtvs[1] = {rtv};
     fbDesc.colorTargets = util::makeConstArrayRef(rtvs);
+    fbDesc.depthTarget = nullptr;
     framebuffer_ = gfx::Framebuffer{gfx, fbDesc};
+    framebufferTarget_ = rtv.image;
   }
 
   // draw stuff
@@ -162,25 +234,77 @@ void ImgShaderNode::execute(ImgContext &ctx) {
   params.vertexCount = 6;
   params.firstInstance = 0;
   params.instanceCount = 1;
-  gfx.draw(pipeline_, framebuffer_, args, params);
-
-  // mark our outputs as dirty so that other passes that depend on them are
-  // updated.
-  // renderTargets_[0]->markDirty();
+  cmd.draw(pipeline_, framebuffer_, args_, params);
 }
 
 static Node *constructor(Network &parent, util::StringRef name) {
   return new ImgShaderNode(parent, name);
 }
 
-void ImgShaderNode::prepare(ImgContext &ctx) {}
+void ImgShaderNode::update(ImgContext &ctx) {
+  // generate the shader source here, so that only the compilation itself
+  // happens in execute()
+  if (shaderDirty_ && fragSource_.empty()) {
+    generateFragmentShaderSource(fragSource_, fragCode_);
+  }
+
+  // build the constant (uniform) buffer
+  constants_.clear();
+  // TODO push all parameters in the buffer
+  constants_.push(0.0f);
+  constants_.push(0.2f);
+  constants_.push(0.4f);
+}
+
+void ImgShaderNode::prepare(ImgContext &ctx) {
+  int w, h;
+  ctx.defaultImageSize(w, h);
+  gfx::ImageDesc targetDesc;
+  targetDesc.width = w;
+  targetDesc.height = h;
+  targetDesc.format = ctx.defaultImageFormat();
+  ctx.setRenderTargetDesc(OUTPUT_NAME, targetDesc);
+  // the halo is in pixels of the full resolution image
+  ctx.setHalo((halo_ + ctx.proxyScale() - 1) / ctx.proxyScale());
+}
 
 void ImgShaderNode::registerNode() {
   ImgNetwork::registerChild("ImgShaderNode", "Shader",
                             "Runs a screen-space shader.", constructor);
 }
 
+bool ImgShaderNode::isPointwise() const {
+  // the code can only read the input at the current pixel if it does not use
+  // the sampler
+  return fragCode_.find(INPUT_SAMPLER_NAME) == std::string::npos;
+}
+
+SVal *ImgShaderNode::emitPointwise(ShaderGenerator &gen, SBlockCtx *block,
+                                   SVal *input, int index) {
+  // the code runs in its own scope, with the same variables as in the
+  // shader of the node
+  const auto result = fmt::format("fused_color_{}", index);
+  gen.emit(block, fmt::format("vec4 {};", result));
+  auto scope = gen.beginBlock(block);
+  gen.emit(scope, "vec4 input_color = $0;", {&input, 1});
+  gen.emit(scope, "vec4 color;");
+  gen.emit(scope, fragCode_);
+  gen.emit(scope, fmt::format("{} = color;", result));
+  gen.endBlock(scope);
+  return gen.emitExpression(block, gen.primitiveType(PrimitiveType::Float4),
+                            result);
+}
+
 ImgShaderNode::ImgShaderNode(Network &parent, util::StringRef name)
-    : ImgNode{parent, name}, fragCode_{DEFAULT_FRAG_CODE} {}
+    : ImgNode{parent, name}, fragCode_{DEFAULT_FRAG_CODE} {
+  createInput(INPUT_NAME);
+  createOutput(OUTPUT_NAME);
+  inputSampler_.minFilter = gfx::SamplerDesc::Filter::Linear;
+  inputSampler_.magFilter = gfx::SamplerDesc::Filter::Linear;
+  inputSampler_.mipMapMode = gfx::SamplerDesc::MipMapMode::None;
+  inputSampler_.addrU = gfx::SamplerDesc::AddressMode::Clamp;
+  inputSampler_.addrV = gfx::SamplerDesc::AddressMode::Clamp;
+  inputSampler_.addrW = gfx::SamplerDesc::AddressMode::Clamp;
+}
 
 } // namespace img
\ No newline at end of file
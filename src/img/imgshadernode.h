@@ -1,10 +1,19 @@
 #pragma once
+#include "img/constantbufferbuilder.h"
 #include "img/imgnode.h"
 
 namespace img {
 
 class ImgContext;
 
+enum class ShaderCompileStatus {
+  NotCompiled,
+  /// The shaders are compiling in the background.
+  Compiling,
+  Succeeded,
+  Failed,
+};
+
 ///
 /// A node representing a screen space operation.
 ///
@@ -14,30 +23,74 @@ public:
   ImgShaderNode(node::Network &parent, util::StringRef name);
 
   void prepare(ImgContext& ctx) override;
+  void update(ImgContext& ctx) override;
   void execute(ImgContext& ctx) override;
 
+  /// The node is point-wise unless the code samples the input itself
+  /// (through `u_input`) instead of reading `input_color`.
+  bool     isPointwise() const override;
+  uint64_t codeVersion() const override { return codeVersion_; }
+  SVal *   emitPointwise(ShaderGenerator &gen, SBlockCtx *block, SVal *input,
+                         int index) override;
+
   //------ Fragment shader ------
 
-  /// Returns the body of the fragment shader.
+  /// Returns the body of the fragment shader. The code reads the input at the
+  /// current pixel in `vec4 input_color` and writes the output to
+  /// `vec4 color`.
   util::StringRef fragCode() const { return fragCode_; }
   /// Sets the body of the fragment shader.
   void setFragCode(std::string code);
 
-  bool compilationSucceeded() const { return compilationSuccess_; }
+  ShaderCompileStatus compileStatus() const { return compileStatus_; }
+  bool                compilationSucceeded() const {
+    return compileStatus_ == ShaderCompileStatus::Succeeded;
+  }
+  /// Returns the errors of the last compilation that failed.
+  util::StringRef compilationMessages() const { return compilationMessages_; }
+
+  /// Returns how far from the current pixel the code samples `u_input`, in
+  /// pixels. See `ImgContext::setHalo()`.
+  int  halo() const { return halo_; }
+  void setHalo(int pixels) { halo_ = pixels; }
+
+  bool hashState(ImgContext &ctx, uint64_t &hash) override;
 
   static void registerNode();
 
+protected:
+  /// Loads and saves the code and the halo, which are not parameters.
+  void loadInternal(util::StringRef key, util::JsonReader &reader,
+                    int baseId) override;
+  void saveInternal(util::JsonWriter &writer) override;
+
 private:
-  bool compile(gfx::GraphicsBackend &gfx);
+  void compile(gfx::GraphicsBackend &gfx);
+  void pollCompilation();
 
-  uint64_t lastFramebufferUpdate_ = 0;
+  gfx::ImageHandle framebufferTarget_ = 0;
+  gfx::SamplerDesc inputSampler_;
   std::string fragCode_;
+  // generated fragment shader source, empty if it must be regenerated
+  std::string fragSource_;
+  ConstantBufferBuilder constants_;
   std::string compilationMessages_;
+  // resources referenced by the recorded commands, kept alive until the
+  // next execution
+  gfx::Buffer constantBuffer_;
+  size_t constantBufferSize_ = 0;
   gfx::Framebuffer framebuffer_;
+  // last pipeline that compiled successfully
   gfx::GraphicsPipeline pipeline_;
+  // pipeline being compiled in the background
+  gfx::GraphicsPipeline pendingPipeline_;
   gfx::Signature signature_;
-  bool compilationSuccess_ = false;
+  gfx::ArgumentBlock args_;
+  ShaderCompileStatus compileStatus_ = ShaderCompileStatus::NotCompiled;
   bool shaderDirty_ = true;
+  int  halo_ = 0;
+  // incremented by setFragCode()
+  uint64_t codeVersion_ = 0;
 };
 
 } // namespace img
\ No newline at end of file
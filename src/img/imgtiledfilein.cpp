@@ -0,0 +1,286 @@
+#include "img/imgtiledfilein.h"
+#include "gfx/pipeline.h"
+#include "gfx/signature.h"
+#include "img/imagefile.h"
+#include "img/imgevaluator.h"
+#include "node/description.h"
+#include "node/param.h"
+#include "util/hash.h"
+#include "util/log.h"
+#include <algorithm>
+#include <cmath>
+
+using node::Network;
+using node::Node;
+
+namespace img {
+
+// Looks up the page of the pixel in the page table, and samples it in the
+// atlas. Positions in the image are in pixels of the mip level, rows from the
+// top.
+static const char FRAG_SRC[] = R"(
+#version 450
+layout(location=0) in vec2 f_position;
+layout(location=1) in vec2 f_texcoord;
+layout(location=0) out vec4 color;
+layout(std140, binding=0) uniform CommonParameters {
+	float u_time;
+	int u_frame;
+	vec2 u_resolution;
+	vec2 u_tileOrigin;
+};
+layout(std140, binding=1) uniform NodeParameters {
+	vec2 u_imageSize;
+	vec2 u_atlasSize;
+	float u_pageSize;
+	float u_pageContentSize;
+};
+layout(binding=0) uniform sampler2D u_atlas;
+layout(binding=1) uniform sampler2D u_pageTable;
+void main() {
+	vec2 uv = (gl_FragCoord.xy + u_tileOrigin) / u_resolution;
+	vec2 p = clamp(vec2(uv.x, 1.0 - uv.y) * u_imageSize, vec2(0.5),
+	               u_imageSize - vec2(0.5));
+	ivec2 page = ivec2(p / u_pageContentSize);
+	vec4 entry = texelFetch(u_pageTable, page, 0);
+	if (entry.z == 0.0) {
+		// not loaded yet
+		color = vec4(0.0);
+		return;
+	}
+	// skip the border of the page
+	vec2 inPage = p - vec2(page) * u_pageContentSize + vec2(1.0);
+	color = textureLod(u_atlas, (entry.xy * u_pageSize + inPage) / u_atlasSize,
+	                   0.0);
+}
+)";
+
+static const char OUTPUT_NAME[] = "output";
+
+static Node *constructor(Network &parent, util::StringRef name) {
+  return new ImgTiledFileIn(parent, name);
+}
+
+void ImgTiledFileIn::registerNode() {
+  ImgNetwork::registerChild(
+      "ImgTiledFileIn", "Tiled File In",
+      "Reads the visible parts of a very large image file.", constructor);
+}
+
+ImgTiledFileIn::ImgTiledFileIn(Network &parent, util::StringRef name)
+    : ImgNode{parent, name} {
+  createOutput(OUTPUT_NAME);
+  createParameter(node::paramFileName("file", "File", "Image file."));
+
+  atlasSampler_.minFilter = gfx::SamplerDesc::Filter::Linear;
+  atlasSampler_.magFilter = gfx::SamplerDesc::Filter::Linear;
+  atlasSampler_.mipMapMode = gfx::SamplerDesc::MipMapMode::None;
+  atlasSampler_.addrU = gfx::SamplerDesc::AddressMode::Clamp;
+  atlasSampler_.addrV = gfx::SamplerDesc::AddressMode::Clamp;
+  atlasSampler_.addrW = gfx::SamplerDesc::AddressMode::Clamp;
+  // only read with texelFetch
+  pageTableSampler_.mipMapMode = gfx::SamplerDesc::MipMapMode::None;
+}
+
+bool ImgTiledFileIn::hashState(ImgContext &ctx, uint64_t &hash) {
+  // the path is a parameter, but not the modification time of the file
+  const auto path = evalParam("file").asString().to_string();
+  if (path.empty()) {
+    return true;
+  }
+  const auto key = ImageFileLoader::fileKey(path);
+  if (key.empty()) {
+    return false;
+  }
+  hash = util::fnv1a64(key.data(), key.size(), hash);
+  return true;
+}
+
+void ImgTiledFileIn::prepare(ImgContext &ctx) {
+  int w, h;
+  ctx.defaultImageSize(w, h);
+  gfx::ImageDesc targetDesc;
+  targetDesc.width = w;
+  targetDesc.height = h;
+  targetDesc.format = ctx.defaultImageFormat();
+  ctx.setRenderTargetDesc(OUTPUT_NAME, targetDesc);
+}
+
+void ImgTiledFileIn::createPipeline(gfx::GraphicsBackend &gfx) {
+  gfx::SignatureDesc         sigDesc;
+  const gfx::ResourceBinding resources[4] = {
+      gfx::ResourceBinding::makeConstantBuffer(0),
+      gfx::ResourceBinding::makeConstantBuffer(1),
+      gfx::ResourceBinding::makeTextureSampler(0),
+      gfx::ResourceBinding::makeTextureSampler(1),
+  };
+  const gfx::FragmentOutputDescription fragOut[1] = {};
+  const gfx::VertexInputBinding        vtxIn[1] = {
+      QUAD_VERTEX_LAYOUT, gfx::VertexInputRate::Vertex, 0};
+  sigDesc.fragmentOutputs = util::makeArrayRef(fragOut);
+  sigDesc.shaderResources = util::makeArrayRef(resources);
+  sigDesc.vertexInputs = util::makeArrayRef(vtxIn);
+  sigDesc.hasdepthStencilFragmentOutput = false;
+  sigDesc.hasIndexFormat = false;
+  sigDesc.viewportsCount = 1;
+  sigDesc.scissorsCount = 1;
+  signature_ = gfx::Signature{gfx, sigDesc};
+  args_ = gfx::ArgumentBlock{gfx, signature_};
+
+  const gfx::RenderPassTargetDesc targets[1] = {};
+  gfx::RenderPassDesc             rpDesc{util::makeArrayRef(targets), nullptr};
+  gfx::RenderPass                 rp{gfx, rpDesc};
+  gfx::ShaderModule               vertexShader{gfx, QUAD_VERTEX_SHADER,
+                                 gfx::ShaderStageFlags::VERTEX};
+  gfx::ShaderModule               fragmentShader{gfx, FRAG_SRC,
+                                   gfx::ShaderStageFlags::FRAGMENT};
+
+  gfx::GraphicsPipelineDesc desc;
+  desc.shaderStages.vertex = vertexShader;
+  desc.shaderStages.fragment = fragmentShader;
+  desc.signature = signature_;
+  desc.renderPass = rp;
+  pipeline_ = gfx::GraphicsPipeline::async(gfx, desc);
+}
+
+void ImgTiledFileIn::execute(ImgContext &ctx) {
+  auto &&gfx = ctx.gfx();
+  if (!pipeline_) {
+    createPipeline(gfx);
+  }
+  if (!pipelineReady_) {
+    std::string log;
+    switch (pipeline_.status(&log)) {
+    case gfx::PipelineStatus::Pending:
+      ctx.scheduleReexecution();
+      break;
+    case gfx::PipelineStatus::Ready:
+      pipelineReady_ = true;
+      break;
+    case gfx::PipelineStatus::Failed:
+      if (log != lastError_) {
+        util::log("ImgNode[{}]: {}", name().to_string(), log);
+        lastError_ = log;
+      }
+      ctx.markOutputsStale();
+      return;
+    }
+  }
+
+  auto &cmd = ctx.commandBuffer();
+  auto  rtv = ctx.getRenderTargetView(OUTPUT_NAME);
+
+  // opened again when the file is modified
+  const auto path = evalParam("file").asString().to_string();
+  const auto key =
+      path.empty() ? std::string{} : ImageFileLoader::fileKey(path);
+  if (path != path_ || key != fileKey_ || !image_) {
+    if (!image_) {
+      image_ = std::make_unique<TiledImage>(gfx);
+    }
+    std::string error;
+    path_ = path;
+    fileKey_ = key;
+    if (!path.empty() && !image_->open(path, &error)) {
+      if (error != lastError_) {
+        util::log("ImgNode[{}]: {}", name().to_string(), error);
+        lastError_ = error;
+      }
+      ctx.markOutputsStale();
+    }
+  }
+  if (!image_->isOpen() || !pipelineReady_) {
+    cmd.clearRenderTarget(rtv, gfx::ColorF{0.0f, 0.0f, 0.0f, 0.0f});
+    return;
+  }
+  lastError_.clear();
+
+  // the finest mip level with at least one pixel per pixel of the output,
+  // coarser if the visible pages do not fit in the atlas. The image covers
+  // the whole output, of which the render target may only be a tile.
+  int outW, outH, originX, originY;
+  ctx.imageSize(outW, outH);
+  ctx.tileOrigin(originX, originY);
+  int w, h;
+  image_->levelSize(0, w, h);
+  const double scale = std::max((double)w / outW, (double)h / outH);
+  int          level = 0;
+  while (level + 1 < image_->levelCount() && (2 << level) <= scale) {
+    ++level;
+  }
+
+  // region of interest in pixels of the level, rows from the top, with a
+  // margin for filtering
+  const auto roi = ctx.regionOfInterest();
+  const int  roiLeft = roi.x + originX;
+  const int  roiRight = roi.right() + originX;
+  const int  roiBottom = roi.y + originY;
+  const int  roiTop = roi.bottom() + originY;
+  gfx::Rect  region;
+  for (;;) {
+    image_->levelSize(level, w, h);
+    const double sx = (double)w / outW;
+    const double sy = (double)h / outH;
+    const int    x0 = (int)std::floor(roiLeft * sx) - 1;
+    const int    x1 = (int)std::ceil(roiRight * sx) + 1;
+    const int    y0 = (int)std::floor((outH - roiTop) * sy) - 1;
+    const int    y1 = (int)std::ceil((outH - roiBottom) * sy) + 1;
+    region = gfx::Rect{x0, y0, x1 - x0, y1 - y0};
+    if (level + 1 >= image_->levelCount() ||
+        image_->pageCount(region, level) <= image_->pageCapacity()) {
+      break;
+    }
+    ++level;
+  }
+
+  if (!image_->update(region, level, PAGE_LOADS_PER_EXECUTION)) {
+    const auto stats = image_->stats();
+    if (stats.overflow || stats.readFailed) {
+      // cannot complete: draw what is resident
+      ctx.markOutputsStale();
+    } else {
+      ctx.scheduleReexecution();
+    }
+  }
+
+  constants_.clear();
+  constants_.push((float)w);
+  constants_.push((float)h);
+  constants_.push((float)image_->atlasSize());
+  constants_.push((float)image_->atlasSize());
+  constants_.push((float)TiledImage::PAGE_SIZE);
+  constants_.push((float)TiledImage::PAGE_CONTENT_SIZE);
+  if (constantBufferSize_ != constants_.size()) {
+    constantBuffer_ = gfx::Buffer::dynamic(gfx, constants_.size());
+    constantBufferSize_ = constants_.size();
+  }
+  cmd.updateBuffer(constantBuffer_, 0, constants_.data(), constants_.size());
+
+  args_.setShaderResource(0, ctx.commonParameters());
+  args_.setShaderResource(
+      1, gfx::ConstantBufferView{constantBuffer_, 0, constantBufferSize_});
+  args_.setShaderResource(
+      0, gfx::SampledImageView{image_->atlas(), atlasSampler_});
+  args_.setShaderResource(
+      1, gfx::SampledImageView{image_->pageTable(), pageTableSampler_});
+  args_.setVertexBuffer(0, ctx.quadVertices());
+  args_.setScissor(0, roi);
+
+  if (!framebuffer_ || framebufferTarget_ != rtv.image) {
+    gfx::FramebufferDesc  fbDesc;
+    gfx::RenderTargetView rtvs[1] = {rtv};
+    fbDesc.colorTargets = util::makeConstArrayRef(rtvs);
+    fbDesc.depthTarget = nullptr;
+    framebuffer_ = gfx::Framebuffer{gfx, fbDesc};
+    framebufferTarget_ = rtv.image;
+  }
+
+  gfx::DrawParams params;
+  params.firstVertex = 0;
+  params.vertexCount = 6;
+  params.firstInstance = 0;
+  params.instanceCount = 1;
+  cmd.draw(pipeline_, framebuffer_, args_, params);
+}
+
+} // namespace img
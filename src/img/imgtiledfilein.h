@@ -0,0 +1,61 @@
+#pragma once
+#include "gfx/gfx.h"
+#include "gfx/sampler.h"
+#include "img/constantbufferbuilder.h"
+#include "img/imgnode.h"
+#include "img/tiledimage.h"
+#include <memory>
+#include <string>
+
+namespace img {
+
+class ImgContext;
+
+///
+/// A node reading an image file too large to be loaded as a whole (e.g. a
+/// 16K scan), through a `TiledImage`.
+///
+/// Only the pages of the image under the region of interest of the node are
+/// loaded, from the mip level closest to the resolution of the output. At
+/// most `PAGE_LOADS_PER_EXECUTION` pages are loaded per execution: the node
+/// is executed again until the region is complete, and draws the missing
+/// pages as transparent in the meantime. In tiled evaluations, the node
+/// executes for each tile.
+class ImgTiledFileIn : public img::ImgNode {
+public:
+  static constexpr int PAGE_LOADS_PER_EXECUTION = 16;
+
+  ImgTiledFileIn(node::Network &parent, util::StringRef name);
+
+  void prepare(ImgContext &ctx) override;
+  void execute(ImgContext &ctx) override;
+  // the pages loaded depend on the tile
+  bool dependsOnTile() const override { return true; }
+  bool hashState(ImgContext &ctx, uint64_t &hash) override;
+
+  static void registerNode();
+
+private:
+  void createPipeline(gfx::GraphicsBackend &gfx);
+
+  std::unique_ptr<TiledImage> image_;
+  // file open in image_, and its key in the loader (see
+  // `ImageFileLoader::fileKey()`)
+  std::string path_;
+  std::string fileKey_;
+  std::string lastError_;
+
+  gfx::SamplerDesc      atlasSampler_;
+  gfx::SamplerDesc      pageTableSampler_;
+  ConstantBufferBuilder constants_;
+  gfx::Buffer           constantBuffer_;
+  size_t                constantBufferSize_ = 0;
+  gfx::Signature        signature_;
+  gfx::ArgumentBlock    args_;
+  gfx::GraphicsPipeline pipeline_;
+  bool                  pipelineReady_ = false;
+  gfx::ImageHandle      framebufferTarget_ = 0;
+  gfx::Framebuffer      framebuffer_;
+};
+
+} // namespace img
@@ -1,5 +1,8 @@
 #include "img/rendertarget.h"
 #include "img/imgnode.h"
+#include "util/log.h"
+#include <algorithm>
+#include <cstdint>
 
 namespace img {
 
@@ -14,23 +17,55 @@ private:
   gfx::ImageDesc desc_;
   gfx::ImageHandle handle_;
   int useCount_ = 0;
+  // last step during which the image is used by an assigned render target
+  int busyUntil_ = INT_MIN;
+  // render target whose contents are currently stored in the image
+  RenderTarget *contents_ = nullptr;
+};
+
+class CachedImage {
+  friend class RenderTargetCache;
+
+private:
+  uint64_t         key_ = 0;
+  gfx::ImageDesc   desc_;
+  gfx::ImageHandle handle_ = 0;
+  // part of the image holding valid contents
+  gfx::Rect region_;
+  size_t    bytes_ = 0;
+  int       pins_ = 0;
 };
 
 class RenderTarget {
 public:
   // description of the image
   gfx::ImageDesc desc;
-  BackingImage *image;
+  BackingImage *image = nullptr;
+  // interval during which the contents of the render target must be preserved
+  int firstUse = 0;
+  int lastUse = INT_MAX;
 };
 
 RenderTargetCache::RenderTargetCache(gfx::GraphicsBackend &backend)
     : backend_{backend} {}
 
-RenderTargetCache::~RenderTargetCache() {}
+RenderTargetCache::~RenderTargetCache() {
+  for (auto &&img : images_) {
+    backend_.deleteImage(img->handle_);
+  }
+  for (auto &&img : cachedImages_) {
+    backend_.deleteImage(img->handle_);
+  }
+}
 
 RenderTarget *
 RenderTargetCache::createRenderTarget(const gfx::ImageDesc &desc) {
-  return nullptr;
+  auto rt = std::make_unique<RenderTarget>();
+  rt->desc = desc;
+  auto ptr = rt.get();
+  renderTargets_.push_back(std::move(rt));
+  dirty_ = true;
+  return ptr;
 }
 
 void RenderTargetCache::setRenderTargetDesc(RenderTarget *renderTarget,
@@ -38,11 +73,12 @@ void RenderTargetCache::setRenderTargetDesc(RenderTarget *renderTarget,
   if (renderTarget->desc == desc) {
     return;
   }
-  if (renderTarget->image) {
-    renderTarget->image->useCount_--;
+  if (renderTarget->image && renderTarget->image->contents_ == renderTarget) {
+    renderTarget->image->contents_ = nullptr;
   }
   renderTarget->desc = desc;
   renderTarget->image = nullptr;
+  dirty_ = true;
 }
 
 const gfx::ImageDesc &
@@ -50,42 +86,257 @@ RenderTargetCache::getRenderTargetDesc(RenderTarget *renderTarget) {
   return renderTarget->desc;
 }
 
+void RenderTargetCache::setRenderTargetLifetime(RenderTarget *renderTarget,
+                                                int firstUse, int lastUse) {
+  if (renderTarget->firstUse == firstUse && renderTarget->lastUse == lastUse) {
+    return;
+  }
+  renderTarget->firstUse = firstUse;
+  renderTarget->lastUse = lastUse;
+  dirty_ = true;
+}
+
 gfx::ImageHandle RenderTargetCache::getImage(RenderTarget *renderTarget) {
-  if (!renderTarget->image) {
-    assignImage(renderTarget);
+  if (dirty_ || !renderTarget->image) {
+    allocateImages();
   }
 
   return renderTarget->image->handle_;
 }
 
-void RenderTargetCache::assignImage(RenderTarget *rt) {
-  // For now, we simply look for an unused image in the cache and use it.
-  // If there are no unused images in the cache, we create a new one.
-  // In the future, we might want to share images between render targets if
-  // we can prove that the render targets are not used at the same time in the
-  // graph (see "Frame graphs"). In theory, we can also reorder the passes
-  // within the frame to maximize aliasing (and minimize the amount of memory
-  // required). However, it's a complicated problem.
-  for (int i = 0; i < images_.size(); ++i) {
-    if (images_[i]->useCount_ == 0 && images_[i]->desc_ == rt->desc) {
-      images_[i]->useCount_++;
-      rt->image = images_[i].get();
-      return;
+void RenderTargetCache::allocateImages() {
+  if (!dirty_) {
+    return;
+  }
+
+  // Greedy interval allocation: render targets are visited by increasing
+  // start of lifetime, and each one is assigned to the first image with the
+  // same description that is not in use anymore at the start of its lifetime.
+  // Render targets only share images if their descriptions are identical,
+  // so there is no need to deal with memory aliasing at the API level.
+  for (auto &&img : images_) {
+    img->useCount_ = 0;
+    img->busyUntil_ = INT_MIN;
+  }
+
+  std::vector<RenderTarget *> sorted;
+  sorted.reserve(renderTargets_.size());
+  for (auto &&rt : renderTargets_) {
+    sorted.push_back(rt.get());
+  }
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](RenderTarget *a, RenderTarget *b) {
+                     return a->firstUse < b->firstUse;
+                   });
+
+  auto isAvailable = [](BackingImage *img, RenderTarget *rt) {
+    return img->desc_ == rt->desc && img->busyUntil_ < rt->firstUse;
+  };
+
+  for (auto rt : sorted) {
+    BackingImage *img = nullptr;
+    // keep the previous image if possible, so that handles stay stable
+    // across reallocations
+    if (rt->image && isAvailable(rt->image, rt)) {
+      img = rt->image;
+    } else {
+      for (auto &&candidate : images_) {
+        if (isAvailable(candidate.get(), rt)) {
+          img = candidate.get();
+          break;
+        }
+      }
     }
+    if (!img) {
+      // allocate a new image
+      auto handle = backend_.createImage(rt->desc);
+      images_.push_back(std::make_unique<BackingImage>(rt->desc, handle));
+      img = images_.back().get();
+    }
+    img->useCount_++;
+    img->busyUntil_ = std::max(img->busyUntil_, rt->lastUse);
+    rt->image = img;
   }
-  // allocate a new image
-  auto handle = backend_.createImage(rt->desc);
-  auto img = std::make_unique<BackingImage>(rt->desc, handle);
-  rt->image = img.get();
-  images_.push_back(std::move(img));
+
+  // release images that are not used anymore
+  for (auto &&img : images_) {
+    if (img->useCount_ == 0) {
+      backend_.deleteImage(img->handle_);
+    }
+  }
+  images_.erase(std::remove_if(images_.begin(), images_.end(),
+                               [](const std::unique_ptr<BackingImage> &img) {
+                                 return img->useCount_ == 0;
+                               }),
+                images_.end());
+
+  dirty_ = false;
+  allocationGeneration_++;
+  updateStats();
+  util::log("Render targets: {} targets, {} images, requested {} MiB, "
+            "allocated {} MiB, aliased {} MiB, peak {} MiB",
+            stats_.renderTargetCount, stats_.imageCount,
+            stats_.requestedBytes >> 20, stats_.allocatedBytes >> 20,
+            stats_.aliasedBytes >> 20, stats_.peakBytes >> 20);
 }
 
-void RenderTargetCache::deleteRenderTarget(RenderTarget* renderTarget) {
-	// TODO
+void RenderTargetCache::markContentsValid(RenderTarget *renderTarget) {
+  if (dirty_ || !renderTarget->image) {
+    allocateImages();
+  }
+  renderTarget->image->contents_ = renderTarget;
+}
+
+bool RenderTargetCache::hasValidContents(RenderTarget *renderTarget) {
+  if (dirty_ || !renderTarget->image) {
+    allocateImages();
+  }
+  return renderTarget->image->contents_ == renderTarget;
+}
+
+void RenderTargetCache::updateStats() {
+  RenderTargetCacheStats s;
+  s.renderTargetCount = (int)renderTargets_.size();
+  s.imageCount = (int)images_.size();
+
+  // (step, byte delta): sweep over lifetimes to find the peak of live memory
+  std::vector<std::pair<int64_t, int64_t>> events;
+  for (auto &&rt : renderTargets_) {
+    auto size = (int64_t)gfx::getImageByteSize(rt->desc);
+    s.requestedBytes += size;
+    events.emplace_back(rt->firstUse, size);
+    events.emplace_back((int64_t)rt->lastUse + 1, -size);
+  }
+  // at equal steps, releases (negative deltas) are sorted first
+  std::sort(events.begin(), events.end());
+  int64_t live = 0;
+  for (auto &&e : events) {
+    live += e.second;
+    s.peakBytes = std::max(s.peakBytes, (size_t)live);
+  }
+
+  for (auto &&img : images_) {
+    s.allocatedBytes += gfx::getImageByteSize(img->desc_);
+  }
+  s.aliasedBytes = s.requestedBytes - s.allocatedBytes;
+  stats_ = s;
+}
+
+void RenderTargetCache::setImageCacheBudget(size_t bytes) {
+  imageCacheBudget_ = bytes;
+  gfx::ImageHandle recycled = 0;
+  evictCachedImages(0, gfx::ImageDesc{}, recycled);
+}
+
+CachedImage *RenderTargetCache::findCachedImage(uint64_t                key,
+                                                const gfx::ImageDesc &desc,
+                                                const gfx::Rect &     region) {
+  auto it = cachedImageIndex_.find(key);
+  if (it == cachedImageIndex_.end() || !((*it->second)->desc_ == desc) ||
+      !(*it->second)->region_.contains(region)) {
+    imageCacheStats_.misses++;
+    return nullptr;
+  }
+  imageCacheStats_.hits++;
+  // move to the front of the LRU list
+  cachedImages_.splice(cachedImages_.begin(), cachedImages_, it->second);
+  return cachedImages_.front().get();
+}
+
+CachedImage *RenderTargetCache::insertCachedImage(uint64_t              key,
+                                                  const gfx::ImageDesc &desc,
+                                                  const gfx::Rect &region) {
+  auto it = cachedImageIndex_.find(key);
+  if (it != cachedImageIndex_.end()) {
+    if ((*it->second)->pins_) {
+      return nullptr;
+    }
+    eraseCachedImage(it->second, false);
+  }
+
+  const size_t     bytes = gfx::getImageByteSize(desc);
+  gfx::ImageHandle handle = 0;
+  if (bytes > imageCacheBudget_ ||
+      !evictCachedImages(bytes, desc, handle)) {
+    return nullptr;
+  }
+  if (!handle) {
+    handle = backend_.createImage(desc);
+  }
+
+  auto img = std::make_unique<CachedImage>();
+  img->key_ = key;
+  img->desc_ = desc;
+  img->handle_ = handle;
+  img->region_ = region;
+  img->bytes_ = bytes;
+  cachedImages_.push_front(std::move(img));
+  cachedImageIndex_[key] = cachedImages_.begin();
+  imageCacheStats_.imageCount++;
+  imageCacheStats_.cachedBytes += bytes;
+  return cachedImages_.front().get();
+}
+
+bool RenderTargetCache::evictCachedImages(size_t                bytesNeeded,
+                                          const gfx::ImageDesc &desc,
+                                          gfx::ImageHandle &    recycled) {
+  // evict from the least recently used end, skipping pinned images
+  auto it = cachedImages_.end();
+  while (imageCacheStats_.cachedBytes + bytesNeeded > imageCacheBudget_) {
+    if (it == cachedImages_.begin()) {
+      return false;
+    }
+    --it;
+    if ((*it)->pins_) {
+      continue;
+    }
+    // an image with the same description is reused instead of being
+    // reallocated
+    if (!recycled && bytesNeeded && (*it)->desc_ == desc) {
+      recycled = (*it)->handle_;
+      (*it)->handle_ = 0;
+    }
+    auto victim = it++;
+    eraseCachedImage(victim, true);
+  }
+  return true;
+}
+
+void RenderTargetCache::eraseCachedImage(
+    std::list<std::unique_ptr<CachedImage>>::iterator it, bool evicted) {
+  auto &img = **it;
+  if (img.handle_) {
+    backend_.deleteImage(img.handle_);
+  }
+  if (evicted) {
+    imageCacheStats_.evictedBytes += img.bytes_;
+  }
+  imageCacheStats_.imageCount--;
+  imageCacheStats_.cachedBytes -= img.bytes_;
+  cachedImageIndex_.erase(img.key_);
+  cachedImages_.erase(it);
+}
+
+gfx::ImageHandle RenderTargetCache::getCachedImage(CachedImage *image) const {
+  return image->handle_;
+}
+
+void RenderTargetCache::pinCachedImage(CachedImage *image) { image->pins_++; }
+
+void RenderTargetCache::unpinCachedImage(CachedImage *image) {
+  image->pins_--;
+}
+
+void RenderTargetCache::deleteRenderTarget(RenderTarget *renderTarget) {
+  if (renderTarget->image && renderTarget->image->contents_ == renderTarget) {
+    renderTarget->image->contents_ = nullptr;
+  }
+  node::eraseRemoveUniquePtr(renderTargets_, renderTarget);
+  dirty_ = true;
 }
 
 RenderTargetCache::Ptr RenderTargetCache::make(gfx::GraphicsBackend &backend) {
   return std::make_unique<RenderTargetCache>(backend);
 }
 
-} // namespace img
\ No newline at end of file
+} // namespace img
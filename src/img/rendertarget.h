@@ -1,13 +1,56 @@
 #pragma once
 #include "gfx/gfx.h"
 #include "gfx/image.h"
+#include "gfx/rect.h"
 #include "node/node.h"
+#include <climits>
+#include <cstdint>
+#include <list>
 #include <memory>
+#include <unordered_map>
 
 namespace img {
 
 class RenderTarget;
 class BackingImage;
+class CachedImage;
+
+/// Memory statistics of a `RenderTargetCache`.
+struct RenderTargetCacheStats {
+  /// Number of render targets.
+  int renderTargetCount = 0;
+  /// Number of images actually allocated to back the render targets.
+  int imageCount = 0;
+  /// Memory that would be needed if every render target had its own image.
+  size_t requestedBytes = 0;
+  /// Memory allocated for backing images.
+  size_t allocatedBytes = 0;
+  /// Memory saved by sharing backing images between render targets
+  /// (`requestedBytes - allocatedBytes`).
+  size_t aliasedBytes = 0;
+  /// Maximum amount of memory used by render targets that are live at the
+  /// same time. This is a lower bound for `allocatedBytes`.
+  size_t peakBytes = 0;
+};
+
+/// Statistics of the cache of evaluated images of a `RenderTargetCache`.
+struct ImageCacheStats {
+  /// Number of lookups that found a matching image.
+  uint64_t hits = 0;
+  /// Number of lookups that did not.
+  uint64_t misses = 0;
+  /// Number of images in the cache.
+  int imageCount = 0;
+  /// Memory used by the images in the cache.
+  size_t cachedBytes = 0;
+  /// Total memory of the images evicted to stay within the budget.
+  size_t evictedBytes = 0;
+
+  double hitRate() const {
+    const auto lookups = hits + misses;
+    return lookups ? (double)hits / (double)lookups : 0.0;
+  }
+};
 
 class RenderTargetCache {
 public:
@@ -28,20 +71,99 @@ public:
 
   /// Returns the description of the render target.
   const gfx::ImageDesc& getRenderTargetDesc(RenderTarget *renderTarget);
+
+  /// Sets the interval during which the contents of the render target must be
+  /// preserved, as a range of steps `[firstUse, lastUse]` (typically, indices
+  /// in the execution order of the nodes).
+  ///
+  /// Render targets with compatible descriptions and lifetimes that do not
+  /// overlap may share the same backing image. By default, render targets
+  /// are live during the whole frame and are never aliased.
+  /// Changing the lifetime of a render target invalidates image handles
+  /// returned by `getImage()` for all render targets.
+  void setRenderTargetLifetime(RenderTarget *renderTarget, int firstUse,
+                               int lastUse = INT_MAX);
   
   /// Returns the GPU image handle of the render target. 
   /// If the memory for the image has not been allocated yet, this function allocates it.
   gfx::ImageHandle getImage(RenderTarget *renderTarget);
 
+  /// Assigns backing images to all render targets, and releases backing
+  /// images that are not used anymore.
+  /// This is done automatically by `getImage()`, but calling it
+  /// before evaluation avoids allocating images in the middle of a frame.
+  void allocateImages();
+
+  /// Records that the render target has been written to: its backing image
+  /// now holds the contents of this render target.
+  void markContentsValid(RenderTarget *renderTarget);
+
+  /// Returns whether the backing image of the render target still holds the
+  /// contents last written to it, i.e. whether they have not been
+  /// overwritten by another render target sharing the same image, or lost
+  /// after a reallocation.
+  bool hasValidContents(RenderTarget *renderTarget);
+
+  /// Returns a counter incremented each time backing images are reassigned.
+  /// Image handles obtained with `getImage()` stay valid as long as this
+  /// value does not change.
+  int allocationGeneration() const { return allocationGeneration_; }
+
+  /// Returns memory statistics. The statistics are up-to-date only after
+  /// `allocateImages()` has been called.
+  const RenderTargetCacheStats &stats() const { return stats_; }
+
+  //------ Cache of evaluated images ------
+
+  /// Sets the maximum amount of memory used by cached images, in bytes.
+  /// Least recently used images are evicted when an insertion would exceed
+  /// it. 0 disables the cache.
+  void   setImageCacheBudget(size_t bytes);
+  size_t imageCacheBudget() const { return imageCacheBudget_; }
+
+  /// Looks up the image stored with `key`. Returns nullptr unless an image
+  /// with the same description has been stored with this key, and its
+  /// contents cover `region`.
+  CachedImage *findCachedImage(uint64_t key, const gfx::ImageDesc &desc,
+                               const gfx::Rect &region);
+  /// Allocates an image to store the contents of `region` under `key`,
+  /// replacing the previous image with this key. The caller is responsible
+  /// for copying the contents into it. Returns nullptr if the image does not
+  /// fit in the budget.
+  CachedImage *insertCachedImage(uint64_t key, const gfx::ImageDesc &desc,
+                                 const gfx::Rect &region);
+  /// Returns the GPU image of a cached image.
+  gfx::ImageHandle getCachedImage(CachedImage *image) const;
+  /// Prevents the eviction of a cached image, e.g. while it is referenced by
+  /// recorded commands. Calls must be balanced with `unpinCachedImage()`.
+  void pinCachedImage(CachedImage *image);
+  void unpinCachedImage(CachedImage *image);
+
+  const ImageCacheStats &imageCacheStats() const { return imageCacheStats_; }
+
   /// Constructor.
-  RenderTargetCache::Ptr RenderTargetCache::make(gfx::GraphicsBackend &backend);
+  static RenderTargetCache::Ptr make(gfx::GraphicsBackend &backend);
 
 private:
-  void assignImage(RenderTarget *rt);
+  void updateStats();
+  bool evictCachedImages(size_t bytesNeeded, const gfx::ImageDesc &desc,
+                         gfx::ImageHandle &recycled);
+  void eraseCachedImage(std::list<std::unique_ptr<CachedImage>>::iterator it,
+                        bool evicted);
 
   gfx::GraphicsBackend &backend_;
   std::vector<std::unique_ptr<RenderTarget>> renderTargets_;
   std::vector<std::unique_ptr<BackingImage>> images_;
+  // set when render targets must be reassigned to backing images
+  bool dirty_ = true;
+  int allocationGeneration_ = 0;
+  RenderTargetCacheStats stats_;
+  // cached images, most recently used first
+  std::list<std::unique_ptr<CachedImage>> cachedImages_;
+  std::unordered_map<uint64_t, std::list<std::unique_ptr<CachedImage>>::iterator>
+                  cachedImageIndex_;
+  size_t          imageCacheBudget_ = 256ull << 20;
+  ImageCacheStats imageCacheStats_;
 };
 
-} // namespace img
\ No newline at end of file
+} // namespace img
@@ -1,83 +1,1211 @@
 #include "img/shadergen.h"
-#include <memory>
-#include <vector>
+#include "fmt/format.h"
+#include "util/hash.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <unordered_map>
 
 namespace img {
 
-/*enum class TypeKind {
-        Primitive,
-        Struct,
-        Image
+enum class TypeKind {
+  Primitive,
+  Texture,
 };
 
-struct SStructField {
-        std::string name;
-        const SType* type;
+struct SType {
+  TypeKind kind;
+  // primitive type, or type of the texels for textures
+  PrimitiveType prim;
+  // textures only
+  gfx::ImageDimensions dim;
 };
 
-struct SStructType {
-        std::vector<std::unique_ptr<SStructField>> fields;
+enum class SOp {
+  Constant,
+  Input,
+  Output,
+  Builtin,
+  Global,
+  Texture,
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Neg,
+  Swizzle,
+  Construct,
+  Call,
+  Sample2D,
+  Expression,
 };
 
-struct SType {
-        TypeKind kind;
-        union {
-                PrimitiveType prim;
-                SStructType* struct_;
-        };
+struct SVal {
+  SOp    op;
+  SType *type;
+  // block in which the value is defined, null for values that are visible
+  // everywhere (constants, inputs, uniforms...)
+  SBlockCtx *        block = nullptr;
+  std::vector<SVal *> args;
+  // variable name, function name, swizzle components or expression
+  std::string text;
+  // components of constants
+  std::vector<double> components;
+  // location of inputs and outputs, buffer of uniforms, index of textures
+  int              index = -1;
+  gfx::SamplerDesc sampler;
+  int              id = 0;
+
+  // set by generate()
+  int  uses = 0;
+  bool temporary = false;
+  int  binding = -1;
+};
+
+struct SStatement {
+  enum class Kind {
+    // definition of a value created in the block
+    Define,
+    // raw code
+    Raw,
+    Store,
+    Block,
+  };
+
+  Kind                kind;
+  SVal *              value = nullptr;
+  SVal *              output = nullptr;
+  std::string         text;
+  std::vector<SVal *> args;
+  SBlockCtx *         block = nullptr;
 };
 
-struct SDeclFun {
-        std::string name;
+struct SBlockCtx {
+  SFunCtx *               fun;
+  SBlockCtx *             parent;
+  bool                    ended = false;
+  std::vector<SStatement> statements;
+};
 
+struct SFunCtx {
+  SBlockCtx *body;
+  bool       ended = false;
 };
 
+struct ShaderGenerator::Private {
+  gfx::ShaderStageFlags stage;
+  Target                target;
 
+  std::vector<std::unique_ptr<SType>>     types;
+  std::vector<std::unique_ptr<SVal>>      values;
+  std::vector<std::unique_ptr<SBlockCtx>> blocks;
+  std::vector<std::unique_ptr<SFunCtx>>   functions;
+  SFunCtx *                               main = nullptr;
 
-struct ShaderGeneratorPrivate {
+  // values by hash, for common subexpression elimination
+  std::unordered_map<uint64_t, std::vector<SVal *>> valueTable;
+  std::vector<SVal *>                               inputs;
+  std::vector<SVal *>                               outputs;
+  std::vector<SVal *>                               globals;
+  std::vector<SVal *>                               textures;
+  std::vector<ShaderSamplerBinding>                 samplerBindings;
+  ShaderGeneratorStats                              stats;
 
-        struct SamplerUniform {
-                int tex;
-                gfx::SamplerDesc desc;
-        };
+  SType *primitive(PrimitiveType prim);
+  SVal * intern(SVal &&proto);
+  void   checkBlock(SBlockCtx *block);
+  void   checkOperand(SBlockCtx *block, SVal *v);
 
-        std::vector<TextureBinding> textures_;
-        std::vector<SamplerUniform> samplers_;
+  SVal *binary(SOp op, SBlockCtx *block, SVal *a, SVal *b);
 
-        SType voidTy;
-        SType floatTy;
-        SType float2Ty;
-        SType float3Ty;
-        SType float4Ty;
-        SType intTy;
-        SType int2Ty;
-        SType int3Ty;
-        SType int4Ty;
-        SType float4x4Ty;
+  // generation
+  void        use(SVal *v, int count = 1);
+  void        useStatements(SBlockCtx *block);
+  std::string expr(SVal *v);
+  std::string ref(SVal *v);
+  std::string operand(SVal *v);
+  std::string joinArgs(const std::vector<SVal *> &args);
+  std::string substitute(util::StringRef text,
+                         const std::vector<SVal *> &args);
+  void writeBlock(fmt::memory_buffer &out, SBlockCtx *block, int indent);
 };
 
+//------------------------------------------------------------------------------
+// types
+
+static int componentCount(PrimitiveType prim) {
+  switch (prim) {
+  case PrimitiveType::Float:
+  case PrimitiveType::Int:
+    return 1;
+  case PrimitiveType::Float2:
+  case PrimitiveType::Int2:
+    return 2;
+  case PrimitiveType::Float3:
+  case PrimitiveType::Int3:
+    return 3;
+  case PrimitiveType::Float4:
+  case PrimitiveType::Int4:
+    return 4;
+  case PrimitiveType::Matrix44:
+    return 16;
+  }
+  return 0;
+}
+
+static bool isInt(PrimitiveType prim) {
+  return prim == PrimitiveType::Int || prim == PrimitiveType::Int2 ||
+         prim == PrimitiveType::Int3 || prim == PrimitiveType::Int4;
+}
+
+static bool isMatrix(PrimitiveType prim) {
+  return prim == PrimitiveType::Matrix44;
+}
+
+static PrimitiveType vectorType(bool integer, int n) {
+  static const PrimitiveType floats[4] = {
+      PrimitiveType::Float, PrimitiveType::Float2, PrimitiveType::Float3,
+      PrimitiveType::Float4};
+  static const PrimitiveType ints[4] = {PrimitiveType::Int, PrimitiveType::Int2,
+                                        PrimitiveType::Int3,
+                                        PrimitiveType::Int4};
+  if (n < 1 || n > 4) {
+    throw std::logic_error{"invalid vector size"};
+  }
+  return integer ? ints[n - 1] : floats[n - 1];
+}
+
+static const char *glslTypeName(PrimitiveType prim) {
+  switch (prim) {
+  case PrimitiveType::Float:
+    return "float";
+  case PrimitiveType::Float2:
+    return "vec2";
+  case PrimitiveType::Float3:
+    return "vec3";
+  case PrimitiveType::Float4:
+    return "vec4";
+  case PrimitiveType::Int:
+    return "int";
+  case PrimitiveType::Int2:
+    return "ivec2";
+  case PrimitiveType::Int3:
+    return "ivec3";
+  case PrimitiveType::Int4:
+    return "ivec4";
+  case PrimitiveType::Matrix44:
+    return "mat4";
+  }
+  return "";
+}
+
+static std::string glslSamplerTypeName(const SType *ty) {
+  const char *dim = "";
+  switch (ty->dim) {
+  case gfx::ImageDimensions::Image1D:
+    dim = "sampler1D";
+    break;
+  case gfx::ImageDimensions::Image2D:
+    dim = "sampler2D";
+    break;
+  case gfx::ImageDimensions::Image2DArray:
+    dim = "sampler2DArray";
+    break;
+  case gfx::ImageDimensions::Image3D:
+    dim = "sampler3D";
+    break;
+  }
+  return fmt::format("{}{}", isInt(ty->prim) ? "i" : "", dim);
+}
+
+static bool isPrimitive(const SVal *v) {
+  return v->type->kind == TypeKind::Primitive;
+}
+
+static bool isConstant(const SVal *v) { return v->op == SOp::Constant; }
+
+// constant whose components are all equal to x
+static bool isSplat(const SVal *v, double x) {
+  if (!isConstant(v) || isMatrix(v->type->prim)) {
+    return false;
+  }
+  for (auto c : v->components) {
+    if (c != x) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// values computed by an operator, which need parentheses when inlined in
+// another expression
+static bool isOperator(SOp op) {
+  return op == SOp::Add || op == SOp::Sub || op == SOp::Mul ||
+         op == SOp::Div || op == SOp::Neg;
+}
+
+static std::string formatScalar(double x, bool integer) {
+  if (integer) {
+    return fmt::format("{}", (int)x);
+  }
+  auto s = fmt::format("{:.9g}", (float)x);
+  if (s.find_first_of(".e") == std::string::npos) {
+    s += ".0";
+  }
+  return s;
+}
+
+static std::string formatConstant(const SVal *v) {
+  const auto prim = v->type->prim;
+  const bool integer = isInt(prim);
+  auto &     c = v->components;
+  if (c.size() == 1) {
+    return formatScalar(c[0], integer);
+  }
+  bool splat = !isMatrix(prim);
+  for (auto x : c) {
+    splat = splat && x == c[0];
+  }
+  fmt::memory_buffer out;
+  fmt::format_to(out, "{}(", glslTypeName(prim));
+  if (splat) {
+    fmt::format_to(out, "{}", formatScalar(c[0], integer));
+  } else {
+    for (size_t i = 0; i < c.size(); ++i) {
+      fmt::format_to(out, "{}{}", i ? ", " : "", formatScalar(c[i], integer));
+    }
+  }
+  fmt::format_to(out, ")");
+  return fmt::to_string(out);
+}
+
+// calls fn(index) for each `$N` reference in the text
+template <typename F> static void forEachReference(util::StringRef text, F fn) {
+  for (size_t i = 0; i + 1 < text.size(); ++i) {
+    if (text[i] == '$' && text[i + 1] >= '0' && text[i + 1] <= '9') {
+      fn(text[i + 1] - '0');
+      ++i;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+SType *ShaderGenerator::Private::primitive(PrimitiveType prim) {
+  for (auto &&ty : types) {
+    if (ty->kind == TypeKind::Primitive && ty->prim == prim) {
+      return ty.get();
+    }
+  }
+  types.push_back(std::unique_ptr<SType>{
+      new SType{TypeKind::Primitive, prim, gfx::ImageDimensions::Image2D}});
+  return types.back().get();
+}
+
+static bool isVisible(const SBlockCtx *def, const SBlockCtx *use) {
+  for (auto b = use; b; b = b->parent) {
+    if (b == def) {
+      return true;
+    }
+  }
+  return def == nullptr;
+}
+
+void ShaderGenerator::Private::checkBlock(SBlockCtx *block) {
+  if (!block || block->ended) {
+    throw std::logic_error{"shader generator: block has ended"};
+  }
+}
+
+void ShaderGenerator::Private::checkOperand(SBlockCtx *block, SVal *v) {
+  if (!v || !isVisible(v->block, block)) {
+    throw std::logic_error{"shader generator: value used out of its scope"};
+  }
+}
+
+static uint64_t hashValue(const SVal &v) {
+  uint64_t h = util::FNV1A64_OFFSET_BASIS;
+  util::fnv1a64Combine(h, v.op);
+  util::fnv1a64Combine(h, v.type);
+  util::fnv1a64Combine(h, v.index);
+  for (auto a : v.args) {
+    util::fnv1a64Combine(h, a);
+  }
+  for (auto c : v.components) {
+    util::fnv1a64Combine(h, c);
+  }
+  return util::fnv1a64(v.text.data(), v.text.size(), h);
+}
+
+static bool sameValue(const SVal &a, const SVal &b) {
+  return a.op == b.op && a.type == b.type && a.index == b.index &&
+         a.args == b.args && a.components == b.components &&
+         a.text == b.text && (a.op != SOp::Sample2D || a.sampler == b.sampler);
+}
+
+SVal *ShaderGenerator::Private::intern(SVal &&proto) {
+  stats.values++;
+  // expressions may read local variables modified between two evaluations
+  const bool shareable = proto.op != SOp::Expression;
+  const auto h = hashValue(proto);
+  if (shareable) {
+    auto it = valueTable.find(h);
+    if (it != valueTable.end()) {
+      for (auto v : it->second) {
+        // the existing value must be visible from the block of the new one
+        if (sameValue(*v, proto) &&
+            (!proto.block || isVisible(v->block, proto.block))) {
+          stats.cseHits++;
+          return v;
+        }
+      }
+    }
+  }
+
+  values.push_back(std::make_unique<SVal>(std::move(proto)));
+  auto v = values.back().get();
+  v->id = (int)values.size() - 1;
+  if (shareable) {
+    valueTable[h].push_back(v);
+  }
+  if (v->block) {
+    SStatement st;
+    st.kind = SStatement::Kind::Define;
+    st.value = v;
+    v->block->statements.push_back(std::move(st));
+  }
+  return v;
+}
+
+//------------------------------------------------------------------------------
 ShaderGenerator::ShaderGenerator(gfx::ShaderStageFlags stage, Target target)
-{
+    : d{std::make_unique<Private>()} {
+  d->stage = stage;
+  d->target = target;
+}
+
+ShaderGenerator::~ShaderGenerator() {}
+
+SType *ShaderGenerator::typeOf(SVal *val) { return val->type; }
+
+SType *ShaderGenerator::primitiveType(PrimitiveType primty) {
+  return d->primitive(primty);
+}
+
+SVal *ShaderGenerator::addTextureResource(gfx::ImageDimensions dim,
+                                          SType *sampledType) {
+  if (sampledType->kind != TypeKind::Primitive ||
+      isMatrix(sampledType->prim)) {
+    throw std::logic_error{"shader generator: invalid texel type"};
+  }
+  d->types.push_back(std::unique_ptr<SType>{
+      new SType{TypeKind::Texture, sampledType->prim, dim}});
+  auto v = std::make_unique<SVal>();
+  v->op = SOp::Texture;
+  v->type = d->types.back().get();
+  v->index = (int)d->textures.size();
+  v->id = (int)d->values.size();
+  d->values.push_back(std::move(v));
+  d->textures.push_back(d->values.back().get());
+  return d->textures.back();
+}
+
+SVal *ShaderGenerator::addGlobalParameter(util::StringRef name, SType *ty,
+                                          int buffer) {
+  for (auto g : d->globals) {
+    if (g->text == name) {
+      if (g->type != ty || g->index != buffer) {
+        throw std::logic_error{fmt::format(
+            "shader generator: uniform {} redeclared", name.to_string())};
+      }
+      return g;
+    }
+  }
+  SVal proto;
+  proto.op = SOp::Global;
+  proto.type = ty;
+  proto.text = name.to_string();
+  proto.index = buffer;
+  auto v = d->intern(std::move(proto));
+  d->globals.push_back(v);
+  return v;
+}
+
+SVal *ShaderGenerator::createInput(util::StringRef name, SType *ty,
+                                   int location) {
+  SVal proto;
+  proto.op = SOp::Input;
+  proto.type = ty;
+  proto.text = name.to_string();
+  proto.index = location;
+  auto v = d->intern(std::move(proto));
+  d->inputs.push_back(v);
+  return v;
+}
+
+SVal *ShaderGenerator::createOutput(util::StringRef name, SType *ty,
+                                    int location) {
+  SVal proto;
+  proto.op = SOp::Output;
+  proto.type = ty;
+  proto.text = name.to_string();
+  proto.index = location;
+  auto v = d->intern(std::move(proto));
+  d->outputs.push_back(v);
+  return v;
+}
+
+SVal *ShaderGenerator::builtin(util::StringRef name, SType *ty) {
+  SVal proto;
+  proto.op = SOp::Builtin;
+  proto.type = ty;
+  proto.text = name.to_string();
+  return d->intern(std::move(proto));
+}
+
+//------------------------------------------------------------------------------
+// constants
+
+static SVal makeConstant(SType *ty, std::vector<double> components) {
+  SVal proto;
+  proto.op = SOp::Constant;
+  proto.type = ty;
+  proto.components = std::move(components);
+  return proto;
+}
+
+SVal *ShaderGenerator::constant(float x) {
+  return d->intern(makeConstant(d->primitive(PrimitiveType::Float), {x}));
+}
+
+SVal *ShaderGenerator::constant(float x, float y) {
+  return d->intern(makeConstant(d->primitive(PrimitiveType::Float2), {x, y}));
+}
+
+SVal *ShaderGenerator::constant(float x, float y, float z) {
+  return d->intern(
+      makeConstant(d->primitive(PrimitiveType::Float3), {x, y, z}));
+}
+
+SVal *ShaderGenerator::constant(float x, float y, float z, float w) {
+  return d->intern(
+      makeConstant(d->primitive(PrimitiveType::Float4), {x, y, z, w}));
+}
+
+SVal *ShaderGenerator::constant(int x) {
+  return d->intern(makeConstant(d->primitive(PrimitiveType::Int), {(double)x}));
+}
 
+//------------------------------------------------------------------------------
+// functions and blocks
+
+SFunCtx *ShaderGenerator::beginMain() {
+  if (d->main) {
+    throw std::logic_error{"shader generator: main function already defined"};
+  }
+  d->blocks.push_back(std::make_unique<SBlockCtx>());
+  d->functions.push_back(std::make_unique<SFunCtx>());
+  auto f = d->functions.back().get();
+  f->body = d->blocks.back().get();
+  f->body->fun = f;
+  f->body->parent = nullptr;
+  d->main = f;
+  return f;
+}
+
+void ShaderGenerator::endMain(SFunCtx *f) {
+  f->ended = true;
+  f->body->ended = true;
+}
+
+SBlockCtx *ShaderGenerator::beginBlock(SFunCtx *f) { return f->body; }
+
+SBlockCtx *ShaderGenerator::beginBlock(SBlockCtx *parent) {
+  d->checkBlock(parent);
+  d->blocks.push_back(std::make_unique<SBlockCtx>());
+  auto b = d->blocks.back().get();
+  b->fun = parent->fun;
+  b->parent = parent;
+  SStatement st;
+  st.kind = SStatement::Kind::Block;
+  st.block = b;
+  parent->statements.push_back(std::move(st));
+  return b;
+}
+
+void ShaderGenerator::endBlock(SBlockCtx *block) {
+  if (block->parent) {
+    block->ended = true;
+  }
+}
+
+//------------------------------------------------------------------------------
+// operations
+
+static SType *binaryResultType(SOp op, SVal *a, SVal *b) {
+  if (!isPrimitive(a) || !isPrimitive(b)) {
+    throw std::logic_error{"shader generator: invalid operand type"};
+  }
+  auto pa = a->type->prim;
+  auto pb = b->type->prim;
+  if (pa == pb) {
+    return a->type;
+  }
+  if (op == SOp::Mul) {
+    // matrix-vector products
+    if (isMatrix(pa) && pb == PrimitiveType::Float4) {
+      return b->type;
+    }
+    if (pa == PrimitiveType::Float4 && isMatrix(pb)) {
+      return a->type;
+    }
+  }
+  if (isInt(pa) == isInt(pb)) {
+    // scalar-vector operations
+    if (componentCount(pa) == 1) {
+      return b->type;
+    }
+    if (componentCount(pb) == 1) {
+      return a->type;
+    }
+  }
+  throw std::logic_error{"shader generator: operand types do not match"};
+}
+
+static bool foldBinary(SOp op, bool integer, double a, double b, double &r) {
+  if (integer) {
+    auto x = (int32_t)a, y = (int32_t)b;
+    switch (op) {
+    case SOp::Add:
+      r = (double)(int32_t)((uint32_t)x + (uint32_t)y);
+      return true;
+    case SOp::Sub:
+      r = (double)(int32_t)((uint32_t)x - (uint32_t)y);
+      return true;
+    case SOp::Mul:
+      r = (double)(int32_t)((uint32_t)x * (uint32_t)y);
+      return true;
+    case SOp::Div:
+      if (y == 0 || (x == INT32_MIN && y == -1)) {
+        return false;
+      }
+      r = x / y;
+      return true;
+    default:
+      return false;
+    }
+  }
+  // evaluate in single precision, like the GPU
+  float x = (float)a, y = (float)b, z;
+  switch (op) {
+  case SOp::Add:
+    z = x + y;
+    break;
+  case SOp::Sub:
+    z = x - y;
+    break;
+  case SOp::Mul:
+    z = x * y;
+    break;
+  case SOp::Div:
+    z = x / y;
+    break;
+  default:
+    return false;
+  }
+  if (!std::isfinite(z)) {
+    return false;
+  }
+  r = z;
+  return true;
+}
+
+SVal *ShaderGenerator::Private::binary(SOp op, SBlockCtx *block, SVal *a,
+                                       SVal *b) {
+  checkBlock(block);
+  checkOperand(block, a);
+  checkOperand(block, b);
+  auto ty = binaryResultType(op, a, b);
+
+  // constant folding
+  if (isConstant(a) && isConstant(b) && !isMatrix(a->type->prim) &&
+      !isMatrix(b->type->prim)) {
+    const int           n = componentCount(ty->prim);
+    std::vector<double> r(n);
+    bool                ok = true;
+    for (int i = 0; i < n && ok; ++i) {
+      auto x = a->components.size() == 1 ? a->components[0] : a->components[i];
+      auto y = b->components.size() == 1 ? b->components[0] : b->components[i];
+      ok = foldBinary(op, isInt(ty->prim), x, y, r[i]);
+    }
+    if (ok) {
+      stats.constantsFolded++;
+      return intern(makeConstant(ty, std::move(r)));
+    }
+  }
+
+  // identities
+  SVal *simplified = nullptr;
+  switch (op) {
+  case SOp::Add:
+    simplified = isSplat(b, 0.0) ? a : isSplat(a, 0.0) ? b : nullptr;
+    break;
+  case SOp::Sub:
+    simplified = isSplat(b, 0.0) ? a : nullptr;
+    break;
+  case SOp::Mul:
+    simplified = isSplat(b, 1.0) ? a : isSplat(a, 1.0) ? b : nullptr;
+    break;
+  case SOp::Div:
+    simplified = isSplat(b, 1.0) ? a : nullptr;
+    break;
+  default:
+    break;
+  }
+  if (simplified && simplified->type == ty) {
+    stats.values++;
+    stats.constantsFolded++;
+    return simplified;
+  }
+
+  SVal proto;
+  proto.op = op;
+  proto.type = ty;
+  proto.block = block;
+  proto.args = {a, b};
+  return intern(std::move(proto));
+}
+
+SVal *ShaderGenerator::emitAdd(SBlockCtx *block, SVal *a, SVal *b) {
+  return d->binary(SOp::Add, block, a, b);
+}
+
+SVal *ShaderGenerator::emitSub(SBlockCtx *block, SVal *a, SVal *b) {
+  return d->binary(SOp::Sub, block, a, b);
+}
+
+SVal *ShaderGenerator::emitMul(SBlockCtx *block, SVal *a, SVal *b) {
+  return d->binary(SOp::Mul, block, a, b);
+}
+
+SVal *ShaderGenerator::emitDiv(SBlockCtx *block, SVal *a, SVal *b) {
+  return d->binary(SOp::Div, block, a, b);
+}
+
+SVal *ShaderGenerator::emitNeg(SBlockCtx *block, SVal *a) {
+  d->checkBlock(block);
+  d->checkOperand(block, a);
+  if (!isPrimitive(a)) {
+    throw std::logic_error{"shader generator: invalid operand type"};
+  }
+  if (isConstant(a)) {
+    std::vector<double> r = a->components;
+    for (auto &c : r) {
+      c = -c;
+    }
+    d->stats.constantsFolded++;
+    return d->intern(makeConstant(a->type, std::move(r)));
+  }
+  if (a->op == SOp::Neg) {
+    d->stats.values++;
+    d->stats.constantsFolded++;
+    return a->args[0];
+  }
+  SVal proto;
+  proto.op = SOp::Neg;
+  proto.type = a->type;
+  proto.block = block;
+  proto.args = {a};
+  return d->intern(std::move(proto));
+}
+
+static int swizzleIndex(char c) {
+  switch (c) {
+  case 'x':
+  case 'r':
+  case 's':
+    return 0;
+  case 'y':
+  case 'g':
+  case 't':
+    return 1;
+  case 'z':
+  case 'b':
+  case 'p':
+    return 2;
+  case 'w':
+  case 'a':
+  case 'q':
+    return 3;
+  default:
+    return -1;
+  }
+}
+
+SVal *ShaderGenerator::emitSwizzle(SBlockCtx *block, SVal *a,
+                                   util::StringRef components) {
+  d->checkBlock(block);
+  d->checkOperand(block, a);
+  if (!isPrimitive(a) || isMatrix(a->type->prim) || components.empty() ||
+      components.size() > 4) {
+    throw std::logic_error{"shader generator: invalid swizzle"};
+  }
+  const int n = componentCount(a->type->prim);
+  int       indices[4];
+  for (size_t i = 0; i < components.size(); ++i) {
+    indices[i] = swizzleIndex(components[i]);
+    if (indices[i] < 0 || indices[i] >= n) {
+      throw std::logic_error{fmt::format("shader generator: invalid swizzle {}",
+                                         components.to_string())};
+    }
+  }
+
+  // swizzle of a swizzle: select directly in the source vector
+  if (a->op == SOp::Swizzle) {
+    for (size_t i = 0; i < components.size(); ++i) {
+      indices[i] = swizzleIndex(a->text[indices[i]]);
+    }
+    a = a->args[0];
+  }
+
+  const int len = (int)components.size();
+  auto      ty = d->primitive(vectorType(isInt(a->type->prim), len));
+  if (isConstant(a)) {
+    std::vector<double> r(len);
+    for (int i = 0; i < len; ++i) {
+      r[i] = a->components[indices[i]];
+    }
+    d->stats.constantsFolded++;
+    return d->intern(makeConstant(ty, std::move(r)));
+  }
+
+  bool identity = len == componentCount(a->type->prim);
+  for (int i = 0; i < len; ++i) {
+    identity = identity && indices[i] == i;
+  }
+  if (identity) {
+    d->stats.values++;
+    d->stats.constantsFolded++;
+    return a;
+  }
+
+  SVal proto;
+  proto.op = SOp::Swizzle;
+  proto.type = ty;
+  proto.block = block;
+  proto.args = {a};
+  // normalized, so that .rg and .xy are the same value
+  for (int i = 0; i < len; ++i) {
+    proto.text += "xyzw"[indices[i]];
+  }
+  return d->intern(std::move(proto));
+}
+
+SVal *ShaderGenerator::emitConstruct(SBlockCtx *block, SType *ty,
+                                     util::ArrayRef<SVal *const> args) {
+  d->checkBlock(block);
+  if (ty->kind != TypeKind::Primitive) {
+    throw std::logic_error{"shader generator: invalid constructor type"};
+  }
+  int  count = 0;
+  bool allConstant = true;
+  for (auto a : args) {
+    d->checkOperand(block, a);
+    if (!isPrimitive(a)) {
+      throw std::logic_error{"shader generator: invalid constructor argument"};
+    }
+    count += componentCount(a->type->prim);
+    allConstant = allConstant && isConstant(a);
+  }
+  const int n = componentCount(ty->prim);
+  if (!isMatrix(ty->prim) && count != n && count != 1) {
+    throw std::logic_error{
+        "shader generator: wrong number of components in constructor"};
+  }
+
+  if (args.len == 1 && args[0]->type == ty) {
+    d->stats.values++;
+    d->stats.constantsFolded++;
+    return args[0];
+  }
+  if (allConstant && !isMatrix(ty->prim)) {
+    std::vector<double> r;
+    for (auto a : args) {
+      r.insert(r.end(), a->components.begin(), a->components.end());
+    }
+    r.resize(n, r[0]);
+    if (isInt(ty->prim)) {
+      for (auto &c : r) {
+        c = (double)(int32_t)c;
+      }
+    }
+    d->stats.constantsFolded++;
+    return d->intern(makeConstant(ty, std::move(r)));
+  }
+
+  SVal proto;
+  proto.op = SOp::Construct;
+  proto.type = ty;
+  proto.block = block;
+  proto.args.assign(args.begin(), args.end());
+  return d->intern(std::move(proto));
+}
+
+SVal *ShaderGenerator::emitCall(SBlockCtx *block, SType *ty,
+                                util::StringRef function,
+                                util::ArrayRef<SVal *const> args) {
+  d->checkBlock(block);
+  for (auto a : args) {
+    d->checkOperand(block, a);
+  }
+  SVal proto;
+  proto.op = SOp::Call;
+  proto.type = ty;
+  proto.block = block;
+  proto.text = function.to_string();
+  proto.args.assign(args.begin(), args.end());
+  return d->intern(std::move(proto));
+}
+
+SVal *ShaderGenerator::emitSample2D(SBlockCtx *block, SVal *texture,
+                                    const gfx::SamplerDesc &sampler, SVal *x,
+                                    SVal *y) {
+  if (texture->op != SOp::Texture ||
+      texture->type->dim != gfx::ImageDimensions::Image2D) {
+    throw std::logic_error{"shader generator: not a 2D texture"};
+  }
+  auto  floatTy = d->primitive(PrimitiveType::Float);
+  if (x->type != floatTy || y->type != floatTy) {
+    throw std::logic_error{"shader generator: invalid texture coordinates"};
+  }
+  SVal *xy[2] = {x, y};
+  auto  uv = emitConstruct(block, d->primitive(PrimitiveType::Float2),
+                          util::ArrayRef<SVal *const>{xy, 2});
+
+  SVal proto;
+  proto.op = SOp::Sample2D;
+  proto.type = d->primitive(vectorType(isInt(texture->type->prim), 4));
+  proto.block = block;
+  proto.args = {texture, uv};
+  proto.sampler = sampler;
+  return d->intern(std::move(proto));
+}
+
+SVal *ShaderGenerator::emitExpression(SBlockCtx *block, SType *type,
+                                      util::StringRef expr,
+                                      util::ArrayRef<SVal *const> args) {
+  d->checkBlock(block);
+  for (auto a : args) {
+    d->checkOperand(block, a);
+  }
+  forEachReference(expr, [&](int i) {
+    if (i >= (int)args.len) {
+      throw std::logic_error{"shader generator: invalid reference in expression"};
+    }
+  });
+  SVal proto;
+  proto.op = SOp::Expression;
+  proto.type = type;
+  proto.block = block;
+  proto.text = expr.to_string();
+  proto.args.assign(args.begin(), args.end());
+  return d->intern(std::move(proto));
+}
+
+void ShaderGenerator::emit(SBlockCtx *f, util::StringRef glsl,
+                           util::ArrayRef<SVal *const> args) {
+  d->checkBlock(f);
+  for (auto a : args) {
+    d->checkOperand(f, a);
+  }
+  forEachReference(glsl, [&](int i) {
+    if (i >= (int)args.len) {
+      throw std::logic_error{"shader generator: invalid reference in code"};
+    }
+  });
+  SStatement st;
+  st.kind = SStatement::Kind::Raw;
+  st.text = glsl.to_string();
+  st.args.assign(args.begin(), args.end());
+  f->statements.push_back(std::move(st));
+}
+
+void ShaderGenerator::emitStore(SBlockCtx *block, SVal *output, SVal *value) {
+  d->checkBlock(block);
+  d->checkOperand(block, value);
+  if (output->op != SOp::Output && output->op != SOp::Builtin) {
+    throw std::logic_error{"shader generator: store to a value that is not "
+                           "an output"};
+  }
+  if (output->type != value->type) {
+    throw std::logic_error{"shader generator: stored value type mismatch"};
+  }
+  SStatement st;
+  st.kind = SStatement::Kind::Store;
+  st.output = output;
+  st.value = value;
+  block->statements.push_back(std::move(st));
+}
+
+//------------------------------------------------------------------------------
+// generation
+
+void ShaderGenerator::Private::use(SVal *v, int count) {
+  const bool first = v->uses == 0;
+  v->uses += count;
+  if (!first) {
+    return;
+  }
+  if (v->op == SOp::Expression) {
+    std::vector<int> refs(v->args.size(), 0);
+    forEachReference(v->text, [&](int i) { refs[i]++; });
+    for (size_t i = 0; i < v->args.size(); ++i) {
+      if (refs[i]) {
+        use(v->args[i], refs[i]);
+      }
+    }
+  } else {
+    for (auto a : v->args) {
+      use(a);
+    }
+  }
+}
+
+void ShaderGenerator::Private::useStatements(SBlockCtx *block) {
+  for (auto &&st : block->statements) {
+    switch (st.kind) {
+    case SStatement::Kind::Raw: {
+      std::vector<int> refs(st.args.size(), 0);
+      forEachReference(st.text, [&](int i) { refs[i]++; });
+      for (size_t i = 0; i < st.args.size(); ++i) {
+        if (refs[i]) {
+          use(st.args[i], refs[i]);
+        }
+      }
+      break;
+    }
+    case SStatement::Kind::Store:
+      use(st.value);
+      break;
+    case SStatement::Kind::Block:
+      useStatements(st.block);
+      break;
+    case SStatement::Kind::Define:
+      break;
+    }
+  }
+}
+
+std::string ShaderGenerator::Private::ref(SVal *v) {
+  if (v->temporary) {
+    return fmt::format("t{}", v->id);
+  }
+  return expr(v);
+}
+
+std::string ShaderGenerator::Private::operand(SVal *v) {
+  auto s = ref(v);
+  if (!v->temporary && isOperator(v->op)) {
+    return "(" + s + ")";
+  }
+  return s;
+}
+
+std::string
+ShaderGenerator::Private::substitute(util::StringRef             text,
+                                     const std::vector<SVal *> &args) {
+  std::string out;
+  out.reserve(text.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == '$' && i + 1 < text.size() && text[i + 1] >= '0' &&
+        text[i + 1] <= '9') {
+      out += operand(args[text[i + 1] - '0']);
+      ++i;
+    } else {
+      out += text[i];
+    }
+  }
+  return out;
 }
 
-SType* ShaderGenerator::typeOf(SVal* val)
-{
-        return SType();
+std::string
+ShaderGenerator::Private::joinArgs(const std::vector<SVal *> &args) {
+  std::string out;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (i) {
+      out += ", ";
+    }
+    out += ref(args[i]);
+  }
+  return out;
 }
 
-SType* ShaderGenerator::primitiveType(PrimitiveType primty)
-{
-        return SType();
+std::string ShaderGenerator::Private::expr(SVal *v) {
+  switch (v->op) {
+  case SOp::Constant:
+    return formatConstant(v);
+  case SOp::Input:
+  case SOp::Output:
+  case SOp::Builtin:
+  case SOp::Global:
+    return v->text;
+  case SOp::Texture:
+    throw std::logic_error{"shader generator: textures can only be sampled"};
+  case SOp::Add:
+    return fmt::format("{} + {}", operand(v->args[0]), operand(v->args[1]));
+  case SOp::Sub:
+    return fmt::format("{} - {}", operand(v->args[0]), operand(v->args[1]));
+  case SOp::Mul:
+    return fmt::format("{} * {}", operand(v->args[0]), operand(v->args[1]));
+  case SOp::Div:
+    return fmt::format("{} / {}", operand(v->args[0]), operand(v->args[1]));
+  case SOp::Neg:
+    return fmt::format("-{}", operand(v->args[0]));
+  case SOp::Swizzle:
+    return fmt::format("{}.{}", operand(v->args[0]), v->text);
+  case SOp::Construct:
+    return fmt::format("{}({})", glslTypeName(v->type->prim),
+                       joinArgs(v->args));
+  case SOp::Call:
+    return fmt::format("{}({})", v->text, joinArgs(v->args));
+  case SOp::Sample2D:
+    return fmt::format("texture(s_{}, {})", v->binding, ref(v->args[1]));
+  case SOp::Expression:
+    return substitute(v->text, v->args);
+  }
+  return "";
 }
 
-SVal ShaderGenerator::addTextureResource(gfx::ImageDimensions dim)
-{
-        return SVal();
+static void writeIndent(fmt::memory_buffer &out, int indent) {
+  for (int i = 0; i < indent; ++i) {
+    fmt::format_to(out, "    ");
+  }
 }
-SVal ShaderGenerator::addGlobalParameter(util::StringRef name, SType ty, int
-buffer)
-{
-        return SVal();
-}*/
-}
\ No newline at end of file
+
+void ShaderGenerator::Private::writeBlock(fmt::memory_buffer &out,
+                                          SBlockCtx *block, int indent) {
+  for (auto &&st : block->statements) {
+    switch (st.kind) {
+    case SStatement::Kind::Define:
+      if (st.value->temporary) {
+        writeIndent(out, indent);
+        fmt::format_to(out, "{} t{} = {};\n",
+                       glslTypeName(st.value->type->prim), st.value->id,
+                       expr(st.value));
+      }
+      break;
+    case SStatement::Kind::Raw:
+      writeIndent(out, indent);
+      fmt::format_to(out, "{}\n", substitute(st.text, st.args));
+      break;
+    case SStatement::Kind::Store:
+      writeIndent(out, indent);
+      fmt::format_to(out, "{} = {};\n", st.output->text, ref(st.value));
+      break;
+    case SStatement::Kind::Block:
+      writeIndent(out, indent);
+      fmt::format_to(out, "{{\n");
+      writeBlock(out, st.block, indent + 1);
+      writeIndent(out, indent);
+      fmt::format_to(out, "}}\n");
+      break;
+    }
+  }
+}
+
+std::string ShaderGenerator::generate() {
+  if (!d->main) {
+    throw std::logic_error{"shader generator: no main function"};
+  }
+
+  // find the values used by statements
+  for (auto &&v : d->values) {
+    v->uses = 0;
+    v->temporary = false;
+    v->binding = -1;
+  }
+  d->useStatements(d->main->body);
+
+  d->stats.deadValues = 0;
+  d->stats.temporaries = 0;
+  d->samplerBindings.clear();
+  for (auto &&v : d->values) {
+    const bool computed = isOperator(v->op) || v->op == SOp::Swizzle ||
+                          v->op == SOp::Construct || v->op == SOp::Call ||
+                          v->op == SOp::Sample2D || v->op == SOp::Expression;
+    if (!computed) {
+      continue;
+    }
+    if (v->uses == 0) {
+      d->stats.deadValues++;
+      continue;
+    }
+    // expressions must be evaluated where they were created
+    v->temporary = v->uses > 1 || v->op == SOp::Expression;
+    if (v->temporary) {
+      d->stats.temporaries++;
+    }
+    if (v->op == SOp::Sample2D) {
+      const int texture = v->args[0]->index;
+      for (size_t i = 0; i < d->samplerBindings.size(); ++i) {
+        auto &b = d->samplerBindings[i];
+        if (b.texture == texture && b.sampler == v->sampler) {
+          v->binding = (int)i;
+        }
+      }
+      if (v->binding < 0) {
+        v->binding = (int)d->samplerBindings.size();
+        d->samplerBindings.push_back(ShaderSamplerBinding{texture, v->sampler});
+      }
+    }
+  }
+
+  fmt::memory_buffer out;
+  fmt::format_to(out, "#version 450\n");
+  for (auto v : d->inputs) {
+    fmt::format_to(out, "layout(location={}) in {} {};\n", v->index,
+                   glslTypeName(v->type->prim), v->text);
+  }
+  for (auto v : d->outputs) {
+    fmt::format_to(out, "layout(location={}) out {} {};\n", v->index,
+                   glslTypeName(v->type->prim), v->text);
+  }
+
+  // uniform blocks, in the order of their first member
+  std::vector<int> buffers;
+  for (auto g : d->globals) {
+    if (std::find(buffers.begin(), buffers.end(), g->index) == buffers.end()) {
+      buffers.push_back(g->index);
+    }
+  }
+  for (auto b : buffers) {
+    fmt::format_to(out, "layout(std140, binding={}) uniform Params{} {{\n", b,
+                   b);
+    for (auto g : d->globals) {
+      if (g->index == b) {
+        fmt::format_to(out, "    {} {};\n", glslTypeName(g->type->prim),
+                       g->text);
+      }
+    }
+    fmt::format_to(out, "}};\n");
+  }
+
+  for (size_t i = 0; i < d->samplerBindings.size(); ++i) {
+    auto tex = d->textures[d->samplerBindings[i].texture];
+    fmt::format_to(out, "layout(binding={}) uniform {} s_{};\n", i,
+                   glslSamplerTypeName(tex->type), i);
+  }
+
+  fmt::format_to(out, "void main() {{\n");
+  d->writeBlock(out, d->main->body, 1);
+  fmt::format_to(out, "}}\n");
+  return fmt::to_string(out);
+}
+
+const std::vector<ShaderSamplerBinding> &
+ShaderGenerator::samplerBindings() const {
+  return d->samplerBindings;
+}
+
+ShaderGeneratorStats ShaderGenerator::stats() const { return d->stats; }
+
+} // namespace img
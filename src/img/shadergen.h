@@ -2,7 +2,11 @@
 #include "gfx/image.h"
 #include "gfx/sampler.h"
 #include "gfx/shader.h"
+#include "util/arrayref.h"
 #include "util/stringref.h"
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace img {
 
@@ -21,10 +25,45 @@ enum class PrimitiveType {
 /// Identifies a value in a shader generator context.
 struct SVal;
 struct SType;
-struct SCtx;
 struct SFunCtx;
 struct SBlockCtx;
 
+/// A combination of a texture and a sampler used by the generated shader,
+/// bound to the texture unit of the same index.
+struct ShaderSamplerBinding {
+  /// Index of the texture, in the order of `addTextureResource()` calls.
+  int              texture;
+  gfx::SamplerDesc sampler;
+};
+
+/// Counters of the simplifications made by a `ShaderGenerator`.
+struct ShaderGeneratorStats {
+  /// Values requested through the emit functions.
+  int values = 0;
+  /// Requests that returned an identical value created before.
+  int cseHits = 0;
+  /// Operations evaluated at generation time because their operands are
+  /// constants, or simplified (e.g. `x * 1.0`).
+  int constantsFolded = 0;
+  /// Values not used by any statement, skipped in the source.
+  int deadValues = 0;
+  /// Values stored in temporary variables because they are used more than
+  /// once.
+  int temporaries = 0;
+};
+
+/// Builds the source of a shader from a graph of values.
+///
+/// Values are pure: each emit function returns a node of the graph, and
+/// requesting the same operation twice on the same operands returns the
+/// same node (common subexpression elimination). Operations on constants
+/// are evaluated immediately (constant folding). Values only appear in the
+/// source if they are reachable from a statement (`emit` or `emitStore`):
+/// values used once are inlined in the expression using them, the others
+/// are assigned to a temporary.
+///
+/// Functions throw `std::logic_error` on invalid operations (type
+/// mismatches, use of a value out of its scope).
 class ShaderGenerator {
 public:
   enum class Target {
@@ -33,6 +72,7 @@ public:
   };
 
   ShaderGenerator(gfx::ShaderStageFlags stage, Target target);
+  ~ShaderGenerator();
 
   /// Returns the type of the value
   SType *typeOf(SVal *val);
@@ -42,30 +82,83 @@ public:
   /// Adds a global texture resource
   SVal *addTextureResource(gfx::ImageDimensions dim, SType *sampledType);
   /// Adds a global uniform value that goes in the given buffer identifier.
+  /// Uniforms of a buffer are declared in a std140 block, in the order of
+  /// the calls. Adding the same name twice returns the same value.
   SVal *addGlobalParameter(util::StringRef name, SType *ty, int buffer = 0);
 
-  /// generates a `sample` expression in the current context
-  SVal *emitSample2D(SFunCtx *f, SVal *texture, const gfx::SamplerDesc &sampler,
-                     SVal *x, SVal *y);
-
   SVal *createInput(util::StringRef name, SType *ty, int location);
   SVal *createOutput(util::StringRef name, SType *ty, int location);
+  /// Returns a built-in variable of the target language (e.g.
+  /// `gl_FragCoord`).
+  SVal *builtin(util::StringRef name, SType *ty);
 
-  SFunCtx *beginVertexShader();
-  void endVertexShader(SFunCtx *ctx);
+  //------ Constants ------
+  SVal *constant(float x);
+  SVal *constant(float x, float y);
+  SVal *constant(float x, float y, float z);
+  SVal *constant(float x, float y, float z, float w);
+  SVal *constant(int x);
 
-  SFunCtx *beginFunction();
-  void emitFunctionArgument(SFunCtx *f, util::StringRef name, SType *ty);
-  void endFunction(SFunCtx *f);
+  //------ Functions and blocks ------
 
-  // begin a block of code in a function
+  /// Starts the entry point of the shader.
+  SFunCtx *beginMain();
+  void     endMain(SFunCtx *f);
+
+  /// Returns the outermost block of the function.
   SBlockCtx *beginBlock(SFunCtx *f);
-  void endBlock(SBlockCtx *block);
+  /// Opens a nested scope in a block. Values created in the nested block
+  /// cannot be used after it ends.
+  SBlockCtx *beginBlock(SBlockCtx *parent);
+  void       endBlock(SBlockCtx *block);
+
+  //------ Operations ------
+
+  SVal *emitAdd(SBlockCtx *block, SVal *a, SVal *b);
+  SVal *emitSub(SBlockCtx *block, SVal *a, SVal *b);
+  SVal *emitMul(SBlockCtx *block, SVal *a, SVal *b);
+  SVal *emitDiv(SBlockCtx *block, SVal *a, SVal *b);
+  SVal *emitNeg(SBlockCtx *block, SVal *a);
+  /// Selects components of a vector, e.g. `"xy"`.
+  SVal *emitSwizzle(SBlockCtx *block, SVal *a, util::StringRef components);
+  /// Builds a vector from scalars and vectors, e.g. `vec4(rgb, 1.0)`.
+  SVal *emitConstruct(SBlockCtx *block, SType *ty,
+                      util::ArrayRef<SVal *const> args);
+  /// Calls a built-in function without side effects (e.g. `mix`, `clamp`).
+  SVal *emitCall(SBlockCtx *block, SType *ty, util::StringRef function,
+                 util::ArrayRef<SVal *const> args);
+
+  /// generates a `sample` expression in the current context
+  SVal *emitSample2D(SBlockCtx *block, SVal *texture,
+                     const gfx::SamplerDesc &sampler, SVal *x, SVal *y);
+
+  /// Creates a value from an expression in the target language, in which
+  /// `$0` to `$9` refer to the elements of `args`. The expression may refer
+  /// to local variables declared by `emit`: it is evaluated at this point of
+  /// the block and never moved.
+  SVal *emitExpression(SBlockCtx *block, SType *type, util::StringRef expr,
+                       util::ArrayRef<SVal *const> args = {});
 
   // emit a block of GLSL code in the function
-  void emit(SBlockCtx *f, util::StringRef glsl);
-  SVal *emitExpression(SBlockCtx *block, SType *type, util::StringRef expr);
+  /// `$0` to `$9` refer to the elements of `args`.
+  void emit(SBlockCtx *f, util::StringRef glsl,
+            util::ArrayRef<SVal *const> args = {});
+  /// Writes a value to an output.
+  void emitStore(SBlockCtx *block, SVal *output, SVal *value);
+
+  //------ Results ------
+
+  /// Returns the source of the shader.
+  std::string generate();
+
+  /// Returns the texture/sampler combinations used by the shader. Valid
+  /// after `generate()`.
+  const std::vector<ShaderSamplerBinding> &samplerBindings() const;
+
+  ShaderGeneratorStats stats() const;
 
 private:
+  struct Private;
+  std::unique_ptr<Private> d;
 };
-} // namespace img
\ No newline at end of file
+} // namespace img
@@ -0,0 +1,91 @@
+#include "img/shadertemplate.h"
+#include <stdexcept>
+
+namespace img {
+
+static const char PLACEHOLDER_BEGIN[] = "<<<";
+static const char PLACEHOLDER_END[] = ">>>";
+constexpr size_t  PLACEHOLDER_DELIM_LEN = 3;
+
+ShaderTemplate::ShaderTemplate(util::StringRef text)
+    : text_{text.to_string()} {
+  util::StringRef t{text_};
+  size_t          pos = 0;
+  for (;;) {
+    auto begin = t.find(PLACEHOLDER_BEGIN, pos);
+    if (begin == util::StringRef::npos) {
+      break;
+    }
+    auto nameBegin = begin + PLACEHOLDER_DELIM_LEN;
+    auto end = t.find(PLACEHOLDER_END, nameBegin);
+    if (end == util::StringRef::npos) {
+      throw std::logic_error{"unterminated placeholder in shader template"};
+    }
+
+    if (begin > pos) {
+      segments_.push_back(Segment{-1, pos, begin - pos});
+      literalLen_ += begin - pos;
+    }
+    auto name = t.substr(nameBegin, end - nameBegin);
+    int  index = placeholderIndex(name);
+    if (index < 0) {
+      index = (int)placeholders_.size();
+      placeholders_.push_back(name.to_string());
+    }
+    segments_.push_back(Segment{index, 0, 0});
+    pos = end + PLACEHOLDER_DELIM_LEN;
+  }
+  if (pos < t.size()) {
+    segments_.push_back(Segment{-1, pos, t.size() - pos});
+    literalLen_ += t.size() - pos;
+  }
+}
+
+int ShaderTemplate::placeholderIndex(util::StringRef name) const {
+  for (int i = 0; i < (int)placeholders_.size(); ++i) {
+    if (placeholders_[i] == name) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void ShaderTemplate::render(std::string &out,
+                            util::ArrayRef<const util::StringRef> values) const {
+  if (values.len != placeholders_.size()) {
+    throw std::logic_error{"wrong number of values for shader template"};
+  }
+  size_t len = literalLen_;
+  for (auto &&s : segments_) {
+    if (s.placeholder >= 0) {
+      len += values[s.placeholder].size();
+    }
+  }
+  out.clear();
+  out.reserve(len);
+  for (auto &&s : segments_) {
+    if (s.placeholder >= 0) {
+      auto v = values[s.placeholder];
+      out.append(v.data(), v.size());
+    } else {
+      out.append(text_, s.offset, s.len);
+    }
+  }
+}
+
+std::string ShaderTemplate::render(
+    std::initializer_list<std::pair<util::StringRef, util::StringRef>> values)
+    const {
+  std::vector<util::StringRef> v(placeholders_.size());
+  for (auto &&kv : values) {
+    auto index = placeholderIndex(kv.first);
+    if (index >= 0) {
+      v[index] = kv.second;
+    }
+  }
+  std::string out;
+  render(out, util::ArrayRef<const util::StringRef>{v.data(), v.size()});
+  return out;
+}
+
+} // namespace img
@@ -0,0 +1,67 @@
+#pragma once
+#include "util/arrayref.h"
+#include "util/stringref.h"
+#include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace img {
+
+/// A shader source with named placeholders of the form `<<<NAME>>>`,
+/// parsed once into literal and placeholder segments.
+///
+/// Rendering a template is a sequence of appends into a single buffer sized
+/// in advance:
+///
+///     static const ShaderTemplate tpl{"void main() { <<<BODY>>> }"};
+///     const int body = tpl.placeholderIndex("BODY");
+///     util::StringRef values[1];
+///     values[body] = code;
+///     tpl.render(source, util::makeConstArrayRef(values));
+///
+class ShaderTemplate {
+public:
+  /// Parses the template. Throws `std::logic_error` if a placeholder is not
+  /// terminated.
+  explicit ShaderTemplate(util::StringRef text);
+
+  /// Returns the number of distinct placeholders in the template.
+  int placeholderCount() const { return (int)placeholders_.size(); }
+  /// Returns the name of a placeholder.
+  util::StringRef placeholderName(int index) const {
+    return placeholders_[index];
+  }
+  /// Returns the index of the named placeholder, or -1 if the template does
+  /// not contain it.
+  int placeholderIndex(util::StringRef name) const;
+
+  /// Replaces the contents of `out` with the template in which each
+  /// placeholder is replaced by `values[placeholderIndex(name)]`. `values`
+  /// must have `placeholderCount()` elements. A placeholder may appear more
+  /// than once.
+  void render(std::string &                           out,
+              util::ArrayRef<const util::StringRef> values) const;
+
+  /// Convenience version that looks up placeholders by name. Placeholders
+  /// without a value are replaced by an empty string.
+  std::string
+  render(std::initializer_list<std::pair<util::StringRef, util::StringRef>>
+             values) const;
+
+private:
+  struct Segment {
+    // literal text if placeholder < 0
+    int    placeholder;
+    size_t offset;
+    size_t len;
+  };
+
+  std::string              text_;
+  std::vector<Segment>     segments_;
+  std::vector<std::string> placeholders_;
+  // total length of the literal segments
+  size_t literalLen_ = 0;
+};
+
+} // namespace img
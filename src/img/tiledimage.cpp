@@ -0,0 +1,299 @@
+#include "img/tiledimage.h"
+#include "fmt/format.h"
+#include "util/log.h"
+#include <OpenImageIO/imagecache.h>
+#include <algorithm>
+
+namespace img {
+
+// The image cache of OpenImageIO shared by the whole application: it keeps
+// the recently read tiles of the files in a bounded amount of memory.
+static OIIO::ImageCache &sharedCache() {
+  static auto cache = [] {
+    auto c = OIIO::ImageCache::create(true);
+    c->attribute("max_memory_MB", TiledImage::CPU_CACHE_MEMORY_MB);
+    // mip levels of untiled files are computed on demand
+    c->attribute("automip", 1);
+    return c;
+  }();
+  return *cache;
+}
+
+TiledImage::TiledImage(gfx::GraphicsBackend &gfx, int atlasPages)
+    : gfx_{&gfx}, atlasPages_{std::max(atlasPages, 1)} {
+  gfx::ImageDesc desc;
+  desc.format = gfx::Format::R16G16B16A16_SFLOAT;
+  desc.width = atlasSize();
+  desc.height = atlasSize();
+  desc.usage = gfx::ImageUsageFlags::Sampled;
+  atlas_ = gfx::Image{gfx, desc};
+  slots_.resize((size_t)atlasPages_ * atlasPages_);
+}
+
+bool TiledImage::open(const util::path &path, std::string *error) {
+  fileName_.clear();
+  auto &     cache = sharedCache();
+  const auto fileName = path.string();
+  const OIIO::ustring name{fileName};
+  int                 levels = 0;
+  int                 channels = 0;
+  // the file may have been modified since its tiles were cached
+  cache.invalidate(name);
+  if (!cache.get_image_info(name, 0, 0, OIIO::ustring{"miplevels"},
+                            OIIO::TypeDesc::INT, &levels) ||
+      !cache.get_image_info(name, 0, 0, OIIO::ustring{"channels"},
+                            OIIO::TypeDesc::INT, &channels)) {
+    if (error) {
+      *error = fmt::format("could not open image {}: {}", fileName,
+                           cache.geterror());
+    }
+    return false;
+  }
+
+  levelWidths_.clear();
+  levelHeights_.clear();
+  for (int i = 0; i < levels; ++i) {
+    int res[2] = {0, 0};
+    if (!cache.get_image_info(name, 0, i, OIIO::ustring{"resolution"},
+                              OIIO::TypeDesc{OIIO::TypeDesc::INT, 2}, res)) {
+      break;
+    }
+    levelWidths_.push_back(res[0]);
+    levelHeights_.push_back(res[1]);
+  }
+  if (levelWidths_.empty() || channels <= 0) {
+    if (error) {
+      *error = fmt::format("empty image: {}", fileName);
+    }
+    return false;
+  }
+
+  fileName_ = fileName;
+  channels_ = std::min(channels, 4);
+  clearPageBuffer();
+  // the pages of the previous file are free
+  for (auto &&slot : slots_) {
+    slot = Slot{};
+  }
+  pageTableData_.assign(levelWidths_.size(), std::vector<float>{});
+  pagesLoaded_ = 0;
+  pagesEvicted_ = 0;
+  level_ = -1;
+  return true;
+}
+
+void TiledImage::clearPageBuffer() {
+  // missing channels are zero, except alpha which is opaque; only the
+  // channels of the file are written when reading pages
+  pageBuffer_.assign((size_t)PAGE_SIZE * PAGE_SIZE * 4, 0);
+  if (channels_ < 4) {
+    const uint16_t halfOne = 0x3C00;
+    for (size_t i = 3; i < pageBuffer_.size(); i += 4) {
+      pageBuffer_[i] = halfOne;
+    }
+  }
+}
+
+void TiledImage::levelSize(int level, int &width, int &height) const {
+  if (levelWidths_.empty()) {
+    width = height = 0;
+    return;
+  }
+  level = std::min(std::max(level, 0), levelCount() - 1);
+  width = levelWidths_[level];
+  height = levelHeights_[level];
+}
+
+void TiledImage::levelPages(int level, int &pagesX, int &pagesY) const {
+  int w, h;
+  levelSize(level, w, h);
+  pagesX = (w + PAGE_CONTENT_SIZE - 1) / PAGE_CONTENT_SIZE;
+  pagesY = (h + PAGE_CONTENT_SIZE - 1) / PAGE_CONTENT_SIZE;
+}
+
+void TiledImage::setLevel(int level) {
+  // the pages of the other levels stay in the atlas, only the page table
+  // shows the new level
+  level_ = level;
+  levelPages(level, pagesX_, pagesY_);
+  auto &table = pageTableData_[level];
+  if (table.empty()) {
+    table.assign((size_t)pagesX_ * pagesY_ * 4, 0.0f);
+  }
+
+  gfx::ImageDesc desc;
+  desc.format = gfx::Format::R32G32B32A32_SFLOAT;
+  desc.width = pagesX_;
+  desc.height = pagesY_;
+  desc.usage = gfx::ImageUsageFlags::Sampled;
+  pageTable_ = gfx::Image{*gfx_, desc};
+  pageTableDirty_ = true;
+}
+
+bool TiledImage::loadPage(int level, int page, int slot) {
+  int pagesX, pagesY, w, h;
+  levelPages(level, pagesX, pagesY);
+  levelSize(level, w, h);
+  const int px = page % pagesX;
+  const int py = page / pagesX;
+
+  // the page with its border, clipped to the image: the pixels outside of
+  // the image are never sampled
+  const gfx::Rect pageRect{px * PAGE_CONTENT_SIZE - 1,
+                           py * PAGE_CONTENT_SIZE - 1, PAGE_SIZE, PAGE_SIZE};
+  const auto      r = pageRect.intersected(gfx::Rect{0, 0, w, h});
+  if (r != pageRect) {
+    // the buffer holds the previous page outside of r
+    clearPageBuffer();
+  }
+  const OIIO::stride_t xstride = 4 * sizeof(uint16_t);
+  const OIIO::stride_t ystride = PAGE_SIZE * xstride;
+  auto dst = &pageBuffer_[((size_t)(r.y - pageRect.y) * PAGE_SIZE +
+                           (r.x - pageRect.x)) *
+                          4];
+  auto &cache = sharedCache();
+  if (!cache.get_pixels(OIIO::ustring{fileName_}, 0, level, r.x, r.right(),
+                        r.y, r.bottom(), 0, 1, 0, channels_,
+                        OIIO::TypeDesc::HALF, dst, xstride, ystride)) {
+    util::log("TiledImage: could not read {}: {}", fileName_,
+              cache.geterror());
+    return false;
+  }
+
+  // grayscale images are displayed as gray, not red
+  if (channels_ == 1) {
+    for (int y = 0; y < r.height; ++y) {
+      auto px = dst + (size_t)y * PAGE_SIZE * 4;
+      for (int x = 0; x < r.width; ++x, px += 4) {
+        px[1] = px[2] = px[0];
+      }
+    }
+  }
+
+  const int sx = slot % atlasPages_;
+  const int sy = slot / atlasPages_;
+  gfx_->updateImageData(atlas_, sx * PAGE_SIZE, sy * PAGE_SIZE, 0, PAGE_SIZE,
+                        PAGE_SIZE, 1, pageBuffer_.data());
+  return true;
+}
+
+int TiledImage::pageCount(const gfx::Rect &region, int level) const {
+  int w, h;
+  levelSize(level, w, h);
+  const auto r = region.intersected(gfx::Rect{0, 0, w, h});
+  if (r.empty()) {
+    return 0;
+  }
+  const int px0 = r.x / PAGE_CONTENT_SIZE;
+  const int px1 = (r.right() - 1) / PAGE_CONTENT_SIZE;
+  const int py0 = r.y / PAGE_CONTENT_SIZE;
+  const int py1 = (r.bottom() - 1) / PAGE_CONTENT_SIZE;
+  return (px1 - px0 + 1) * (py1 - py0 + 1);
+}
+
+bool TiledImage::update(const gfx::Rect &region, int level, int maxPageLoads) {
+  if (!isOpen()) {
+    return false;
+  }
+  level = std::min(std::max(level, 0), levelCount() - 1);
+  if (level != level_) {
+    setLevel(level);
+  }
+  useCount_++;
+
+  int w, h;
+  levelSize(level_, w, h);
+  const auto r = region.intersected(gfx::Rect{0, 0, w, h});
+  bool       complete = true;
+  overflow_ = false;
+  readFailed_ = false;
+  if (!r.empty()) {
+    const int px0 = r.x / PAGE_CONTENT_SIZE;
+    const int px1 = (r.right() - 1) / PAGE_CONTENT_SIZE;
+    const int py0 = r.y / PAGE_CONTENT_SIZE;
+    const int py1 = (r.bottom() - 1) / PAGE_CONTENT_SIZE;
+    overflow_ = pageCount(r, level_) > pageCapacity();
+
+    // mark the resident pages as used first, so that they are not evicted
+    // by the pages loaded below
+    auto &           table = pageTableData_[level_];
+    std::vector<int> missing;
+    for (int py = py0; py <= py1; ++py) {
+      for (int px = px0; px <= px1; ++px) {
+        const int    page = py * pagesX_ + px;
+        const float *entry = &table[(size_t)page * 4];
+        if (entry[2] != 0.0f) {
+          slots_[(int)entry[1] * atlasPages_ + (int)entry[0]].lastUse =
+              useCount_;
+        } else {
+          missing.push_back(page);
+        }
+      }
+    }
+
+    int loads = 0;
+    for (int page : missing) {
+      if (loads >= maxPageLoads) {
+        complete = false;
+        break;
+      }
+      // free slots have never been used, so they come first
+      int victim = -1;
+      for (int i = 0; i < (int)slots_.size(); ++i) {
+        if (slots_[i].lastUse != useCount_ &&
+            (victim < 0 || slots_[i].lastUse < slots_[victim].lastUse)) {
+          victim = i;
+        }
+      }
+      if (victim < 0) {
+        // the atlas is full of pages of this region
+        complete = false;
+        break;
+      }
+      auto &slot = slots_[victim];
+      if (slot.page >= 0) {
+        pageTableData_[slot.level][(size_t)slot.page * 4 + 2] = 0.0f;
+        pageTableDirty_ = pageTableDirty_ || slot.level == level_;
+        slot = Slot{};
+        pagesEvicted_++;
+      }
+      if (!loadPage(level_, page, victim)) {
+        readFailed_ = true;
+        complete = false;
+        break;
+      }
+      slot.level = level_;
+      slot.page = page;
+      slot.lastUse = useCount_;
+      float *entry = &table[(size_t)page * 4];
+      entry[0] = (float)(victim % atlasPages_);
+      entry[1] = (float)(victim / atlasPages_);
+      entry[2] = 1.0f;
+      pageTableDirty_ = true;
+      pagesLoaded_++;
+      loads++;
+    }
+  }
+
+  if (pageTableDirty_) {
+    gfx_->updateImageData(pageTable_, 0, 0, 0, pagesX_, pagesY_, 1,
+                          pageTableData_[level_].data());
+    pageTableDirty_ = false;
+  }
+  return complete;
+}
+
+TiledImageStats TiledImage::stats() const {
+  TiledImageStats s;
+  s.pageCapacity = pageCapacity();
+  s.pagesResident =
+      (int)std::count_if(slots_.begin(), slots_.end(),
+                         [](const Slot &slot) { return slot.page >= 0; });
+  s.pagesLoaded = pagesLoaded_;
+  s.pagesEvicted = pagesEvicted_;
+  s.overflow = overflow_;
+  s.readFailed = readFailed_;
+  return s;
+}
+
+} // namespace img
@@ -0,0 +1,144 @@
+#pragma once
+#include "gfx/gfx.h"
+#include "gfx/image.h"
+#include "gfx/rect.h"
+#include "util/filesystem.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace img {
+
+/// Counters of a `TiledImage`.
+struct TiledImageStats {
+  /// Pages in the atlas, and how many of them hold a page of the image.
+  int pageCapacity = 0;
+  int pagesResident = 0;
+  /// Pages read from the file and uploaded since the image was opened.
+  uint64_t pagesLoaded = 0;
+  /// Pages evicted from the atlas to make room for others.
+  uint64_t pagesEvicted = 0;
+  /// Whether the last requested region needed more pages than the atlas can
+  /// hold.
+  bool overflow = false;
+  /// Whether a page could not be read during the last update.
+  bool readFailed = false;
+};
+
+///
+/// A GPU view of an image too large to be uploaded as a whole (e.g. 16K
+/// scans).
+///
+/// The image is divided in pages of `PAGE_CONTENT_SIZE` pixels, loaded on
+/// demand into a fixed-size atlas texture. A page table texture has one texel
+/// per page of the image: `(x, y)` is the slot of the page in the atlas (in
+/// pages) and `z` is 1 if the page is resident. Pages are stored with a border
+/// of one pixel, so that linear filtering does not bleed across slots.
+///
+/// Files are read through the shared OpenImageIO image cache, whose memory is
+/// bounded (tiled, mip-mapped files are read most efficiently, but any file
+/// can be used). GPU memory is bounded by the size of the atlas, regardless
+/// of the size of the image.
+///
+/// The rows of the pages and of the page table are stored from the top of
+/// the image.
+class TiledImage {
+public:
+  /// Size of a page in the atlas, including the borders.
+  static constexpr int PAGE_SIZE = 256;
+  /// Pixels of the image in a page.
+  static constexpr int PAGE_CONTENT_SIZE = PAGE_SIZE - 2;
+  /// Memory used by the image cache of OpenImageIO, shared by all images.
+  static constexpr float CPU_CACHE_MEMORY_MB = 512.0f;
+
+  /// Creates an atlas of `atlasPages` x `atlasPages` pages (the default is
+  /// 128 MiB of 16-bit float RGBA).
+  explicit TiledImage(gfx::GraphicsBackend &gfx, int atlasPages = 16);
+
+  TiledImage(const TiledImage &) = delete;
+  TiledImage &operator=(const TiledImage &) = delete;
+
+  /// Opens an image file. Only its header is read; tiles of the file cached
+  /// before are discarded, so that a modified file is read again. Returns
+  /// false and stores the reason in `error` if the file cannot be opened.
+  bool open(const util::path &path, std::string *error = nullptr);
+  /// Returns whether an image is open.
+  bool isOpen() const { return !fileName_.empty(); }
+
+  /// Returns the number of mip levels of the image (the image cache creates
+  /// them if the file has none).
+  int levelCount() const { return (int)levelWidths_.size(); }
+  /// Returns the size of a mip level of the image.
+  void levelSize(int level, int &width, int &height) const;
+
+  /// Returns the number of pages of a mip level covering a region of the
+  /// level.
+  int pageCount(const gfx::Rect &region, int level) const;
+  /// Returns the number of pages the atlas can hold.
+  int pageCapacity() const { return (int)slots_.size(); }
+
+  /// Loads the pages of a mip level covering a region of the level (in
+  /// pixels, rows from the top), evicting the least recently used pages if
+  /// needed. At most `maxPageLoads` pages are read, so that large regions
+  /// are loaded over several calls.
+  ///
+  /// Returns true if all the pages of the region are resident. The page
+  /// table refers to the pages of `level` after the call; the pages of the
+  /// other levels stay in the atlas until they are evicted. The atlas and the
+  /// page table are updated immediately: commands recorded before the call
+  /// must have been submitted.
+  bool update(const gfx::Rect &region, int level, int maxPageLoads);
+
+  /// Returns the level of the pages in the atlas.
+  int level() const { return level_; }
+  gfx::Image &atlas() { return atlas_; }
+  gfx::Image &pageTable() { return pageTable_; }
+  /// Returns the size of the atlas in pixels.
+  int atlasSize() const { return atlasPages_ * PAGE_SIZE; }
+
+  TiledImageStats stats() const;
+
+private:
+  struct Slot {
+    // mip level of the page, and its index in the page table of the level,
+    // -1 if the slot is free
+    int level = -1;
+    int page = -1;
+    // value of useCount_ when the page was last needed
+    uint64_t lastUse = 0;
+  };
+
+  void levelPages(int level, int &pagesX, int &pagesY) const;
+  void setLevel(int level);
+  void clearPageBuffer();
+  bool loadPage(int level, int page, int slot);
+
+  gfx::GraphicsBackend *gfx_;
+  std::string           fileName_;
+  int                   channels_ = 0;
+  std::vector<int>      levelWidths_;
+  std::vector<int>      levelHeights_;
+  // level shown by the page table, and its size in pages
+  int level_ = -1;
+  int pagesX_ = 0;
+  int pagesY_ = 0;
+
+  int               atlasPages_;
+  gfx::Image        atlas_;
+  std::vector<Slot> slots_;
+  // page tables of the levels (4 floats per page), created when the level is
+  // first shown; the one of level_ is uploaded when dirty
+  std::vector<std::vector<float>> pageTableData_;
+  gfx::Image         pageTable_;
+  bool               pageTableDirty_ = false;
+  // pixels of the page being loaded
+  std::vector<uint16_t> pageBuffer_;
+
+  uint64_t useCount_ = 0;
+  uint64_t pagesLoaded_ = 0;
+  uint64_t pagesEvicted_ = 0;
+  bool     overflow_ = false;
+  bool     readFailed_ = false;
+};
+
+} // namespace img
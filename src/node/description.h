@@ -22,7 +22,9 @@ public:
         description_{description.to_string()}, constructor_{constructor} {}
 
   Node *instantiate(Network &net, util::StringRef name) {
-    return constructor_(net, name);
+    auto node = constructor_(net, name);
+    node->typeName_ = name_;
+    return node;
   }
 
   util::StringRef typeName() const { return name_; }
@@ -2,6 +2,8 @@
 #include "fmt/format.h"
 #include "util/log.h"
 #include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace node {
@@ -19,6 +21,8 @@ void Network::deleteChild(Node *node) {
 }
 
 void Network::deleteChildren(util::ArrayRef<Node *const> nodes) {
+  // ~Node signals the removal (once disconnected), which also invalidates
+  // the cached sort order
   auto it = std::remove_if(children_.begin(), children_.end(),
                            [this, nodes](const std::unique_ptr<Node> &ptr) {
                              for (auto n : nodes) {
@@ -72,40 +76,201 @@ void Network::makeNameUnique(std::string &name) {
   }
 }
 
-std::vector<std::vector<Node *>> Network::buildAdjacencyList() {
-  std::vector<std::vector<Node *>> result;
-  for (auto &&c : children_) {
-    result.push_back(c->dependentNodes());
+const std::vector<Node *> &Network::sortedChildren() {
+  if (!sortedChildrenValid_) {
+    updateSortedChildren();
   }
-  return result;
+  return sortedChildren_;
 }
 
-std::vector<Node *> Network::sortedChildren() {
-  std::vector<Node *>              L;
-  std::vector<std::vector<Node *>> adjList = buildAdjacencyList();
-  int                              remaining = adjList.size();
+const std::vector<Node *> &Network::cyclicChildren() {
+  if (!sortedChildrenValid_) {
+    updateSortedChildren();
+  }
+  return cyclicChildren_;
+}
 
-  for (int i = 0; i < remaining; ++i) {
-    if (adjList[i].size() == 0) {
-      auto n = children_[i].get();
-      L.push_back(n);
-      for (int j = 0; j < adjList.size(); ++j) {
-        auto &a = adjList[j];
-        a.erase(std::remove(a.begin(), a.end(), n), a.end());
+void Network::updateSortedChildren() {
+  // Kahn's algorithm: repeatedly emit the nodes that have no unprocessed
+  // predecessors.
+  const int n = (int)children_.size();
+  std::unordered_map<Node *, int> indices;
+  indices.reserve(n);
+  for (int i = 0; i < n; ++i) {
+    indices[children_[i].get()] = i;
+  }
+
+  std::vector<std::vector<int>> successors(n);
+  std::vector<int>              inDegree(n, 0);
+  for (int i = 0; i < n; ++i) {
+    for (auto d : children_[i]->dependentNodes()) {
+      auto it = indices.find(d);
+      if (it == indices.end()) {
+        // not a child of this network
+        continue;
       }
-      if (i < remaining - 1) {
-        std::swap(adjList[i], adjList[remaining - 1]);
+      successors[i].push_back(it->second);
+      inDegree[it->second]++;
+    }
+  }
+
+  sortedChildren_.clear();
+  sortedChildren_.reserve(n);
+  // the sorted list doubles as the queue of nodes to process
+  std::vector<int> queue;
+  queue.reserve(n);
+  for (int i = 0; i < n; ++i) {
+    if (inDegree[i] == 0) {
+      queue.push_back(i);
+    }
+  }
+  for (size_t head = 0; head < queue.size(); ++head) {
+    int i = queue[head];
+    sortedChildren_.push_back(children_[i].get());
+    for (auto s : successors[i]) {
+      if (--inDegree[s] == 0) {
+        queue.push_back(s);
       }
-      remaining--;
-      i = 0;
     }
   }
 
-  std::reverse(L.begin(), L.end());
-  return L;
+  // nodes that were never emitted are part of a cycle, or depend on one
+  auto previousCyclicChildren = std::move(cyclicChildren_);
+  cyclicChildren_.clear();
+  for (int i = 0; i < n; ++i) {
+    if (inDegree[i] != 0) {
+      auto node = children_[i].get();
+      cyclicChildren_.push_back(node);
+      node->setErrorState("Node is part of a dependency cycle");
+      util::log("Network[{}]: node {} is part of a dependency cycle",
+                name().to_string(), node->name().to_string());
+    }
+  }
+  // clear the error on nodes that are not in a cycle anymore
+  for (auto node : previousCyclicChildren) {
+    if (indices.count(node) && std::find(cyclicChildren_.begin(),
+                                         cyclicChildren_.end(),
+                                         node) == cyclicChildren_.end()) {
+      node->resetErrorState();
+    }
+  }
+
+  sortedChildrenValid_ = true;
+}
+
+void Network::notifyModified() {
+  modificationCount_++;
+  if (auto p = parent()) {
+    p->notifyModified();
+  }
+}
+
+void Network::onChildAdded(Node *node) {
+  sortedChildrenValid_ = false;
+  notifyModified();
+  Node::onChildAdded(node);
+}
+
+void Network::onChildRemoved(Node *node) {
+  sortedChildrenValid_ = false;
+  notifyModified();
+  Node::onChildRemoved(node);
 }
 
-void Network::loadInternal(util::StringRef key, util::JsonReader &r) {}
+void Network::onConnectionAdded(Node *source, Output *output, Node *dest,
+                                Input *input) {
+  sortedChildrenValid_ = false;
+  notifyModified();
+  Node::onConnectionAdded(source, output, dest, input);
+}
+
+void Network::onConnectionRemoved(Node *source, Output *output, Node *dest,
+                                  Input *input) {
+  sortedChildrenValid_ = false;
+  notifyModified();
+  Node::onConnectionRemoved(source, output, dest, input);
+}
+
+void Network::loadInternal(util::StringRef key, util::JsonReader &r,
+                           int baseId) {
+  if (key == "children") {
+    loadChildren(r, baseId);
+  } else if (key == "connections") {
+    loadConnections(r, baseId);
+  } else {
+    Node::loadInternal(key, r, baseId);
+  }
+}
+
+Node *Network::findChildById(int id) {
+  for (auto &&c : children_) {
+    if (c->uniqueId() == id) {
+      return c.get();
+    }
+  }
+  return nullptr;
+}
+
+void Network::loadChildren(util::JsonReader &r, int baseId) {
+  r.beginArray();
+  while (r.hasNext()) {
+    r.beginObject();
+    // the type is saved first: create the node, then let it load the rest
+    if (!r.hasNext() || r.nextName() != "type") {
+      throw std::runtime_error{"node saved without a type"};
+    }
+    auto typeName = r.nextString();
+    auto child = createNode(typeName, typeName);
+    if (child) {
+      child->loadMembers(r, baseId);
+    } else {
+      util::log("WARNING Network::load: skipping node of unknown type {}",
+                typeName);
+      while (r.hasNext()) {
+        r.nextName();
+        r.skipValue();
+      }
+    }
+    r.endObject();
+  }
+  r.endArray();
+}
+
+void Network::loadConnections(util::JsonReader &r, int baseId) {
+  // (source node, output, destination node, input) IDs, see saveInternal
+  r.beginArray();
+  while (r.hasNext()) {
+    int ids[4];
+    for (auto &&id : ids) {
+      id = (int)r.nextInt();
+    }
+    auto    source = findChildById(baseId + ids[0]);
+    auto    destination = findChildById(baseId + ids[2]);
+    Output *output = nullptr;
+    Input * input = nullptr;
+    if (source) {
+      for (int i = 0; i < source->outputCount(); ++i) {
+        if (source->outputUniqueId(source->output(i)) == ids[1]) {
+          output = source->output(i);
+        }
+      }
+    }
+    if (destination) {
+      for (int i = 0; i < destination->inputCount(); ++i) {
+        if (destination->inputUniqueId(destination->input(i)) == ids[3]) {
+          input = destination->input(i);
+        }
+      }
+    }
+    if (!output || !input) {
+      util::log("WARNING Network::load: dangling connection {}:{} -> {}:{}",
+                ids[0], ids[1], ids[2], ids[3]);
+      continue;
+    }
+    addConnection(source, output, destination, input);
+  }
+  r.endArray();
+}
 
 void Network::saveInternal(util::JsonWriter &w) {
   w.name("children");
@@ -54,24 +54,53 @@ public:
   void addConnection(Node *source, Output *output, Node *destination,
                      Input *input);
 
+  /// Returns a topologically sorted list of all the child nodes in this
+  /// network that are not part of a cycle.
   ///
-  std::vector<std::vector<Node*>> buildAdjacencyList();
+  /// The order is computed lazily and cached until a child or a connection is
+  /// added or removed.
+  const std::vector<Node *> &sortedChildren();
 
-  /// Returns a vector containing a topologically sorted list of all the child nodes in this network.
-  std::vector<Node*> sortedChildren();
+  /// Returns the child nodes that are part of (or depend on) a dependency
+  /// cycle, and are thus excluded from `sortedChildren()`.
+  const std::vector<Node *> &cyclicChildren();
+
+  /// Returns a counter incremented by each modification of the network or of
+  /// the networks it contains: parameters, connections, added or removed
+  /// children. Evaluators compare it to tell edits from re-executions.
+  uint64_t modificationCount() const { return modificationCount_; }
+  /// Increments the modification counter of this network and its parents.
+  void notifyModified();
 
   ///
   virtual NodeDescriptions& registeredNodes() const = 0;
 
 protected:
-  void loadInternal(util::StringRef key, util::JsonReader &reader) override;
+  void loadInternal(util::StringRef key, util::JsonReader &reader,
+                    int baseId) override;
   void saveInternal(util::JsonWriter &writer) override;
 
+  void onChildAdded(Node *node) override;
+  void onChildRemoved(Node *node) override;
+  void onConnectionAdded(Node *source, Output *output, Node *dest,
+                         Input *input) override;
+  void onConnectionRemoved(Node *source, Output *output, Node *dest,
+                           Input *input) override;
+
 private:
-  void makeNameUnique(std::string &name);
+  void  makeNameUnique(std::string &name);
+  Node *findChildById(int id);
+  void  loadChildren(util::JsonReader &reader, int baseId);
+  void  loadConnections(util::JsonReader &reader, int baseId);
+  void updateSortedChildren();
 
   std::vector<Node::Ptr> children_;
   int uniqueNameCounter_ = 0;
+  // cached topological order, see sortedChildren()
+  bool sortedChildrenValid_ = false;
+  std::vector<Node *> sortedChildren_;
+  std::vector<Node *> cyclicChildren_;
+  uint64_t            modificationCount_ = 0;
 };
 
 } // namespace node
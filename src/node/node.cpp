@@ -53,8 +53,25 @@ void Node::setName(std::string name) { name_ = std::move(name); }
 int Node::uniqueId() { return id_; }
 
 void Node::markDirty() {
+  if (parent_) {
+    parent_->notifyModified();
+  }
+  propagateDirty();
+}
+
+void Node::markDirtyForReexecution() { propagateDirty(); }
+
+void Node::propagateDirty() {
+  if (dirty_) {
+    // all dependent nodes are already dirty
+    return;
+  }
   dirty_ = true;
-  // TODO: propagate to children
+  for (auto &&o : outputs_) {
+    for (auto d : o->dependents) {
+      d->propagateDirty();
+    }
+  }
 }
 
 Network *Node::parent() const { return parent_; }
@@ -147,9 +164,11 @@ void Node::connectInput(Input *input, std::string source, std::string output) {
   // try to resolve the node and output
   if (resolveInput(input)) {
     // successful, add this node as a dependent node if it's not added already
-    if (referenceCount(input->source, input->output)) {
+    if (referenceCount(input->source, input->output) == 1) {
       input->source->addDependentNode(input->output, this, input);
     }
+    // the value of the input has changed
+    markDirty();
     // ... and signal observers that a connection has been made
     if (parent_)
       parent_->onConnectionAdded(input->source, input->output, this, input);
@@ -181,6 +200,8 @@ void Node::doDisconnectInput(Input *input, bool removeReferenceFromOutput) {
 
     input->source = nullptr;
     input->output = nullptr;
+    // the value of the input has changed
+    markDirty();
   }
 }
 
@@ -194,7 +215,9 @@ void Node::removeDependentNode(Output *output, Node *destination,
   // TODO send event? (output connector update)
   auto it = std::find(output->dependents.begin(), output->dependents.end(),
                       destination);
-  output->dependents.erase(it, output->dependents.end());
+  if (it != output->dependents.end()) {
+    output->dependents.erase(it);
+  }
 }
 
 Output *Node::createOutput(std::string name) {
@@ -203,11 +226,9 @@ Output *Node::createOutput(std::string name) {
 }
 
 Output *Node::createOutputInternal(std::string name, int uid) {
-
-  int    outputId = getOutputId();
   Output out;
-  out.id = outputId;
-  out.name = makeUniqueOutputName(name, outputId);
+  out.id = uid;
+  out.name = makeUniqueOutputName(name, uid);
   auto ptr = pushUniquePtr(outputs_, std::make_unique<Output>(std::move(out)));
   onOutputAdded(ptr);
   return ptr;
@@ -234,6 +255,7 @@ void Node::disconnectOutput(Output *output) {
       }
     }
   }
+  output->dependents.clear();
 }
 
 bool Node::hasAnyInputConnected() {
@@ -519,6 +541,7 @@ void Node::setParam(const ParamDesc &param_, util::Value value) {
 
 void Node::setParam(Param &p, util::Value value) {
   p.value() = std::move(value);
+  markDirty();
 }
 
 Param *Node::param(const ParamDesc &param) {
@@ -581,15 +604,103 @@ void Node::onChildAdded(Node *node) {
 // ===================================================================
 // Serialization
 
+// parameter values are saved with their type, since the reader cannot
+// peek at the type of the next value
+static const char *valueTypeName(Value::Type type) {
+  switch (type) {
+  case Value::Type::Int:
+    return "int";
+  case Value::Type::Real:
+    return "real";
+  case Value::Type::String:
+    return "string";
+  case Value::Type::IntArray:
+    return "int_array";
+  case Value::Type::RealArray:
+    return "real_array";
+  default:
+    return nullptr;
+  }
+}
+
+static void writeValue(util::JsonWriter &w, const Value &v) {
+  switch (v.type()) {
+  case Value::Type::Int:
+    w.value(v.asInt());
+    break;
+  case Value::Type::Real:
+    w.value(v.asReal());
+    break;
+  case Value::Type::String:
+    w.value(v.asString());
+    break;
+  case Value::Type::IntArray:
+    w.beginArray();
+    for (auto x : v.asIntArray()) {
+      w.value(x);
+    }
+    w.endArray();
+    break;
+  case Value::Type::RealArray:
+    w.beginArray();
+    for (auto x : v.asRealArray()) {
+      w.value(x);
+    }
+    w.endArray();
+    break;
+  default:
+    break;
+  }
+}
+
+static Value readValue(util::JsonReader &r, util::StringRef type) {
+  if (type == "int") {
+    return Value{r.nextInt()};
+  } else if (type == "real") {
+    return Value{r.nextReal()};
+  } else if (type == "string") {
+    return Value{r.nextString()};
+  } else if (type == "int_array") {
+    std::vector<int64_t> values;
+    r.beginArray();
+    while (r.hasNext()) {
+      values.push_back(r.nextInt());
+    }
+    r.endArray();
+    return Value{util::ArrayRef<int64_t>{values.data(), values.size()}};
+  } else if (type == "real_array") {
+    std::vector<double> values;
+    r.beginArray();
+    while (r.hasNext()) {
+      values.push_back(r.nextReal());
+    }
+    r.endArray();
+    return Value{util::ArrayRef<double>{values.data(), values.size()}};
+  }
+  util::log("WARNING Node::load: unknown value type {}", type.to_string());
+  r.skipValue();
+  return Value{};
+}
+
 void Node::load(util::JsonReader &r, int baseId) {
   r.beginObject();
+  loadMembers(r, baseId);
+  r.endObject();
+}
+
+void Node::loadMembers(util::JsonReader &r, int baseId) {
   while (r.hasNext()) {
     auto k = r.nextName();
-    if (k == "name") {
+    if (k == "type") {
+      // the node has already been created with this type
+      r.skipValue();
+    } else if (k == "name") {
       setName(r.nextString());
     } else if (k == "id") {
       int id = (int)r.nextInt();
       id_ = baseId + id;
+      // nodes created afterwards must not reuse the ID
+      setUniqueNodeIdCounter(std::max(uniqueNodeIdCounter, id_ + 1));
     } else if (k == "inputs") {
       r.beginArray();
       while (r.hasNext()) {
@@ -608,7 +719,14 @@ void Node::load(util::JsonReader &r, int baseId) {
           }
         }
         r.endObject();
-        createInputInternal(name, id);
+        // inputs created by the constructor of the node get their saved ID,
+        // so that connections can be restored
+        if (auto existing = input(name)) {
+          existing->id = id;
+        } else {
+          createInputInternal(name, id);
+        }
+        inputIdCounter_ = std::max(inputIdCounter_, id + 1);
       }
       r.endArray();
     } else if (k == "outputs") {
@@ -629,20 +747,57 @@ void Node::load(util::JsonReader &r, int baseId) {
           }
         }
         r.endObject();
-        createOutputInternal(name, id);
+        if (auto existing = output(name)) {
+          existing->id = id;
+        } else {
+          createOutputInternal(name, id);
+        }
+        outputIdCounter_ = std::max(outputIdCounter_, id + 1);
       }
       r.endArray();
+    } else if (k == "params") {
+      loadParams(r);
     } else {
-      // loadInternal(nextName, r)
-      util::log("WARNING Node::load: unknown attribute {}", k);
-      r.skipValue();
+      loadInternal(k, r, baseId);
     }
   }
-  r.endObject();
+}
+
+void Node::loadParams(util::JsonReader &r) {
+  r.beginArray();
+  while (r.hasNext()) {
+    std::string name;
+    std::string type;
+    Value       value;
+    r.beginObject();
+    while (r.hasNext()) {
+      auto k = r.nextName();
+      if (k == "name") {
+        name = r.nextString();
+      } else if (k == "type") {
+        type = r.nextString();
+      } else if (k == "value" && !type.empty()) {
+        value = readValue(r, type);
+      } else {
+        util::log("WARNING Node::load: unknown attribute {}", k);
+        r.skipValue();
+      }
+    }
+    r.endObject();
+    if (auto p = param(name)) {
+      setParam(*p, std::move(value));
+    } else {
+      util::log("WARNING Node::load: unknown parameter {}", name);
+    }
+  }
+  r.endArray();
 }
 
 void Node::save(util::JsonWriter &w) {
   w.beginObject();
+  // first, so that networks can create the node before loading the rest
+  w.name("type");
+  w.value(typeName());
   w.name("name");
   w.value(name());
   w.name("id");
@@ -669,11 +824,34 @@ void Node::save(util::JsonWriter &w) {
     w.endObject();
   }
   w.endArray();
+  w.name("params");
+  w.beginArray();
+  for (auto &&p : params_) {
+    auto &&value = p->value();
+    auto   type = valueTypeName(value.type());
+    if (!type) {
+      // not set, or not a parameter type
+      continue;
+    }
+    w.beginObject();
+    w.name("name");
+    w.value(p->name());
+    w.name("type");
+    w.value(type);
+    w.name("value");
+    writeValue(w, value);
+    w.endObject();
+  }
+  w.endArray();
   saveInternal(w);
   w.endObject();
 }
 
-void Node::loadInternal(util::StringRef key, util::JsonReader &reader) {}
+void Node::loadInternal(util::StringRef key, util::JsonReader &reader,
+                        int baseId) {
+  util::log("WARNING Node::load: unknown attribute {}", key.to_string());
+  reader.skipValue();
+}
 void Node::saveInternal(util::JsonWriter &writer) {}
 
 } // namespace node
\ No newline at end of file
@@ -127,7 +127,7 @@ void eraseRemoveId(Container &container, int id) {
       "Container value type must be unique_ptr<T>");
   auto it = std::remove_if(
       container.begin(), container.end(),
-      [val](const std::unique_ptr<T> &ptr) { return ptr->id() == id; });
+      [id](const std::unique_ptr<T> &ptr) { return ptr->id() == id; });
   container.erase(it, container.end());
 }
 
@@ -149,6 +149,7 @@ class Node {
   friend class Observer;
   friend class Param;
   friend class Network;
+  friend class NodeDescription;
 
 public:
   using Ptr = std::unique_ptr<Node>;
@@ -162,9 +163,27 @@ public:
   util::StringRef name() const;
   void            setName(std::string name);
   int             uniqueId();
-
-  /// Marks this node as dirty.
+  /// Returns the name of the type of the node (see `NodeDescription`), empty
+  /// if the node was not created from a registered description.
+  util::StringRef typeName() const { return typeName_; }
+
+  /// Marks this node as dirty, as well as all nodes that depend on it,
+  /// directly or indirectly.
+  ///
+  /// Called when a parameter of the node or one of its input connections
+  /// changes. Counts as a modification of the parent network (see
+  /// `Network::modificationCount()`).
   void markDirty();
+  /// Marks this node and its dependents as dirty, without counting as a
+  /// modification of the network. Called by evaluators to execute again the
+  /// nodes that asked for it (e.g. waiting for work in the background).
+  void markDirtyForReexecution();
+  /// Returns whether the node is dirty, i.e. whether its outputs must be
+  /// recomputed.
+  bool isDirty() const { return dirty_; }
+  /// Marks the node as clean. Called by evaluators once the outputs of the
+  /// node are up-to-date.
+  void resetDirty() { dirty_ = false; }
 
   /// Returns the parent of this node.
   Network *parent() const;
@@ -222,14 +241,22 @@ public:
   void unlock();
 
   // load/save
+
+  /// Loads the node saved by `save()`. `baseId` is added to the saved unique
+  /// IDs.
   void load(util::JsonReader &reader, int baseId);
+  /// Saves the node: its type, name, inputs, outputs and parameters, followed
+  /// by the data saved by `saveInternal()`.
   void save(util::JsonWriter &writer);
 
 protected:
   Input * createInputInternal(std::string name, int uid);
   Output *createOutputInternal(std::string name, int uid);
 
-  virtual void loadInternal(util::StringRef key, util::JsonReader &reader);
+  /// Loads an attribute saved by `saveInternal()`. The default
+  /// implementation skips the value.
+  virtual void loadInternal(util::StringRef key, util::JsonReader &reader,
+                            int baseId);
   virtual void saveInternal(util::JsonWriter &writer);
 
   void         notify(const EventData &e);
@@ -250,6 +277,9 @@ protected:
                                    Input *input);
 
 private:
+  void propagateDirty();
+  void loadMembers(util::JsonReader &reader, int baseId);
+  void loadParams(util::JsonReader &reader);
   void addDependentNode(Output *output, Node *destination, Input *input);
   void removeDependentNode(Output *output, Node *destination, Input *input);
   void doDisconnectInput(Input *input, bool removeReferenceFromOutput);
@@ -272,6 +302,7 @@ private:
   bool        error_;
   bool        dirty_ = true;
   std::string name_;
+  std::string typeName_;
   std::string errorMsg_;
   int         outputIdCounter_ = 0;
   int         inputIdCounter_ = 0;
@@ -91,6 +91,19 @@ static FloatParamDesc paramFloatSlider(util::StringRef name,
                         ParamHint::None, util::Value{v}, nullptr);
 }
 
+static ParamDesc paramInt(util::StringRef name, util::StringRef friendlyName,
+                          util::StringRef help, int64_t v = 0) {
+  return ParamDesc(name, friendlyName, help, util::Value::Type::Int, 1,
+                   ParamHint::None, util::Value{v}, nullptr);
+}
+
+static ParamDesc paramFileName(util::StringRef name,
+                               util::StringRef friendlyName,
+                               util::StringRef help, util::StringRef v = "") {
+  return ParamDesc(name, friendlyName, help, util::Value::Type::String, 1,
+                   ParamHint::FileName, util::Value{v}, nullptr);
+}
+
 static ColorParamDesc paramColorRGBA(util::StringRef name,
                                      util::StringRef friendlyName,
                                      util::StringRef help, double r = 0.0,
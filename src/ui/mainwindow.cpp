@@ -1,8 +1,5 @@
 #include "ui/mainwindow.h"
 #include "QtAwesome/QtAwesome.h"
-#include "img/imgshadernode.h"
-#include "img/imgoutput.h"
-#include "img/imgclear.h"
 #include "ui/connectdialog.h"
 #include "node/description.h"
 #include "ui/nodes/nodeparams.h"
@@ -92,9 +89,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 
 void MainWindow::registerNodes() {
 	// IMG nodes
-	img::ImgShaderNode::registerNode();
-	img::ImgOutput::registerNode();
-	img::ImgClear::registerNode();
+	img::ImgNetwork::registerBuiltinNodes();
 }
 
 void MainWindow::exit() {
@@ -4,7 +4,10 @@
 #include "gfx/signature.h"
 #include "gfxopengl/opengl.h"
 #include "util/log.h"
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
 #include <QOpenGLWindow>
+#include <QStandardPaths>
 #include <QSurfaceFormat>
 
 namespace ui {
@@ -57,6 +60,41 @@ void main() {
 }
 )";
 
+/// Context of the shader compilation thread of the backend, sharing objects
+/// with the context of the view.
+class QtWorkerContext : public gfxopengl::OpenGLWorkerContext {
+public:
+  /// Must be called on the GUI thread: surfaces cannot be created elsewhere.
+  QtWorkerContext(QOpenGLContext *shareContext)
+      : shareContext_{shareContext} {
+    surface_.setFormat(shareContext->format());
+    surface_.create();
+  }
+
+  bool makeCurrent() override {
+    // the context is created on the worker thread, which then owns it
+    context_ = std::make_unique<QOpenGLContext>();
+    context_->setFormat(shareContext_->format());
+    context_->setShareContext(shareContext_);
+    if (!context_->create() || !context_->makeCurrent(&surface_)) {
+      util::log("could not create the shader compilation context");
+      context_.reset();
+      return false;
+    }
+    return true;
+  }
+
+  void doneCurrent() override {
+    context_->doneCurrent();
+    context_.reset();
+  }
+
+private:
+  QOpenGLContext *                shareContext_;
+  QOffscreenSurface               surface_;
+  std::unique_ptr<QOpenGLContext> context_;
+};
+
 class RenderOutputView : public QOpenGLWindow {
   Q_OBJECT
 public:
@@ -78,6 +116,13 @@ public:
   void initializeGL() override {
     util::log("initializeGL");
     g_ = std::make_unique<gfxopengl::OpenGLGraphicsBackend>();
+    auto cacheDir =
+        QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (!cacheDir.isEmpty()) {
+      g_->setProgramCacheDirectory(util::path{cacheDir.toStdString()} /
+                                   "programs");
+    }
+    g_->setWorkerContext(std::make_unique<QtWorkerContext>(context()));
 
 	gfx::ShaderModule vert{ *g_, BACKGROUND_VERT, gfx::ShaderStageFlags::VERTEX };
 	gfx::ShaderModule frag{ *g_, BACKGROUND_FRAG, gfx::ShaderStageFlags::FRAGMENT };
@@ -126,6 +171,9 @@ public:
 
   void paintGL() override {
 	util::log("paintGL");
+    // Qt makes its own GL calls on the context between frames
+    g_->invalidateStateCache();
+    g_->beginFrame();
     gfx::ImageDesc desc;
     desc.width = width();
     desc.height = height();
@@ -160,6 +208,7 @@ public:
 	g_->draw(pipeline_, fbo, args, params);
 
     g_->presentToScreen(img, width(), height());
+    g_->endFrame();
 
   }
 
@@ -0,0 +1,83 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace util {
+
+/// Linear (bump) allocator.
+///
+/// Memory is allocated in chunks, and individual allocations cannot be freed:
+/// all memory is released at once with `reset()`. Chunks are kept across
+/// resets, so that once the arena has grown to its working size, allocating
+/// does not go through the system allocator anymore.
+///
+/// Objects allocated in the arena are never destroyed: only use it for
+/// trivially destructible types.
+class LinearArena {
+public:
+  explicit LinearArena(size_t chunkSize = 64 * 1024) : chunkSize_{chunkSize} {}
+
+  LinearArena(LinearArena &&) = default;
+  LinearArena &operator=(LinearArena &&) = default;
+
+  /// Allocates `size` bytes aligned to `align` (which must be a power of two).
+  void *allocate(size_t size, size_t align) {
+    while (current_ < chunks_.size()) {
+      auto &chunk = chunks_[current_];
+      auto  base = reinterpret_cast<uintptr_t>(chunk.data.get());
+      auto  aligned = (base + offset_ + align - 1) & ~(uintptr_t)(align - 1);
+      if (aligned + size <= base + chunk.size) {
+        offset_ = aligned + size - base;
+        return reinterpret_cast<void *>(aligned);
+      }
+      // does not fit, try the next chunk
+      ++current_;
+      offset_ = 0;
+    }
+    // allocate a new chunk big enough for the allocation
+    Chunk chunk;
+    chunk.size = std::max(chunkSize_, size + align);
+    chunk.data.reset(new char[chunk.size]);
+    chunks_.push_back(std::move(chunk));
+    return allocate(size, align);
+  }
+
+  /// Allocates uninitialized storage for an object of type T.
+  template <typename T> T *allocate() {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "objects allocated in the arena are never destroyed");
+    return static_cast<T *>(allocate(sizeof(T), alignof(T)));
+  }
+
+  /// Releases all allocations, keeping the allocated chunks for reuse.
+  void reset() {
+    current_ = 0;
+    offset_ = 0;
+  }
+
+  /// Returns the total size of the chunks allocated by the arena.
+  size_t capacity() const {
+    size_t total = 0;
+    for (auto &&c : chunks_) {
+      total += c.size;
+    }
+    return total;
+  }
+
+private:
+  struct Chunk {
+    std::unique_ptr<char[]> data;
+    size_t                  size = 0;
+  };
+
+  size_t             chunkSize_;
+  std::vector<Chunk> chunks_;
+  size_t             current_ = 0;
+  size_t             offset_ = 0;
+};
+
+} // namespace util
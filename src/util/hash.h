@@ -1,4 +1,6 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 
 namespace util {
@@ -9,4 +11,28 @@ constexpr inline void hashCombine(std::size_t &s, const T &v) {
   s ^= h(v) + 0x9e3779b9 + (s << 6) + (s >> 2);
 }
 
-} // namespace util
\ No newline at end of file
+constexpr uint64_t FNV1A64_OFFSET_BASIS = 14695981039346656037ull;
+constexpr uint64_t FNV1A64_PRIME = 1099511628211ull;
+
+/// 64-bit FNV-1a hash of a sequence of bytes. Pass the result of a previous
+/// call as `hash` to hash several sequences as one.
+///
+/// Unlike `std::hash`, the result is stable across runs and platforms, so it
+/// can be used as a key in persistent caches.
+inline uint64_t fnv1a64(const void *data, size_t len,
+                        uint64_t hash = FNV1A64_OFFSET_BASIS) {
+  auto bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= bytes[i];
+    hash *= FNV1A64_PRIME;
+  }
+  return hash;
+}
+
+/// Hashes the bytes of a value with `fnv1a64`. Only use with types without
+/// padding (integers, enums, floats).
+template <class T> inline void fnv1a64Combine(uint64_t &hash, const T &v) {
+  hash = fnv1a64(&v, sizeof(T), hash);
+}
+
+} // namespace util
@@ -6,10 +6,10 @@
 namespace util {
 class JsonReader {
 public:
-  class TypeError : public std::exception {
+  class TypeError : public std::runtime_error {
   public:
-    TypeError() = default;
-    TypeError(const char *message) : std::exception{message} {}
+    TypeError() : std::runtime_error{"type error"} {}
+    TypeError(const char *message) : std::runtime_error{message} {}
   };
 
   JsonReader();
@@ -1,5 +1,6 @@
 #include "log.h"
 #include "logprivate.h"
+#include <QCoreApplication>
 #include <QPlainTextEdit>
 #include <QVBoxLayout>
 #include <QFontDatabase>
@@ -37,9 +38,14 @@ static LogWindow* getLogWindow() {
 }
 
 void util::log(const char *msg) {
-	auto w = getLogWindow();
-	w->append(msg);
-	w->show();
+	// may be called from worker threads: widgets must only be accessed from
+	// the GUI thread (the call is direct if we are already on it)
+	QString text{msg};
+	QMetaObject::invokeMethod(qApp, [text] {
+		auto w = getLogWindow();
+		w->append(text);
+		w->show();
+	});
 }
 
 } // namespace util
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "util/taskscheduler.h"
+#include <algorithm>
+#include <exception>
+
+namespace util {
+
+TaskScheduler::TaskScheduler(int threadCount) {
+  if (threadCount < 0) {
+    threadCount = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+  }
+  for (int i = 0; i < threadCount; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  // start threads only once all queues exist, since workers steal from each
+  // other
+  for (int i = 0; i < threadCount; ++i) {
+    workers_[i]->thread = std::thread{[this, i] { workerMain(i); }};
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard<std::mutex> lock{wakeMutex_};
+    stop_ = true;
+  }
+  wakeCondition_.notify_all();
+  for (auto &&w : workers_) {
+    w->thread.join();
+  }
+}
+
+void TaskScheduler::push(int workerIndex, Task task) {
+  {
+    std::lock_guard<std::mutex> lock{workers_[workerIndex]->mutex};
+    workers_[workerIndex]->tasks.push_back(std::move(task));
+  }
+  {
+    // increment under the lock so that sleeping workers can't miss it
+    std::lock_guard<std::mutex> lock{wakeMutex_};
+    queuedTasks_++;
+  }
+  wakeCondition_.notify_one();
+}
+
+bool TaskScheduler::tryPop(int workerIndex, Task &task) {
+  const int n = (int)workers_.size();
+  // own queue first (LIFO, for locality)
+  if (workerIndex >= 0) {
+    auto &w = *workers_[workerIndex];
+    std::lock_guard<std::mutex> lock{w.mutex};
+    if (!w.tasks.empty()) {
+      task = std::move(w.tasks.back());
+      w.tasks.pop_back();
+      queuedTasks_--;
+      return true;
+    }
+  }
+  // then steal from the other workers (FIFO)
+  const int start = workerIndex >= 0 ? workerIndex + 1 : 0;
+  for (int k = 0; k < n; ++k) {
+    auto &victim = *workers_[(start + k) % n];
+    std::lock_guard<std::mutex> lock{victim.mutex};
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      queuedTasks_--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskScheduler::workerMain(int workerIndex) {
+  for (;;) {
+    Task task;
+    if (tryPop(workerIndex, task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock{wakeMutex_};
+    wakeCondition_.wait(lock, [this] { return stop_ || queuedTasks_ > 0; });
+    if (stop_ && queuedTasks_ == 0) {
+      return;
+    }
+  }
+}
+
+void TaskScheduler::parallelFor(int count, const std::function<void(int)> &fn) {
+  if (count <= 0) {
+    return;
+  }
+  if (workers_.empty() || count == 1) {
+    for (int i = 0; i < count; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  // split the range in a few chunks per thread to amortize the cost of
+  // scheduling, while leaving enough chunks to balance the load
+  const int chunkCount = std::min(count, (int)(workers_.size() + 1) * 4);
+  const int chunkSize = (count + chunkCount - 1) / chunkCount;
+
+  std::atomic<int>   remaining{chunkCount};
+  std::mutex         errorMutex;
+  std::exception_ptr error;
+
+  for (int c = 0; c < chunkCount; ++c) {
+    const int begin = c * chunkSize;
+    const int end = std::min(begin + chunkSize, count);
+    push(nextWorker_++ % workers_.size(), [&, begin, end] {
+      try {
+        for (int i = begin; i < end; ++i) {
+          fn(i);
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> lock{errorMutex};
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+      remaining--;
+    });
+  }
+
+  // help until all chunks of this loop have completed
+  while (remaining > 0) {
+    Task task;
+    if (tryPop(-1, task)) {
+      task();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+TaskScheduler &TaskScheduler::instance() {
+  static TaskScheduler scheduler;
+  return scheduler;
+}
+
+} // namespace util
@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util {
+
+/// A pool of worker threads executing CPU-only tasks.
+///
+/// Each worker has its own queue of tasks. Workers take tasks from the back
+/// of their own queue, and steal tasks from the front of the queues of other
+/// workers when theirs is empty.
+class TaskScheduler {
+public:
+  using Task = std::function<void()>;
+
+  /// Creates a scheduler with the specified number of worker threads.
+  /// If `threadCount` is negative, one worker is created per hardware thread,
+  /// minus one for the calling thread.
+  explicit TaskScheduler(int threadCount = -1);
+  ~TaskScheduler();
+
+  TaskScheduler(const TaskScheduler &) = delete;
+  TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+  /// Returns the number of worker threads.
+  int threadCount() const { return (int)workers_.size(); }
+
+  /// Calls `fn(i)` for each `i` in `[0, count)`, in parallel, and waits for
+  /// all calls to complete. The calling thread also executes tasks while
+  /// waiting.
+  ///
+  /// If one of the calls throws an exception, the first exception is
+  /// rethrown in the calling thread once all calls have completed.
+  void parallelFor(int count, const std::function<void(int)> &fn);
+
+  /// Returns the scheduler shared by the whole application.
+  static TaskScheduler &instance();
+
+private:
+  struct Worker {
+    std::mutex       mutex;
+    std::deque<Task> tasks;
+    std::thread      thread;
+  };
+
+  void push(int workerIndex, Task task);
+  bool tryPop(int workerIndex, Task &task);
+  void workerMain(int workerIndex);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::mutex                           wakeMutex_;
+  std::condition_variable              wakeCondition_;
+  std::atomic<int>                     queuedTasks_{0};
+  std::atomic<unsigned>                nextWorker_{0};
+  bool                                 stop_ = false;
+};
+
+} // namespace util
@@ -2,4 +2,49 @@
 
 namespace util {
 	Value Value::EMPTY = Value();
+
+uint64_t Value::hash(uint64_t seed) const {
+  uint64_t h = seed;
+  fnv1a64Combine(h, ty_);
+  switch (ty_) {
+  case Type::Empty:
+    break;
+  case Type::Int:
+    fnv1a64Combine(h, v_.intVal);
+    break;
+  case Type::Real:
+    fnv1a64Combine(h, v_.doubleVal);
+    break;
+  case Type::String:
+    fnv1a64Combine(h, (uint64_t)v_.string.size());
+    h = fnv1a64(v_.string.data(), v_.string.size(), h);
+    break;
+  case Type::Object:
+    // sizes are hashed so that nested values hash differently from
+    // flattened ones
+    fnv1a64Combine(h, (uint64_t)v_.object.size());
+    for (auto &&kv : v_.object) {
+      fnv1a64Combine(h, (uint64_t)kv.first.size());
+      h = fnv1a64(kv.first.data(), kv.first.size(), h);
+      h = kv.second.hash(h);
+    }
+    break;
+  case Type::Array:
+    fnv1a64Combine(h, (uint64_t)v_.array.size());
+    for (auto &&v : v_.array) {
+      h = v.hash(h);
+    }
+    break;
+  case Type::IntArray:
+    fnv1a64Combine(h, (uint64_t)v_.intArray.size());
+    h = fnv1a64(v_.intArray.data(), v_.intArray.size() * sizeof(int64_t), h);
+    break;
+  case Type::RealArray:
+    fnv1a64Combine(h, (uint64_t)v_.realArray.size());
+    h = fnv1a64(v_.realArray.data(), v_.realArray.size() * sizeof(double), h);
+    break;
+  }
+  return h;
 }
+
+} // namespace util
@@ -1,5 +1,6 @@
 #pragma once
 #include "util/arrayref.h"
+#include "util/hash.h"
 #include "util/stringref.h"
 #include <cstdint>
 #include <map>
@@ -30,16 +31,16 @@ public:
   using IntArray = std::vector<int64_t>;
   using RealArray = std::vector<double>;
 
-  class OutOfRange : public std::exception {
+  class OutOfRange : public std::runtime_error {
   public:
-    OutOfRange() = default;
-    OutOfRange(const char *message) : std::exception{message} {}
+    OutOfRange() : std::runtime_error{"out of range"} {}
+    OutOfRange(const char *message) : std::runtime_error{message} {}
   };
 
-  class TypeError : public std::exception {
+  class TypeError : public std::runtime_error {
   public:
-    TypeError() = default;
-    TypeError(const char *message) : std::exception{message} {}
+    TypeError() : std::runtime_error{"type error"} {}
+    TypeError(const char *message) : std::runtime_error{message} {}
   };
 
   Value(Value &&v) { *this = std::move(v); }
@@ -107,6 +108,12 @@ public:
 
   ~Value() { reset(); }
 
+  Type type() const { return ty_; }
+
+  /// Returns a hash of the type and contents of the value (see
+  /// `util::fnv1a64`), combined with `seed`. Equal values have equal hashes.
+  uint64_t hash(uint64_t seed = FNV1A64_OFFSET_BASIS) const;
+
   util::StringRef asString() const {
     checkType(Type::String);
     return util::StringRef{v_.string.c_str(), v_.string.size()};